@@ -0,0 +1,288 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "debugLog.hpp"
+#include "dns.hpp"
+#include "dnsPacker.hpp"
+#include "query.hpp"
+#include "response.hpp"
+
+using namespace dns;
+
+// count heap allocations of the measured operations
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+const std::string kDomain = "bench.local";
+
+volatile size_t g_sink = 0;
+
+struct Options
+{
+    std::string filter;
+    std::chrono::milliseconds minTime{200};
+};
+
+bool selected(const Options& options, const std::string& name)
+{
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+/* Runs fn in a loop, doubling the iteration count until one round lasts
+ * minTime, and prints the last round: time and allocations per call, and
+ * bytesPerOp divided by the time per call. fn returns a value that is
+ * accumulated into g_sink so the work is not optimized out.
+ */
+template <typename Fn>
+void bench(const Options& options, const std::string& name, size_t bytesPerOp, Fn&& fn)
+{
+    if (!selected(options, name))
+        return;
+
+    using clock = std::chrono::steady_clock;
+    g_sink = g_sink + fn();
+
+    size_t iterations = 1;
+    while (true)
+    {
+        const size_t allocationsBefore = allocations;
+        const auto start = clock::now();
+        for (size_t i = 0; i < iterations; ++i)
+            g_sink = g_sink + fn();
+        const auto elapsed = clock::now() - start;
+        const size_t allocated = allocations - allocationsBefore;
+
+        if (elapsed >= options.minTime || iterations >= (size_t{1} << 40))
+        {
+            const double ns = std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(iterations);
+            std::cout << std::left << std::setw(40) << name << std::right << std::fixed
+                      << std::setprecision(1) << std::setw(12) << ns << " ns/op"
+                      << std::setw(12) << (bytesPerOp ? static_cast<double>(bytesPerOp) / ns * 1e3 : 0.0) << " MB/s"
+                      << std::setprecision(2) << std::setw(10) << static_cast<double>(allocated) / static_cast<double>(iterations)
+                      << " allocs/op\n";
+            return;
+        }
+        iterations *= 2;
+    }
+}
+
+std::string randomBytes(size_t size, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::string bytes(size, '\0');
+    for (char& c : bytes)
+        c = static_cast<char>(rng());
+    return bytes;
+}
+
+// Exposes the fragmentation and reassembly of Dns.
+class Endpoint : public Dns {
+public:
+    Endpoint() : Dns(kDomain, "serv") {}
+
+    // Split msg into the fragments of a TXT answer, and drop them.
+    size_t split(const std::string& msg)
+    {
+        setMsg(msg, "serv");
+        splitPacket(16, "serv");
+        auto& queue = m_msgQueue["serv"];
+        const size_t count = queue.size();
+        while (!queue.empty())
+            queue.pop();
+        return count;
+    }
+
+    std::vector<std::string> fragments(const std::string& msg)
+    {
+        setMsg(msg, "serv");
+        splitPacket(16, "serv");
+        std::vector<std::string> result;
+        for (auto& queue = m_msgQueue["serv"]; !queue.empty(); queue.pop())
+            result.push_back(std::move(queue.front()));
+        return result;
+    }
+
+    void receive(const std::string& fragment) { handleDataReceived(fragment, "serv", Codec::Hex); }
+    size_t take() { return getMsg().second.size(); }
+};
+
+Response makeResponse(uint type, const std::string& payload)
+{
+    Response response;
+    response.setID(0x1234);
+    response.setQdCount(1);
+    response.setAnCount(1);
+    response.setName("data.c1." + kDomain);
+    response.setType(type);
+    response.setClass(1);
+    response.setTtl(0);
+    response.setEdnsUdpSize(1232);
+    switch (type)
+    {
+        case 1:  response.setRdata("7f000001"); break;
+        case 28: response.setRdata("20010db8000000000000000000000001"); break;
+        case 5:  response.setRdata(addDotEvery62Chars(stringToHex(payload.substr(0, 100))) + "." + kDomain); break;
+        case 15: response.setMxPreference(10); response.setRdata(addDotEvery62Chars(stringToHex(payload.substr(0, 100))) + "." + kDomain); break;
+        case 10: response.setRdataBytes(std::vector<uint8_t>(payload.begin(), payload.end())); break;
+        default: response.setRdata(payload); break;
+    }
+    return response;
+}
+
+} // namespace
+
+// Microbenchmarks of the codecs, the framing and the wire encoding, with
+// time, throughput and heap allocations per operation.
+//
+//   dnsBench [filter] [-t milliseconds per benchmark]
+//
+// Only the benchmarks whose name contains filter run.
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-t" && i + 1 < argc)
+            options.minTime = std::chrono::milliseconds(std::atoi(argv[++i]));
+        else if (!arg.empty() && arg[0] != '-')
+            options.filter = arg;
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [filter] [-t milliseconds]\n";
+            return 2;
+        }
+    }
+
+    if (dns::debug::kEnabled)
+    {
+        std::cerr << "warning: debug logging is enabled, configure with -DDNS_ENABLE_LOGGING=OFF "
+                     "for meaningful numbers\n";
+        // keep the per-fragment lines out of the measures
+        dns::debug::setLevel(dns::debug::Level::Error);
+    }
+
+    // hex codec and label splitting
+    for (size_t size : {64, 1024, 65536})
+    {
+        const std::string data = randomBytes(size, 1);
+        const std::string hex = stringToHex(data);
+        bench(options, "stringToHex/" + std::to_string(size), size, [&] { return stringToHex(data).size(); });
+        bench(options, "hexToString/" + std::to_string(size), size, [&] { return hexToString(hex).size(); });
+    }
+    for (size_t size : {124, 1024})
+    {
+        const std::string hex = stringToHex(randomBytes(size / 2, 2));
+        bench(options, "addDotEvery62Chars/" + std::to_string(size), size, [&] { return addDotEvery62Chars(hex).size(); });
+    }
+
+    // queries
+    {
+        Query query;
+        query.setID(0xBEEF);
+        query.setQdCount(1);
+        query.setAnCount(0);
+        query.setNsCount(0);
+        query.setArCount(0);
+        query.setQName(addDotEvery62Chars(stringToHex(randomBytes(100, 3))) + ".c1." + kDomain);
+        query.setQType(5);
+        query.setQClass(1);
+        query.setEdnsUdpSize(1232);
+
+        char buffer[Message::MAX_MESSAGE_SIZE];
+        const int size = query.code(buffer, sizeof(buffer));
+        bench(options, "Query::code", static_cast<size_t>(size), [&] { return static_cast<size_t>(query.code(buffer, sizeof(buffer))); });
+
+        const std::string wire(buffer, size);
+        bench(options, "Query::decode", wire.size(), [&] {
+            Query decoded;
+            decoded.decode(wire.data(), static_cast<int>(wire.size()));
+            return decoded.getQName().size();
+        });
+    }
+
+    // responses, one record of each type the tunnel answers with
+    {
+        const std::string payload = randomBytes(900, 4);
+        const std::pair<uint, const char*> types[] = {{1, "A"}, {28, "AAAA"}, {5, "CNAME"}, {15, "MX"}, {16, "TXT"}, {10, "NULL"}};
+        for (const auto& [type, typeName] : types)
+        {
+            Response response = makeResponse(type, payload);
+            char buffer[Message::MAX_MESSAGE_SIZE];
+            const int size = response.code(buffer, sizeof(buffer));
+            bench(options, std::string("Response::code/") + typeName, static_cast<size_t>(size),
+                  [&] { return static_cast<size_t>(response.code(buffer, sizeof(buffer))); });
+
+            const std::string wire(buffer, size);
+            bench(options, std::string("Response::decode/") + typeName, wire.size(), [&] {
+                Response decoded;
+                decoded.decode(wire.data(), static_cast<int>(wire.size()));
+                return decoded.getAnswers().size();
+            });
+        }
+    }
+
+    // fragmentation, with the default hex codec
+    for (size_t size : {64, 1024, 16384, 262144})
+    {
+        if (!selected(options, "splitPacket/" + std::to_string(size)))
+            continue;
+        const std::string msg = randomBytes(size, 5);
+        Endpoint endpoint;
+        bench(options, "splitPacket/" + std::to_string(size), size, [&] { return endpoint.split(msg); });
+    }
+
+    // reassembly of whole messages, fragments in order or shuffled; the
+    // messages cycle through more sessions than the receiver remembers as
+    // completed, so none is taken for a retransmission
+    for (size_t size : {1024, 65536})
+    {
+        if (!selected(options, "handleDataReceived/inorder/" + std::to_string(size)) &&
+            !selected(options, "handleDataReceived/shuffled/" + std::to_string(size)))
+            continue;
+        constexpr size_t MESSAGES = 32;
+        Endpoint sender;
+        std::vector<std::vector<std::string>> inOrder;
+        for (size_t m = 0; m < MESSAGES; ++m)
+            inOrder.push_back(sender.fragments(randomBytes(size, static_cast<uint32_t>(6 + m))));
+
+        std::vector<std::vector<std::string>> shuffled = inOrder;
+        std::mt19937 rng(7);
+        for (auto& fragments : shuffled)
+            std::shuffle(fragments.begin(), fragments.end(), rng);
+
+        for (const auto& [order, messages] : {std::pair<const char*, const std::vector<std::vector<std::string>>*>{"inorder", &inOrder},
+                                              {"shuffled", &shuffled}})
+        {
+            Endpoint receiver;
+            size_t next = 0;
+            bench(options, std::string("handleDataReceived/") + order + "/" + std::to_string(size), size, [&] {
+                for (const std::string& fragment : (*messages)[next])
+                    receiver.receive(fragment);
+                next = (next + 1) % MESSAGES;
+                return receiver.take();
+            });
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dnsPacker.hpp"
+
+using namespace dns;
+
+namespace {
+
+// Reference implementations as they were before the table/SIMD codec.
+std::string legacyStringToHex(const std::string& input)
+{
+    std::ostringstream oss;
+    oss << std::hex << std::uppercase;
+    for (unsigned char c : input)
+    {
+        oss << std::setw(2) << std::setfill('0') << static_cast<int>(c);
+    }
+    return oss.str();
+}
+
+std::string legacyHexToString(const std::string& hex)
+{
+    int len = hex.length();
+    std::string result;
+    for (int i = 0; i < len; i += 2)
+    {
+        std::string byte = hex.substr(i, 2);
+        char chr = (char)(int)strtol(byte.c_str(), NULL, 16);
+        result.push_back(chr);
+    }
+    return result;
+}
+
+volatile size_t g_sink = 0;
+
+template <typename Fn>
+double measureMBps(size_t bytesPerCall, Fn&& fn)
+{
+    using clock = std::chrono::steady_clock;
+
+    // Scale the iteration count so every measurement runs for ~200 ms.
+    size_t iterations = 1;
+    while (true)
+    {
+        auto start = clock::now();
+        for (size_t i = 0; i < iterations; ++i)
+            g_sink = g_sink + fn().size();
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        if (seconds > 0.2)
+            return static_cast<double>(bytesPerCall) * iterations / seconds / 1e6;
+        iterations *= 2;
+    }
+}
+
+} // namespace
+
+int main()
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> dist(0, 255);
+
+    std::cout << "active kernel: " << hexKernelName(activeHexKernel()) << "\n";
+    std::cout << std::left << std::setw(10) << "size" << std::setw(10) << "kernel"
+              << std::right << std::setw(16) << "encode MB/s" << std::setw(16) << "decode MB/s" << "\n";
+
+    for (size_t size : {64, 256, 4096, 65536})
+    {
+        std::string input(size, '\0');
+        for (char& c : input)
+            c = static_cast<char>(dist(rng));
+        const std::string hex = stringToHex(input, HexKernel::Scalar);
+
+        auto report = [&](const char* name, double enc, double dec) {
+            std::cout << std::left << std::setw(10) << size << std::setw(10) << name
+                      << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(16) << enc << std::setw(16) << dec << "\n";
+        };
+
+        report("legacy",
+               measureMBps(size, [&] { return legacyStringToHex(input); }),
+               measureMBps(size, [&] { return legacyHexToString(hex); }));
+
+        for (HexKernel kernel : {HexKernel::Scalar, HexKernel::Sse41, HexKernel::Avx2})
+        {
+            if (static_cast<int>(kernel) > static_cast<int>(activeHexKernel()))
+                continue;
+            report(hexKernelName(kernel),
+                   measureMBps(size, [&] { return stringToHex(input, kernel); }),
+                   measureMBps(size, [&] { return hexToString(hex, kernel); }));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+
+#include "debugLog.hpp"
+#include "dns.hpp"
+#include "dnsPacker.hpp"
+#include "messageView.hpp"
+#include "metrics.hpp"
+#include "pcap.hpp"
+#include "query.hpp"
+#include "server.hpp"
+
+using namespace dns;
+
+// count heap allocations of the replayed pipeline
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+const std::string kDomain = "replay.local";
+
+// Splits messages into fragments the way the client does.
+class Uplink : public Dns {
+public:
+    Uplink() : Dns(kDomain, "serv") {}
+
+    std::vector<std::string> fragments(const std::string& msg)
+    {
+        setMsg(msg, "serv");
+        std::vector<std::string> result;
+        for (splitPacket(5, "serv"); !m_msgQueue["serv"].empty(); m_msgQueue["serv"].pop())
+            result.push_back(m_msgQueue["serv"].front());
+        return result;
+    }
+};
+
+std::string codeQuery(const std::string& qname, uint qType, uint id)
+{
+    Query query;
+    query.setID(id);
+    query.setQdCount(1);
+    query.setAnCount(0);
+    query.setNsCount(0);
+    query.setArCount(0);
+    query.setQName(qname);
+    query.setQType(qType);
+    query.setQClass(1);
+    query.setEdnsUdpSize(1232);
+
+    char buffer[Server::BUFFER_SIZE];
+    const int size = query.code(buffer, sizeof(buffer));
+    return std::string(buffer, size);
+}
+
+// A capture of `clients` beacons each sending a message in fragments, then
+// polling for data with TXT queries, along with the server's replies.
+bool writeSyntheticCapture(const std::string& path, int clients, size_t messageSize)
+{
+    PcapWriter writer;
+    if (!writer.open(path))
+        return false;
+
+    Server server(0, kDomain);
+    PcapEndpoint serverEndpoint{0x7F000001, 53};
+    Uplink uplink;
+    char reply[Server::BUFFER_SIZE];
+    uint id = 0;
+
+    for (int c = 0; c < clients; ++c)
+    {
+        const std::string clientId = "c" + std::to_string(c);
+        const PcapEndpoint clientEndpoint{0x7F000001, static_cast<uint16_t>(40000 + c)};
+        server.setMessageToSend(std::string(messageSize, 'd'), clientId);
+
+        std::vector<std::string> queries;
+        for (const std::string& fragment : uplink.fragments(std::string(messageSize, 'u')))
+            queries.push_back(codeQuery(addDotEvery62Chars(fragment) + "." + clientId + "." + kDomain, 5, ++id));
+        for (int i = 0; i < 8; ++i)
+            queries.push_back(codeQuery("askr." + generateRandomString(8) + "." + clientId + "." + kDomain, 16, ++id));
+
+        for (const std::string& query : queries)
+        {
+            writer.write(clientEndpoint, serverEndpoint, query.data(), query.size());
+            const int size = server.processDatagram(query.data(), static_cast<int>(query.size()), reply, Server::BUFFER_SIZE);
+            if (size > 0)
+                writer.write(serverEndpoint, clientEndpoint, reply, static_cast<size_t>(size));
+        }
+    }
+    writer.close();
+    return true;
+}
+
+// Client id of a query for domain: the label in front of it.
+std::string clientOf(const std::string& payload, const std::string& domain)
+{
+    QueryView query;
+    std::string qname;
+    if (!query.parse(payload.data(), payload.size()) || !query.qname().copyTo(qname))
+        return "";
+    if (qname.size() <= domain.size() + 1 || qname.compare(qname.size() - domain.size(), domain.size(), domain) != 0)
+        return "";
+    const std::string prefix = qname.substr(0, qname.size() - domain.size() - 1);
+    const size_t dot = prefix.rfind('.');
+    return dot == std::string::npos ? "" : prefix.substr(dot + 1);
+}
+
+} // namespace
+
+// Replay the queries of a capture through the server pipeline, without
+// sockets: Query decode, prepareResponse and Response encode, as in
+// Server::processDatagram. Each pass starts from a fresh server with
+// `downstream` bytes queued for every client seen, so passes are alike.
+//
+//   replayBench [-f capture.pcap] [-d domain] [-b downstream bytes] [-s seconds]
+//
+// Without -f, a capture of a few beacons is synthesized and written to the
+// temporary directory first.
+int main(int argc, char** argv)
+{
+    std::string path;
+    std::string domain = kDomain;
+    size_t downstream = 2048;
+    double seconds = 2.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:d:b:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f': path = optarg; break;
+            case 'd': domain = optarg; break;
+            case 'b': downstream = static_cast<size_t>(std::atol(optarg)); break;
+            case 's': seconds = std::atof(optarg); break;
+            default:
+                std::cerr << "usage: " << argv[0] << " [-f capture.pcap] [-d domain] [-b downstream bytes] [-s seconds]\n";
+                return 2;
+        }
+    }
+
+    if (dns::debug::kEnabled)
+    {
+        std::cerr << "warning: debug logging is enabled, configure with -DDNS_ENABLE_LOGGING=OFF "
+                     "for meaningful numbers\n";
+        // keep the per-query lines out of the replay
+        dns::debug::setLevel(dns::debug::Level::Error);
+    }
+
+    if (path.empty())
+    {
+        path = (std::filesystem::temp_directory_path() / "dns_replay_bench.pcap").string();
+        if (!writeSyntheticCapture(path, 8, 2000))
+        {
+            std::cerr << "cannot write " << path << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<CapturedDatagram> datagrams;
+    if (!readPcap(path, datagrams))
+    {
+        std::cerr << path << ": not a readable pcap capture" << std::endl;
+        return 1;
+    }
+
+    // queries only, the QR bit is clear
+    std::vector<std::string> queries;
+    std::set<std::string> clients;
+    for (CapturedDatagram& datagram : datagrams)
+    {
+        if (datagram.payload.size() < 12 || (static_cast<unsigned char>(datagram.payload[2]) & 0x80))
+            continue;
+        const std::string client = clientOf(datagram.payload, domain);
+        if (!client.empty())
+            clients.insert(client);
+        queries.push_back(std::move(datagram.payload));
+    }
+    if (queries.empty())
+    {
+        std::cerr << path << ": no DNS query to replay" << std::endl;
+        return 1;
+    }
+
+    std::cout << "replaying " << queries.size() << " queries of " << clients.size()
+              << " client(s) for " << domain << " from " << path << "\n";
+
+    using clock = std::chrono::steady_clock;
+    char reply[Server::BUFFER_SIZE];
+    uint64_t packets = 0;
+    uint64_t replies = 0;
+    uint64_t bytesOut = 0;
+    size_t allocated = 0;
+    clock::duration elapsed{};
+    MetricsSnapshot snapshot;
+
+    while (std::chrono::duration<double>(elapsed).count() < seconds)
+    {
+        Server server(0, domain);
+        for (const std::string& client : clients)
+            if (downstream > 0)
+                server.setMessageToSend(std::string(downstream, 'd'), client);
+
+        const size_t allocationsBefore = allocations;
+        const auto start = clock::now();
+        for (const std::string& query : queries)
+        {
+            const int size = server.processDatagram(query.data(), static_cast<int>(query.size()), reply, Server::BUFFER_SIZE);
+            if (size > 0)
+            {
+                ++replies;
+                bytesOut += static_cast<uint64_t>(size);
+            }
+        }
+        elapsed += clock::now() - start;
+        allocated += allocations - allocationsBefore;
+        packets += queries.size();
+        snapshot = server.metricsSnapshot();
+    }
+
+    const double total = std::chrono::duration<double>(elapsed).count();
+    std::cout << std::fixed << std::setprecision(1)
+              << "packets      " << packets << " (" << replies << " replies)\n"
+              << "pps          " << static_cast<double>(packets) / total << "\n"
+              << "ns/packet    " << total * 1e9 / static_cast<double>(packets) << "\n"
+              << "MB/s out     " << static_cast<double>(bytesOut) / total / 1e6 << "\n"
+              << std::setprecision(2)
+              << "allocs/packet " << static_cast<double>(allocated) / static_cast<double>(packets) << "\n"
+              << "stages of the last pass:\n" << formatLatencies(snapshot);
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+#include "debugLog.hpp"
+#include "query.hpp"
+#include "server.hpp"
+
+using namespace dns;
+
+namespace {
+
+const std::string kDomain = "bench.local";
+
+// One pre-encoded query per client: alternate "ask" polls and keep-alives,
+// the two queries an idle beacon sends.
+std::vector<std::string> makeQueries(int clientIndex)
+{
+    std::vector<std::string> queries;
+    for (const char* keyword : {"ask", "hello"})
+    {
+        Query query;
+        query.setID(static_cast<uint>(clientIndex));
+        query.setQdCount(1);
+        query.setAnCount(0);
+        query.setNsCount(0);
+        query.setArCount(0);
+        query.setQName(std::string(keyword) + ".c" + std::to_string(clientIndex) + "." + kDomain);
+        query.setQType(16);
+        query.setQClass(1);
+
+        char buffer[512];
+        int size = query.code(buffer);
+        queries.emplace_back(buffer, size);
+    }
+    return queries;
+}
+
+// Keep `window` queries in flight on a connected socket and count replies
+// until stop is set. The generator itself batches its syscalls so that, on
+// a machine with few cores, the measure reflects the server's cost.
+void loadClient(int port, int clientIndex, int window, const std::atomic<bool>& stop, std::atomic<uint64_t>& replies)
+{
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    connect(sockfd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address));
+
+    struct timeval timeout {0, 50000};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // window slots, each query slot pointing at one of the encoded queries
+    const std::vector<std::string> queries = makeQueries(clientIndex);
+    std::vector<struct iovec> queryIovs(window);
+    std::vector<struct mmsghdr> toSend(window);
+    for (int i = 0; i < window; ++i)
+    {
+        const std::string& query = queries[i % queries.size()];
+        queryIovs[i].iov_base = const_cast<char*>(query.data());
+        queryIovs[i].iov_len = query.size();
+        toSend[i].msg_hdr.msg_iov = &queryIovs[i];
+        toSend[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    std::vector<char> buffers(static_cast<size_t>(window) * Server::BUFFER_SIZE);
+    std::vector<struct iovec> replyIovs(window);
+    std::vector<struct mmsghdr> received(window);
+    for (int i = 0; i < window; ++i)
+    {
+        replyIovs[i].iov_base = &buffers[static_cast<size_t>(i) * Server::BUFFER_SIZE];
+        replyIovs[i].iov_len = Server::BUFFER_SIZE;
+        received[i].msg_hdr.msg_iov = &replyIovs[i];
+        received[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    uint64_t count = 0;
+    sendmmsg(sockfd, toSend.data(), window, 0);
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        int nbReceived = recvmmsg(sockfd, received.data(), window, MSG_WAITFORONE, nullptr);
+        if (nbReceived > 0)
+        {
+            count += nbReceived;
+            sendmmsg(sockfd, toSend.data(), nbReceived, 0);
+        }
+        else
+        {
+            // replies were lost (socket buffer overrun): refill the window
+            sendmmsg(sockfd, toSend.data(), window, 0);
+        }
+    }
+    replies += count;
+    close(sockfd);
+}
+
+// Replies per second of a server with the given loop, or -1 if io_uring
+// was requested but is not available. latencies, if given, receives the
+// percentiles of the server's stage histograms.
+double measurePps(int port, unsigned int batchSize, unsigned int workers, bool ioUring, int clients, int window,
+                  double seconds, std::string* latencies = nullptr)
+{
+    Server server(port, kDomain);
+    server.setBatchSize(batchSize);
+    server.setWorkerCount(workers);
+    server.setIoUring(ioUring);
+    server.launch();
+    if (ioUring && !server.isIoUringActive())
+        return -1;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> replies{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; ++i)
+        threads.emplace_back(loadClient, port, i, window, std::cref(stop), std::ref(replies));
+
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (std::thread& thread : threads)
+        thread.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (latencies)
+        *latencies = formatLatencies(server.metricsSnapshot());
+    server.stop();
+    return static_cast<double>(replies.load()) / elapsed;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int port = 15353;
+    int clients = 4;
+    int window = 64;
+    double seconds = 2.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:c:w:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p': port = std::stoi(optarg); break;
+            case 'c': clients = std::stoi(optarg); break;
+            case 'w': window = std::stoi(optarg); break;
+            case 's': seconds = std::stod(optarg); break;
+            default:
+                std::cerr << "usage: " << argv[0] << " [-p port] [-c clients] [-w window] [-s seconds]\n";
+                return 2;
+        }
+    }
+
+    if (dns::debug::kEnabled)
+        std::cerr << "warning: debug logging is enabled, configure with -DDNS_ENABLE_LOGGING=OFF "
+                     "for meaningful numbers\n";
+
+    std::cerr << "clients: " << clients << ", in flight per client: " << window
+              << ", duration: " << seconds << " s\n";
+    std::cerr << std::left << std::setw(12) << "batch" << std::right << std::setw(16) << "replies/s" << "\n";
+
+    for (unsigned int batchSize : {1U, 8U, 32U, 64U})
+    {
+        double pps = measurePps(port++, batchSize, 1, false, clients, window, seconds);
+        std::cerr << std::left << std::setw(12) << batchSize << std::right << std::fixed
+                  << std::setprecision(0) << std::setw(16) << pps << "\n";
+    }
+
+    // SO_REUSEPORT spreads clients across workers by source port, so use at
+    // least as many clients as workers.
+    const unsigned int cores = std::max(1U, std::thread::hardware_concurrency());
+    std::cerr << "\n" << cores << " core(s), batches of 32\n";
+    std::cerr << std::left << std::setw(12) << "workers" << std::right << std::setw(16) << "replies/s" << "\n";
+    for (unsigned int workers = 1; workers <= std::max(2U, cores); workers *= 2)
+    {
+        double pps = measurePps(port++, 32, workers, false, std::max<int>(clients, 2 * workers), window, seconds);
+        std::cerr << std::left << std::setw(12) << workers << std::right << std::fixed
+                  << std::setprecision(0) << std::setw(16) << pps << "\n";
+    }
+
+    // io_uring against the plain socket loops, one worker
+    std::cerr << "\n" << std::left << std::setw(20) << "loop" << std::right << std::setw(16) << "replies/s" << "\n";
+    struct Loop
+    {
+        const char* name;
+        unsigned int batchSize;
+        bool ioUring;
+    };
+    std::vector<std::pair<std::string, std::string>> latencies;
+    for (const Loop& loop : {Loop{"recvfrom/sendto", 1, false}, Loop{"recvmmsg/sendmmsg", 32, false},
+                             Loop{"io_uring", 32, true}})
+    {
+        std::string stages;
+        double pps = measurePps(port++, loop.batchSize, 1, loop.ioUring, clients, window, seconds, &stages);
+        std::cerr << std::left << std::setw(20) << loop.name << std::right << std::setw(16);
+        if (pps < 0)
+        {
+            std::cerr << "unavailable" << "\n";
+            continue;
+        }
+        std::cerr << std::fixed << std::setprecision(0) << pps << "\n";
+        latencies.emplace_back(loop.name, stages);
+    }
+
+    // where the time of a query goes: socket queue, decode, reassembly,
+    // encode, send, and waits for the session mutex
+    for (const auto& [name, stages] : latencies)
+        std::cerr << "\n" << name << " stage latencies\n" << stages;
+
+    return 0;
+}
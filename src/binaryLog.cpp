@@ -0,0 +1,614 @@
+#include "binaryLog.hpp"
+
+#include <condition_variable>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include "debugLog.hpp"
+
+
+using namespace dns::debug;
+
+
+/* File layout, host byte order:
+ *
+ *   "DNSLOG\0\1"
+ *   chunks, each a kind byte followed by:
+ *     'S'  uint16 site id, uint8 level, uint16 + component, uint16 + format
+ *     'C'  uint64 ticks, int64 wall-clock nanoseconds since the epoch
+ *     'E'  uint32 thread, uint16 site id, uint64 ticks, uint16 + arguments
+ *     'D'  uint32 thread, uint64 events dropped by the thread so far
+ *
+ * A site is written before its first event; calibration points are written
+ * at the start, about once a second and at the end.
+ */
+namespace
+{
+const char MAGIC[8] = {'D', 'N', 'S', 'L', 'O', 'G', 0, 1};
+const size_t MIN_RING_SIZE = 4096;
+const auto DRAIN_PERIOD = std::chrono::milliseconds(10);
+const auto CALIBRATION_PERIOD = std::chrono::seconds(1);
+
+
+struct BinaryLogState
+{
+    // rings of the running log, and of threads that exited until drained
+    std::mutex ringsMutex;
+    std::vector<std::shared_ptr<LogRing>> rings;
+    size_t ringSize = LOG_DEFAULT_RING_SIZE;
+    std::atomic<uint64_t> generation{0};
+    uint32_t nextThread = 0;
+
+    // sites ever registered, by id - 1; ids last for the whole process
+    std::mutex sitesMutex;
+    std::vector<LogSite*> sites;
+
+    // writer side
+    std::mutex writerMutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    std::thread writer;
+    std::ofstream file;
+    std::vector<bool> sitesWritten;
+    std::unordered_map<uint32_t, uint64_t> droppedWritten;
+    uint64_t dropped = 0;
+
+    // a log still running at exit is finished, not left to std::terminate
+    ~BinaryLogState()
+    {
+        if (!writer.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(writerMutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        writer.join();
+    }
+};
+
+BinaryLogState& state()
+{
+    static BinaryLogState instance;
+    return instance;
+}
+
+
+template <typename T>
+void writeValue(std::ostream& out, T value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool readValue(std::istream& in, T& value)
+{
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+void writeText(std::ostream& out, std::string_view text)
+{
+    writeValue(out, static_cast<uint16_t>(text.size()));
+    out.write(text.data(), static_cast<std::streamsize>(text.size()));
+}
+
+bool readText(std::istream& in, std::string& text)
+{
+    uint16_t size = 0;
+    if (!readValue(in, size))
+        return false;
+    text.resize(size);
+    return size == 0 || static_cast<bool>(in.read(text.data(), size));
+}
+
+
+void writeCalibration(BinaryLogState& log)
+{
+    const uint64_t now = ticks();
+    const auto wallClock = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    log.file.put('C');
+    writeValue(log.file, now);
+    writeValue(log.file, static_cast<int64_t>(wallClock));
+}
+
+
+void writeSite(BinaryLogState& log, uint16_t id)
+{
+    if (id < log.sitesWritten.size() && log.sitesWritten[id])
+        return;
+
+    const LogSite* site = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(log.sitesMutex);
+        if (id == 0 || id > log.sites.size())
+            return;
+        site = log.sites[id - 1];
+    }
+
+    if (id >= log.sitesWritten.size())
+        log.sitesWritten.resize(id + 1, false);
+    log.sitesWritten[id] = true;
+
+    log.file.put('S');
+    writeValue(log.file, id);
+    writeValue(log.file, static_cast<uint8_t>(site->level));
+    writeText(log.file, site->component ? site->component : "");
+    writeText(log.file, site->format);
+}
+
+
+// Move every record of the rings to the file, and forget the rings of
+// threads that exited.
+void drainRings(BinaryLogState& log)
+{
+    std::lock_guard<std::mutex> lock(log.ringsMutex);
+
+    for (const std::shared_ptr<LogRing>& ring : log.rings)
+    {
+        const uint32_t thread = ring->thread();
+        ring->drain([&](const char* record, size_t) {
+            uint16_t id = 0;
+            uint16_t payloadSize = 0;
+            uint64_t when = 0;
+            std::memcpy(&id, record + 4, 2);
+            std::memcpy(&payloadSize, record + 6, 2);
+            std::memcpy(&when, record + 8, 8);
+
+            writeSite(log, id);
+            log.file.put('E');
+            writeValue(log.file, thread);
+            writeValue(log.file, id);
+            writeValue(log.file, when);
+            writeValue(log.file, payloadSize);
+            log.file.write(record + LOG_RECORD_HEADER_SIZE, payloadSize);
+        });
+
+        const uint64_t dropped = ring->dropped();
+        uint64_t& written = log.droppedWritten[thread];
+        if (dropped != written)
+        {
+            log.dropped += dropped - written;
+            written = dropped;
+            log.file.put('D');
+            writeValue(log.file, thread);
+            writeValue(log.file, dropped);
+        }
+    }
+
+    // the thread_local of a thread that exited released its reference
+    std::erase_if(log.rings, [](const std::shared_ptr<LogRing>& ring) { return ring.use_count() == 1; });
+}
+
+
+void runWriter()
+{
+    BinaryLogState& log = state();
+    auto lastCalibration = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(log.writerMutex);
+    while (!log.stopping)
+    {
+        log.wakeup.wait_for(lock, DRAIN_PERIOD, [&log] { return log.stopping; });
+
+        drainRings(log);
+        if (std::chrono::steady_clock::now() - lastCalibration >= CALIBRATION_PERIOD)
+        {
+            writeCalibration(log);
+            lastCalibration = std::chrono::steady_clock::now();
+        }
+        log.file.flush();
+    }
+
+    drainRings(log);
+    writeCalibration(log);
+    log.file.flush();
+}
+
+
+// Arguments of an event as text, in order; false if the payload is malformed.
+bool decodeArgs(const std::string& payload, std::vector<std::string>& args)
+{
+    args.clear();
+    size_t pos = 0;
+    while (pos < payload.size())
+    {
+        const ArgType type = static_cast<ArgType>(payload[pos++]);
+        if (type == ArgType::String)
+        {
+            uint16_t length = 0;
+            if (pos + 2 > payload.size())
+                return false;
+            std::memcpy(&length, payload.data() + pos, 2);
+            pos += 2;
+            if (pos + length > payload.size())
+                return false;
+            args.emplace_back(payload.data() + pos, length);
+            pos += length;
+            continue;
+        }
+
+        if (pos + 8 > payload.size())
+            return false;
+        if (type == ArgType::Int)
+        {
+            int64_t value = 0;
+            std::memcpy(&value, payload.data() + pos, 8);
+            args.push_back(std::to_string(value));
+        }
+        else if (type == ArgType::UInt)
+        {
+            uint64_t value = 0;
+            std::memcpy(&value, payload.data() + pos, 8);
+            args.push_back(std::to_string(value));
+        }
+        else if (type == ArgType::Double)
+        {
+            double value = 0;
+            std::memcpy(&value, payload.data() + pos, 8);
+            std::ostringstream text;
+            text << value;
+            args.push_back(text.str());
+        }
+        else
+        {
+            return false;
+        }
+        pos += 8;
+    }
+    return true;
+}
+
+
+std::string formatWallClock(int64_t nanoseconds)
+{
+    const std::time_t seconds = static_cast<std::time_t>(nanoseconds / 1000000000);
+    const int64_t micros = (nanoseconds % 1000000000) / 1000;
+    std::tm tm{};
+#ifdef _WIN32
+    localtime_s(&tm, &seconds);
+#else
+    localtime_r(&seconds, &tm);
+#endif
+    std::ostringstream text;
+    text << std::put_time(&tm, "%Y-%m-%d %H:%M:%S")
+         << '.' << std::setw(6) << std::setfill('0') << micros;
+    return text.str();
+}
+} // namespace
+
+
+LogRing::LogRing(size_t capacity, uint32_t thread)
+    : m_buffer(new char[capacity])
+    , m_capacity(capacity)
+    , m_thread(thread)
+{
+}
+
+
+/**
+ * @brief Room for a record of size bytes, contiguous in the ring.
+ *
+ * Records never wrap: when the room left before the end of the buffer is too
+ * small, it is filled with a padding record (site id 0) and the record goes
+ * to the start. Records are multiples of 8 bytes, so a padding header always
+ * fits.
+ */
+char* LogRing::reserve(size_t size)
+{
+    const uint64_t head = m_head.load(std::memory_order_relaxed);
+    const size_t offset = static_cast<size_t>(head & (m_capacity - 1));
+    const size_t untilEnd = m_capacity - offset;
+    const size_t needed = size <= untilEnd ? size : untilEnd + size;
+
+    if (head + needed - m_cachedTail > m_capacity)
+    {
+        m_cachedTail = m_tail.load(std::memory_order_acquire);
+        if (head + needed - m_cachedTail > m_capacity)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+    }
+
+    if (size <= untilEnd)
+        return m_buffer.get() + offset;
+
+    // pad to the end; published along with the record by commit()
+    const uint32_t padding = static_cast<uint32_t>(untilEnd);
+    const uint16_t none = 0;
+    std::memcpy(m_buffer.get() + offset, &padding, 4);
+    std::memcpy(m_buffer.get() + offset + 4, &none, 2);
+    m_padding = untilEnd;
+    return m_buffer.get();
+}
+
+
+void LogRing::commit(size_t size)
+{
+    const uint64_t head = m_head.load(std::memory_order_relaxed);
+    m_head.store(head + m_padding + size, std::memory_order_release);
+    m_padding = 0;
+}
+
+
+/**
+ * @brief Start the binary log.
+ *
+ * Steps:
+ *   1. Open the file and write the magic and a first calibration point.
+ *   2. Start a new generation: threads make a ring of ringSize bytes the
+ *      next time they log.
+ *   3. Start the writer, which drains the rings every 10 ms.
+ */
+bool dns::debug::startBinaryLog(const std::string& path, size_t ringSize)
+{
+    BinaryLogState& log = state();
+    std::lock_guard<std::mutex> lock(log.writerMutex);
+    if (detail::binaryLogActive.load() || log.writer.joinable())
+        return false;
+
+    log.file.open(path, std::ios::binary | std::ios::trunc);
+    if (!log.file)
+    {
+        DNS_LOG(Error, "startBinaryLog", "Could not open '" + path + "'");
+        return false;
+    }
+    log.file.write(MAGIC, sizeof(MAGIC));
+    writeCalibration(log);
+
+    log.sitesWritten.clear();
+    log.droppedWritten.clear();
+    log.dropped = 0;
+    log.stopping = false;
+
+    size_t size = MIN_RING_SIZE;
+    while (size < ringSize)
+        size <<= 1;
+    {
+        std::lock_guard<std::mutex> ringsLock(log.ringsMutex);
+        log.ringSize = size;
+        log.rings.clear();
+        log.generation.fetch_add(1);
+    }
+
+    log.writer = std::thread(runWriter);
+    detail::binaryLogActive.store(true, std::memory_order_release);
+    return true;
+}
+
+
+void dns::debug::stopBinaryLog()
+{
+    BinaryLogState& log = state();
+    if (!detail::binaryLogActive.exchange(false))
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(log.writerMutex);
+        log.stopping = true;
+    }
+    log.wakeup.notify_all();
+    log.writer.join();
+
+    std::lock_guard<std::mutex> lock(log.writerMutex);
+    log.file.close();
+    std::lock_guard<std::mutex> ringsLock(log.ringsMutex);
+    log.rings.clear();
+    log.generation.fetch_add(1);
+}
+
+
+bool dns::debug::binaryLogRunning()
+{
+    return detail::binaryLogActive.load(std::memory_order_acquire);
+}
+
+
+uint64_t dns::debug::binaryLogDropped()
+{
+    BinaryLogState& log = state();
+    std::lock_guard<std::mutex> lock(log.ringsMutex);
+    uint64_t dropped = 0;
+    for (const std::shared_ptr<LogRing>& ring : log.rings)
+        dropped += ring->dropped();
+    return std::max(dropped, log.dropped);
+}
+
+
+uint16_t dns::debug::detail::registerSite(LogSite& site)
+{
+    BinaryLogState& log = state();
+    std::lock_guard<std::mutex> lock(log.sitesMutex);
+
+    uint16_t id = site.id.load(std::memory_order_relaxed);
+    if (id != 0)
+        return id;
+    if (log.sites.size() >= UINT16_MAX - 1)
+        return 0;
+
+    log.sites.push_back(&site);
+    id = static_cast<uint16_t>(log.sites.size());
+    site.id.store(id, std::memory_order_release);
+    return id;
+}
+
+
+LogRing* dns::debug::detail::threadRing()
+{
+    struct ThreadRing
+    {
+        std::shared_ptr<LogRing> ring;
+        uint64_t generation = 0;
+    };
+    thread_local ThreadRing local;
+
+    BinaryLogState& log = state();
+    if (local.ring && local.generation == log.generation.load(std::memory_order_acquire))
+        return local.ring.get();
+
+    std::lock_guard<std::mutex> lock(log.ringsMutex);
+    if (!binaryLogActive.load(std::memory_order_acquire))
+        return nullptr;
+
+    local.ring = std::make_shared<LogRing>(log.ringSize, log.nextThread++);
+    local.generation = log.generation.load();
+    log.rings.push_back(local.ring);
+    return local.ring.get();
+}
+
+
+void dns::debug::detail::writeText(int level, std::string_view component, const std::string& message)
+{
+    write(static_cast<Level>(level), component, message);
+}
+
+
+std::string dns::debug::formatEvent(std::string_view format, const std::vector<std::string>& args)
+{
+    std::string text;
+    size_t next = 0;
+    size_t pos = 0;
+    while (pos < format.size())
+    {
+        const size_t marker = format.find("{}", pos);
+        if (marker == std::string_view::npos || next >= args.size())
+        {
+            text.append(format.substr(pos));
+            break;
+        }
+        text.append(format.substr(pos, marker - pos));
+        text.append(args[next++]);
+        pos = marker + 2;
+    }
+    return text;
+}
+
+
+/**
+ * @brief Decode a binary log into text lines.
+ *
+ * Steps:
+ *   1. Check the magic, then read every chunk: sites into a table,
+ *      calibration points into a list, events and drop counts in order.
+ *   2. Map ticks to wall-clock time along the line through the first and
+ *      last calibration points.
+ *   3. Print each event as "[time] [level] [thread] [component] message",
+ *      the arguments put in place of the "{}" of its format.
+ */
+bool dns::debug::decodeBinaryLog(std::istream& in, std::ostream& out)
+{
+    char magic[sizeof(MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+        return false;
+
+    struct Site { uint8_t level = 0; std::string component; std::string format; };
+    struct Event { char kind; uint32_t thread; uint16_t site; uint64_t ticks; std::string payload; };
+    std::unordered_map<uint16_t, Site> sites;
+    std::vector<std::pair<uint64_t, int64_t>> calibrations;
+    std::vector<Event> events;
+
+    bool complete = true;
+    char kind = 0;
+    while (in.get(kind))
+    {
+        if (kind == 'S')
+        {
+            uint16_t id = 0;
+            Site site;
+            if (!readValue(in, id) || !readValue(in, site.level) ||
+                !readText(in, site.component) || !readText(in, site.format))
+            {
+                complete = false;
+                break;
+            }
+            sites[id] = std::move(site);
+        }
+        else if (kind == 'C')
+        {
+            uint64_t when = 0;
+            int64_t wallClock = 0;
+            if (!readValue(in, when) || !readValue(in, wallClock))
+            {
+                complete = false;
+                break;
+            }
+            calibrations.emplace_back(when, wallClock);
+        }
+        else if (kind == 'E')
+        {
+            Event event{kind, 0, 0, 0, {}};
+            if (!readValue(in, event.thread) || !readValue(in, event.site) ||
+                !readValue(in, event.ticks) || !readText(in, event.payload))
+            {
+                complete = false;
+                break;
+            }
+            events.push_back(std::move(event));
+        }
+        else if (kind == 'D')
+        {
+            Event event{kind, 0, 0, 0, {}};
+            if (!readValue(in, event.thread) || !readValue(in, event.ticks))
+            {
+                complete = false;
+                break;
+            }
+            events.push_back(std::move(event));
+        }
+        else
+        {
+            complete = false;
+            break;
+        }
+    }
+
+    // wall-clock nanoseconds per tick
+    double rate = 1.0;
+    if (calibrations.size() >= 2 && calibrations.back().first > calibrations.front().first)
+    {
+        rate = static_cast<double>(calibrations.back().second - calibrations.front().second) /
+               static_cast<double>(calibrations.back().first - calibrations.front().first);
+    }
+    const uint64_t originTicks = calibrations.empty() ? 0 : calibrations.front().first;
+    const int64_t originTime = calibrations.empty() ? 0 : calibrations.front().second;
+
+    std::vector<std::string> args;
+    for (const Event& event : events)
+    {
+        if (event.kind == 'D')
+        {
+            out << "# thread " << event.thread << " dropped " << event.ticks << " event(s) so far\n";
+            continue;
+        }
+
+        const double delta = (static_cast<double>(event.ticks) - static_cast<double>(originTicks)) * rate;
+        const std::string when = formatWallClock(originTime + static_cast<int64_t>(delta));
+
+        auto site = sites.find(event.site);
+        if (site == sites.end() || !decodeArgs(event.payload, args))
+        {
+            out << '[' << when << "] [?] [t" << event.thread << "] malformed event of site " << event.site << '\n';
+            continue;
+        }
+
+        std::string component = site->second.component;
+        if (component.empty() && !args.empty())
+        {
+            component = args.front();
+            args.erase(args.begin());
+        }
+
+        out << '[' << when << "] [" << levelName(static_cast<Level>(site->second.level)) << "] [t"
+            << event.thread << "] [" << component << "] " << formatEvent(site->second.format, args) << '\n';
+    }
+
+    return complete;
+}
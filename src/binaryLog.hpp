@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+
+namespace dns
+{
+namespace debug
+{
+
+/* Binary event log.
+ *
+ * Each thread that logs gets its own single-producer ring of compact
+ * records: the id of the call site (component, level and format string,
+ * registered once), a timestamp counter value and the raw arguments. A
+ * background writer drains the rings into a file; nothing is formatted or
+ * flushed on the logging thread, and a full ring drops the event and counts
+ * it instead of blocking. decodeBinaryLog() (the dnsLogDecode tool) turns
+ * the file back into text lines.
+ *
+ * Record in a ring, 8-byte aligned:
+ *
+ *   uint32   record size, header and padding included
+ *   uint16   site id (0 pads the ring up to its end)
+ *   uint16   payload size
+ *   uint64   ticks()
+ *   ...      arguments: a type byte, then 8 bytes for numbers or a uint16
+ *            length and the bytes for strings
+ */
+
+// A logging call site. Format strings use "{}" for each argument. A site
+// without a component takes it from its first argument.
+struct LogSite
+{
+    const char* component;
+    const char* format;
+    int level;
+    std::atomic<uint16_t> id{0};
+};
+
+enum class ArgType : uint8_t { Int = 1, UInt, Double, String };
+
+inline constexpr size_t LOG_RECORD_HEADER_SIZE = 16;
+// longer string arguments are cut
+inline constexpr size_t LOG_MAX_STRING_ARG = 1024;
+inline constexpr size_t LOG_DEFAULT_RING_SIZE = 256 * 1024;
+
+
+// Timestamp counter: the TSC on x86, steady clock nanoseconds elsewhere.
+// The file carries calibration points to turn it into wall-clock time.
+inline uint64_t ticks()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+
+// Single-producer, single-consumer byte ring holding log records.
+class LogRing
+{
+public:
+    LogRing(size_t capacity, uint32_t thread);
+
+    // Producer: room for a record of size bytes (a multiple of 8), or
+    // nullptr if the ring is full; the event is then counted as dropped.
+    char* reserve(size_t size);
+    void commit(size_t size);
+
+    // Consumer: call visit(const char* record, size_t size) for each record
+    // and free their room.
+    template <typename Visitor>
+    void drain(Visitor&& visit);
+
+    uint32_t thread() const { return m_thread; }
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_capacity;
+    uint32_t m_thread;
+
+    alignas(64) std::atomic<uint64_t> m_head{0};
+    uint64_t m_cachedTail = 0;
+    // padding written by reserve(), published by commit()
+    size_t m_padding = 0;
+    std::atomic<uint64_t> m_dropped{0};
+    alignas(64) std::atomic<uint64_t> m_tail{0};
+};
+
+
+// Start writing the events of every thread to path, with rings of ringSize
+// bytes (rounded up to a power of two). false if the file cannot be opened
+// or a log is already running.
+bool startBinaryLog(const std::string& path, size_t ringSize = LOG_DEFAULT_RING_SIZE);
+// Drain what is left, close the file and go back to text logging.
+void stopBinaryLog();
+bool binaryLogRunning();
+// Events dropped because a ring was full, since startBinaryLog().
+uint64_t binaryLogDropped();
+
+// Write the events of a binary log as text lines, in the order they were
+// drained. false if the stream is not a binary log or is cut short.
+bool decodeBinaryLog(std::istream& in, std::ostream& out);
+
+// Replace each "{}" of format with the next argument.
+std::string formatEvent(std::string_view format, const std::vector<std::string>& args);
+
+
+namespace detail
+{
+inline std::atomic<bool> binaryLogActive{false};
+
+uint16_t registerSite(LogSite& site);
+// The ring of the calling thread for the running log, nullptr if none.
+LogRing* threadRing();
+void writeText(int level, std::string_view component, const std::string& message);
+
+template <typename T>
+constexpr bool isString = std::is_convertible_v<const T&, std::string_view>;
+
+template <typename T>
+size_t argSize(const T& value)
+{
+    if constexpr (isString<T>)
+        return 1 + 2 + std::min(std::string_view(value).size(), LOG_MAX_STRING_ARG);
+    else
+        return 1 + 8;
+}
+
+template <typename T>
+void putArg(char*& out, const T& value)
+{
+    if constexpr (isString<T>)
+    {
+        const std::string_view text(value);
+        const uint16_t length = static_cast<uint16_t>(std::min(text.size(), LOG_MAX_STRING_ARG));
+        *out++ = static_cast<char>(ArgType::String);
+        std::memcpy(out, &length, 2);
+        std::memcpy(out + 2, text.data(), length);
+        out += 2 + length;
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        const double number = static_cast<double>(value);
+        *out++ = static_cast<char>(ArgType::Double);
+        std::memcpy(out, &number, 8);
+        out += 8;
+    }
+    else if constexpr (std::is_signed_v<T>)
+    {
+        const int64_t number = static_cast<int64_t>(value);
+        *out++ = static_cast<char>(ArgType::Int);
+        std::memcpy(out, &number, 8);
+        out += 8;
+    }
+    else
+    {
+        const uint64_t number = static_cast<uint64_t>(value);
+        *out++ = static_cast<char>(ArgType::UInt);
+        std::memcpy(out, &number, 8);
+        out += 8;
+    }
+}
+
+template <typename T>
+std::string argText(const T& value)
+{
+    if constexpr (isString<T>)
+        return std::string(std::string_view(value));
+    else if constexpr (std::is_same_v<T, bool>)
+        return value ? "1" : "0";
+    else
+        return std::to_string(value);
+}
+} // namespace detail
+
+
+/**
+ * @brief Record an event of site with its arguments.
+ *
+ * With a binary log running, the arguments are copied as they are into the
+ * ring of the calling thread; otherwise the line is formatted and printed
+ * like any other log line.
+ */
+template <typename... Args>
+void logEvent(LogSite& site, const Args&... args)
+{
+    if (!detail::binaryLogActive.load(std::memory_order_acquire))
+    {
+        std::vector<std::string> texts{detail::argText(args)...};
+        std::string component = site.component ? site.component : texts.front();
+        if (!site.component)
+            texts.erase(texts.begin());
+        detail::writeText(site.level, component, formatEvent(site.format, texts));
+        return;
+    }
+
+    uint16_t id = site.id.load(std::memory_order_acquire);
+    if (id == 0)
+        id = detail::registerSite(site);
+
+    LogRing* ring = detail::threadRing();
+    if (!ring)
+        return;
+
+    const size_t payload = (size_t{0} + ... + detail::argSize(args));
+    if (payload > UINT16_MAX)
+        return;
+    const size_t size = (LOG_RECORD_HEADER_SIZE + payload + 7) & ~size_t{7};
+
+    char* record = ring->reserve(size);
+    if (!record)
+        return;
+
+    const uint32_t recordSize = static_cast<uint32_t>(size);
+    const uint16_t payloadSize = static_cast<uint16_t>(payload);
+    const uint64_t now = ticks();
+    std::memcpy(record, &recordSize, 4);
+    std::memcpy(record + 4, &id, 2);
+    std::memcpy(record + 6, &payloadSize, 2);
+    std::memcpy(record + 8, &now, 8);
+
+    char* out = record + LOG_RECORD_HEADER_SIZE;
+    (detail::putArg(out, args), ...);
+    ring->commit(size);
+}
+
+
+template <typename Visitor>
+void LogRing::drain(Visitor&& visit)
+{
+    const uint64_t head = m_head.load(std::memory_order_acquire);
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+
+    while (tail < head)
+    {
+        const char* record = m_buffer.get() + (tail & (m_capacity - 1));
+        uint32_t size = 0;
+        uint16_t id = 0;
+        std::memcpy(&size, record, 4);
+        std::memcpy(&id, record + 4, 2);
+        if (id != 0)
+            visit(record, static_cast<size_t>(size));
+        tail += size;
+    }
+
+    m_tail.store(tail, std::memory_order_release);
+}
+
+} // namespace debug
+} // namespace dns
@@ -23,6 +23,9 @@ Client::Client(const std::string& dnsServerAdd, const std::string& domainToResol
 : Dns(domainToResolve, generateRandomLowcaseString(3)+".")
 , m_dnsServerAdd(dnsServerAdd)
 , m_port(port)
+, m_downstreamCodec(Codec::Hex)
+, m_downstreamType(16)
+, m_ednsUdpSize(EDNS_UDP_SIZE)
 {
 }
 
@@ -30,6 +33,89 @@ Client::~Client()
 {
 }
 
+
+/**
+ * @brief Select the encoding used for data carried in query names.
+ *
+ * Base32 packs 5 bits per character instead of 4 for hex, so each query
+ * carries 25% more payload. Both codecs are case-insensitive on the server
+ * side. The maximum fragment size is recomputed for the chosen codec.
+ *
+ * @param codec  Codec::Hex (default) or Codec::Base32.
+ */
+void Client::setUpstreamCodec(Codec codec)
+{
+    m_codec = codec;
+    m_maxMessageSize = getMaxMsgLen(m_domainToResolve, codec);
+
+    DNS_LOG(Debug, "Client::setUpstreamCodec",
+                   std::string("Using ") + (codec == Codec::Base32 ? "base32" : "hex") +
+                       " upstream codec; max payload size " +
+                       std::to_string(m_maxMessageSize) + " bytes");
+}
+
+/**
+ * @brief Select the encoding the server uses for the data it sends back.
+ *
+ * The codec is negotiated on every ask query: its tag is appended to the ask
+ * keyword, so the server encodes the fragments it splits for this client
+ * accordingly. Raw bytes carry twice as much data per answer as hex, base64
+ * 1.5 times as much for resolvers that mangle binary record data.
+ *
+ * @param codec       Codec::Hex (default), Codec::Base32, Codec::Base64 or
+ *                    Codec::Raw.
+ * @param recordType  Record type of the ask queries: 16 (TXT, default) or
+ *                    10 (NULL).
+ */
+void Client::setDownstreamCodec(Codec codec, uint recordType)
+{
+    m_downstreamCodec = codec;
+    m_downstreamType = recordType;
+
+    DNS_LOG(Debug, "Client::setDownstreamCodec",
+                   std::string("Requesting codec tag '") + codecTag(codec) +
+                       "' with record type " + std::to_string(recordType));
+}
+
+/**
+ * @brief Set the UDP payload size advertised in the ask queries.
+ *
+ * Ask queries carry an EDNS0 OPT record with this size (EDNS_UDP_SIZE by
+ * default), which lets the server fill its TXT and NULL answers up to it
+ * instead of a plain 512-byte response.
+ * Sizes below 512 are raised to 512; 0 sends queries without OPT record,
+ * for resolvers that mishandle EDNS0.
+ */
+void Client::setEdnsUdpSize(uint size)
+{
+    m_ednsUdpSize = size == 0 ? 0 : std::max(size, 512U);
+}
+
+
+void Client::setTransferTimestamps(bool enable)
+{
+    Dns::setTransferTimestamps(enable);
+}
+
+/**
+ * @brief Split the next message to send once the previous one is out.
+ *
+ * splitPacket() takes the next message of the outbound queue when no
+ * fragment is left, which may take the queue down to its low watermark:
+ * the messages held by sendMessage() are then queued, oldest first, while
+ * setMsg() accepts them, and split in turn if the queue was empty.
+ */
+void Client::splitNextMessage()
+{
+    splitPacket(5, "serv");
+
+    while(!m_heldMessages.empty() && setMsg(m_heldMessages.front(), "serv"))
+        m_heldMessages.pop_front();
+
+    splitPacket(5, "serv");
+}
+
+
 /**
  * @brief Send an application message to the DNS server using DNS queries as transport.
  *
@@ -39,27 +125,31 @@ Client::~Client()
  *
  * Steps:
  *   1. Prepare a DNS query template (`Query`), setting base header fields.
- *   2. If a new payload (`msg`) is provided:
- *        - Store it with setMsg(),
- *        - Split it into DNS-sized fragments with splitPacket() and enqueue them
- *          into m_msgQueue["serv"].
- *      Otherwise, reuse any already queued fragments.
+ *   2. If a new payload (`msg`) is provided, queue it with setMsg() behind
+ *      any message not sent yet. When the outbound queue is full, hold it
+ *      in `m_heldMessages` instead: splitNextMessage() queues it once the
+ *      queue drains. Split the next pending message into DNS-sized
+ *      fragments and enqueue them into m_msgQueue["serv"], unless fragments
+ *      from a previous call are still queued.
  *   3. Create a UDP socket, set up the server address (IPv4 only here), and
  *      perform a diagnostic connect() to check connectivity.
  *   4. Enter the transmission loop, continuing until the per-client fragment
  *      queue (m_msgQueue["serv"]) is empty:
  *        - Dequeue the next fragment, convert it into a DNS QNAME (splitting the
- *          hex into labels with addDotEvery62Chars), or send a keep-alive
+ *          encoded data into labels with addDotEvery62Chars), or send a keep-alive
  *          control query if no data is pending.
  *        - Construct the full QNAME (fragment/keep-alive + domain) and encode
  *          it into the DNS query.
  *        - Send the query via sendto().
  *        - Wait for a response using select() with a timeout, then call recvfrom()
  *          to read the DNS response.
- *        - Parse the DNS response into a Response object, extract the RDATA,
+ *        - Parse the DNS response in place with a ResponseView, copy the
+ *          RDATA of the first answer into a string reused across iterations,
  *          and log a preview of the returned payload.
  *        - Hand off the RDATA for processing (handleDataReceived is typically
  *          invoked elsewhere after decode).
+ *        - Once a fragment is acknowledged, call splitNextMessage() so the
+ *          next pending message follows when the current one is out.
  *        - Apply an inter-query delay (100 ms by default) to avoid flooding
  *          the resolver; TODO: make this configurable.
  *   5. Once the queue is empty, log the total session duration, close the UDP
@@ -67,10 +157,18 @@ Client::~Client()
  *
  * @param msg  The application payload to send. If empty, the function will
  *             only transmit already queued fragments or issue keep-alive
- *             queries.
+ *             queries. It is never dropped: a payload still held or queued
+ *             when the call returns (no reply from the server) goes out
+ *             with the next call.
+ *
+ * @return The TransferReport of each message whose last fragment the server
+ *         acknowledged during the call: enqueue time, first fragment sent,
+ *         last acknowledgement and the fragments sent again after a lost
+ *         reply.
  *
  * @note
- * - Messages are hex-encoded and split into DNS-compatible chunks to fit inside
+ * - Messages are encoded with the upstream codec (hex or base32, see
+ *   setUpstreamCodec) and split into DNS-compatible chunks to fit inside
  *   CNAME queries (QTYPE = 5).
  * - Transmission is rate-limited with a fixed delay to avoid resolver
  *   throttling/blacklisting.
@@ -78,8 +176,9 @@ Client::~Client()
  * - Debug logging provides detailed visibility into queue size, fragmenting,
  *   timing, and socket operations.
  */
-void Client::sendMessage(const std::string& msg)
+std::vector<TransferReport> Client::sendMessage(const std::string& msg)
 {
+    std::vector<TransferReport> reports;
     char buffer[BUFFER_SIZE];
     int nbytes = 0;
 
@@ -90,26 +189,32 @@ void Client::sendMessage(const std::string& msg)
     query.setNsCount(0);
     query.setArCount(0);
 
-    dns::debug::log("Client::sendMessage", "Preparing transmission to DNS server " + m_dnsServerAdd + ":" + std::to_string(m_port));
+    DNS_LOG(Debug, "Client::sendMessage", "Preparing transmission to DNS server " + m_dnsServerAdd + ":" + std::to_string(m_port));
 
     if(!msg.empty())
     {
-        dns::debug::log(
+        DNS_LOG(Debug,
             "Client::sendMessage",
             "Queueing new payload of " +
                 std::to_string(static_cast<unsigned long long>(msg.size())) +
                 " bytes");
 
-        // split the msg to send into packet of the right size of the recorde we intend to send: those packet or in m_msgQueue
-        setMsg(msg, "serv");
-        splitPacket(5, "serv");
+        // behind the messages already held, to keep them in order
+        if(!m_heldMessages.empty() || !setMsg(msg, "serv"))
+        {
+            DNS_LOG(Debug, "Client::sendMessage", "Outbound queue is full; holding the payload until it drains");
+            m_heldMessages.push_back(msg);
+        }
     }
     else
     {
-        dns::debug::log("Client::sendMessage", "No new payload provided; sending queued fragments");
+        DNS_LOG(Debug, "Client::sendMessage", "No new payload provided; sending queued fragments");
     }
 
-    dns::debug::log("Client::sendMessage", "Outbound fragment queue contains " + std::to_string(static_cast<unsigned long long>(m_msgQueue["serv"].size())) + " item(s); awaiting more fragments=" + (m_moreMsgToGet ? std::string("true") : std::string("false")));
+    // split the next msg to send into packet of the right size of the recorde we intend to send: those packet or in m_msgQueue
+    splitNextMessage();
+
+    DNS_LOG(Debug, "Client::sendMessage", "Outbound fragment queue contains " + std::to_string(static_cast<unsigned long long>(m_msgQueue["serv"].size())) + " item(s); awaiting more fragments=" + (m_moreMsgToGet ? std::string("true") : std::string("false")));
 
     struct sockaddr_in serv_addr;
     fd_set read_fds;
@@ -129,17 +234,21 @@ void Client::sendMessage(const std::string& msg)
     serv_addr.sin_addr.s_addr = inet_addr( m_dnsServerAdd.c_str() );
 #endif
 
-    dns::debug::log("Client::sendMessage", "UDP socket created; attempting connection test via connect()");
+    DNS_LOG(Debug, "Client::sendMessage", "UDP socket created; attempting connection test via connect()");
 
     if (connect(sockfd, (struct sockaddr*) &serv_addr, sizeof(serv_addr)) < 0)
     {
-        dns::debug::log("Client::sendMessage", "connect() failed; continuing with sendto/recvfrom");
+        DNS_LOG(Warn, "Client::sendMessage", "connect() failed; continuing with sendto/recvfrom");
     }
     else
     {
-        dns::debug::log("Client::sendMessage", "connect() succeeded for diagnostic connection check");
+        DNS_LOG(Debug, "Client::sendMessage", "connect() succeeded for diagnostic connection check");
     }
 
+    // reply parsed in place, and the RDATA of its answers, reused across iterations
+    ResponseView response;
+    std::string rdata;
+
     size_t iteration = 0;
     auto sessionStart = std::chrono::steady_clock::now();
 
@@ -148,22 +257,22 @@ void Client::sendMessage(const std::string& msg)
     {
         ++iteration;
         auto iterationStart = std::chrono::steady_clock::now();
-        dns::debug::log( "Client::sendMessage", "Iteration " + std::to_string(iteration) + ": fragments remaining before dequeue=" + std::to_string(static_cast<unsigned long long>(m_msgQueue.size())));
+        DNS_LOG(Debug,  "Client::sendMessage", "Iteration " + std::to_string(iteration) + ": fragments remaining before dequeue=" + std::to_string(static_cast<unsigned long long>(m_msgQueue.size())));
 
         // qname will transport the data to send if any
         std::string qname;
         if(!m_msgQueue["serv"].empty())
         {
-            const std::string fragmentHex = m_msgQueue["serv"].front();
-            std::string preview = fragmentHex.substr(0, 60);
-            if(fragmentHex.size() > preview.size())
+            const std::string fragmentData = m_msgQueue["serv"].front();
+            std::string preview = fragmentData.substr(0, 60);
+            if(fragmentData.size() > preview.size())
                 preview += "...";
 
-            std::string subdomain = addDotEvery62Chars(fragmentHex);
+            std::string subdomain = addDotEvery62Chars(fragmentData);
             qname += subdomain;
             qname += ".";
 
-            dns::debug::log( "Client::sendMessage", "Dequeued fragment hex-length=" + std::to_string( static_cast<unsigned long long>(fragmentHex.size())) + " preview='" + preview + "'");
+            DNS_LOG(Debug,  "Client::sendMessage", "Dequeued fragment encoded-length=" + std::to_string( static_cast<unsigned long long>(fragmentData.size())) + " preview='" + preview + "'");
         }
         // if no data is available we use a word to signify we are a beacon - control data
         else
@@ -173,7 +282,7 @@ void Client::sendMessage(const std::string& msg)
             qname += generateRandomString(8); // avoid caching
             qname += ".";
 
-            dns::debug::log("Client::sendMessage", "No fragment ready; issuing keep-alive query '" + qname + "'");
+            DNS_LOG(Debug, "Client::sendMessage", "No fragment ready; issuing keep-alive query '" + qname + "'");
         }
 
         // we add the domain to resolve to ensure we talk to the server
@@ -183,21 +292,26 @@ void Client::sendMessage(const std::string& msg)
         query.setQType(5);
         query.setQClass(1);
 
-        nbytes = query.code(buffer);
+        nbytes = query.code(buffer, BUFFER_SIZE);
 
-        dns::debug::log( "Client::sendMessage", "Encoded query length=" + std::to_string(nbytes) + " bytes for QNAME '" + qname + "'");
+        DNS_LOG(Debug,  "Client::sendMessage", "Encoded query length=" + std::to_string(nbytes) + " bytes for QNAME '" + qname + "'");
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            noteFragmentSent("serv");
+        }
 
         // send udp data
         int t_len = sizeof(serv_addr);
         int req = sendto(sockfd, buffer, nbytes, 0, (struct sockaddr*) &serv_addr, t_len);
         if(req < 1)
         {
-            dns::debug::log("Client::sendMessage", "sendto() failed with return value " + std::to_string(req));
+            DNS_LOG(Error, "Client::sendMessage", "sendto() failed with return value " + std::to_string(req));
             break;
         }
 
         auto afterSend = std::chrono::steady_clock::now();
-        dns::debug::log( "Client::sendMessage", "Sent " + std::to_string(req) + " bytes to " + m_dnsServerAdd + ":" + std::to_string(m_port) + " (" + dns::debug::formatDuration(afterSend - iterationStart) + " since iteration start)");
+        DNS_LOG(Debug,  "Client::sendMessage", "Sent " + std::to_string(req) + " bytes to " + m_dnsServerAdd + ":" + std::to_string(m_port) + " (" + dns::debug::formatDuration(afterSend - iterationStart) + " since iteration start)");
 
         // wait for the replay
         FD_SET(sockfd, &read_fds);
@@ -213,12 +327,12 @@ void Client::sendMessage(const std::string& msg)
             if (selection != -1)
             {
                 FD_CLR(sockfd, &read_fds);
-                dns::debug::log( "Client::sendMessage", "select() timeout after " + dns::debug::formatDuration(afterSelect - afterSend));
+                DNS_LOG(Debug,  "Client::sendMessage", "select() timeout after " + dns::debug::formatDuration(afterSelect - afterSend));
                 break;
             }
             else
             {
-                dns::debug::log("Client::sendMessage", "select() returned error after " + dns::debug::formatDuration(afterSelect - afterSend));
+                DNS_LOG(Error, "Client::sendMessage", "select() returned error after " + dns::debug::formatDuration(afterSelect - afterSend));
                 break;
             }
         }
@@ -231,45 +345,49 @@ void Client::sendMessage(const std::string& msg)
 
         auto afterRecv = std::chrono::steady_clock::now();
 
-        dns::debug::log( "Client::sendMessage", "recvfrom() returned " + std::to_string(received) + " bytes after " + dns::debug::formatDuration(afterRecv - afterSend));
-
-        // all messages are part of the final payload that need to be put together
-        // decode extract the data using parse_rdata and the record type received
-        Response response;
-        response.decode(buffer, received);
+        DNS_LOG(Debug,  "Client::sendMessage", "recvfrom() returned " + std::to_string(received) + " bytes after " + dns::debug::formatDuration(afterRecv - afterSend));
 
-        std::string rdata = response.getRdata();
+        // parse the reply in place, the ack is in the first answer
+        rdata.clear();
+        if(response.parse(buffer, received > 0 ? static_cast<size_t>(received) : 0) && response.answerCount() > 0)
+            response.answer(0).copyRdata(rdata);
 
         if(rdata.contains(m_secretKeyAck))  
         {
             if(!m_msgQueue["serv"].empty())
             {
-                dns::debug::log("Client::sendMessage", "Server acknowledged fragment, dequeuing");
+                DNS_LOG(Debug, "Client::sendMessage", "Server acknowledged fragment, dequeuing");
                 m_msgQueue["serv"].pop();  // now safe to remove$
+                std::lock_guard<std::mutex> lock(m_mutex);
+                TransferReport report;
+                if(noteFragmentDone("serv", report))
+                    reports.push_back(report);
             }
+            // move on to the next queued message once this one is out
+            splitNextMessage();
         }
         else
         {
-            dns::debug::log("Client::sendMessage", "Server did not ACK, fragment remains queued");
+            DNS_LOG(Debug, "Client::sendMessage", "Server did not ACK, fragment remains queued");
         }
 
         std::string rdataPreview = rdata.substr(0, 60);
         if(rdata.size() > rdataPreview.size())
             rdataPreview += "...";
-        dns::debug::log( "Client::sendMessage", "Received RDATA length=" + std::to_string(static_cast<unsigned long long>(rdata.size())) + " preview='" + rdataPreview + "'");
+        DNS_LOG(Debug,  "Client::sendMessage", "Received RDATA length=" + std::to_string(static_cast<unsigned long long>(rdata.size())) + " preview='" + rdataPreview + "'");
 
         auto afterHandle = std::chrono::steady_clock::now();
-        dns::debug::log( "Client::sendMessage", "Response handling completed in " + dns::debug::formatDuration(afterHandle - afterRecv) + "; fragments remaining=" + std::to_string(static_cast<unsigned long long>(m_msgQueue["serv"].size())) +", awaiting more=" + (m_moreMsgToGet ? std::string("true") : std::string("false")));
+        DNS_LOG(Debug,  "Client::sendMessage", "Response handling completed in " + dns::debug::formatDuration(afterHandle - afterRecv) + "; fragments remaining=" + std::to_string(static_cast<unsigned long long>(m_msgQueue["serv"].size())) +", awaiting more=" + (m_moreMsgToGet ? std::string("true") : std::string("false")));
 
-        dns::debug::log("Client::sendMessage", "Applying inter-query delay of 100 ms to avoid flooding");
+        DNS_LOG(Debug, "Client::sendMessage", "Applying inter-query delay of 100 ms to avoid flooding");
       
          // TODO make it configurable - Resolvers usually accept ~5–20 qps per client without rate-limiting. Above that, some will throttle or blacklist.
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
-        dns::debug::log( "Client::sendMessage", "Iteration " + std::to_string(iteration) + " total time " + dns::debug::formatDuration(std::chrono::steady_clock::now() - iterationStart));
+        DNS_LOG(Debug,  "Client::sendMessage", "Iteration " + std::to_string(iteration) + " total time " + dns::debug::formatDuration(std::chrono::steady_clock::now() - iterationStart));
     }
 
-    dns::debug::log( "Client::sendMessage", "Transmission loop completed after " + dns::debug::formatDuration(std::chrono::steady_clock::now() - sessionStart) + "; remaining fragments=" + std::to_string(static_cast<unsigned long long>(m_msgQueue.size())) + ", awaiting more=" + (m_moreMsgToGet ? std::string("true") : std::string("false")));
+    DNS_LOG(Debug,  "Client::sendMessage", "Transmission loop completed after " + dns::debug::formatDuration(std::chrono::steady_clock::now() - sessionStart) + "; remaining fragments=" + std::to_string(static_cast<unsigned long long>(m_msgQueue.size())) + ", awaiting more=" + (m_moreMsgToGet ? std::string("true") : std::string("false")));
 
 #ifdef __linux__
     close(sockfd);
@@ -278,7 +396,9 @@ void Client::sendMessage(const std::string& msg)
     WSACleanup();
 #endif
 
-    dns::debug::log("Client::sendMessage", "Socket closed");
+    DNS_LOG(Info, "Client::sendMessage", "Socket closed");
+
+    return reports;
 }
 
 /**
@@ -297,13 +417,18 @@ void Client::sendMessage(const std::string& msg)
  *      are expected (`m_moreMsgToGet`):
  *        - Increment iteration counter and log state.
  *        - Build the query name (QNAME) starting with a control keyword
- *          (`m_secretKeyClientAskData`) to signal a data request, followed by
- *          the configured domain (`m_domainToResolve`).
- *        - Encode the query as a TXT request and send it with sendto().
+ *          (`m_secretKeyClientAskData`, followed by the downstream codec tag
+ *          unless it is hex) to signal a data request, followed by the
+ *          configured domain (`m_domainToResolve`).
+ *        - Encode the query as a TXT (or NULL) request, advertising
+ *          m_ednsUdpSize with EDNS0 (see setEdnsUdpSize), and send it with
+ *          sendto().
  *        - Wait for a response using select() with a 10-second timeout.
- *        - If data is received, decode the DNS response, extract the RDATA,
- *          and log a preview.
- *        - Pass the RDATA to handleDataReceived() for JSON decoding and
+ *        - If data is received, parse the DNS response in place with a
+ *          ResponseView and, for each of its answer records (the server
+ *          packs as many fragments as fit), copy the RDATA into a string
+ *          reused across iterations, log a preview and pass it to
+ *          handleDataReceived() with the downstream codec for decoding and
  *          fragment reassembly.
  *        - Sleep 100 ms between queries to avoid overloading the resolver.
  *   5. Once all fragments are received, call getMsg() to retrieve the complete
@@ -311,6 +436,10 @@ void Client::sendMessage(const std::string& msg)
  *   6. Log transmission statistics, close the socket (platform-specific), and
  *      return the final message.
  *
+ * @param report  If not null, receives the timing of the returned message
+ *                (see TransferReport); its latency starts at the server's
+ *                enqueue time when the server timestamps its fragments.
+ *
  * @return std::string
  *         The fully reassembled message received from the DNS server,
  *         or an empty string if no complete message was available.
@@ -318,13 +447,13 @@ void Client::sendMessage(const std::string& msg)
  * @note
  * - This method uses a beacon-style query (`m_secretKeyClientAskData`) to
  *   request pending data from the server.
- * - Responses are expected to be JSON-encoded, hex-transmitted fragments
- *   carried in TXT records.
+ * - Responses are expected to be JSON-encoded fragments carried in TXT (or
+ *   NULL) records, encoded with the codec chosen by setDownstreamCodec().
  * - The inter-query delay (100 ms) is fixed but should be configurable
  *   to tune throughput vs. stealth.
  * - Logging provides detailed timing and queue state information for debugging.
  */
-std::string Client::requestMessage()
+std::string Client::requestMessage(TransferReport* report)
 {
     char buffer[BUFFER_SIZE];
     int nbytes = 0;
@@ -336,7 +465,7 @@ std::string Client::requestMessage()
     query.setNsCount(0);
     query.setArCount(0);
 
-    dns::debug::log("Client::requestMessage", "Preparing transmission to DNS server " + m_dnsServerAdd + ":" + std::to_string(m_port));
+    DNS_LOG(Debug, "Client::requestMessage", "Preparing transmission to DNS server " + m_dnsServerAdd + ":" + std::to_string(m_port));
 
     struct sockaddr_in serv_addr;
     fd_set read_fds;
@@ -356,17 +485,21 @@ std::string Client::requestMessage()
     serv_addr.sin_addr.s_addr = inet_addr( m_dnsServerAdd.c_str() );
 #endif
 
-    dns::debug::log("Client::requestMessage", "UDP socket created; attempting connection test via connect()");
+    DNS_LOG(Debug, "Client::requestMessage", "UDP socket created; attempting connection test via connect()");
 
     if (connect(sockfd, (struct sockaddr*) &serv_addr, sizeof(serv_addr)) < 0)
     {
-        dns::debug::log("Client::requestMessage", "connect() failed; continuing with sendto/recvfrom");
+        DNS_LOG(Warn, "Client::requestMessage", "connect() failed; continuing with sendto/recvfrom");
     }
     else
     {
-        dns::debug::log("Client::requestMessage", "connect() succeeded for diagnostic connection check");
+        DNS_LOG(Debug, "Client::requestMessage", "connect() succeeded for diagnostic connection check");
     }
 
+    // reply parsed in place, and the RDATA of its answers, reused across iterations
+    ResponseView response;
+    std::string rdata;
+
     size_t iteration = 0;
     auto sessionStart = std::chrono::steady_clock::now();
 
@@ -375,39 +508,42 @@ std::string Client::requestMessage()
     {
         ++iteration;
         auto iterationStart = std::chrono::steady_clock::now();
-        dns::debug::log( "Client::requestMessage", "Iteration " + std::to_string(iteration) + ": awaiting more=" + (m_moreMsgToGet ? std::string("true") : std::string("false")));
+        DNS_LOG(Debug,  "Client::requestMessage", "Iteration " + std::to_string(iteration) + ": awaiting more=" + (m_moreMsgToGet ? std::string("true") : std::string("false")));
 
-        // qname transmit our identity
+        // qname transmit our identity and the downstream codec we want
         std::string qname;
         qname = m_secretKeyClientAskData;
+        if(m_downstreamCodec != Codec::Hex)
+            qname += codecTag(m_downstreamCodec);
         qname += ".";
         qname += generateRandomString(8); // avoid caching
         qname += ".";
 
-        dns::debug::log("Client::requestMessage", "issuing message request with qname '" + qname + "'");
+        DNS_LOG(Debug, "Client::requestMessage", "issuing message request with qname '" + qname + "'");
     
         // we add the domain to resolve to ensure we talk to the server
         qname += m_domainToResolve;
         query.setQName(qname);
-        // TXT record
-        query.setQType(16);
+        // TXT record, or NULL if requested
+        query.setQType(m_downstreamType);
         query.setQClass(1);
+        query.setEdnsUdpSize(m_ednsUdpSize);
 
-        nbytes = query.code(buffer);
+        nbytes = query.code(buffer, BUFFER_SIZE);
 
-        dns::debug::log( "Client::requestMessage", "Encoded query length=" + std::to_string(nbytes) + " bytes for QNAME '" + qname + "'");
+        DNS_LOG(Debug,  "Client::requestMessage", "Encoded query length=" + std::to_string(nbytes) + " bytes for QNAME '" + qname + "'");
 
         // send udp datza
         int t_len = sizeof(serv_addr);
         int req = sendto(sockfd, buffer, nbytes, 0, (struct sockaddr*) &serv_addr, t_len);
         if(req < 1)
         {
-            dns::debug::log("Client::requestMessage", "sendto() failed with return value " + std::to_string(req));
+            DNS_LOG(Error, "Client::requestMessage", "sendto() failed with return value " + std::to_string(req));
             break;
         }
 
         auto afterSend = std::chrono::steady_clock::now();
-        dns::debug::log( "Client::requestMessage", "Sent " + std::to_string(req) + " bytes to " + m_dnsServerAdd + ":" + std::to_string(m_port) + " (" + dns::debug::formatDuration(afterSend - iterationStart) + " since iteration start)");
+        DNS_LOG(Debug,  "Client::requestMessage", "Sent " + std::to_string(req) + " bytes to " + m_dnsServerAdd + ":" + std::to_string(m_port) + " (" + dns::debug::formatDuration(afterSend - iterationStart) + " since iteration start)");
 
         // wait for the replay
         FD_SET(sockfd, &read_fds);
@@ -423,12 +559,12 @@ std::string Client::requestMessage()
             if (selection != -1)
             {
                 FD_CLR(sockfd, &read_fds);
-                dns::debug::log( "Client::requestMessage", "select() timeout after " + dns::debug::formatDuration(afterSelect - afterSend));
+                DNS_LOG(Debug,  "Client::requestMessage", "select() timeout after " + dns::debug::formatDuration(afterSelect - afterSend));
                 break;
             }
             else
             {
-                dns::debug::log("Client::requestMessage", "select() returned error after " + dns::debug::formatDuration(afterSelect - afterSend));
+                DNS_LOG(Error, "Client::requestMessage", "select() returned error after " + dns::debug::formatDuration(afterSelect - afterSend));
                 break;
             }
         }
@@ -441,38 +577,42 @@ std::string Client::requestMessage()
 
         auto afterRecv = std::chrono::steady_clock::now();
 
-        dns::debug::log( "Client::requestMessage", "recvfrom() returned " + std::to_string(received) + " bytes after " + dns::debug::formatDuration(afterRecv - afterSend));
+        DNS_LOG(Debug,  "Client::requestMessage", "recvfrom() returned " + std::to_string(received) + " bytes after " + dns::debug::formatDuration(afterRecv - afterSend));
 
         // all messages are part of the final payload that need to be put together
-        // decode extract the data using parse_rdata and the record type received
-        Response response;
-        response.decode(buffer, received);
+        // parse the reply in place and extract the data of each answer
+        if(!response.parse(buffer, received > 0 ? static_cast<size_t>(received) : 0))
+            DNS_LOG(Warn, "Client::requestMessage", "Malformed response; keeping the answers read");
 
-        std::string rdata = response.getRdata();
+        // a response may pack several fragments, one per answer record
+        for(size_t i = 0; i < response.answerCount(); ++i)
+        {
+            response.answer(i).copyRdata(rdata);
 
-        std::string rdataPreview = rdata.substr(0, 60);
-        if(rdata.size() > rdataPreview.size())
-            rdataPreview += "...";
-        dns::debug::log( "Client::requestMessage", "Received RDATA length=" + std::to_string(static_cast<unsigned long long>(rdata.size())) + " preview='" + rdataPreview + "'");
-        
-        // reassemble a message from the data extracted from the dns packet
-        handleDataReceived(rdata, "serv");
+            std::string rdataPreview = rdata.substr(0, 60);
+            if(rdata.size() > rdataPreview.size())
+                rdataPreview += "...";
+            DNS_LOG(Debug,  "Client::requestMessage", "Received RDATA length=" + std::to_string(static_cast<unsigned long long>(rdata.size())) + " preview='" + rdataPreview + "'");
+
+            // reassemble a message from the data extracted from the dns packet
+            handleDataReceived(rdata, "serv", m_downstreamCodec);
+        }
 
         auto afterHandle = std::chrono::steady_clock::now();
-        dns::debug::log( "Client::requestMessage", "Response handling completed in " + dns::debug::formatDuration(afterHandle - afterRecv) + "; fragments remaining=" + std::to_string(static_cast<unsigned long long>(m_msgQueue.size())) +", awaiting more=" + (m_moreMsgToGet ? std::string("true") : std::string("false")));
+        DNS_LOG(Debug,  "Client::requestMessage", "Response handling completed in " + dns::debug::formatDuration(afterHandle - afterRecv) + "; fragments remaining=" + std::to_string(static_cast<unsigned long long>(m_msgQueue.size())) +", awaiting more=" + (m_moreMsgToGet ? std::string("true") : std::string("false")));
 
-        dns::debug::log("Client::requestMessage", "Applying inter-query delay of 100 ms to avoid flooding");
+        DNS_LOG(Debug, "Client::requestMessage", "Applying inter-query delay of 100 ms to avoid flooding");
       
          // TODO make it configurable - Resolvers usually accept ~5–20 qps per client without rate-limiting. Above that, some will throttle or blacklist.
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
-        dns::debug::log( "Client::requestMessage", "Iteration " + std::to_string(iteration) + " total time " + dns::debug::formatDuration(std::chrono::steady_clock::now() - iterationStart));
+        DNS_LOG(Debug,  "Client::requestMessage", "Iteration " + std::to_string(iteration) + " total time " + dns::debug::formatDuration(std::chrono::steady_clock::now() - iterationStart));
     }
     while(m_moreMsgToGet);
 
-    auto [clientId, msg] = getMsg();
+    auto [clientId, msg] = getMsg(report);
 
-    dns::debug::log( "Client::requestMessage", "Transmission loop completed after " + dns::debug::formatDuration(std::chrono::steady_clock::now() - sessionStart) + "; remaining fragments=" + std::to_string(static_cast<unsigned long long>(m_msgQueue.size())) + ", awaiting more=" + (m_moreMsgToGet ? std::string("true") : std::string("false")));
+    DNS_LOG(Debug,  "Client::requestMessage", "Transmission loop completed after " + dns::debug::formatDuration(std::chrono::steady_clock::now() - sessionStart) + "; remaining fragments=" + std::to_string(static_cast<unsigned long long>(m_msgQueue.size())) + ", awaiting more=" + (m_moreMsgToGet ? std::string("true") : std::string("false")));
 
 #ifdef __linux__
     close(sockfd);
@@ -481,7 +621,7 @@ std::string Client::requestMessage()
     WSACleanup();
 #endif
 
-    dns::debug::log("Client::requestMessage", "Socket closed");
+    DNS_LOG(Info, "Client::requestMessage", "Socket closed");
 
     return msg;
 }
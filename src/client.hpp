@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <deque>
 #include <iostream>
 #include <queue>
 #include <vector>
@@ -35,17 +36,40 @@ public:
     Client(const std::string& dnsServerAdd, const std::string& domainToResolve, int port = 53);
     ~Client();
 
-    void sendMessage(const std::string& msg);
-    std::string requestMessage();
+    // Returns the timing of each message whose last fragment was
+    // acknowledged during the call.
+    std::vector<TransferReport> sendMessage(const std::string& msg);
+    // report, if not null, receives the timing of the returned message.
+    std::string requestMessage(TransferReport* report = nullptr);
+
+    // Codec used to encode fragments into QNAMEs by sendMessage.
+    void setUpstreamCodec(Codec codec);
+    // Codec and record type (TXT or NULL) requested by requestMessage.
+    void setDownstreamCodec(Codec codec, uint recordType = 16);
+    // UDP payload size advertised with EDNS0 in the ask queries, so the
+    // server can send larger fragments; 0 sends plain queries (512 bytes).
+    void setEdnsUdpSize(uint size);
+    // Timestamp the first fragment of each message sent, so the server can
+    // report its end-to-end latency (see TransferReport).
+    void setTransferTimestamps(bool enable);
     
 private:
     static const int BUFFER_SIZE = 4096;
 
+    void splitNextMessage();
+
     struct sockaddr_in m_address;
     int m_sockfd;
 
     std::string m_dnsServerAdd;
     int m_port;
+
+    Codec m_downstreamCodec;
+    uint m_downstreamType;
+    uint m_ednsUdpSize;
+    // messages refused by setMsg() while the outbound queue was full, oldest
+    // first, queued by splitNextMessage() once it drains
+    std::deque<std::string> m_heldMessages;
 };
 
 }
@@ -1,19 +1,161 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <ctime>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#include "binaryLog.hpp"
+
+/* Debug logging.
+ *
+ * Log through DNS_LOG(level, component, message): message is any expression
+ * convertible to std::string, and it is only evaluated when the build has
+ * DNS_ENABLE_LOGGING and the runtime level and component filters let the
+ * line through. A disabled call costs a load and a compare, and nothing at
+ * all without DNS_ENABLE_LOGGING, so per-packet paths can log freely:
+ *
+ *     DNS_LOG(Debug, "Server::run", "Received " + std::to_string(n) + " bytes");
+ *
+ * Components are "Class::method" strings; setComponents() keeps only those
+ * starting with one of the given prefixes ("Server", "Dns::handleDataReceived").
+ *
+ * On per-packet paths, DNS_LOG_EVENT(level, component, format, args...)
+ * takes a "{}" format string and one or more numbers or strings instead.
+ * With a binary log running (startBinaryLog() in binaryLog.hpp) the
+ * arguments are copied raw into a per-thread ring and formatted offline;
+ * otherwise the line is formatted and printed as DNS_LOG does. DNS_LOG lines
+ * go to the binary log as well, already formatted.
+ */
+#define DNS_LOG(level, component, message)                                            \
+    do                                                                                \
+    {                                                                                 \
+        if (::dns::debug::enabled(::dns::debug::Level::level, component))             \
+            ::dns::debug::write(::dns::debug::Level::level, component, (message));    \
+    } while (0)
+
+#define DNS_LOG_EVENT(level, component, format, ...)                                  \
+    do                                                                                \
+    {                                                                                 \
+        if (::dns::debug::enabled(::dns::debug::Level::level, component))             \
+        {                                                                             \
+            static ::dns::debug::LogSite dnsLogSite{                                  \
+                component, format, static_cast<int>(::dns::debug::Level::level)};     \
+            ::dns::debug::logEvent(dnsLogSite, __VA_ARGS__);                          \
+        }                                                                             \
+    } while (0)
+
 
 namespace dns
 {
 namespace debug
 {
-#if defined(DNS_ENABLE_LOGGING)
 
+enum class Level { Error = 0, Warn, Info, Debug, Trace };
+
+#if defined(DNS_ENABLE_LOGGING)
 inline constexpr bool kEnabled = true;
+#else
+inline constexpr bool kEnabled = false;
+#endif
+
+namespace detail
+{
+inline std::atomic<int> level{static_cast<int>(Level::Debug)};
+inline std::atomic<bool> filtered{false};
+// components is only touched under componentsMutex; every setComponents()
+// bumps componentsGeneration so threads know their copy is stale
+inline std::mutex componentsMutex;
+inline std::vector<std::string> components;
+inline std::atomic<uint64_t> componentsGeneration{0};
+
+// The filter as this thread last copied it.
+struct ComponentsCache
+{
+    uint64_t generation = 0;
+    std::vector<std::string> prefixes;
+};
+
+inline ComponentsCache& componentsCache()
+{
+    thread_local ComponentsCache cache;
+    return cache;
+}
+}
+
+// Lines above level are dropped; Debug by default. Trace adds hex dumps of
+// every encoded message.
+inline void setLevel(Level level)
+{
+    detail::level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+inline Level level()
+{
+    return static_cast<Level>(detail::level.load(std::memory_order_relaxed));
+}
+
+// Keep only the components starting with one of prefixes; all of them when
+// prefixes is empty.
+inline void setComponents(const std::vector<std::string>& prefixes)
+{
+    std::lock_guard<std::mutex> lock(detail::componentsMutex);
+    detail::components = prefixes;
+    detail::componentsGeneration.fetch_add(1, std::memory_order_release);
+    detail::filtered.store(!prefixes.empty(), std::memory_order_release);
+}
+
+// Whether the runtime settings let a line of level from component through,
+// whether or not logging is compiled in. Component filters are matched
+// against a per-thread copy, refreshed under the mutex only after
+// setComponents() changed them, so logging threads do not contend.
+inline bool shouldLog(Level level, std::string_view component)
+{
+    if (static_cast<int>(level) > detail::level.load(std::memory_order_relaxed))
+        return false;
+    if (!detail::filtered.load(std::memory_order_acquire))
+        return true;
+
+    detail::ComponentsCache& cache = detail::componentsCache();
+    if (cache.generation != detail::componentsGeneration.load(std::memory_order_acquire))
+    {
+        std::lock_guard<std::mutex> lock(detail::componentsMutex);
+        cache.prefixes = detail::components;
+        cache.generation = detail::componentsGeneration.load(std::memory_order_relaxed);
+    }
+
+    for (const std::string& prefix : cache.prefixes)
+    {
+        if (component.substr(0, prefix.size()) == prefix)
+            return true;
+    }
+    return false;
+}
+
+inline bool enabled(Level level, std::string_view component)
+{
+    return kEnabled && shouldLog(level, component);
+}
+
+inline const char* levelName(Level level)
+{
+    switch (level)
+    {
+        case Level::Error: return "error";
+        case Level::Warn:  return "warn";
+        case Level::Info:  return "info";
+        case Level::Debug: return "debug";
+        case Level::Trace: return "trace";
+    }
+    return "?";
+}
 
 inline std::string timestamp()
 {
@@ -48,49 +190,57 @@ inline std::string formatDuration(std::chrono::steady_clock::duration duration)
     return oss.str();
 }
 
-inline void log(const std::string& component, const std::string& message)
+inline int64_t microseconds(std::chrono::steady_clock::duration duration)
 {
-    std::cout << '[' << timestamp() << "] [" << component << "] " << message << std::endl;
+    return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
 }
 
-inline void logDuration(const std::string& component,
-                        const std::string& activity,
-                        std::chrono::steady_clock::duration duration)
+// Time point for durations that are only logged: a clock read with
+// DNS_ENABLE_LOGGING, nothing without.
+inline std::chrono::steady_clock::time_point now()
 {
-    log(component, activity + " took " + formatDuration(duration));
+    if constexpr (kEnabled)
+        return std::chrono::steady_clock::now();
+    else
+        return {};
 }
 
-#else
-
-inline constexpr bool kEnabled = false;
-
-inline std::string timestamp()
+// Print a line unconditionally, or add it to the binary log when one is
+// running; DNS_LOG checks enabled() first.
+inline void write(Level level, std::string_view component, const std::string& message)
 {
-    return {};
-}
-
-inline std::string formatDuration(std::chrono::steady_clock::duration duration)
-{
-    (void)duration;
-    return {};
+    if (detail::binaryLogActive.load(std::memory_order_acquire))
+    {
+        // the component is the first argument of these sites
+        static LogSite textSites[] = {
+            {nullptr, "{}", static_cast<int>(Level::Error)},
+            {nullptr, "{}", static_cast<int>(Level::Warn)},
+            {nullptr, "{}", static_cast<int>(Level::Info)},
+            {nullptr, "{}", static_cast<int>(Level::Debug)},
+            {nullptr, "{}", static_cast<int>(Level::Trace)},
+        };
+        logEvent(textSites[static_cast<int>(level)], component, message);
+        return;
+    }
+
+    std::cout << '[' << timestamp() << "] [" << levelName(level) << "] [" << component << "] "
+              << message << std::endl;
 }
 
+// Eager variants, for callers outside the library: the message is built
+// before the call whether or not it is printed.
 inline void log(const std::string& component, const std::string& message)
 {
-    (void)component;
-    (void)message;
+    if (enabled(Level::Debug, component))
+        write(Level::Debug, component, message);
 }
 
 inline void logDuration(const std::string& component,
                         const std::string& activity,
                         std::chrono::steady_clock::duration duration)
 {
-    (void)component;
-    (void)activity;
-    (void)duration;
+    DNS_LOG(Debug, component, activity + " took " + formatDuration(duration));
 }
 
-#endif
 } // namespace debug
 } // namespace dns
-
@@ -4,9 +4,9 @@
 
 #include <algorithm>
 #include <cctype>
+#include <random>
 #include <string_view>
 
-#include "nlohmann/json.hpp"
 #include "dns.hpp"
 #include "debugLog.hpp"
 
@@ -14,20 +14,29 @@
 using namespace std;
 using namespace dns;
 
-using json = nlohmann::json;
-
 
 Dns::Dns(const std::string& domain, const std::string& id)
     : m_domainToResolve(id + domain)
     , m_maxMessageSize(0)
+    , m_codec(Codec::Hex)
+    , m_nextSession(0)
+    , m_highWatermark(DEFAULT_HIGH_WATERMARK)
+    , m_lowWatermark(DEFAULT_LOW_WATERMARK)
+    , m_transferTimestamps(false)
     , m_moreMsgToGet(false)
+    , m_observer(nullptr)
+    , m_observerCalls(0)
 {
     m_maxMessageSize = getMaxMsgLen(m_domainToResolve);
 
-    dns::debug::log("Dns",
-                    "Initialized for domain '" + m_domainToResolve +
-                        "' with max payload size " +
-                        std::to_string(m_maxMessageSize) + " bytes");
+    // start at a random point so restarted peers do not reuse identifiers,
+    // while keeping the session varint on two bytes for a long time
+    m_nextSession = static_cast<uint32_t>(std::random_device{}() & 0x3FFF);
+
+    DNS_LOG(Info, "Dns",
+                  "Initialized for domain '" + m_domainToResolve +
+                      "' with max payload size " +
+                      std::to_string(m_maxMessageSize) + " bytes");
 }
 
 Dns::~Dns()
@@ -35,74 +44,220 @@ Dns::~Dns()
 }
 
 /**
- * @brief Store a message to be sent to a specific client.
+ * @brief Queue a message to be sent to a specific client.
  *
  * This function:
  *   - Locks the internal mutex (m_mutex) to ensure thread-safe access
  *     to the shared map of outgoing messages (m_msgToSend).
- *   - Associates the given message with the specified clientId
- *     in m_msgToSend (overwriting any previous pending message
- *     for that client).
+ *   - Refuses the message if the client's queue is flagged full, i.e. it
+ *     reached the high watermark and has not yet drained to the low one.
+ *   - Otherwise appends the message behind the ones already pending for
+ *     that client, and flags the queue full if it now holds at least
+ *     m_highWatermark bytes.
+ *
+ * A message larger than the high watermark is still accepted by an empty
+ * queue, so every message can eventually be sent.
  *
  * @param msg       The complete message to be queued for the client.
  * @param clientId  The identifier of the client who should receive the message.
+ *
+ * @return true if the message was queued, false if the client's queue is
+ *         full; the caller keeps ownership of the message and may retry once
+ *         waitForSendSpace() returns.
  */
 #undef min
-void Dns::setMsg(const std::string& msg, const std::string& clientId)
+bool Dns::setMsg(const std::string& msg, const std::string& clientId)
 {
-    dns::debug::log("Dns::setMsg",
-        "Preparing message of " + std::to_string(msg.size()) + " bytes" );
+    DNS_LOG(Debug, "Dns::setMsg",
+       "Preparing message of " + std::to_string(msg.size()) + " bytes" );
+
+    if(msg.empty())
+        return true;
 
     const std::lock_guard<std::mutex> lock(m_mutex);
 
-    m_msgToSend[clientId] = msg;
+    OutboundQueue& queue = m_msgToSend[clientId];
+    if(queue.full)
+    {
+        DNS_LOG(Warn, "Dns::setMsg",
+                      "Queue for client '" + clientId + "' is full (" +
+                          std::to_string(static_cast<unsigned long long>(queue.bytes)) +
+                          " bytes pending); message refused");
+        return false;
+    }
+
+    queue.messages.push_back({msg, TransferReport::Clock::now()});
+    queue.bytes += msg.size();
+    if(queue.bytes >= m_highWatermark)
+        queue.full = true;
+
+    return true;
+}
+
+
+// Register the observer notified by handleDataReceived, nullptr to remove it.
+// The observer is not owned; once this returns, no callback runs on the
+// previous one anymore, so it may be destroyed. Must not be called from a
+// callback.
+void Dns::setObserver(MessageObserver* observer)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_observer = observer;
+    m_observerIdle.wait(lock, [this] { return m_observerCalls == 0; });
+}
+
+
+MessageObserver* Dns::acquireObserver()
+{
+    if (m_observer)
+        ++m_observerCalls;
+    return m_observer;
+}
+
+
+void Dns::releaseObserver()
+{
+    std::unique_lock<std::mutex> lock = lockState();
+
+    if (--m_observerCalls == 0)
+        m_observerIdle.notify_all();
+}
+
+
+/**
+ * @brief Configure the byte watermarks of the outbound message queues.
+ *
+ * A queue stops accepting messages once it holds `high` bytes and accepts
+ * them again when splitPacket has taken it down to `low` bytes or less.
+ * `low` is clamped to `high`. Queues already flagged full keep waiting for
+ * the new low watermark.
+ */
+void Dns::setWatermarks(size_t high, size_t low)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_highWatermark = high;
+    m_lowWatermark = std::min(low, high);
+
+    for(auto& [clientId, queue] : m_msgToSend)
+    {
+        if(queue.full && queue.bytes <= m_lowWatermark)
+            queue.full = false;
+    }
+    m_sendSpaceAvailable.notify_all();
+}
+
+
+void Dns::setTransferTimestamps(bool enable)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_transferTimestamps = enable;
+}
+
+
+// Bytes of the messages queued for clientId that splitPacket has not taken yet.
+size_t Dns::pendingBytes(const std::string& clientId)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_msgToSend.find(clientId);
+    return it == m_msgToSend.end() ? 0 : it->second.bytes;
+}
+
+
+/**
+ * @brief Block until the client's outbound queue accepts messages again.
+ *
+ * Returns immediately if the queue is not full, otherwise waits for
+ * splitPacket to drain it to the low watermark or for the timeout to expire.
+ *
+ * @return true if setMsg() would accept a message for the client.
+ */
+bool Dns::waitForSendSpace(const std::string& clientId, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    return m_sendSpaceAvailable.wait_for(lock, timeout, [&] {
+        auto it = m_msgToSend.find(clientId);
+        return it == m_msgToSend.end() || !it->second.full;
+    });
 }
 
 /**
  * @brief Split and enqueue an outgoing message for a client into DNS-sized packets.
  *
- * This function takes the message prepared for a given client (m_msgToSend[clientId])
- * and breaks it into one or more fragments suitable for transmission via DNS responses.
+ * This function takes the oldest message queued for a given client
+ * (m_msgToSend[clientId]) and breaks it into one or more fragments suitable
+ * for transmission via DNS responses. Messages are split one at a time: the
+ * next one is only taken once the fragments of the previous one have all
+ * been sent, so queued bytes keep counting against the watermarks until
+ * they are actually on their way.
  * 
  * Steps:
- *   1. If there is no message for the client, return immediately.
- *   2. Determine the maximum allowed payload size (`maxMessageSize`) based on the
- *      DNS query type (A, AAAA, MX, CNAME, NS, PTR, TXT, ...). Some types have no
- *      payload capacity (set to 0), while others use `m_maxMessageSize`.
- *   3. Log the message size and generate a random session identifier to track
+ *   1. If fragments are still queued for the client, or there is no message
+ *      for the client, return immediately.
+ *   2. Pick the codec: the one negotiated by the client in m_clientCodec, or
+ *      m_codec. Determine the maximum allowed payload size (`maxMessageSize`)
+ *      based on the DNS query type (A, AAAA, MX, CNAME, NS, PTR, TXT, NULL, ...).
+ *      Some types have no payload capacity (set to 0), name types use
+ *      `m_maxMessageSize` and fall back to hex for binary codecs, while TXT,
+ *      NULL and other record types get a character budget converted to
+ *      payload bytes for the codec, so raw answers carry twice the data. The
+ *      budget is `rdataBudget` (less the TXT character-string length bytes)
+ *      when the caller knows the room left in the response, otherwise the
+ *      budget of a hex-encoded query name.
+ *      If the record type cannot carry data, leave the message queued for a
+ *      later query.
+ *   3. Log the message size and take the next session identifier to track
  *      all fragments belonging to this message.
- *   4. Serialize the message, session ID, and metadata into JSON (`packetJson`).
- *   5. If the serialized message exceeds the maximum payload size:
- *        - Compute the maximum fragment size (accounting for JSON overhead).
- *        - Split the message into chunks of that size.
- *        - For each chunk:
- *            * Insert metadata (`n` = total number of fragments, `k` = fragment index).
- *            * Convert the JSON fragment to hex.
- *            * Push the encoded fragment into the per-client queue (m_msgQueue[clientId]).
- *   6. If the message fits within one payload:
- *        - Encode the JSON as hex.
- *        - Push it into the client’s queue as a single fragment.
- *   7. Finally, clear m_msgToSend[clientId] since the message has been enqueued
- *      for transmission.
+ *   4. Compute the chunk size left once the binary fragment header (see
+ *      fragment.hpp) is accounted for, and the resulting fragment count.
+ *      If the header alone exceeds the payload size, leave the message
+ *      queued.
+ *   5. For each chunk:
+ *        - Write the header (session, index, count) followed by the chunk.
+ *        - Encode the fragment with the selected codec.
+ *        - Push the encoded fragment into the per-client queue (m_msgQueue[clientId]).
+ *   6. Finally, move the message from m_msgToSend[clientId] to the transfer
+ *      record of the client, where restartTransfer() can find it, and, if
+ *      that takes the queue down to the low watermark, clear its full flag
+ *      and wake producers blocked in waitForSendSpace().
  *
  * @param qType     The DNS query type (A, AAAA, MX, TXT, etc.), used to determine
  *                  the maximum payload size per packet.
  * @param clientId  The identifier of the client whose message is being fragmented
  *                  and queued.
+ * @param rdataBudget  Bytes of record data the response to the query can
+ *                  carry (see Server::responseRdataBudget), or 0 if
+ *                  unknown.
  *
  * @note Each message is tagged with a session ID so fragments can be reassembled
- *       on the receiving side. Messages are hex-encoded to fit safely into DNS
- *       records. The function modifies m_msgQueue and clears the pending message
- *       from m_msgToSend for the given client.
+ *       on the receiving side. Messages may hold arbitrary bytes; fragments
+ *       are hex, base32, base64 or raw encoded depending on the codec and the
+ *       record type. The function modifies m_msgQueue and pops the pending
+ *       message from m_msgToSend for the given client.
  */
 
-void Dns::splitPacket(int qType, const std::string& clientId)
+void Dns::splitPacket(int qType, const std::string& clientId, int rdataBudget)
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::unique_lock<std::mutex> lock = lockState();
+
+    auto queueIt = m_msgQueue.find(clientId);
+    if(queueIt != m_msgQueue.end() && !queueIt->second.empty())
+        return;
 
     auto it = m_msgToSend.find(clientId);
-    if(it == m_msgToSend.end() || it->second.empty())
+    if(it == m_msgToSend.end() || it->second.messages.empty())
         return;
+    OutboundQueue& pending = it->second;
+
+    // downstream codec negotiated by the client, if any
+    Codec codec = m_codec;
+    auto codecIt = m_clientCodec.find(clientId);
+    if(codecIt != m_clientCodec.end())
+        codec = codecIt->second;
 
     int maxMessageSize;
 
@@ -119,124 +274,218 @@ void Dns::splitPacket(int qType, const std::string& clientId)
             break;
         }
         case 15: // MX
-            maxMessageSize = m_maxMessageSize;
-            break;
         case 5:  // CNAME
         case 2:  // NS
         case 12: // PTR
+        {
+            // names only carry text-safe encodings
+            if(codec == Codec::Base64 || codec == Codec::Raw)
+                codec = Codec::Hex;
             maxMessageSize = m_maxMessageSize;
             break;
+        }
+        case 10: // NULL
         case 16: // TXT
         default:
-            maxMessageSize = m_maxMessageSize;
+        {
+            // record data is binary-safe: give every codec the character
+            // budget a hex fragment would use, or what the requester accepts
+            int encodedBudget = 2 * getMaxMsgLen(m_domainToResolve);
+            if(rdataBudget > 0)
+            {
+                // TXT data goes in character-strings of up to 255 bytes,
+                // each behind a length byte
+                encodedBudget = qType == 10 ? rdataBudget : rdataBudget - (rdataBudget + 255) / 256;
+            }
+            maxMessageSize = getPayloadCapacity(encodedBudget, codec);
             break;
+        }
     }
 
     if(maxMessageSize <= 0)
     {
-        dns::debug::log("Dns::splitPacket",
-                        "Query type " + std::to_string(qType) +
-                            " does not support payload transmission; dropping " +
-                            std::to_string(static_cast<unsigned long long>(it->second.size())) +
-                            " byte message for client '" + clientId + "'");
-        it->second.clear();
+        DNS_LOG(Debug, "Dns::splitPacket",
+                       "Query type " + std::to_string(qType) +
+                           " does not support payload transmission; keeping " +
+                           std::to_string(static_cast<unsigned long long>(pending.messages.front().data.size())) +
+                           " byte message queued for client '" + clientId + "'");
         return;
     }
 
-    dns::debug::log("Dns::splitPacket",
-                    "Preparing message of " + std::to_string(static_cast<unsigned long long>(it->second.size())) +
-                        " bytes for domain '" + m_domainToResolve + "'");
+    DNS_LOG(Debug, "Dns::splitPacket",
+                   "Preparing message of " + std::to_string(static_cast<unsigned long long>(pending.messages.front().data.size())) +
+                       " bytes for domain '" + m_domainToResolve + "'");
+
+    const std::string& msg = pending.messages.front().data;
+    const TransferReport::Clock::time_point enqueued = pending.messages.front().enqueued;
+
+    FragmentHeader header;
+    header.session = m_nextSession++;
+    header.enqueueTime = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        enqueued.time_since_epoch()).count());
+    // the first fragment carries the enqueue time, every chunk keeps room
+    // for it so they all have the same size
+    const int timestampSize = m_transferTimestamps ? static_cast<int>(FRAGMENT_TIMESTAMP_SIZE) : 0;
+
+    DNS_LOG(Debug, "Dns::splitPacket",
+                   "Using session identifier " + std::to_string(header.session));
+
+    // Find the fragment count: the chunk size depends on the size of the
+    // count and index varints, which depends on the count itself.
+    const int sessionSize = static_cast<int>(varintSize(header.session));
+    int countSize = 1;
+    int maxLength = 0;
+    size_t nbFragments = 0;
+    while (true)
+    {
+        maxLength = maxMessageSize - 1 - sessionSize - 2 * countSize - timestampSize;
+        if(maxLength <= 0)
+            break;
+        nbFragments = (msg.size() + maxLength - 1) / maxLength;
+        const int neededSize = static_cast<int>(varintSize(static_cast<uint32_t>(nbFragments)));
+        if(neededSize <= countSize)
+            break;
+        countSize = neededSize;
+    }
 
-    std::string sessionId = generateRandomString(2);
+    if(maxLength <= 0)
+    {
+        DNS_LOG(Warn, "Dns::splitPacket",
+                      "Fragment header exceeds maximum payload size (header=" +
+                          std::to_string(1 + sessionSize + 2 * countSize + timestampSize) +
+                          " bytes, capacity=" +
+                          std::to_string(maxMessageSize) +
+                          "); keeping message queued for client '" + clientId + "'");
+        return;
+    }
 
-    dns::debug::log("Dns::splitPacket",
-                    "Generated session identifier '" + sessionId + "'");
+    DNS_LOG(Debug, "Dns::splitPacket",
+                   "Fragmenting " + std::to_string(static_cast<unsigned long long>(msg.size())) +
+                       " bytes into " + std::to_string(nbFragments) +
+                       " fragment(s) with chunk capacity " +
+                       std::to_string(maxLength) + " bytes");
 
-    json packetJson;
-    packetJson["m"] = it->second;
-    packetJson["s"] = sessionId;
-    packetJson["n"] = 1;
-    packetJson["k"] = 0;
-    std::string packet = packetJson.dump();
+    header.count = static_cast<uint32_t>(nbFragments);
+    std::string packet;
+    packet.reserve(maxMessageSize);
 
-    if(packet.size() > maxMessageSize)
+    size_t startPos = 0;
+    for(size_t i = 0; i < nbFragments; ++i)
     {
-        std::vector<json> messages;
-        packetJson["m"] = "";
-        packetJson["n"] = 0;
-        packetJson["k"] = 0;
-        packet = packetJson.dump();
+        const size_t chunkSize = std::min<size_t>(maxLength, msg.size() - startPos);
+
+        header.index = static_cast<uint32_t>(i);
+        header.flags = (i == 0 && m_transferTimestamps) ? FRAGMENT_FLAG_TIMESTAMP : 0;
+        packet.clear();
+        encodeFragmentHeader(header, packet);
+        packet.append(msg, startPos, chunkSize);
+        startPos += chunkSize;
+
+        std::string msgEncoded = encodeFragmentData(packet, codec);
+        const size_t encodedSize = msgEncoded.size();
+        m_msgQueue[clientId].push(std::move(msgEncoded));
+
+        DNS_LOG_EVENT(Debug, "Dns::splitPacket",
+                      "Fragment {}/{} for session {} raw={} bytes encoded={} chars; queue size={}",
+                      i + 1, nbFragments, header.session, chunkSize, encodedSize,
+                      m_msgQueue[clientId].size());
+    }
 
-        int maxLength = maxMessageSize - static_cast<int>(packet.size());
-        if(maxLength <= 0)
-        {
-            dns::debug::log("Dns::splitPacket",
-                            "Message metadata exceeds maximum payload size (metadata=" +
-                                std::to_string(static_cast<unsigned long long>(packet.size())) +
-                                " bytes, capacity=" +
-                                std::to_string(maxMessageSize) +
-                                "); dropping message for client '" + clientId + "'");
-            it->second.clear();
-            return;
-        }
+    m_metrics.add(Counter::FragmentsOut, nbFragments);
+    m_metrics.add(Counter::MessagesOut);
+    m_metrics.adjust(Gauge::QueuedFragments, static_cast<int64_t>(nbFragments));
+
+    OutboundTransfer& transfer = m_transfers[clientId];
+    transfer = OutboundTransfer();
+    transfer.report.outbound = true;
+    transfer.report.session = header.session;
+    transfer.report.bytes = msg.size();
+    transfer.report.fragments = header.count;
+    transfer.report.enqueued = enqueued;
+    transfer.remaining = header.count;
+
+    pending.bytes -= msg.size();
+    transfer.message = std::move(pending.messages.front());
+    pending.messages.pop_front();
+    if(pending.full && pending.bytes <= m_lowWatermark)
+    {
+        pending.full = false;
+        m_sendSpaceAvailable.notify_all();
+    }
+}
 
-        size_t totalLen = it->second.length();
-        size_t startPos = 0;
 
-        dns::debug::log("Dns::splitPacket",
-                        "Message exceeds max payload size (" +
-                            std::to_string(packet.size()) + " > " +
-                            std::to_string(maxMessageSize) +
-                            "), fragmenting with chunk capacity " +
-                            std::to_string(maxLength) + " bytes");
-        while (startPos < totalLen)
-        {
-            size_t chunkSize = std::min<size_t>(maxLength, totalLen - startPos);
-            std::string tmp = it->second.substr(startPos, chunkSize);
-            packetJson["m"] = tmp;
-            messages.push_back(packetJson);
-            startPos += chunkSize;
-        }
+// A fragment of m_msgQueue[clientId] went on the wire: the first time for
+// the front fragment, a retransmission after that.
+void Dns::noteFragmentSent(const std::string& clientId)
+{
+    auto it = m_transfers.find(clientId);
+    if (it == m_transfers.end())
+        return;
 
-        size_t nbMaxMessage = messages.size();
-        dns::debug::log("Dns::splitPacket",
-                        "Enqueued " + std::to_string(nbMaxMessage) +
-                            " fragment(s) for session '" + sessionId + "'");
-        for(size_t i = 0; i < nbMaxMessage; ++i)
-        {
-            const std::string chunkData = messages[i]["m"].get<std::string>();
-            messages[i]["n"] = nbMaxMessage;
-            messages[i]["k"] = i;
-            std::string msgHex = stringToHex(messages[i].dump());
-            m_msgQueue[clientId].push(msgHex);
-
-            dns::debug::log(
-                "Dns::splitPacket",
-                "Fragment " + std::to_string(i + 1) + "/" +
-                    std::to_string(nbMaxMessage) + " for session '" +
-                    sessionId + "' raw=" + std::to_string(chunkData.size()) +
-                    " bytes encoded=" + std::to_string(msgHex.size()) +
-                    " hex chars; queue size=" +
-                    std::to_string(static_cast<unsigned long long>(
-                        m_msgQueue[clientId].size())));
-        }
-    }
-    else
-    {
-        std::string msgHex = stringToHex(packet);
-        m_msgQueue[clientId].push(msgHex);
-
-        dns::debug::log(
-            "Dns::splitPacket",
-            "Message fits in a single fragment for session '" + sessionId +
-                "' raw=" + std::to_string(static_cast<unsigned long long>(it->second.size())) + " bytes encoded=" +
-                std::to_string(msgHex.size()) +
-                " hex chars; queue size=" +
-                std::to_string(static_cast<unsigned long long>(
-                    m_msgQueue[clientId].size())));
-    }
+    OutboundTransfer& transfer = it->second;
+    if (transfer.frontSent)
+        ++transfer.report.retransmits;
+    transfer.frontSent = true;
+    if (transfer.report.firstSent == TransferReport::Clock::time_point())
+        transfer.report.firstSent = TransferReport::Clock::now();
+}
+
+
+/**
+ * @brief Account for the front fragment of m_msgQueue[clientId] being popped.
+ *
+ * The caller pops the fragment once it is acknowledged (client) or written
+ * into a response (server), with m_mutex held. When it was the last fragment
+ * of its message, the transfer is over: its report is completed with the
+ * time of the last acknowledgement and handed to the caller, which emits it
+ * once the lock is released.
+ *
+ * @return true if report was filled.
+ */
+bool Dns::noteFragmentDone(const std::string& clientId, TransferReport& report)
+{
+    m_metrics.adjust(Gauge::QueuedFragments, -1);
+
+    auto it = m_transfers.find(clientId);
+    if (it == m_transfers.end())
+        return false;
+
+    OutboundTransfer& transfer = it->second;
+    transfer.frontSent = false;
+    if (transfer.remaining > 0)
+        --transfer.remaining;
+    if (transfer.remaining > 0)
+        return false;
+
+    transfer.report.lastAcked = TransferReport::Clock::now();
+    report = transfer.report;
+    m_transfers.erase(it);
+    return true;
+}
+
+/**
+ * @brief Send the message of m_msgQueue[clientId] again from the start.
+ *
+ * Used when its fragments were cut for a larger response than the requester
+ * now accepts. The fragments already sent belong to a session the receiver
+ * will not complete; the next splitPacket() sizes the whole message for the
+ * current requester and reports it as a new transfer.
+ */
+void Dns::restartTransfer(const std::string& clientId)
+{
+    auto it = m_transfers.find(clientId);
+    if (it == m_transfers.end())
+        return;
 
-    it->second.clear();
+    std::queue<std::string>& fragments = m_msgQueue[clientId];
+    m_metrics.adjust(Gauge::QueuedFragments, -static_cast<int64_t>(fragments.size()));
+    fragments = std::queue<std::string>();
+
+    OutboundQueue& pending = m_msgToSend[clientId];
+    pending.bytes += it->second.message.data.size();
+    pending.messages.push_front(std::move(it->second.message));
+    m_transfers.erase(it);
 }
 
 /**
@@ -248,245 +497,457 @@ void Dns::splitPacket(int qType, const std::string& clientId)
  * Steps:
  *   1. If the RDATA matches a control record (client ask-data / keep-alive),
  *      ignore it and return.
- *   2. Remove all '.' characters (the payload is hex-encoded and transmitted
- *      across DNS labels).
- *   3. Decode the remaining hex string back into raw data.
- *   4. Validate that the data contains a terminating '}' to ensure JSON completeness.
- *      If not, discard it.
- *   5. Parse the JSON safely with exception handling. On parse failure, discard
- *      the fragment.
- *   6. Extract session identifier (`s`), fragment index (`k`), total fragment
- *      count (`n`), and the payload (`m`) from the JSON.
- *   7. Insert or update the corresponding `Packet` entry in
- *      `m_msgReceived[clientId][session]`:
- *        - initialize session/client identifiers if needed,
- *        - append the payload to the accumulated message,
- *        - mark `isFull` true if this was the last fragment (k == n-1).
- *   8. Log fragment progress, including accumulated size and completeness.
- *   9. Recalculate `m_moreMsgToGet`: set to true if at least one fragment for
- *      this client is still incomplete.
+ *   2. For hex and base32, remove all '.' characters (the payload is
+ *      transmitted across DNS labels).
+ *   3. Decode the remaining string back into raw data; base32 data is
+ *      recognised by its leading BASE32_TAG, hex otherwise. Base64 and raw
+ *      data are decoded according to `codec`.
+ *   4. Parse the binary fragment header (decodeFragment). If the version,
+ *      varints or index/count are invalid, discard the fragment.
+ *   5. Take the session identifier, fragment index (`k`), total fragment
+ *      count (`n`) from the header; the payload is everything after it.
+ *   6. Add the payload to the corresponding `Packet` entry in
+ *      `m_msgReceived[clientId].sessions[session]` (see Packet::addFragment):
+ *        - the payload is copied once, straight to its final offset,
+ *        - duplicates and fragments inconsistent with the session are
+ *          ignored,
+ *        - the packet is full once every index has been received.
+ *      Fragments of one of the last sessions completed by the client (late
+ *      retransmissions) are ignored. A client seen for the first time while
+ *      MAX_INBOUND_CLIENTS are tracked first makes room for itself (see
+ *      evictInboundClients).
+ *      Each session keeps the time its first fragment arrived, the
+ *      duplicates received and, from a fragment flagged
+ *      FRAGMENT_FLAG_TIMESTAMP, the time the sender queued the message.
+ *   7. When the packet is full, move its data and timing to the client's ready queue
+ *      (`m_msgReady`), append the client to the round-robin order
+ *      (`m_clientsReady`) if it had no ready message, and erase the session.
+ *      Older sessions of the client still incomplete were abandoned by the
+ *      sender (see Dns::restartTransfer) and are erased too; their late
+ *      fragments are then ignored like those of completed sessions.
+ *   8. Recalculate `m_moreMsgToGet`: true if this client still has sessions
+ *      being reassembled. Complete sessions never stay in `m_msgReceived`,
+ *      so this is O(1).
+ *   9. Once the lock is released, wake the threads blocked in waitForMsg()
+ *      if a message completed, then report the new fragment and the
+ *      completed message, if any, with its TransferReport, to the
+ *      MessageObserver.
+ *  10. Log fragment progress, including accumulated size and completeness.
  *
- * @param rdata     The raw RDATA string (hex-encoded fragments with optional dots).
+ * @param rdata     The raw RDATA string (encoded fragments with optional dots).
  * @param clientId  The identifier of the client that sent the data.
+ * @param codec     Codec the data was encoded with. Codec::Hex (default) also
+ *                  accepts tagged base32 data.
  *
- * @note This function updates `m_msgReceived` (per-client session map) and sets
- *       `m_moreMsgToGet` accordingly. Fragments are expected to arrive in order
- *       but will still be accumulated until the final fragment marks completion.
+ * @note This function updates `m_msgReceived` (per-client sessions), the
+ *       ready queues, and sets `m_moreMsgToGet` accordingly. Fragments may arrive in any order; each
+ *       one costs O(1) regardless of the message size.
  */
-void Dns::handleDataReceived(const std::string& rdata, const std::string& clientId)
+void Dns::handleDataReceived(const std::string& rdata, const std::string& clientId, Codec codec)
 {
     std::string msg = rdata;
 
     // no data was transmited we use the word
     if(startsWith(rdata, m_secretKeyClientAskData) || startsWith(rdata, m_secretKeyClientKeepAlive))
     {
-        dns::debug::log("Dns::handleResponse",
-                        "Ignoring control record '" + rdata + "'");
+        DNS_LOG_EVENT(Debug, "Dns::handleResponse", "Ignoring control record '{}'", rdata);
         return;
     }
 
-    dns::debug::log("Dns::handleResponse",
-                    "Processing RDATA of length " +
-                        std::to_string(rdata.size()));
-
-    // Remove all the dots - only hex data is transmited, no .
-    auto noDot = std::remove(msg.begin(), msg.end(), '.');
-    msg.erase(noDot, msg.end());
+    DNS_LOG_EVENT(Debug, "Dns::handleResponse", "Processing RDATA of length {}", rdata.size());
 
-    // decode hex
-    std::string msgReceived = hexToString(msg);
-
-    // check validity of json
-    size_t lastBracePos = msgReceived.find_last_of('}');
-    if (lastBracePos == std::string::npos)
+    // Remove all the dots - only hex or base32 data is transmited in names, no .
+    // Raw and base64 data come from record data and are left untouched.
+    if(codec == Codec::Hex || codec == Codec::Base32)
     {
-        dns::debug::log("Dns::handleResponse",
-                        "Discarded response missing JSON terminator; raw='" +
-                            msgReceived + "'");
-        return;
+        auto noDot = std::remove(msg.begin(), msg.end(), '.');
+        msg.erase(noDot, msg.end());
     }
 
-    json packetJson;
-    try
-    {
-        packetJson = json::parse(msgReceived.substr(0, lastBracePos+1));
-    }
-    catch (const std::exception& e)
-    {
-        dns::debug::log(
-            "Dns::handleResponse",
-            std::string("Failed to parse JSON fragment: ") + e.what());
-        return;
-    }
-    catch (...)
+    // decode hex or base32 depending on the tag, base64 and raw as negotiated
+    std::string msgReceived = decodeFragmentData(msg, codec);
+
+    // parse the binary header, the payload is a view into msgReceived
+    FragmentHeader header;
+    std::string_view payloadView;
+    if (!decodeFragment(msgReceived, header, payloadView))
     {
-        dns::debug::log("Dns::handleResponse",
-                        "Failed to parse JSON fragment: unknown error");
+        m_metrics.add(Counter::FragmentsDiscarded);
+        DNS_LOG(Warn, "Dns::handleResponse",
+                      "Discarded fragment with invalid header (" +
+                          std::to_string(msgReceived.size()) + " bytes)");
         return;
     }
 
-    std::string session = packetJson["s"];
-
-    int k = packetJson["k"].get<int>();
-    int n = packetJson["n"].get<int>();
-
-    const std::string payload = packetJson["m"].get<std::string>();
+    const uint32_t session = header.session;
+    const int k = static_cast<int>(header.index);
+    const int n = static_cast<int>(header.count);
 
     size_t accumulatedSize = 0;
     bool packetFull = false;
     bool morePending = false;
+    bool fragmentAdded = false;
+    FragmentProgress progress;
+    TransferReport report;
+    MessageObserver* observer = nullptr;
+    const TransferReport::Clock::time_point now = TransferReport::Clock::now();
 
     {
-        std::lock_guard<std::mutex> lock(m_mutex);
+        std::unique_lock<std::mutex> lock = lockState();
 
-        auto& packet = m_msgReceived[clientId][session];
-        if(packet.id.empty())
-            packet.id = session;
-        if(packet.clientId.empty() && !clientId.empty())
-            packet.clientId = clientId;
-
-        if (packet.expectedCount < 0)
+        auto clientIt = m_msgReceived.find(clientId);
+        if (clientIt == m_msgReceived.end())
         {
-            packet.expectedCount = n;
+            if (m_msgReceived.size() >= MAX_INBOUND_CLIENTS)
+                evictInboundClients(now);
+            clientIt = m_msgReceived.try_emplace(clientId).first;
         }
-        else if (packet.expectedCount != n)
+        InboundClient& inbound = clientIt->second;
+        inbound.lastActive = now;
+        auto& sessions = inbound.sessions;
+        auto& completed = inbound.completed;
+        if (sessions.find(session) == sessions.end() &&
+            std::find(completed.begin(), completed.end(), session) != completed.end())
         {
-            dns::debug::log(
+            DNS_LOG(Debug,
                 "Dns::handleResponse",
-                "Fragment count mismatch for session '" + session +
-                    "' (expected " + std::to_string(packet.expectedCount) +
-                    ", got " + std::to_string(n) + ")");
-            packet.expectedCount = n;
+                "Ignoring fragment " + std::to_string(k) +
+                    " for already completed session " + std::to_string(session));
+            m_moreMsgToGet = !sessions.empty();
+            return;
         }
 
-        packet.fragments[k] = payload;
+        auto [packetIt, newSession] = sessions.try_emplace(session);
+        auto& packet = packetIt->second.packet;
+        auto& timing = packetIt->second.report;
+        if (newSession)
+        {
+            m_metrics.adjust(Gauge::Sessions, 1);
+            timing.session = session;
+            timing.firstReceived = now;
+        }
+        if (header.flags & FRAGMENT_FLAG_TIMESTAMP)
+            timing.enqueued = TransferReport::Clock::time_point(std::chrono::duration_cast<TransferReport::Clock::duration>(
+                std::chrono::microseconds(header.enqueueTime)));
 
-        accumulatedSize = 0;
-        for (const auto& fragment : packet.fragments)
+        const Packet::AddResult result = packet.addFragment(header, payloadView);
+        if (result == Packet::AddResult::Invalid)
+        {
+            m_metrics.add(Counter::FragmentsDiscarded);
+            DNS_LOG(Warn,
+                "Dns::handleResponse",
+                "Discarded fragment " + std::to_string(k) + "/" + std::to_string(n) +
+                    " inconsistent with session " + std::to_string(session) +
+                    " (expected count " + std::to_string(packet.expectedCount()) + ")");
+        }
+        else if (result == Packet::AddResult::Duplicate)
         {
-            accumulatedSize += fragment.second.size();
+            ++timing.retransmits;
+            DNS_LOG(Debug,
+                "Dns::handleResponse",
+                "Ignoring duplicate fragment " + std::to_string(k) +
+                    " for session " + std::to_string(session));
         }
 
-        bool allPresent =
-            packet.expectedCount > 0 &&
-            packet.fragments.size() == static_cast<size_t>(packet.expectedCount);
+        accumulatedSize = packet.accumulatedSize();
+        packetFull = packet.isFull();
+
+        fragmentAdded = result == Packet::AddResult::Added;
+        if (fragmentAdded)
+            m_metrics.add(Counter::FragmentsIn);
+        progress.session = session;
+        progress.receivedFragments = packet.receivedCount();
+        progress.expectedFragments = packet.expectedCount();
+        progress.receivedBytes = accumulatedSize;
+        if (fragmentAdded)
+            observer = acquireObserver();
 
-        if (allPresent)
+        if (packetFull)
         {
-            int expectedIndex = 0;
-            for (const auto& entry : packet.fragments)
+            // move the message to the ready queue, the client joins the
+            // round-robin when it gets its first ready message
+            timing.completed = now;
+            timing.bytes = accumulatedSize;
+            timing.fragments = packet.expectedCount();
+            report = timing;
+            if (report.enqueued != TransferReport::Clock::time_point())
+                m_metrics.record(Histogram::MessageLatency, report.latency());
+
+            auto& ready = m_msgReady[clientId];
+            if (ready.empty())
+                m_clientsReady.push_back(clientId);
+            ready.push_back({packet.takeData(), report});
+
+            completed.push_back(session);
+            if (completed.size() > COMPLETED_SESSIONS_KEPT)
+                completed.pop_front();
+
+            sessions.erase(session);
+            m_metrics.adjust(Gauge::Sessions, -1);
+            m_metrics.add(Counter::MessagesIn);
+
+            // a sender splits one message at a time, so an older session still
+            // incomplete was abandoned (the message was cut again in a new one)
+            for (auto other = sessions.begin(); other != sessions.end();)
             {
-                if (entry.first != expectedIndex)
+                if (static_cast<int32_t>(session - other->first) <= 0)
                 {
-                    allPresent = false;
-                    break;
+                    ++other;
+                    continue;
                 }
-                ++expectedIndex;
+                DNS_LOG_EVENT(Debug, "Dns::handleResponse",
+                              "Dropping session {} abandoned for session {}", other->first, session);
+                completed.push_back(other->first);
+                if (completed.size() > COMPLETED_SESSIONS_KEPT)
+                    completed.pop_front();
+                other = sessions.erase(other);
+                dropInboundSessions(1);
             }
         }
+        else if (packet.expectedCount() == 0)
+        {
+            sessions.erase(session);
+            m_metrics.adjust(Gauge::Sessions, -1);
+        }
 
-        if (allPresent)
+        // every session left in the map is incomplete
+        m_moreMsgToGet = !sessions.empty();
+
+        morePending = m_moreMsgToGet;
+    }
+
+    if (packetFull)
+        m_msgAvailable.notify_all();
+
+    if (observer)
+    {
+        observer->onFragmentReceived(clientId, progress);
+        if (packetFull)
         {
-            packet.data.clear();
-            packet.data.reserve(accumulatedSize);
-            for (const auto& entry : packet.fragments)
-            {
-                packet.data.append(entry.second);
-            }
+            observer->onMessageComplete(clientId, session, accumulatedSize);
+            observer->onTransferComplete(clientId, report);
         }
+        releaseObserver();
+    }
+
+    DNS_LOG_EVENT(Debug, "Dns::handleResponse",
+                  "Received fragment {}/{} for session {} payload={} bytes; accumulated={} bytes; isFull={}; more pending={}",
+                  k + 1, n, session, payloadView.size(), accumulatedSize, packetFull, morePending);
+}
 
-        packet.isFull = allPresent;
-        packetFull = packet.isFull;
+/**
+ * @brief Make room in m_msgReceived for a new client.
+ *
+ * Client identifiers are taken from the query names, so any sender can make
+ * up new ones. Called with m_mutex held once MAX_INBOUND_CLIENTS clients are
+ * tracked, this function:
+ *   - drops the state of the clients idle for INBOUND_IDLE_TIMEOUT,
+ *   - if more than three quarters of the limit are still tracked, drops the
+ *     least recently active clients down to that.
+ * Each call frees at least a quarter of the entries, so the cost stays O(1)
+ * amortized per new client. The incomplete sessions dropped are counted in
+ * Counter::SessionsDropped; completed messages wait in m_msgReady and are
+ * kept.
+ *
+ * @param now  Time of the fragment being handled.
+ */
+void Dns::evictInboundClients(TransferReport::Clock::time_point now)
+{
+    const size_t target = MAX_INBOUND_CLIENTS - MAX_INBOUND_CLIENTS / 4;
+    const size_t before = m_msgReceived.size();
 
-        m_moreMsgToGet = false;
-        for(const auto& p : m_msgReceived[clientId])
+    for (auto it = m_msgReceived.begin(); it != m_msgReceived.end();)
+    {
+        if (now - it->second.lastActive < INBOUND_IDLE_TIMEOUT)
         {
-            if(!p.second.isFull)
-            {
-                m_moreMsgToGet = true;
-                break;
-            }
+            ++it;
+            continue;
         }
+        dropInboundSessions(it->second.sessions.size());
+        it = m_msgReceived.erase(it);
+    }
 
-        morePending = m_moreMsgToGet;
+    if (m_msgReceived.size() > target)
+    {
+        std::vector<decltype(m_msgReceived)::iterator> clients;
+        clients.reserve(m_msgReceived.size());
+        for (auto it = m_msgReceived.begin(); it != m_msgReceived.end(); ++it)
+            clients.push_back(it);
+
+        const size_t excess = m_msgReceived.size() - target;
+        std::nth_element(clients.begin(), clients.begin() + excess, clients.end(),
+                         [](const auto& a, const auto& b) { return a->second.lastActive < b->second.lastActive; });
+        for (size_t i = 0; i < excess; ++i)
+        {
+            dropInboundSessions(clients[i]->second.sessions.size());
+            m_msgReceived.erase(clients[i]);
+        }
     }
 
-    dns::debug::log(
-        "Dns::handleResponse",
-        "Received fragment " + std::to_string(k + 1) + "/" +
-            std::to_string(n) + " for session '" + session + "' payload=" +
-            std::to_string(payload.size()) +
-            " bytes; accumulated=" +
-            std::to_string(static_cast<unsigned long long>(accumulatedSize)) +
-            " bytes; isFull=" + (packetFull ? "true" : "false"));
-
-    dns::debug::log("Dns::handleResponse",
-                    std::string("More fragments pending: ") +
-                        (morePending ? "yes" : "no"));
+    DNS_LOG_EVENT(Info, "Dns::evictInboundClients", "Dropped the state of {} of {} clients",
+                  before - m_msgReceived.size(), before);
 }
 
+
+// Account for count incomplete sessions erased from m_msgReceived without
+// their message; m_mutex must be held.
+void Dns::dropInboundSessions(size_t count)
+{
+    if (count == 0)
+        return;
+    m_metrics.adjust(Gauge::Sessions, -static_cast<int64_t>(count));
+    m_metrics.add(Counter::SessionsDropped, count);
+}
+
+
 /**
- * @brief Retrieve the first complete message from any client.
+ * @brief Retrieve the next complete message, round-robin across clients.
  *
- * This function scans through all clients in m_msgReceived and their
- * pending sessions. If it finds a session marked as complete
- * (Packet::isFull == true), it:
- *   - extracts the assembled message (Packet::data),
- *   - remembers which clientId it belongs to,
- *   - erases the completed session from the pending map,
- *   - sets m_moreMsgToGet = true,
- *   - logs the operation,
- *   - and immediately returns the pair {clientId, message}.
+ * Completed messages wait in a per-client ready queue (m_msgReady), and
+ * clients with ready messages wait in m_clientsReady. This function:
+ *   - takes the client at the front of m_clientsReady,
+ *   - pops the oldest ready message of that client,
+ *   - puts the client back at the end of m_clientsReady if it has more
+ *     ready messages, so a chatty client cannot starve the others,
+ *   - logs the operation and returns the pair {clientId, message}.
  *
- * If no complete session is found, it returns {"", ""}.
+ * The cost is O(1) whatever the number of clients and pending sessions.
+ * If no message is complete, it returns {"", ""}.
+ *
+ * @param report  If not null, receives the timing of the returned message
+ *                (see TransferReport).
  *
  * @return std::pair<std::string, std::string>
- *         The first {clientId, message} found, or {"", ""} if none complete.
+ *         The next {clientId, message}, or {"", ""} if none complete.
  */
-std::pair<std::string, std::string> Dns::getMsg()
+std::pair<std::string, std::string> Dns::getMsg(TransferReport* report)
 {
     std::lock_guard<std::mutex> lock(m_mutex);
 
-    std::string result;
-    std::string foundClientId;
+    if (m_clientsReady.empty())
+        return {"", ""};
 
-    for (auto& clientPair : m_msgReceived) // iterate all clientIds
-    {
-        auto& clientId   = clientPair.first;
-        auto& sessionMap = clientPair.second;
+    auto result = popReadyMsg(report);
 
-        for (auto it = sessionMap.begin(); it != sessionMap.end(); )
-        {
-            if (it->second.isFull)
-            {
-                std::string sessionId = it->first;
-                result = it->second.data;
-                foundClientId = clientId;
+    DNS_LOG(Debug, "Dns::getMsg",
+       "Delivering complete message of " +
+       std::to_string(static_cast<unsigned long long>(result.second.size())) +
+       " bytes (client=" + result.first + "); clients still ready=" +
+       std::to_string(static_cast<unsigned long long>(m_clientsReady.size())));
 
-                it = sessionMap.erase(it);  // erase this session
+    return result;
+}
 
-                dns::debug::log("Dns::getMsg",
-                    "Completed session '" + sessionId +
-                    "' removed from pending map (client=" + clientId + ")");
-                break; // stop scanning sessions for this client
-            }
-            else
-            {
-                ++it;
-            }
-        }
 
-        if (!result.empty()) break; // stop after the first found
-    }
+/**
+ * @brief Wait for the next complete message, round-robin across clients.
+ *
+ * Same as getMsg(), but blocks on m_msgAvailable until a message completes
+ * or the timeout expires. handleDataReceived() notifies the condition
+ * variable as soon as the last fragment of a message is added.
+ *
+ * @return The next {clientId, message}, or {"", ""} on timeout.
+ */
+std::pair<std::string, std::string> Dns::waitForMsg(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if (!m_msgAvailable.wait_for(lock, timeout, [this] { return !m_clientsReady.empty(); }))
+        return {"", ""};
+
+    return popReadyMsg();
+}
+
+
+// Pop the oldest message of the client at the front of the round-robin and
+// put the client back at the end if it has more, its timing going to report
+// if not null. m_mutex must be held and m_clientsReady must not be empty.
+std::pair<std::string, std::string> Dns::popReadyMsg(TransferReport* report)
+{
+    std::string clientId = std::move(m_clientsReady.front());
+    m_clientsReady.pop_front();
+
+    auto& ready = m_msgReady[clientId];
+    std::string msg = std::move(ready.front().data);
+    if (report)
+        *report = ready.front().report;
+    ready.pop_front();
+
+    if (ready.empty())
+        m_msgReady.erase(clientId);
+    else
+        m_clientsReady.push_back(clientId);
+
+    return {std::move(clientId), std::move(msg)};
+}
+
+
+/**
+ * @brief Retrieve up to maxCount complete messages under a single lock.
+ *
+ * Messages are taken in the same round-robin order as getMsg(): one message
+ * per client per turn.
+ *
+ * @return The {clientId, message} pairs, possibly fewer than maxCount.
+ */
+std::vector<std::pair<std::string, std::string>> Dns::getMsgs(size_t maxCount)
+{
+    std::vector<std::pair<std::string, std::string>> result;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    while (result.size() < maxCount && !m_clientsReady.empty())
+        result.push_back(popReadyMsg());
 
     if (!result.empty())
+        DNS_LOG(Debug, "Dns::getMsgs",
+           "Delivering " + std::to_string(static_cast<unsigned long long>(result.size())) +
+           " complete message(s); clients still ready=" +
+           std::to_string(static_cast<unsigned long long>(m_clientsReady.size())));
+
+    return result;
+}
+
+
+/**
+ * @brief Lock m_mutex, timing the wait if it is contended.
+ *
+ * An uncontended lock costs a try_lock and no clock read, so only the
+ * waits behind another thread reach Histogram::LockWait: its count is the
+ * number of contended acquisitions, its percentiles how long they took.
+ */
+std::unique_lock<std::mutex> Dns::lockState()
+{
+    std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        const auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        m_metrics.record(Histogram::LockWait, std::chrono::steady_clock::now() - start);
+    }
+    return lock;
+}
+
+
+/**
+ * @brief Take a snapshot of the metrics.
+ *
+ * Counters, gauges and histograms are read without any lock. The depth of
+ * each client's fragment queue is read under m_mutex only if it is free:
+ * an exporter thread must never hold up the I/O threads, so a busy mutex
+ * leaves the per-client depths out of this snapshot.
+ */
+MetricsSnapshot Dns::metricsSnapshot()
+{
+    MetricsSnapshot snapshot = m_metrics.snapshot();
+
+    std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+    if (lock.owns_lock())
     {
-        dns::debug::log("Dns::getMsg",
-            "Assembled complete message of " +
-            std::to_string(static_cast<unsigned long long>(result.size())) +
-            " bytes; remaining sessions=" +
-            std::to_string(static_cast<unsigned long long>(m_msgReceived[foundClientId].size())));
+        snapshot.queueDepths.reserve(m_msgQueue.size());
+        for (const auto& [clientId, queue] : m_msgQueue)
+            snapshot.queueDepths.emplace_back(clientId, queue.size());
     }
 
-    return {foundClientId, result};
+    return snapshot;
 }
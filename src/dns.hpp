@@ -5,7 +5,10 @@
 #include <thread>
 #include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <vector>
+#include <deque>
 #include <queue>
 #include <unordered_map>
 
@@ -26,6 +29,9 @@
 #include "query.hpp"
 #include "response.hpp"
 #include "dnsPacker.hpp"
+#include "fragment.hpp"
+#include "messageObserver.hpp"
+#include "metrics.hpp"
 
 
 namespace dns 
@@ -38,22 +44,131 @@ public:
     Dns(const std::string& domain, const std::string& id);
     ~Dns();
 
-protected:
-    void setMsg(const std::string& msg, const std::string& clientId);
-    std::pair<std::string, std::string> getMsg();
+    // Default byte watermarks of each client's outbound message queue.
+    static constexpr size_t DEFAULT_HIGH_WATERMARK = 1U << 20;
+    static constexpr size_t DEFAULT_LOW_WATERMARK = 256U << 10;
+    // UDP payload size advertised in EDNS0 OPT records (DNS flag day 2020
+    // value, safe from IP fragmentation).
+    static constexpr uint EDNS_UDP_SIZE = 1232;
+
+    // Counters, gauges and latency histograms of the tunnel, with the
+    // fragments queued for each client when m_mutex is free; never blocks.
+    MetricsSnapshot metricsSnapshot();
 
-    void handleDataReceived(const std::string& rdata, const std::string& clientId);
-    void splitPacket(int qType, const std::string& clientId);
+protected:
+    bool setMsg(const std::string& msg, const std::string& clientId);
+    std::pair<std::string, std::string> getMsg(TransferReport* report = nullptr);
+    std::vector<std::pair<std::string, std::string>> getMsgs(size_t maxCount);
+    std::pair<std::string, std::string> waitForMsg(std::chrono::milliseconds timeout);
+
+    void setObserver(MessageObserver* observer);
+
+    void setWatermarks(size_t high, size_t low);
+    // Carry the enqueue time of each message in its first fragment, so the
+    // receiver can report the end-to-end latency. Costs 8 bytes of every
+    // fragment's capacity.
+    void setTransferTimestamps(bool enable);
+    size_t pendingBytes(const std::string& clientId);
+    bool waitForSendSpace(const std::string& clientId, std::chrono::milliseconds timeout);
+
+    void handleDataReceived(const std::string& rdata, const std::string& clientId, Codec codec = Codec::Hex);
+    // Lock m_mutex on an I/O path; the wait, when another thread holds it,
+    // is recorded in Histogram::LockWait.
+    std::unique_lock<std::mutex> lockState();
+
+    // Sender side timing of the message whose fragments are in
+    // m_msgQueue[clientId]; m_mutex must be held. noteFragmentSent is called
+    // for each fragment put on the wire, noteFragmentDone once the front
+    // fragment is popped (acknowledged, or put in a response): it returns
+    // true and fills report when that was the last fragment of its message.
+    void noteFragmentSent(const std::string& clientId);
+    bool noteFragmentDone(const std::string& clientId, TransferReport& report);
+    // Drop the fragments left in m_msgQueue[clientId] and put their message
+    // back at the front of m_msgToSend[clientId], for splitPacket() to cut it
+    // again in a new session; m_mutex must be held.
+    void restartTransfer(const std::string& clientId);
+    // The observer to call once m_mutex is released, nullptr if none;
+    // m_mutex must be held. Each observer returned must be handed back with
+    // releaseObserver() after its callbacks, which setObserver() waits for.
+    MessageObserver* acquireObserver();
+    void releaseObserver();
+    void splitPacket(int qType, const std::string& clientId, int rdataBudget = 0);
     
     std::string m_domainToResolve;
     int m_maxMessageSize;
-
-    std::unordered_map<std::string, std::string> m_msgToSend;
+    // codec used by splitPacket to encode fragments
+    Codec m_codec;
+    // session identifier of the next message split by splitPacket
+    uint32_t m_nextSession;
+
+    // downstream codec negotiated by each client in its ask queries
+    std::unordered_map<std::string, Codec> m_clientCodec;
+
+    // Messages waiting to be split for a client, oldest first. The queue is
+    // flagged full when its size reaches the high watermark and accepts
+    // messages again once splitPacket has drained it down to the low one.
+    struct OutboundMessage
+    {
+        std::string data;
+        TransferReport::Clock::time_point enqueued;
+    };
+    struct OutboundQueue
+    {
+        std::deque<OutboundMessage> messages;
+        size_t bytes = 0;
+        bool full = false;
+    };
+    std::unordered_map<std::string, OutboundQueue> m_msgToSend;
+    size_t m_highWatermark;
+    size_t m_lowWatermark;
+    std::condition_variable m_sendSpaceAvailable;
     std::unordered_map<std::string, std::queue<std::string>> m_msgQueue;
+    // the message being sent from m_msgQueue, per client
+    struct OutboundTransfer
+    {
+        OutboundMessage message;
+        TransferReport report;
+        uint32_t remaining = 0;
+        bool frontSent = false;
+    };
+    std::unordered_map<std::string, OutboundTransfer> m_transfers;
+    bool m_transferTimestamps;
 
     bool m_moreMsgToGet;
-    std::unordered_map<std::string, std::unordered_map<std::string, Packet>> m_msgReceived;
-    std::vector<std::string> m_qnameReceived;
+    // sessions still being reassembled, per client
+    struct InboundSession
+    {
+        Packet packet;
+        TransferReport report;
+    };
+    struct InboundClient
+    {
+        std::unordered_map<uint32_t, InboundSession> sessions;
+        // last sessions completed or abandoned, so late retransmissions of
+        // their fragments do not open a new session
+        std::deque<uint32_t> completed;
+        TransferReport::Clock::time_point lastActive;
+    };
+    std::unordered_map<std::string, InboundClient> m_msgReceived;
+    static constexpr size_t COMPLETED_SESSIONS_KEPT = 16;
+    // Client identifiers come from the query names: past this many clients,
+    // the state of the idle ones is dropped (see evictInboundClients).
+    static constexpr size_t MAX_INBOUND_CLIENTS = 4096;
+    static constexpr std::chrono::seconds INBOUND_IDLE_TIMEOUT{120};
+    // completed messages waiting for getMsg, per client, oldest first
+    struct ReadyMessage
+    {
+        std::string data;
+        TransferReport report;
+    };
+    std::unordered_map<std::string, std::deque<ReadyMessage>> m_msgReady;
+    // clients with at least one completed message, in round-robin order
+    std::deque<std::string> m_clientsReady;
+    std::condition_variable m_msgAvailable;
+    MessageObserver* m_observer;
+    // observer callbacks in progress, outside of m_mutex
+    unsigned int m_observerCalls;
+    std::condition_variable m_observerIdle;
 
     const std::string m_secretKeyClientAskData = "ask";
     const std::string m_secretKeyClientKeepAlive = "hello";
@@ -63,6 +178,12 @@ protected:
 
     std::mutex m_mutex;    
 
+    Metrics m_metrics;
+
+private:
+    std::pair<std::string, std::string> popReadyMsg(TransferReport* report = nullptr);
+    void evictInboundClients(TransferReport::Clock::time_point now);
+    void dropInboundSessions(size_t count);
 };
 
 
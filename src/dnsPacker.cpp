@@ -1,41 +1,599 @@
 #include <iostream>
 #include <string>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
 #include <iomanip>
 #include <sstream>
 #include <random>
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define DNS_HEX_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DNS_TARGET(isa)
+#else
+#define DNS_TARGET(isa) __attribute__((target(isa)))
+#endif
+#else
+#define DNS_HEX_X86 0
+#endif
+
 #include "dnsPacker.hpp"
 
 namespace dns
 {
 
 
+namespace
+{
+
+constexpr char kHexDigits[] = "0123456789ABCDEF";
+
+struct HexTables
+{
+    char encode[512];   // two upper-case digits per byte value
+    int8_t decode[256]; // nibble value, or -1 for anything that is not a hex digit
+};
+
+constexpr HexTables makeHexTables()
+{
+    HexTables tables{};
+    for (int i = 0; i < 256; ++i)
+    {
+        tables.encode[2 * i] = kHexDigits[i >> 4];
+        tables.encode[2 * i + 1] = kHexDigits[i & 0x0F];
+        tables.decode[i] = -1;
+    }
+    for (int i = 0; i < 10; ++i)
+        tables.decode['0' + i] = static_cast<int8_t>(i);
+    for (int i = 0; i < 6; ++i)
+    {
+        tables.decode['A' + i] = static_cast<int8_t>(10 + i);
+        tables.decode['a' + i] = static_cast<int8_t>(10 + i);
+    }
+    return tables;
+}
+
+constexpr HexTables kHexTables = makeHexTables();
+
+void encodeHexScalar(const uint8_t* in, size_t len, char* out)
+{
+    for (size_t i = 0; i < len; ++i)
+        std::memcpy(out + 2 * i, &kHexTables.encode[2 * in[i]], 2);
+}
+
+// len is the number of decoded bytes, in holds 2 * len characters.
+bool decodeHexScalar(const char* in, size_t len, uint8_t* out)
+{
+    int invalid = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        int high = kHexTables.decode[static_cast<uint8_t>(in[2 * i])];
+        int low = kHexTables.decode[static_cast<uint8_t>(in[2 * i + 1])];
+        invalid |= high | low;
+        out[i] = static_cast<uint8_t>((high << 4) | low);
+    }
+    return invalid >= 0;
+}
+
+#if DNS_HEX_X86
+
+/* The vector kernels process whole blocks only and return the number of bytes
+ * they handled; the caller finishes the tail with the scalar kernel.
+ */
+
+DNS_TARGET("sse4.1")
+size_t encodeHexSse41(const uint8_t* in, size_t len, char* out)
+{
+    const __m128i lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                                      '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+    const __m128i mask = _mm_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i high = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        __m128i low = _mm_shuffle_epi8(lut, _mm_and_si128(v, mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16), _mm_unpackhi_epi8(high, low));
+    }
+    return i;
+}
+
+DNS_TARGET("avx2")
+size_t encodeHexAvx2(const uint8_t* in, size_t len, char* out)
+{
+    const __m256i lut = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                                         '8', '9', 'A', 'B', 'C', 'D', 'E', 'F',
+                                         '0', '1', '2', '3', '4', '5', '6', '7',
+                                         '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m256i high = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+        __m256i low = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, mask));
+        // unpack works per 128-bit lane: a = bytes 0-7 | 16-23, b = bytes 8-15 | 24-31
+        __m256i a = _mm256_unpacklo_epi8(high, low);
+        __m256i b = _mm256_unpackhi_epi8(high, low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    return i;
+}
+
+// Map 16 hex characters to nibble values and clear the lanes of valid that do
+// not hold a hex digit. Upper and lower case are both accepted.
+DNS_TARGET("sse4.1")
+__m128i hexNibblesSse41(__m128i c, __m128i& valid)
+{
+    const __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    const __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    const __m128i alpha = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    const __m128i isAlpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+    valid = _mm_and_si128(valid, _mm_or_si128(isDigit, isAlpha));
+    return _mm_blendv_epi8(_mm_add_epi8(alpha, _mm_set1_epi8(10)), digit, isDigit);
+}
+
+DNS_TARGET("sse4.1")
+size_t decodeHexSse41(const char* in, size_t len, uint8_t* out, bool& ok)
+{
+    // maddubs with (16, 1) folds each nibble pair into one byte
+    const __m128i weights = _mm_set1_epi16(0x0110);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i valid = _mm_set1_epi8(-1);
+        __m128i a = hexNibblesSse41(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i)), valid);
+        __m128i b = hexNibblesSse41(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * i + 16)), valid);
+        if (_mm_movemask_epi8(valid) != 0xFFFF)
+        {
+            ok = false;
+            return i;
+        }
+        a = _mm_maddubs_epi16(a, weights);
+        b = _mm_maddubs_epi16(b, weights);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(a, b));
+    }
+    return i;
+}
+
+DNS_TARGET("avx2")
+__m256i hexNibblesAvx2(__m256i c, __m256i& valid)
+{
+    const __m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    const __m256i isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    const __m256i alpha = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    const __m256i isAlpha = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+    valid = _mm256_and_si256(valid, _mm256_or_si256(isDigit, isAlpha));
+    return _mm256_blendv_epi8(_mm256_add_epi8(alpha, _mm256_set1_epi8(10)), digit, isDigit);
+}
+
+DNS_TARGET("avx2")
+size_t decodeHexAvx2(const char* in, size_t len, uint8_t* out, bool& ok)
+{
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i valid = _mm256_set1_epi8(-1);
+        __m256i a = hexNibblesAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 2 * i)), valid);
+        __m256i b = hexNibblesAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 2 * i + 32)), valid);
+        if (_mm256_movemask_epi8(valid) != -1)
+        {
+            ok = false;
+            return i;
+        }
+        a = _mm256_maddubs_epi16(a, weights);
+        b = _mm256_maddubs_epi16(b, weights);
+        // packus works per lane, restore the byte order afterwards
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+    }
+    return i;
+}
+
+#endif
+
+HexKernel detectHexKernel()
+{
+#if DNS_HEX_X86
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool sse41 = (info[2] & (1 << 19)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    bool avx2 = false;
+    if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    const bool sse41 = __builtin_cpu_supports("sse4.1");
+    const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if (avx2)
+        return HexKernel::Avx2;
+    if (sse41)
+        return HexKernel::Sse41;
+#endif
+    return HexKernel::Scalar;
+}
+
+HexKernel supportedHexKernel(HexKernel requested)
+{
+    const HexKernel best = activeHexKernel();
+    return static_cast<int>(requested) <= static_cast<int>(best) ? requested : best;
+}
+
+} // namespace
+
+
+HexKernel activeHexKernel()
+{
+    static const HexKernel kernel = detectHexKernel();
+    return kernel;
+}
+
+
+const char* hexKernelName(HexKernel kernel)
+{
+    switch (kernel)
+    {
+        case HexKernel::Avx2:
+            return "avx2";
+        case HexKernel::Sse41:
+            return "sse4.1";
+        case HexKernel::Scalar:
+        default:
+            return "scalar";
+    }
+}
+
+
 std::string stringToHex(const std::string& input)
 {
-    std::ostringstream oss;
-    oss << std::hex << std::uppercase;
+    return stringToHex(input, activeHexKernel());
+}
+
+
+std::string stringToHex(const std::string& input, HexKernel kernel)
+{
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(input.data());
+    const size_t len = input.size();
+
+    std::string result(len * 2, '\0');
+    char* out = result.data();
+
+    size_t done = 0;
+#if DNS_HEX_X86
+    switch (supportedHexKernel(kernel))
+    {
+        case HexKernel::Avx2:
+            done = encodeHexAvx2(in, len, out);
+            break;
+        case HexKernel::Sse41:
+            done = encodeHexSse41(in, len, out);
+            break;
+        default:
+            break;
+    }
+#else
+    (void)kernel;
+#endif
+    encodeHexScalar(in + done, len - done, out + 2 * done);
+
+    return result;
+}
+
+
+std::string hexToString(const std::string& hex)
+{
+    return hexToString(hex, activeHexKernel());
+}
+
+
+std::string hexToString(const std::string& hex, HexKernel kernel)
+{
+    if (hex.size() % 2 != 0)
+        return {};
+
+    const size_t len = hex.size() / 2;
+    std::string result(len, '\0');
+    uint8_t* out = reinterpret_cast<uint8_t*>(result.data());
+
+    size_t done = 0;
+    bool ok = true;
+#if DNS_HEX_X86
+    switch (supportedHexKernel(kernel))
+    {
+        case HexKernel::Avx2:
+            done = decodeHexAvx2(hex.data(), len, out, ok);
+            break;
+        case HexKernel::Sse41:
+            done = decodeHexSse41(hex.data(), len, out, ok);
+            break;
+        default:
+            break;
+    }
+#else
+    (void)kernel;
+#endif
+    if (!ok || !decodeHexScalar(hex.data() + 2 * done, len - done, out + done))
+        return {};
+
+    return result;
+}
+
+
+namespace
+{
+
+constexpr char kBase32Alphabet[] = "abcdefghijklmnopqrstuvwxyz234567";
+
+constexpr std::array<int8_t, 256> makeBase32DecodeTable()
+{
+    std::array<int8_t, 256> table{};
+    for (auto& value : table)
+        value = -1;
+    for (int i = 0; i < 32; ++i)
+    {
+        const unsigned char c = static_cast<unsigned char>(kBase32Alphabet[i]);
+        table[c] = static_cast<int8_t>(i);
+        if (c >= 'a' && c <= 'z')
+            table[c - 'a' + 'A'] = static_cast<int8_t>(i);
+    }
+    return table;
+}
+
+constexpr std::array<int8_t, 256> kBase32Decode = makeBase32DecodeTable();
+
+constexpr char kBase64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+constexpr std::array<int8_t, 256> makeBase64DecodeTable()
+{
+    std::array<int8_t, 256> table{};
+    for (auto& value : table)
+        value = -1;
+    for (int i = 0; i < 64; ++i)
+        table[static_cast<unsigned char>(kBase64Alphabet[i])] = static_cast<int8_t>(i);
+    return table;
+}
+
+constexpr std::array<int8_t, 256> kBase64Decode = makeBase64DecodeTable();
+
+} // namespace
+
+
+char codecTag(Codec codec)
+{
+    switch (codec)
+    {
+        case Codec::Base32:
+            return BASE32_TAG;
+        case Codec::Base64:
+            return 'b';
+        case Codec::Raw:
+            return 'r';
+        case Codec::Hex:
+        default:
+            return 'x';
+    }
+}
+
+
+bool codecFromTag(char tag, Codec& codec)
+{
+    switch (std::tolower(static_cast<unsigned char>(tag)))
+    {
+        case 'x':
+            codec = Codec::Hex;
+            return true;
+        case BASE32_TAG:
+            codec = Codec::Base32;
+            return true;
+        case 'b':
+            codec = Codec::Base64;
+            return true;
+        case 'r':
+            codec = Codec::Raw;
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+std::string stringToBase32(const std::string& input)
+{
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(input.data());
+    const size_t len = input.size();
+
+    std::string result;
+    result.reserve((len * 8 + 4) / 5);
+
+    size_t i = 0;
+    for (; i + 5 <= len; i += 5)
+    {
+        const uint64_t block = (static_cast<uint64_t>(in[i]) << 32) |
+                               (static_cast<uint64_t>(in[i + 1]) << 24) |
+                               (static_cast<uint64_t>(in[i + 2]) << 16) |
+                               (static_cast<uint64_t>(in[i + 3]) << 8) |
+                               static_cast<uint64_t>(in[i + 4]);
+        for (int shift = 35; shift >= 0; shift -= 5)
+            result.push_back(kBase32Alphabet[(block >> shift) & 0x1F]);
+    }
+
+    uint32_t buffer = 0;
+    int bits = 0;
+    for (; i < len; ++i)
+    {
+        buffer = (buffer << 8) | in[i];
+        bits += 8;
+        while (bits >= 5)
+        {
+            bits -= 5;
+            result.push_back(kBase32Alphabet[(buffer >> bits) & 0x1F]);
+        }
+    }
+    if (bits > 0)
+        result.push_back(kBase32Alphabet[(buffer << (5 - bits)) & 0x1F]);
+
+    return result;
+}
+
+
+std::string base32ToString(const std::string& input)
+{
+    // A trailing group of 1, 3 or 6 characters cannot come out of the encoder.
+    const size_t rest = input.size() % 8;
+    if (rest == 1 || rest == 3 || rest == 6)
+        return {};
+
+    std::string result;
+    result.reserve(input.size() * 5 / 8);
+
+    uint32_t buffer = 0;
+    int bits = 0;
     for (unsigned char c : input)
     {
-        oss << std::setw(2) << std::setfill('0') << static_cast<int>(c);
+        const int value = kBase32Decode[c];
+        if (value < 0)
+            return {};
+        buffer = (buffer << 5) | static_cast<uint32_t>(value);
+        bits += 5;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            result.push_back(static_cast<char>((buffer >> bits) & 0xFF));
+        }
+    }
+
+    return result;
+}
+
+
+std::string stringToBase64(const std::string& input)
+{
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(input.data());
+    const size_t len = input.size();
+
+    std::string result;
+    result.reserve((len * 4 + 2) / 3);
+
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3)
+    {
+        const uint32_t block = (static_cast<uint32_t>(in[i]) << 16) |
+                               (static_cast<uint32_t>(in[i + 1]) << 8) |
+                               static_cast<uint32_t>(in[i + 2]);
+        result.push_back(kBase64Alphabet[(block >> 18) & 0x3F]);
+        result.push_back(kBase64Alphabet[(block >> 12) & 0x3F]);
+        result.push_back(kBase64Alphabet[(block >> 6) & 0x3F]);
+        result.push_back(kBase64Alphabet[block & 0x3F]);
+    }
+
+    if (i < len)
+    {
+        uint32_t block = static_cast<uint32_t>(in[i]) << 16;
+        if (i + 1 < len)
+            block |= static_cast<uint32_t>(in[i + 1]) << 8;
+        result.push_back(kBase64Alphabet[(block >> 18) & 0x3F]);
+        result.push_back(kBase64Alphabet[(block >> 12) & 0x3F]);
+        if (i + 1 < len)
+            result.push_back(kBase64Alphabet[(block >> 6) & 0x3F]);
     }
-    return oss.str();
+
+    return result;
 }
 
 
-std::string hexToString(const std::string& hex) 
+std::string base64ToString(const std::string& input)
 {
-    int len = hex.length();
+    size_t len = input.size();
+    while (len > 0 && input[len - 1] == '=')
+        --len;
+    if (len % 4 == 1 || input.size() - len > 2)
+        return {};
+
     std::string result;
-    for(int i=0; i< len; i+=2)
+    result.reserve(len * 3 / 4);
+
+    uint32_t buffer = 0;
+    int bits = 0;
+    for (size_t i = 0; i < len; ++i)
     {
-        std::string byte = hex.substr(i,2);
-        char chr = (char) (int)strtol(byte.c_str(), NULL, 16);
-        result.push_back(chr);
+        const int value = kBase64Decode[static_cast<unsigned char>(input[i])];
+        if (value < 0)
+            return {};
+        buffer = (buffer << 6) | static_cast<uint32_t>(value);
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            result.push_back(static_cast<char>((buffer >> bits) & 0xFF));
+        }
     }
+
     return result;
 }
 
 
+std::string encodeFragmentData(const std::string& data, Codec codec)
+{
+    switch (codec)
+    {
+        case Codec::Base32:
+            return BASE32_TAG + stringToBase32(data);
+        case Codec::Base64:
+            return stringToBase64(data);
+        case Codec::Raw:
+            return data;
+        case Codec::Hex:
+        default:
+            return stringToHex(data);
+    }
+}
+
+
+std::string decodeFragmentData(const std::string& data)
+{
+    if (!data.empty() && std::tolower(static_cast<unsigned char>(data[0])) == BASE32_TAG)
+        return base32ToString(data.substr(1));
+
+    return hexToString(data);
+}
+
+
+std::string decodeFragmentData(const std::string& data, Codec codec)
+{
+    switch (codec)
+    {
+        case Codec::Base64:
+            return base64ToString(data);
+        case Codec::Raw:
+            return data;
+        case Codec::Hex:
+        case Codec::Base32:
+        default:
+            return decodeFragmentData(data);
+    }
+}
+
+
 std::string addDotEvery62Chars(const std::string& str)
 {
     std::string result;
@@ -2,21 +2,21 @@
 
 #include <algorithm>
 #include <cctype>
-#include <map>
+#include <cstdint>
+#include <string>
 
 
 namespace dns
 {
 
-struct Packet
-{
-    std::string data;
-    bool isFull = false;
-    std::string id;
-    std::string clientId;
-    int expectedCount = -1;
-    std::map<int, std::string> fragments;
-};
+// Encodings used to carry fragments inside DNS names and records. Hex and
+// base32 are safe in names; base64 and raw bytes only fit record data such as
+// TXT or NULL answers.
+enum class Codec { Hex = 0, Base32, Base64, Raw };
+
+// First character of base32 fragment data. It is not a hex digit in either
+// case, so receivers can tell both codecs apart without negotiation.
+inline constexpr char BASE32_TAG = 'z';
 
 // https://github.com/iagox86/dnscat2
 #define MAX_FIELD_LENGTH 62
@@ -24,18 +24,79 @@ struct Packet
 
 /* The max length is:
  * 255 because that's the max DNS length
- * Halved, because we encode in hex
+ * Scaled by the codec expansion: halved for hex, 5/8 for base32
+ * Minus 1 for the base32 tag
  * Minus the length of the domain, which is appended
  * Minus 1, for the period right before the domain
  * Minus the number of periods that could appear within the name
  */
-inline int getMaxMsgLen(const std::string& domain)
+inline int getMaxMsgLen(const std::string& domain, Codec codec = Codec::Hex)
 {
-    return ((255/2) - domain.size() - 1 - ((MAX_DNS_LENGTH / MAX_FIELD_LENGTH) + 1));
+    const int encoded = codec == Codec::Base32 ? ((MAX_DNS_LENGTH * 5) / 8) - 1 : (MAX_DNS_LENGTH / 2);
+    return (encoded - domain.size() - 1 - ((MAX_DNS_LENGTH / MAX_FIELD_LENGTH) + 1));
 }
 
+// Number of payload bytes that fit in encodedBudget characters once encoded
+// with codec (tag included).
+inline int getPayloadCapacity(int encodedBudget, Codec codec)
+{
+    switch (codec)
+    {
+        case Codec::Raw:
+            return encodedBudget;
+        case Codec::Base64:
+            return (encodedBudget / 4) * 3;
+        case Codec::Base32:
+            return ((encodedBudget - 1) * 5) / 8;
+        case Codec::Hex:
+        default:
+            return encodedBudget / 2;
+    }
+}
+
+// Single character naming a codec, used by clients to negotiate the
+// downstream codec in their ask queries.
+char codecTag(Codec codec);
+bool codecFromTag(char tag, Codec& codec);
+
+/* Hex codec kernels. The best kernel supported by the running CPU is picked
+ * once at first use; the explicit-kernel overloads exist for tests and
+ * benchmarks and fall back to the best supported kernel when the requested
+ * one is not available.
+ */
+enum class HexKernel { Scalar = 0, Sse41, Avx2 };
+
+HexKernel activeHexKernel();
+const char* hexKernelName(HexKernel kernel);
+
+// Upper-case hex encoding of every byte of input.
 std::string stringToHex(const std::string& input);
+std::string stringToHex(const std::string& input, HexKernel kernel);
+
+// Decode upper- or lower-case hex. Returns an empty string when the input has
+// an odd length or contains a character that is not a hex digit.
 std::string hexToString(const std::string& hex);
+std::string hexToString(const std::string& hex, HexKernel kernel);
+
+// RFC 4648 base32 with the lower-case alphabet and no padding. Decoding is
+// case-insensitive so it survives resolvers applying 0x20 randomization, and
+// returns an empty string on invalid characters or lengths.
+std::string stringToBase32(const std::string& input);
+std::string base32ToString(const std::string& input);
+
+// Standard base64 alphabet without padding; the decoder accepts padding.
+// Returns an empty string on invalid characters or lengths.
+std::string stringToBase64(const std::string& input);
+std::string base64ToString(const std::string& input);
+
+// Encode data for a fragment using codec, prefixing base32 with BASE32_TAG.
+std::string encodeFragmentData(const std::string& data, Codec codec);
+// Decode fragment data produced by encodeFragmentData. Hex and base32 are
+// told apart by the tag; base64 and raw data carry no tag, so the receiver
+// passes the codec it negotiated. Returns an empty string if the data is not
+// valid.
+std::string decodeFragmentData(const std::string& data);
+std::string decodeFragmentData(const std::string& data, Codec codec);
 
 std::string addDotEvery62Chars(const std::string& str);
 
@@ -0,0 +1,202 @@
+#include <cstring>
+
+#include "fragment.hpp"
+
+namespace dns
+{
+
+namespace
+{
+
+void putVarint(uint32_t value, std::string& out)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool getVarint(const unsigned char*& cur, const unsigned char* end, uint32_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        if (cur == end)
+            return false;
+        const uint32_t byte = *cur++;
+        // the fifth byte only has room for the top 4 bits of a uint32
+        if (shift == 28 && byte > 0x0F)
+            return false;
+        value |= (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+
+size_t varintSize(uint32_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+
+size_t fragmentHeaderSize(const FragmentHeader& header)
+{
+    const size_t timestampSize = (header.flags & FRAGMENT_FLAG_TIMESTAMP) ? FRAGMENT_TIMESTAMP_SIZE : 0;
+    return 1 + varintSize(header.session) + varintSize(header.index) + varintSize(header.count) + timestampSize;
+}
+
+
+void encodeFragmentHeader(const FragmentHeader& header, std::string& out)
+{
+    out.push_back(static_cast<char>((FRAGMENT_VERSION << 4) | (header.flags & 0x0F)));
+    putVarint(header.session, out);
+    putVarint(header.index, out);
+    putVarint(header.count, out);
+
+    if (header.flags & FRAGMENT_FLAG_TIMESTAMP)
+    {
+        for (size_t i = 0; i < FRAGMENT_TIMESTAMP_SIZE; ++i)
+            out.push_back(static_cast<char>(header.enqueueTime >> (8 * i)));
+    }
+}
+
+
+bool decodeFragment(std::string_view data, FragmentHeader& header, std::string_view& payload)
+{
+    const unsigned char* cur = reinterpret_cast<const unsigned char*>(data.data());
+    const unsigned char* end = cur + data.size();
+
+    if (cur == end || (*cur >> 4) != FRAGMENT_VERSION)
+        return false;
+    header.flags = *cur++ & 0x0F;
+
+    if (!getVarint(cur, end, header.session) ||
+        !getVarint(cur, end, header.index) ||
+        !getVarint(cur, end, header.count))
+        return false;
+
+    if (header.count == 0 || header.index >= header.count)
+        return false;
+
+    header.enqueueTime = 0;
+    if (header.flags & FRAGMENT_FLAG_TIMESTAMP)
+    {
+        if (static_cast<size_t>(end - cur) < FRAGMENT_TIMESTAMP_SIZE)
+            return false;
+        for (size_t i = 0; i < FRAGMENT_TIMESTAMP_SIZE; ++i)
+            header.enqueueTime |= static_cast<uint64_t>(cur[i]) << (8 * i);
+        cur += FRAGMENT_TIMESTAMP_SIZE;
+    }
+
+    payload = data.substr(reinterpret_cast<const char*>(cur) - data.data());
+    return true;
+}
+
+
+Packet::AddResult Packet::addFragment(const FragmentHeader& header, std::string_view payload)
+{
+    if (m_expectedCount == 0)
+    {
+        if (header.count == 0 || header.count > MAX_FRAGMENT_COUNT)
+            return AddResult::Invalid;
+        m_expectedCount = header.count;
+        m_present.assign((header.count + 63) / 64, 0);
+    }
+    else if (header.count != m_expectedCount)
+    {
+        return AddResult::Invalid;
+    }
+
+    if (header.index >= m_expectedCount)
+        return AddResult::Invalid;
+
+    uint64_t& word = m_present[header.index / 64];
+    const uint64_t bit = uint64_t(1) << (header.index % 64);
+    if (word & bit)
+        return AddResult::Duplicate;
+
+    const bool isLast = header.index + 1 == m_expectedCount;
+    if (isLast)
+    {
+        if (!placeLast(payload))
+            return AddResult::Invalid;
+    }
+    else
+    {
+        if (m_chunkSize == 0)
+        {
+            if (payload.empty() || payload.size() > MAX_REASSEMBLY_SIZE / m_expectedCount)
+                return AddResult::Invalid;
+            if (!m_pendingLast.empty() && m_pendingLast.size() > payload.size())
+                return AddResult::Invalid;
+
+            m_chunkSize = payload.size();
+            m_data.resize(m_chunkSize * m_expectedCount);
+            if (!m_pendingLast.empty())
+            {
+                std::memcpy(&m_data[m_chunkSize * (m_expectedCount - 1)], m_pendingLast.data(), m_pendingLast.size());
+                std::string().swap(m_pendingLast);
+            }
+        }
+        else if (payload.size() != m_chunkSize)
+        {
+            return AddResult::Invalid;
+        }
+
+        std::memcpy(&m_data[m_chunkSize * header.index], payload.data(), payload.size());
+    }
+
+    word |= bit;
+    ++m_receivedCount;
+    m_accumulatedSize += payload.size();
+    return AddResult::Added;
+}
+
+
+bool Packet::placeLast(std::string_view payload)
+{
+    if (m_expectedCount == 1)
+    {
+        if (payload.size() > MAX_REASSEMBLY_SIZE)
+            return false;
+        m_data.assign(payload);
+    }
+    else if (m_chunkSize == 0)
+    {
+        // the chunk size is not known yet, keep the payload aside
+        if (payload.size() > MAX_REASSEMBLY_SIZE / m_expectedCount)
+            return false;
+        m_pendingLast.assign(payload);
+    }
+    else
+    {
+        if (payload.size() > m_chunkSize)
+            return false;
+        std::memcpy(&m_data[m_chunkSize * (m_expectedCount - 1)], payload.data(), payload.size());
+    }
+
+    m_lastSize = payload.size();
+    return true;
+}
+
+
+std::string Packet::takeData()
+{
+    if (m_expectedCount > 1)
+        m_data.resize(m_chunkSize * (m_expectedCount - 1) + m_lastSize);
+    return std::move(m_data);
+}
+
+}
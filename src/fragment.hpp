@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace dns
+{
+
+/* Binary header in front of every fragment payload:
+ *
+ *   byte 0   version (high nibble) | flags (low nibble)
+ *   varint   session identifier
+ *   varint   fragment index
+ *   varint   fragment count
+ *   uint64   with FRAGMENT_FLAG_TIMESTAMP only: time the message was queued
+ *            by the sender, microseconds since the Unix epoch, little-endian
+ *   ...      payload bytes up to the end of the fragment
+ *
+ * Varints are little-endian base 128 (7 bits per byte, high bit set on every
+ * byte but the last) and at most 5 bytes long.
+ */
+inline constexpr uint8_t FRAGMENT_VERSION = 1;
+inline constexpr uint8_t FRAGMENT_FLAG_TIMESTAMP = 0x1;
+inline constexpr size_t FRAGMENT_TIMESTAMP_SIZE = 8;
+inline constexpr size_t FRAGMENT_MAX_HEADER_SIZE = 1 + 3 * 5 + FRAGMENT_TIMESTAMP_SIZE;
+
+// Limits applied by the receiver before allocating reassembly state.
+inline constexpr uint32_t MAX_FRAGMENT_COUNT = 1U << 20;
+inline constexpr size_t MAX_REASSEMBLY_SIZE = 64U << 20;
+
+struct FragmentHeader
+{
+    uint8_t flags = 0;
+    uint32_t session = 0;
+    uint32_t index = 0;
+    uint32_t count = 0;
+    // with FRAGMENT_FLAG_TIMESTAMP
+    uint64_t enqueueTime = 0;
+};
+
+size_t varintSize(uint32_t value);
+size_t fragmentHeaderSize(const FragmentHeader& header);
+
+// Append the encoded header to out.
+void encodeFragmentHeader(const FragmentHeader& header, std::string& out);
+
+// Parse the header of a fragment without copying. On success payload views
+// the bytes that follow the header inside data. Fails on a version mismatch,
+// truncated or oversized varints, a zero count, an index past the count or
+// a truncated timestamp.
+bool decodeFragment(std::string_view data, FragmentHeader& header, std::string_view& payload);
+
+
+/* Reassembly state of one message.
+ *
+ * splitPacket cuts every fragment but the last to the same size, so once the
+ * first non-last fragment arrives the payload buffer is allocated for the
+ * whole message and each fragment is copied straight to its final offset.
+ * A presence bitmap rejects duplicates, and a running byte counter tracks
+ * progress, so every fragment costs O(1) and the message is never rebuilt.
+ * A last fragment that arrives before the chunk size is known is kept aside
+ * until then.
+ */
+class Packet
+{
+public:
+    enum class AddResult { Added, Duplicate, Invalid };
+
+    AddResult addFragment(const FragmentHeader& header, std::string_view payload);
+
+    bool isFull() const { return m_expectedCount > 0 && m_receivedCount == m_expectedCount; }
+    uint32_t expectedCount() const { return m_expectedCount; }
+    uint32_t receivedCount() const { return m_receivedCount; }
+    size_t accumulatedSize() const { return m_accumulatedSize; }
+
+    // Hand over the assembled message. Only meaningful once isFull().
+    std::string takeData();
+
+private:
+    bool placeLast(std::string_view payload);
+
+    uint32_t m_expectedCount = 0;
+    uint32_t m_receivedCount = 0;
+    size_t m_accumulatedSize = 0;
+    size_t m_chunkSize = 0;
+    size_t m_lastSize = 0;
+    std::vector<uint64_t> m_present;
+    std::string m_data;
+    std::string m_pendingLast;
+};
+
+}
@@ -0,0 +1,320 @@
+#ifdef DNS_HAVE_IO_URING
+
+#include <cstring>
+
+#include <algorithm>
+
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ioUring.hpp"
+#include "debugLog.hpp"
+
+
+using namespace std;
+using namespace dns;
+
+
+namespace
+{
+// The kernel reads the tails and writes the heads concurrently with us.
+unsigned int loadAcquire(const unsigned int* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned int* p, unsigned int value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+unsigned char* offset(void* base, unsigned int bytes)
+{
+    return static_cast<unsigned char*>(base) + bytes;
+}
+}
+
+
+IoUring::IoUring()
+    : m_fd(-1)
+    , m_wakeupFd(-1)
+    , m_sqRing(MAP_FAILED)
+    , m_sqRingSize(0)
+    , m_cqRing(MAP_FAILED)
+    , m_cqRingSize(0)
+    , m_sqes(nullptr)
+    , m_sqesSize(0)
+    , m_sqHead(nullptr)
+    , m_sqTail(nullptr)
+    , m_sqArray(nullptr)
+    , m_sqMask(0)
+    , m_sqEntries(0)
+    , m_sqeTail(0)
+    , m_sqeSubmitted(0)
+    , m_cqHead(nullptr)
+    , m_cqTail(nullptr)
+    , m_cqMask(0)
+    , m_cqes(nullptr)
+    , m_bufferRing(nullptr)
+    , m_bufferRingSize(0)
+    , m_bufferCount(0)
+    , m_bufferTail(0)
+    , m_bufferGroup(0)
+    , m_bufferSize(0)
+{
+}
+
+
+IoUring::~IoUring()
+{
+    release();
+}
+
+
+void IoUring::release()
+{
+    // closing the ring also drops the registered buffer ring
+    if(m_fd >= 0)
+        close(m_fd);
+    m_fd = -1;
+
+    if(m_wakeupFd >= 0)
+        close(m_wakeupFd);
+    m_wakeupFd = -1;
+
+    if(m_bufferRing)
+        munmap(m_bufferRing, m_bufferRingSize);
+    m_bufferRing = nullptr;
+
+    if(m_sqes)
+        munmap(m_sqes, m_sqesSize);
+    m_sqes = nullptr;
+
+    if(m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+        munmap(m_cqRing, m_cqRingSize);
+    m_cqRing = MAP_FAILED;
+
+    if(m_sqRing != MAP_FAILED)
+        munmap(m_sqRing, m_sqRingSize);
+    m_sqRing = MAP_FAILED;
+}
+
+
+/**
+ * @brief Create the ring and map its queues.
+ *
+ * Steps:
+ *   1. io_uring_setup() with `entries` submission entries (the kernel
+ *      rounds up to a power of two and sizes the completion queue twice as
+ *      large).
+ *   2. Map the submission ring, the completion ring (the same mapping when
+ *      the kernel reports IORING_FEAT_SINGLE_MMAP) and the submission entry
+ *      array, and keep pointers to the head, tail, mask and array fields at
+ *      the offsets the kernel returned.
+ *   3. Create the wakeup eventfd.
+ *
+ * @return false, with nothing left open, if the kernel has no io_uring
+ *         (ENOSYS) or forbids it (EPERM, e.g. io_uring_disabled or seccomp).
+ */
+bool IoUring::init(unsigned int entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if(m_fd < 0)
+    {
+        DNS_LOG(Error, "IoUring::init", "io_uring_setup() failed: " + std::string(strerror(errno)));
+        return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(singleMmap)
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if(m_sqRing == MAP_FAILED)
+    {
+        DNS_LOG(Error, "IoUring::init", "mmap(SQ ring) failed: " + std::string(strerror(errno)));
+        release();
+        return false;
+    }
+
+    if(singleMmap)
+        m_cqRing = m_sqRing;
+    else
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+    if(m_cqRing == MAP_FAILED)
+    {
+        DNS_LOG(Error, "IoUring::init", "mmap(CQ ring) failed: " + std::string(strerror(errno)));
+        release();
+        return false;
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED)
+    {
+        DNS_LOG(Error, "IoUring::init", "mmap(SQEs) failed: " + std::string(strerror(errno)));
+        release();
+        return false;
+    }
+    m_sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+    m_sqHead = reinterpret_cast<unsigned int*>(offset(m_sqRing, params.sq_off.head));
+    m_sqTail = reinterpret_cast<unsigned int*>(offset(m_sqRing, params.sq_off.tail));
+    m_sqArray = reinterpret_cast<unsigned int*>(offset(m_sqRing, params.sq_off.array));
+    m_sqMask = *reinterpret_cast<unsigned int*>(offset(m_sqRing, params.sq_off.ring_mask));
+    m_sqEntries = params.sq_entries;
+    m_sqeTail = m_sqeSubmitted = *m_sqTail;
+
+    m_cqHead = reinterpret_cast<unsigned int*>(offset(m_cqRing, params.cq_off.head));
+    m_cqTail = reinterpret_cast<unsigned int*>(offset(m_cqRing, params.cq_off.tail));
+    m_cqMask = *reinterpret_cast<unsigned int*>(offset(m_cqRing, params.cq_off.ring_mask));
+    m_cqes = reinterpret_cast<struct io_uring_cqe*>(offset(m_cqRing, params.cq_off.cqes));
+
+    m_wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_wakeupFd < 0)
+    {
+        DNS_LOG(Error, "IoUring::init", "eventfd() failed: " + std::string(strerror(errno)));
+        release();
+        return false;
+    }
+
+    DNS_LOG(Info, "IoUring::init",
+                  "Ring created (fd=" + std::to_string(m_fd) + ", " + std::to_string(params.sq_entries) +
+                      " SQ / " + std::to_string(params.cq_entries) + " CQ entries)");
+    return true;
+}
+
+
+/**
+ * @brief Register a ring of provided buffers.
+ *
+ * The buffer ring is page-aligned anonymous memory shared with the kernel:
+ * an array of {address, length, id} entries whose tail we advance to hand
+ * buffers over. Receives submitted with IOSQE_BUFFER_SELECT and this buffer
+ * group take the next buffer of the ring and report its id in the
+ * completion flags.
+ *
+ * @return false if the kernel does not support buffer rings (before 5.19)
+ *         or the ring cannot be allocated.
+ */
+bool IoUring::registerBuffers(uint16_t group, unsigned int count, size_t bufferSize)
+{
+    if(count == 0 || (count & (count - 1)) != 0 || count > 32768)
+    {
+        DNS_LOG(Warn, "IoUring::registerBuffers", "Buffer count must be a power of two up to 32768");
+        return false;
+    }
+
+    m_bufferRingSize = count * sizeof(struct io_uring_buf);
+    void* ring = mmap(nullptr, m_bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ring == MAP_FAILED)
+    {
+        DNS_LOG(Error, "IoUring::registerBuffers", "mmap() failed: " + std::string(strerror(errno)));
+        return false;
+    }
+    m_bufferRing = static_cast<struct io_uring_buf_ring*>(ring);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(m_bufferRing);
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if(syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    {
+        DNS_LOG(Error, "IoUring::registerBuffers",
+                       "IORING_REGISTER_PBUF_RING failed: " + std::string(strerror(errno)));
+        munmap(m_bufferRing, m_bufferRingSize);
+        m_bufferRing = nullptr;
+        return false;
+    }
+
+    m_bufferCount = count;
+    m_bufferGroup = group;
+    m_bufferSize = bufferSize;
+    m_buffers.assign(count * bufferSize, 0);
+    m_bufferTail = 0;
+    for(unsigned int i = 0; i < count; ++i)
+        recycleBuffer(static_cast<uint16_t>(i));
+
+    DNS_LOG(Info, "IoUring::registerBuffers",
+                  "Registered " + std::to_string(count) + " buffer(s) of " + std::to_string(bufferSize) +
+                      " bytes as group " + std::to_string(group));
+    return true;
+}
+
+
+void IoUring::recycleBuffer(uint16_t bufferId)
+{
+    // not m_bufferRing->bufs: in C++ the UAPI flexible array is laid out
+    // after an empty struct, 8 bytes past the start of the ring
+    struct io_uring_buf* entries = reinterpret_cast<struct io_uring_buf*>(m_bufferRing);
+    struct io_uring_buf& entry = entries[m_bufferTail & (m_bufferCount - 1)];
+    entry.addr = reinterpret_cast<uint64_t>(buffer(bufferId));
+    entry.len = static_cast<uint32_t>(m_bufferSize);
+    entry.bid = bufferId;
+    ++m_bufferTail;
+    __atomic_store_n(&m_bufferRing->tail, m_bufferTail, __ATOMIC_RELEASE);
+}
+
+
+void IoUring::wakeup()
+{
+    uint64_t one = 1;
+    if(write(m_wakeupFd, &one, sizeof(one)) != sizeof(one))
+        DNS_LOG(Error, "IoUring::wakeup", "eventfd write failed: " + std::string(strerror(errno)));
+}
+
+
+struct io_uring_sqe* IoUring::getSqe()
+{
+    if(m_sqeTail - loadAcquire(m_sqHead) >= m_sqEntries)
+        return nullptr;
+
+    const unsigned int index = m_sqeTail & m_sqMask;
+    m_sqArray[index] = index;
+    ++m_sqeTail;
+
+    struct io_uring_sqe* sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+
+int IoUring::submit(unsigned int waitCount)
+{
+    const unsigned int toSubmit = m_sqeTail - m_sqeSubmitted;
+    storeRelease(m_sqTail, m_sqeTail);
+    m_sqeSubmitted = m_sqeTail;
+
+    if(toSubmit == 0 && waitCount == 0)
+        return 0;
+
+    const unsigned int flags = waitCount > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret = static_cast<int>(syscall(__NR_io_uring_enter, m_fd, toSubmit, waitCount, flags, nullptr, 0));
+    return ret < 0 ? -errno : ret;
+}
+
+
+struct io_uring_cqe* IoUring::peekCqe()
+{
+    const unsigned int head = *m_cqHead;
+    if(head == loadAcquire(m_cqTail))
+        return nullptr;
+    return &m_cqes[head & m_cqMask];
+}
+
+
+void IoUring::cqeSeen()
+{
+    storeRelease(m_cqHead, *m_cqHead + 1);
+}
+
+#endif
@@ -0,0 +1,98 @@
+#pragma once
+
+#ifdef DNS_HAVE_IO_URING
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <linux/io_uring.h>
+
+
+namespace dns
+{
+
+/* Minimal io_uring ring driven through the raw syscalls (no liburing).
+ *
+ * Holds one submission/completion queue pair and, optionally, one ring of
+ * provided buffers registered with the kernel, from which it picks a buffer
+ * for every datagram of a buffer-select receive (IORING_REGISTER_PBUF_RING,
+ * Linux 5.19).
+ *
+ * Not thread-safe: a ring is used by one thread at a time, except for
+ * wakeup(), which any thread may call to complete the poll its owner keeps
+ * armed on wakeupFd().
+ */
+class IoUring
+{
+public:
+    IoUring();
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // Create the ring, with room for `entries` queued submissions.
+    bool init(unsigned int entries);
+    // Register `count` buffers (a power of two) of bufferSize bytes as
+    // buffer group `group`, all of them handed to the kernel.
+    bool registerBuffers(uint16_t group, unsigned int count, size_t bufferSize);
+
+    // Next submission entry, zeroed, or nullptr if the queue is full.
+    struct io_uring_sqe* getSqe();
+    // Submit the queued entries, then wait until waitCount completions are
+    // available. Returns the number of entries submitted, or -errno.
+    int submit(unsigned int waitCount);
+
+    // Oldest completion not yet seen, or nullptr.
+    struct io_uring_cqe* peekCqe();
+    void cqeSeen();
+
+    char* buffer(uint16_t bufferId) { return &m_buffers[bufferId * m_bufferSize]; }
+    size_t bufferSize() const { return m_bufferSize; }
+    // Give a provided buffer back to the kernel once its data is consumed.
+    void recycleBuffer(uint16_t bufferId);
+
+    // eventfd made readable by wakeup()
+    int wakeupFd() const { return m_wakeupFd; }
+    void wakeup();
+
+private:
+    void release();
+
+    int m_fd;
+    int m_wakeupFd;
+
+    void* m_sqRing;
+    size_t m_sqRingSize;
+    void* m_cqRing;
+    size_t m_cqRingSize;
+    struct io_uring_sqe* m_sqes;
+    size_t m_sqesSize;
+
+    unsigned int* m_sqHead;
+    unsigned int* m_sqTail;
+    unsigned int* m_sqArray;
+    unsigned int m_sqMask;
+    unsigned int m_sqEntries;
+    // entries filled by getSqe(), and the part of them already submitted
+    unsigned int m_sqeTail;
+    unsigned int m_sqeSubmitted;
+
+    unsigned int* m_cqHead;
+    unsigned int* m_cqTail;
+    unsigned int m_cqMask;
+    struct io_uring_cqe* m_cqes;
+
+    struct io_uring_buf_ring* m_bufferRing;
+    size_t m_bufferRingSize;
+    unsigned int m_bufferCount;
+    uint16_t m_bufferTail;
+    uint16_t m_bufferGroup;
+    size_t m_bufferSize;
+    std::vector<char> m_buffers;
+};
+
+}
+
+#endif
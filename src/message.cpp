@@ -1,6 +1,7 @@
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
 
 #ifdef __linux__
 
@@ -13,6 +14,7 @@
 #endif
 
 #include "message.hpp"
+#include "debugLog.hpp"
 
 using namespace dns;
 using namespace std;
@@ -38,6 +40,8 @@ Message::Message(Type type)
     m_anCount=0;
     m_nsCount=0;
     m_arCount=0;
+
+    m_ednsUdpSize=0;
 }
 
 
@@ -55,6 +59,7 @@ string Message::asString() const
     text << "\tANcount: " << m_anCount << endl;
     text << "\tNScount: " << m_nsCount << endl;
     text << "\tARcount: " << m_arCount << endl;
+    text << "\tEDNS UDP size: " << m_ednsUdpSize << endl;
 
     return text.str();
 }
@@ -77,6 +82,8 @@ void Message::decode_hdr(const char* buffer)
     m_anCount = get16bits(buffer);
     m_nsCount = get16bits(buffer);
     m_arCount = get16bits(buffer);
+
+    m_ednsUdpSize = 0;
 }
 
 
@@ -97,15 +104,98 @@ void Message::code_hdr(char* buffer)
     put16bits(buffer, m_qdCount);
     put16bits(buffer, m_anCount);
     put16bits(buffer, m_nsCount);
-    put16bits(buffer, m_arCount);
+    put16bits(buffer, m_arCount + (m_ednsUdpSize != 0 ? 1U : 0U));
+}
+
+
+/**
+ * @brief Append the OPT pseudo-RR, if an EDNS UDP size is set.
+ *
+ * Root owner name, type OPT, the UDP payload size in the class field, a zero
+ * TTL (extended RCODE, version 0, no DO bit) and no options: 11 bytes.
+ * code_hdr() counts it in ARCOUNT.
+ *
+ * @return false if it does not fit in the writer.
+ */
+bool Message::code_edns(WireWriter& writer)
+{
+    if (m_ednsUdpSize == 0)
+        return true;
+
+    writer.put8(0);
+    writer.put16(OPT_TYPE);
+    writer.put16(static_cast<uint16_t>(m_ednsUdpSize));
+    writer.put32(0);
+    return writer.put16(0);
+}
+
+
+/**
+ * @brief Walk count resource records and pick up the OPT pseudo-RR.
+ *
+ * Every record is skipped, bounded by end: owner name (labels, ending at
+ * the root label or a compression pointer), fixed fields and RDATA. When an
+ * OPT record is found its class gives the requester's UDP payload size,
+ * raised to 512 as RFC 6891 requires, and it is removed from m_arCount. The
+ * walk stops at the first malformed record.
+ */
+void Message::decode_records(const char*& buffer, const char* end, uint count)
+{
+    for (uint i = 0; i < count && buffer < end; ++i)
+    {
+        // owner name
+        while (buffer < end)
+        {
+            const uchar length = static_cast<uchar>(*buffer);
+            if ((length & 0xC0) == 0xC0)
+            {
+                buffer += 2;
+                break;
+            }
+            buffer += 1 + length;
+            if (length == 0)
+                break;
+        }
+
+        if (buffer + 10 > end)
+        {
+            buffer = end;
+            return;
+        }
+
+        const uint type = get16bits(buffer);
+        const uint klass = get16bits(buffer);
+        buffer += 4; // ttl
+        const uint rdLength = get16bits(buffer);
+
+        if (buffer + rdLength > end)
+        {
+            buffer = end;
+            return;
+        }
+        buffer += rdLength;
+
+        if (type == OPT_TYPE && m_ednsUdpSize == 0)
+        {
+            m_ednsUdpSize = std::max(klass, EDNS_MIN_UDP_SIZE);
+            if (m_arCount > 0)
+                --m_arCount;
+        }
+    }
+}
+
+
+// Hex dump of the message at Trace level; built only when it is printed.
+void Message::log_buffer(const char* buffer, int size)
+{
+    DNS_LOG(Trace, "Message::log_buffer", dump_buffer(buffer, size));
 }
 
 
-void Message::log_buffer(const char* buffer, int size)  
+string Message::dump_buffer(const char* buffer, int size)
 {
     ostringstream text;
 
-    text << "Message::log_buffer()" << endl;
     text << "size: " << size << " bytes" << endl;
     text << "---------------------------------" << setfill('0');
 
@@ -119,6 +209,7 @@ void Message::log_buffer(const char* buffer, int size)
     text << endl << setfill(' ');
     text << "---------------------------------";
 
+    return text.str();
 }
 
 
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 
+#include "wireWriter.hpp"
+
 namespace dns 
 {
 
@@ -45,7 +48,11 @@ public:
     enum Type { Query=0, Response };
 
 
-    virtual int code(char* buffer) = 0;
+    // Encode into buffer, writing at most capacity bytes. Returns the size
+    // of the message, or 0 if not even its fixed part fits.
+    virtual int code(char* buffer, size_t capacity) = 0;
+    // Same, for a buffer that holds any DNS message.
+    int code(char* buffer) { return code(buffer, MAX_MESSAGE_SIZE); }
     virtual void decode(const char* buffer, int size) = 0;
 
     uint getID() const { return m_id; }
@@ -55,10 +62,22 @@ public:
     uint getArCount() const { return m_arCount; }
 
     bool isResponse() const { return m_qr != 0; }
+    // TC bit: set by code() when records were left out for lack of room
+    bool isTruncated() const { return m_tc != 0; }
     bool isRecursionDesired() const { return m_rd != 0; }
 
     void setRecursionDesired(bool value) { m_rd = value ? 1U : 0U; }
 
+    // EDNS0 (RFC 6891): UDP payload size carried by the OPT pseudo-RR of the
+    // additional section, 0 if the message has none. Setting a size makes
+    // code() append an OPT record; getArCount() never counts it.
+    uint getEdnsUdpSize() const { return m_ednsUdpSize; }
+    void setEdnsUdpSize(uint size) { m_ednsUdpSize = size; }
+
+    // wire size of an OPT record without options
+    static const uint EDNS_OPT_SIZE = 11;
+    static constexpr size_t MAX_MESSAGE_SIZE = 65535;
+
     void setID(uint id) { m_id = id; }
     void setQdCount(uint count) { m_qdCount = count; }
     void setAnCount(uint count) { m_anCount = count; }
@@ -86,11 +105,16 @@ protected:
     uint m_nsCount;
     uint m_arCount;
 
+    uint m_ednsUdpSize;
+
     virtual std::string asString() const ;
 
     void decode_hdr(const char* buffer) ;
     void code_hdr(char* buffer) ;
 
+    bool code_edns(WireWriter& writer) ;
+    void decode_records(const char*& buffer, const char* end, uint count) ;
+
     int get16bits(const char*& buffer) ;
     int get32bits(const char*& buffer) ;
 
@@ -98,6 +122,7 @@ protected:
     void put32bits(char*& buffer, ulong value) ;
 
     void log_buffer(const char* buffer, int size) ;
+    static std::string dump_buffer(const char* buffer, int size) ;
     
 private:
     static const uint QR_MASK = 0x8000;
@@ -107,6 +132,9 @@ private:
     static const uint RD_MASK = 0x0100;
     static const uint RA_MASK = 0x0080;
     static const uint RCODE_MASK = 0x000F;
+
+    static constexpr uint OPT_TYPE = 41;
+    static constexpr uint EDNS_MIN_UDP_SIZE = 512;
 };
 
 }
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+namespace dns
+{
+
+// Progress of one message being reassembled.
+struct FragmentProgress
+{
+    uint32_t session = 0;
+    uint32_t receivedFragments = 0;
+    uint32_t expectedFragments = 0;
+    size_t receivedBytes = 0;
+};
+
+/* Timing of one message, as seen by the side that sent or received it.
+ *
+ * Times are wall-clock, so the enqueue time carried by timestamped fragments
+ * (see setTransferTimestamps) can be compared with the receiver's clock; the
+ * end-to-end latency then includes the skew between the two hosts. Times the
+ * reporting side does not know are left at the clock's epoch.
+ */
+struct TransferReport
+{
+    using Clock = std::chrono::system_clock;
+
+    // reported by the sender of the message, else by its receiver
+    bool outbound = false;
+    uint32_t session = 0;
+    size_t bytes = 0;
+    uint32_t fragments = 0;
+    // sender: fragments sent again for want of an acknowledgement;
+    // receiver: duplicate fragments received
+    uint32_t retransmits = 0;
+
+    // the sender queued the message
+    Clock::time_point enqueued;
+    // sender: first fragment sent, and last fragment acknowledged (client)
+    // or put in a response (the server gets no acknowledgements)
+    Clock::time_point firstSent;
+    Clock::time_point lastAcked;
+    // receiver: first fragment received, and message reassembled
+    Clock::time_point firstReceived;
+    Clock::time_point completed;
+
+    // From the enqueue time, or the first fragment, to the reassembly or the
+    // last acknowledgement; zero if the report lacks either end.
+    std::chrono::microseconds latency() const
+    {
+        const Clock::time_point start = enqueued != Clock::time_point{} ? enqueued
+                                      : firstSent != Clock::time_point{} ? firstSent : firstReceived;
+        const Clock::time_point end = completed != Clock::time_point{} ? completed : lastAcked;
+        if (start == Clock::time_point{} || end == Clock::time_point{} || end < start)
+            return std::chrono::microseconds(0);
+        return std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+    }
+
+    // Message bytes per second over latency(), 0 if unknown.
+    double goodput() const
+    {
+        const auto elapsed = latency();
+        if (elapsed.count() <= 0)
+            return 0;
+        return static_cast<double>(bytes) * 1e6 / static_cast<double>(elapsed.count());
+    }
+};
+
+/* Receives reassembly events from a Server (see Server::setMessageObserver).
+ *
+ * Callbacks run on the thread that processes the datagrams, outside of any
+ * internal lock: they may call back into the server (getAvailableMessage,
+ * setMessageToSend, ...), except setMessageObserver, but should return
+ * quickly, as the server answers no query meanwhile.
+ */
+class MessageObserver
+{
+public:
+    virtual ~MessageObserver() = default;
+
+    // A new fragment was added to a session of clientId.
+    virtual void onFragmentReceived(const std::string& /*clientId*/, const FragmentProgress& /*progress*/)
+    {
+    }
+
+    // A message of clientId is complete and waits in the ready queue.
+    virtual void onMessageComplete(const std::string& /*clientId*/, uint32_t /*session*/, size_t /*size*/)
+    {
+    }
+
+    // A message from or to clientId has been reassembled, or its last
+    // fragment has gone out.
+    virtual void onTransferComplete(const std::string& /*clientId*/, const TransferReport& /*report*/)
+    {
+    }
+};
+
+}
@@ -0,0 +1,238 @@
+#include "messageView.hpp"
+
+#include <algorithm>
+
+
+using namespace dns;
+
+
+namespace
+{
+const uint16_t OPT_TYPE = 41;
+const uint16_t EDNS_MIN_UDP_SIZE = 512;
+const size_t HEADER_SIZE = 12;
+
+uint16_t read16(const char* data)
+{
+    return static_cast<uint16_t>(static_cast<uint8_t>(data[0]) << 8 | static_cast<uint8_t>(data[1]));
+}
+
+uint32_t read32(const char* data)
+{
+    return static_cast<uint32_t>(read16(data)) << 16 | read16(data + 2);
+}
+}
+
+
+bool NameView::copyTo(std::string& out) const
+{
+    out.clear();
+    return forEachLabel([&out](std::string_view label) {
+        if (!out.empty())
+            out.push_back('.');
+        out.append(label);
+    });
+}
+
+
+/**
+ * @brief Decode the RDATA as text, the way Response::decode() does.
+ *
+ * TXT character-strings are concatenated, names are followed through
+ * compression pointers into the rest of the message, an MX record gives its
+ * exchange. Other types are copied as they are; A and AAAA are not turned
+ * into hex.
+ *
+ * @return false if the RDATA is malformed; out then holds what was read.
+ */
+bool RecordView::copyRdata(std::string& out) const
+{
+    out.clear();
+
+    switch (type)
+    {
+        case 16: // TXT
+        {
+            size_t pos = 0;
+            while (pos < rdata.size())
+            {
+                const size_t length = static_cast<uint8_t>(rdata[pos]);
+                if (pos + 1 + length > rdata.size())
+                    return false;
+                out.append(rdata.substr(pos + 1, length));
+                pos += 1 + length;
+            }
+            return true;
+        }
+        case 5:  // CNAME
+        case 2:  // NS
+        case 12: // PTR
+            return NameView(message, messageSize, rdataOffset).copyTo(out);
+        case 15: // MX
+            if (rdata.size() < 2)
+                return false;
+            return NameView(message, messageSize, rdataOffset + 2).copyTo(out);
+        default:
+            out.assign(rdata);
+            return true;
+    }
+}
+
+
+bool HeaderView::parseHeader(const char* buffer, size_t size)
+{
+    m_message = buffer;
+    m_size = size;
+    m_cursor = HEADER_SIZE;
+    m_ednsUdpSize = 0;
+    m_qname = NameView();
+    m_qType = 0;
+    m_qClass = 0;
+
+    if (size < HEADER_SIZE)
+    {
+        m_id = m_flags = m_qdCount = m_anCount = m_nsCount = m_arCount = 0;
+        return false;
+    }
+
+    m_id = read16(buffer);
+    m_flags = read16(buffer + 2);
+    m_qdCount = read16(buffer + 4);
+    m_anCount = read16(buffer + 6);
+    m_nsCount = read16(buffer + 8);
+    m_arCount = read16(buffer + 10);
+    return true;
+}
+
+
+bool HeaderView::parseQuestion()
+{
+    for (unsigned int i = 0; i < m_qdCount; ++i)
+    {
+        NameView name(m_message, m_size, m_cursor);
+        size_t next = 0;
+        if (!name.skip(next) || next + 4 > m_size)
+            return false;
+
+        if (i == 0)
+        {
+            m_qname = name;
+            m_qType = read16(m_message + next);
+            m_qClass = read16(m_message + next + 2);
+        }
+        m_cursor = next + 4;
+    }
+    return true;
+}
+
+
+bool HeaderView::readRecord(const char* message, size_t size, size_t& cursor, RecordView& record)
+{
+    record.name = NameView(message, size, cursor);
+    size_t next = 0;
+    if (!record.name.skip(next) || next + 10 > size)
+        return false;
+
+    record.type = read16(message + next);
+    record.klass = read16(message + next + 2);
+    record.ttl = read32(message + next + 4);
+    const size_t rdLength = read16(message + next + 8);
+    next += 10;
+    if (next + rdLength > size)
+        return false;
+
+    record.rdata = std::string_view(message + next, rdLength);
+    record.message = message;
+    record.messageSize = size;
+    record.rdataOffset = next;
+    cursor = next + rdLength;
+    return true;
+}
+
+
+// The first OPT record gives the EDNS0 size and is not counted in arCount().
+// The walk stops at the first malformed record.
+void HeaderView::parseAdditional(unsigned int count)
+{
+    RecordView record;
+    for (unsigned int i = 0; i < count && readRecord(m_message, m_size, m_cursor, record); ++i)
+    {
+        if (record.type == OPT_TYPE && m_ednsUdpSize == 0)
+        {
+            m_ednsUdpSize = std::max(record.klass, EDNS_MIN_UDP_SIZE);
+            if (m_arCount > 0)
+                --m_arCount;
+        }
+    }
+}
+
+
+/**
+ * @brief Parse a query in place.
+ *
+ * Steps:
+ *   1. Read the header; fail if the datagram is shorter than 12 bytes or has
+ *      no question.
+ *   2. Read the first question: QNAME position, QTYPE and QCLASS.
+ *   3. Walk the records that follow, whatever section they are in, to pick
+ *      up an EDNS0 OPT record, as Query::decode() does.
+ */
+bool QueryView::parse(const char* buffer, size_t size)
+{
+    if (!parseHeader(buffer, size) || m_qdCount == 0)
+        return false;
+
+    if (!parseQuestion())
+        return false;
+
+    parseAdditional(static_cast<unsigned int>(m_anCount) + m_nsCount + m_arCount);
+    return true;
+}
+
+
+/**
+ * @brief Parse a response in place.
+ *
+ * Steps:
+ *   1. Read the header and the question section.
+ *   2. Record the offset of each answer record, up to MAX_ANSWERS, checking
+ *      its name, fixed fields and RDATA length against the buffer.
+ *   3. Skip the authority section and look for an EDNS0 OPT record in the
+ *      additional section.
+ */
+bool ResponseView::parse(const char* buffer, size_t size)
+{
+    m_answerCount = 0;
+
+    if (!parseHeader(buffer, size) || !parseQuestion())
+        return false;
+
+    RecordView record;
+    for (unsigned int i = 0; i < m_anCount; ++i)
+    {
+        const size_t offset = m_cursor;
+        if (!readRecord(m_message, m_size, m_cursor, record))
+            return false;
+        if (m_answerCount < MAX_ANSWERS)
+            m_answerOffsets[m_answerCount++] = static_cast<uint16_t>(offset);
+    }
+
+    for (unsigned int i = 0; i < m_nsCount; ++i)
+    {
+        if (!readRecord(m_message, m_size, m_cursor, record))
+            return false;
+    }
+
+    parseAdditional(m_arCount);
+    return true;
+}
+
+
+RecordView ResponseView::answer(size_t index) const
+{
+    // parse() checked the record already
+    size_t cursor = m_answerOffsets[index];
+    RecordView record;
+    readRecord(m_message, m_size, cursor, record);
+    return record;
+}
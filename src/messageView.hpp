@@ -0,0 +1,202 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+
+namespace dns
+{
+
+/* Non-owning views over a DNS message sitting in a receive buffer.
+ *
+ * Parsing checks every length against the end of the buffer and copies
+ * nothing: names are read label by label where they lie, RDATA is a span of
+ * the buffer. The buffer must outlive the views. Query and Response decode
+ * into owned strings; these views let hot paths parse a datagram without
+ * allocating.
+ */
+
+// A domain name inside a message, possibly compressed (RFC 1035 4.1.4).
+class NameView
+{
+public:
+    NameView() = default;
+    NameView(const char* message, size_t size, size_t offset)
+        : m_message(message), m_size(size), m_offset(offset) {}
+
+    // Call visit(std::string_view label) for each label, following
+    // compression pointers. On success, `next` (if given) is the offset just
+    // after the name as written at its own offset. false if the name runs
+    // out of the message, uses a reserved label type or follows more than
+    // MAX_POINTER_HOPS pointers (a compression loop).
+    template <typename Visitor>
+    bool forEachLabel(Visitor&& visit, size_t* next = nullptr) const;
+
+    // Offset just after the name; false if it is malformed.
+    bool skip(size_t& next) const { return forEachLabel([](std::string_view) {}, &next); }
+    // Write the name, dot separated, to out. The capacity of out is reused,
+    // so a string kept across calls stops allocating.
+    bool copyTo(std::string& out) const;
+
+    static constexpr unsigned int MAX_POINTER_HOPS = 64;
+
+private:
+    const char* m_message = nullptr;
+    size_t m_size = 0;
+    size_t m_offset = 0;
+};
+
+
+// A resource record: owner name, fixed fields and RDATA.
+struct RecordView
+{
+    NameView name;
+    uint16_t type = 0;
+    uint16_t klass = 0;
+    uint32_t ttl = 0;
+    std::string_view rdata;
+
+    // Where the record lives, to read names inside the RDATA.
+    const char* message = nullptr;
+    size_t messageSize = 0;
+    size_t rdataOffset = 0;
+
+    // Write the RDATA to out as Response::decode() would: TXT
+    // character-strings concatenated, CNAME/NS/PTR/MX targets dotted, other
+    // types as raw bytes. Reuses the capacity of out.
+    bool copyRdata(std::string& out) const;
+};
+
+
+// Header fields shared by QueryView and ResponseView.
+class HeaderView
+{
+public:
+    uint16_t id() const { return m_id; }
+    bool isResponse() const { return (m_flags & 0x8000) != 0; }
+    bool isRecursionDesired() const { return (m_flags & 0x0100) != 0; }
+    bool isTruncated() const { return (m_flags & 0x0200) != 0; }
+    unsigned int rcode() const { return m_flags & 0x000F; }
+    uint16_t qdCount() const { return m_qdCount; }
+    uint16_t anCount() const { return m_anCount; }
+    uint16_t nsCount() const { return m_nsCount; }
+    // not counting the OPT record, as Message::getArCount()
+    uint16_t arCount() const { return m_arCount; }
+    // EDNS0 UDP payload size of the OPT record (at least 512), 0 without one
+    uint16_t ednsUdpSize() const { return m_ednsUdpSize; }
+
+    const char* data() const { return m_message; }
+    size_t size() const { return m_size; }
+
+protected:
+    // Read the header; false if the buffer is shorter than one.
+    bool parseHeader(const char* buffer, size_t size);
+    // Read the first question, skipping the others, from m_cursor.
+    bool parseQuestion();
+    // Read the record at cursor and move cursor past it.
+    static bool readRecord(const char* message, size_t size, size_t& cursor, RecordView& record);
+    // Walk count records of the additional section looking for OPT.
+    void parseAdditional(unsigned int count);
+
+    const char* m_message = nullptr;
+    size_t m_size = 0;
+    size_t m_cursor = 0;
+
+    uint16_t m_id = 0;
+    uint16_t m_flags = 0;
+    uint16_t m_qdCount = 0;
+    uint16_t m_anCount = 0;
+    uint16_t m_nsCount = 0;
+    uint16_t m_arCount = 0;
+    uint16_t m_ednsUdpSize = 0;
+
+    NameView m_qname;
+    uint16_t m_qType = 0;
+    uint16_t m_qClass = 0;
+};
+
+
+// A query: header, question and the EDNS0 size of its OPT record.
+class QueryView : public HeaderView
+{
+public:
+    // false if the datagram is not a well-formed query with a question;
+    // the header is still readable when it is at least 12 bytes.
+    bool parse(const char* buffer, size_t size);
+
+    const NameView& qname() const { return m_qname; }
+    uint16_t qType() const { return m_qType; }
+    uint16_t qClass() const { return m_qClass; }
+};
+
+
+// A response: header, question and answer records.
+class ResponseView : public HeaderView
+{
+public:
+    // false if the header or a record is malformed; the answers read until
+    // then stay available.
+    bool parse(const char* buffer, size_t size);
+
+    const NameView& questionName() const { return m_qname; }
+    uint16_t questionType() const { return m_qType; }
+    uint16_t questionClass() const { return m_qClass; }
+
+    // Answers read, at most MAX_ANSWERS.
+    size_t answerCount() const { return m_answerCount; }
+    RecordView answer(size_t index) const;
+
+    static constexpr size_t MAX_ANSWERS = 256;
+
+private:
+    // offsets of the answer records, parsed again on demand
+    std::array<uint16_t, MAX_ANSWERS> m_answerOffsets{};
+    size_t m_answerCount = 0;
+};
+
+
+template <typename Visitor>
+bool NameView::forEachLabel(Visitor&& visit, size_t* next) const
+{
+    size_t offset = m_offset;
+    unsigned int hops = 0;
+    bool jumped = false;
+
+    while (offset < m_size)
+    {
+        const uint8_t length = static_cast<uint8_t>(m_message[offset]);
+
+        if ((length & 0xC0) == 0xC0)
+        {
+            if (offset + 1 >= m_size || ++hops > MAX_POINTER_HOPS)
+                return false;
+            if (!jumped && next)
+                *next = offset + 2;
+            jumped = true;
+            offset = (static_cast<size_t>(length & 0x3F) << 8) | static_cast<uint8_t>(m_message[offset + 1]);
+            continue;
+        }
+        // 0x40 and 0x80 label types are reserved
+        if ((length & 0xC0) != 0)
+            return false;
+
+        if (length == 0)
+        {
+            if (!jumped && next)
+                *next = offset + 1;
+            return true;
+        }
+
+        if (offset + 1 + length > m_size)
+            return false;
+        visit(std::string_view(m_message + offset + 1, length));
+        offset += 1 + length;
+    }
+
+    return false;
+}
+
+}
@@ -0,0 +1,495 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+
+using namespace dns;
+
+
+namespace
+{
+const char* const COUNTER_NAMES[COUNTER_COUNT] = {
+    "parse_failures_total",
+    "bytes_in_total",
+    "bytes_out_total",
+    "fragments_in_total",
+    "fragments_out_total",
+    "fragments_discarded_total",
+    "messages_in_total",
+    "messages_out_total",
+    "nxdomain_total",
+    "truncated_total",
+    "send_errors_total",
+    "sessions_dropped_total",
+};
+
+const char* const COUNTER_HELP[COUNTER_COUNT] = {
+    "Datagrams that are not a well-formed query.",
+    "Query bytes received.",
+    "Response bytes sent.",
+    "Fragments added to a reassembly.",
+    "Fragments queued for sending.",
+    "Fragments with a bad header or an inconsistent count.",
+    "Messages reassembled.",
+    "Messages split into fragments.",
+    "Responses with RCODE NXDOMAIN.",
+    "Responses with the TC bit set.",
+    "Replies the socket did not take.",
+    "Incomplete sessions abandoned by their sender or evicted.",
+};
+
+const char* const GAUGE_NAMES[GAUGE_COUNT] = {
+    "queued_fragments",
+    "sessions",
+};
+
+const char* const GAUGE_HELP[GAUGE_COUNT] = {
+    "Fragments waiting to be sent, all clients.",
+    "Sessions being reassembled, all clients.",
+};
+
+const char* const HISTOGRAM_NAMES[HISTOGRAM_COUNT] = {
+    "process",
+    "send",
+    "receive_delay",
+    "decode",
+    "prepare",
+    "encode",
+    "lock_wait",
+    "message_latency",
+};
+
+const char* const HISTOGRAM_HELP[HISTOGRAM_COUNT] = {
+    "Time to reassemble and answer one decoded query.",
+    "Time of one sendto() or sendmmsg() call handing replies to the socket.",
+    "Time from the kernel receiving a query to the server reading it.",
+    "Time to parse one datagram into a query.",
+    "Time to add the fragment of a query and choose its answer.",
+    "Time to write one response.",
+    "Time waiting for the session mutex while another thread held it.",
+    "Time from the sender queuing a message to its reassembly, from fragment timestamps.",
+};
+
+const double QUANTILES[] = {0.5, 0.99, 0.999};
+const char* const QUANTILE_NAMES[] = {"0.5", "0.99", "0.999"};
+const char* const QUANTILE_SHORT_NAMES[] = {"p50", "p99", "p999"};
+
+const char* const QTYPE_NAMES[QTYPE_BUCKET_COUNT] = {"A", "CNAME", "NULL", "MX", "TXT", "AAAA", "other"};
+
+// each thread sticks to the shard it is given first
+std::atomic<size_t> nextShard{0};
+
+std::string seconds(uint64_t nanoseconds)
+{
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.9g", static_cast<double>(nanoseconds) / 1e9);
+    return text;
+}
+
+std::string escapeLabel(const std::string& value)
+{
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (char c : value)
+    {
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+        if (c == '\n')
+        {
+            escaped += "\\n";
+            continue;
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+} // namespace
+
+
+/**
+ * @brief Value at quantile q.
+ *
+ * Walks the buckets up to the one holding the value of rank ceil(q * count)
+ * and returns its largest duration, capped by the largest recorded value,
+ * as HdrHistogram does.
+ */
+uint64_t HistogramSnapshot::percentile(double q) const
+{
+    if (count == 0)
+        return 0;
+
+    const double target = std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(count));
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(target));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i)
+    {
+        seen += buckets[i];
+        // the last bucket also holds the durations beyond its bound
+        if (seen >= rank)
+            return i == LATENCY_BUCKET_COUNT - 1 ? maxNanoseconds : std::min(Metrics::latencyBucketBound(i), maxNanoseconds);
+    }
+    return maxNanoseconds;
+}
+
+
+uint64_t MetricsSnapshot::totalQueries() const
+{
+    uint64_t total = 0;
+    for (uint64_t count : queries)
+        total += count;
+    return total;
+}
+
+
+Metrics::Metrics()
+    : m_shards(new Shard[SHARD_COUNT])
+{
+}
+
+
+Metrics::Shard& Metrics::shard()
+{
+    thread_local const size_t index = nextShard.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+    return m_shards[index];
+}
+
+
+void Metrics::add(Counter counter, uint64_t value)
+{
+    shard().counters[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+}
+
+
+void Metrics::countQuery(unsigned int qType)
+{
+    shard().queries[qTypeBucket(qType)].fetch_add(1, std::memory_order_relaxed);
+}
+
+
+void Metrics::record(Histogram histogram, std::chrono::nanoseconds duration)
+{
+    const uint64_t nanoseconds = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+
+    HistogramShard& target = shard().histograms[static_cast<size_t>(histogram)];
+    target.buckets[latencyBucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    target.count.fetch_add(1, std::memory_order_relaxed);
+    target.sumNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    // only the thread of this shard raises its maximum, usually not at all
+    uint64_t max = target.maxNanoseconds.load(std::memory_order_relaxed);
+    while (nanoseconds > max && !target.maxNanoseconds.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed))
+    {
+    }
+}
+
+
+void Metrics::adjust(Gauge gauge, int64_t delta)
+{
+    m_gauges[static_cast<size_t>(gauge)].fetch_add(delta, std::memory_order_relaxed);
+}
+
+
+void Metrics::set(Gauge gauge, int64_t value)
+{
+    m_gauges[static_cast<size_t>(gauge)].store(value, std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief Sum the shards.
+ *
+ * The values are read one by one while the I/O threads go on counting, so
+ * a snapshot is not a single instant; each value is exact for some moment
+ * during the call and never goes backwards.
+ */
+MetricsSnapshot Metrics::snapshot() const
+{
+    MetricsSnapshot result;
+    for (size_t s = 0; s < SHARD_COUNT; ++s)
+    {
+        const Shard& source = m_shards[s];
+        for (size_t i = 0; i < COUNTER_COUNT; ++i)
+            result.counters[i] += source.counters[i].load(std::memory_order_relaxed);
+        for (size_t i = 0; i < QTYPE_BUCKET_COUNT; ++i)
+            result.queries[i] += source.queries[i].load(std::memory_order_relaxed);
+        for (size_t h = 0; h < HISTOGRAM_COUNT; ++h)
+        {
+            HistogramSnapshot& histogram = result.histograms[h];
+            for (size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i)
+                histogram.buckets[i] += source.histograms[h].buckets[i].load(std::memory_order_relaxed);
+            histogram.count += source.histograms[h].count.load(std::memory_order_relaxed);
+            histogram.sumNanoseconds += source.histograms[h].sumNanoseconds.load(std::memory_order_relaxed);
+            histogram.maxNanoseconds = std::max(histogram.maxNanoseconds,
+                                                source.histograms[h].maxNanoseconds.load(std::memory_order_relaxed));
+        }
+    }
+    for (size_t i = 0; i < GAUGE_COUNT; ++i)
+        result.gauges[i] = m_gauges[i].load(std::memory_order_relaxed);
+    return result;
+}
+
+
+size_t Metrics::qTypeBucket(unsigned int qType)
+{
+    switch (qType)
+    {
+    case 1:  return 0; // A
+    case 5:  return 1; // CNAME
+    case 10: return 2; // NULL
+    case 15: return 3; // MX
+    case 16: return 4; // TXT
+    case 28: return 5; // AAAA
+    default: return 6;
+    }
+}
+
+
+const char* Metrics::qTypeBucketName(size_t bucket)
+{
+    return bucket < QTYPE_BUCKET_COUNT ? QTYPE_NAMES[bucket] : "other";
+}
+
+
+const char* Metrics::histogramName(Histogram histogram)
+{
+    const size_t index = static_cast<size_t>(histogram);
+    return index < HISTOGRAM_COUNT ? HISTOGRAM_NAMES[index] : "";
+}
+
+
+/**
+ * @brief Log-linear bucket of a duration.
+ *
+ * Durations below 2^LATENCY_SUB_BUCKET_BITS ns have a bucket each. Above,
+ * the power of two of the duration selects a group of 16 buckets and the
+ * 4 bits after its leading one select the bucket in the group.
+ */
+size_t Metrics::latencyBucket(uint64_t nanoseconds)
+{
+    constexpr uint64_t subBuckets = uint64_t{1} << LATENCY_SUB_BUCKET_BITS;
+    if (nanoseconds < subBuckets)
+        return static_cast<size_t>(nanoseconds);
+
+    const size_t magnitude = static_cast<size_t>(std::bit_width(nanoseconds)) - 1;
+    if (magnitude >= LATENCY_MAX_BITS)
+        return LATENCY_BUCKET_COUNT - 1;
+
+    const size_t shift = magnitude - LATENCY_SUB_BUCKET_BITS;
+    const size_t group = magnitude - LATENCY_SUB_BUCKET_BITS + 1;
+    return (group << LATENCY_SUB_BUCKET_BITS) + static_cast<size_t>((nanoseconds >> shift) & (subBuckets - 1));
+}
+
+
+uint64_t Metrics::latencyBucketBound(size_t bucket)
+{
+    constexpr uint64_t subBuckets = uint64_t{1} << LATENCY_SUB_BUCKET_BITS;
+    if (bucket < subBuckets)
+        return bucket;
+
+    const size_t group = bucket >> LATENCY_SUB_BUCKET_BITS;
+    const size_t shift = group - 1;
+    const uint64_t lowest = (subBuckets + (bucket & (subBuckets - 1))) << shift;
+    return lowest + (uint64_t{1} << shift) - 1;
+}
+
+
+/**
+ * @brief Format snapshot in the Prometheus text exposition format.
+ *
+ * Steps:
+ *   1. Queries as one counter labelled by qtype.
+ *   2. The other counters and the gauges, each with HELP and TYPE lines.
+ *   3. Per-client queue depths, labelled by client, when the snapshot has
+ *      them.
+ *   4. Histograms in seconds with _sum, _count and cumulative "le"
+ *      buckets at each power of two of nanoseconds from 2^10 (about 1 us),
+ *      which are bucket boundaries of the log-linear histograms, then their
+ *      p50, p99 and p999 as a gauge labelled by quantile.
+ */
+std::string dns::toPrometheus(const MetricsSnapshot& snapshot, const std::string& prefix)
+{
+    std::ostringstream out;
+
+    out << "# HELP " << prefix << "_queries_total Queries received, by QTYPE.\n";
+    out << "# TYPE " << prefix << "_queries_total counter\n";
+    for (size_t i = 0; i < QTYPE_BUCKET_COUNT; ++i)
+        out << prefix << "_queries_total{qtype=\"" << QTYPE_NAMES[i] << "\"} " << snapshot.queries[i] << '\n';
+
+    for (size_t i = 0; i < COUNTER_COUNT; ++i)
+    {
+        out << "# HELP " << prefix << '_' << COUNTER_NAMES[i] << ' ' << COUNTER_HELP[i] << '\n';
+        out << "# TYPE " << prefix << '_' << COUNTER_NAMES[i] << " counter\n";
+        out << prefix << '_' << COUNTER_NAMES[i] << ' ' << snapshot.counters[i] << '\n';
+    }
+
+    for (size_t i = 0; i < GAUGE_COUNT; ++i)
+    {
+        out << "# HELP " << prefix << '_' << GAUGE_NAMES[i] << ' ' << GAUGE_HELP[i] << '\n';
+        out << "# TYPE " << prefix << '_' << GAUGE_NAMES[i] << " gauge\n";
+        out << prefix << '_' << GAUGE_NAMES[i] << ' ' << snapshot.gauges[i] << '\n';
+    }
+
+    if (!snapshot.queueDepths.empty())
+    {
+        out << "# HELP " << prefix << "_client_queued_fragments Fragments waiting to be sent, by client.\n";
+        out << "# TYPE " << prefix << "_client_queued_fragments gauge\n";
+        for (const auto& [client, depth] : snapshot.queueDepths)
+            out << prefix << "_client_queued_fragments{client=\"" << escapeLabel(client) << "\"} " << depth << '\n';
+    }
+
+    constexpr size_t firstExportedBits = 10;
+    for (size_t h = 0; h < HISTOGRAM_COUNT; ++h)
+    {
+        const HistogramSnapshot& histogram = snapshot.histograms[h];
+        const std::string name = prefix + '_' + HISTOGRAM_NAMES[h] + "_seconds";
+        out << "# HELP " << name << ' ' << HISTOGRAM_HELP[h] << '\n';
+        out << "# TYPE " << name << " histogram\n";
+
+        uint64_t cumulative = 0;
+        size_t bucket = 0;
+        for (size_t bits = firstExportedBits; bits < LATENCY_MAX_BITS; ++bits)
+        {
+            const uint64_t bound = uint64_t{1} << bits;
+            for (; bucket < LATENCY_BUCKET_COUNT && Metrics::latencyBucketBound(bucket) < bound; ++bucket)
+                cumulative += histogram.buckets[bucket];
+            out << name << "_bucket{le=\"" << seconds(bound) << "\"} " << cumulative << '\n';
+        }
+        out << name << "_bucket{le=\"+Inf\"} " << histogram.count << '\n';
+        out << name << "_sum " << seconds(histogram.sumNanoseconds) << '\n';
+        out << name << "_count " << histogram.count << '\n';
+
+        out << "# HELP " << name << "_quantile " << HISTOGRAM_HELP[h] << " Quantiles since start.\n";
+        out << "# TYPE " << name << "_quantile gauge\n";
+        for (size_t q = 0; q < std::size(QUANTILES); ++q)
+            out << name << "_quantile{quantile=\"" << QUANTILE_NAMES[q] << "\"} "
+                << seconds(histogram.percentile(QUANTILES[q])) << '\n';
+    }
+
+    return out.str();
+}
+
+
+/**
+ * @brief Summarize the latency histograms, for benchmarks and logs.
+ *
+ * Histograms without values are left out. Durations are in microseconds.
+ */
+std::string dns::formatLatencies(const MetricsSnapshot& snapshot)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    for (size_t h = 0; h < HISTOGRAM_COUNT; ++h)
+    {
+        const HistogramSnapshot& histogram = snapshot.histograms[h];
+        if (histogram.count == 0)
+            continue;
+
+        out << std::left << std::setw(14) << HISTOGRAM_NAMES[h] << std::right
+            << " n=" << histogram.count;
+        for (size_t q = 0; q < std::size(QUANTILES); ++q)
+            out << ' ' << QUANTILE_SHORT_NAMES[q] << '=' << static_cast<double>(histogram.percentile(QUANTILES[q])) / 1000 << "us";
+        out << " max=" << static_cast<double>(histogram.maxNanoseconds) / 1000 << "us\n";
+    }
+    return out.str();
+}
+
+
+MetricsExporter::MetricsExporter()
+    : m_period(std::chrono::seconds(10))
+    , m_stopping(false)
+{
+}
+
+
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+}
+
+
+bool MetricsExporter::startFile(Source source, const std::string& path, std::chrono::milliseconds period)
+{
+    return start(std::move(source), [path](const std::string& text) { writeFile(path, text); }, period);
+}
+
+
+bool MetricsExporter::startCallback(Source source, Sink sink, std::chrono::milliseconds period)
+{
+    return start(std::move(source), std::move(sink), period);
+}
+
+
+bool MetricsExporter::start(Source source, Sink sink, std::chrono::milliseconds period)
+{
+    if (m_thread.joinable() || !source || !sink || period.count() <= 0)
+        return false;
+
+    m_source = std::move(source);
+    m_sink = std::move(sink);
+    m_period = period;
+    m_stopping = false;
+    m_thread = std::thread(&MetricsExporter::run, this);
+    return true;
+}
+
+
+void MetricsExporter::stop()
+{
+    if (!m_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wakeup.notify_all();
+    m_thread.join();
+}
+
+
+/**
+ * @brief Export every period until stopped, then once more.
+ */
+void MetricsExporter::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping)
+    {
+        m_wakeup.wait_for(lock, m_period, [this] { return m_stopping; });
+        lock.unlock();
+        m_sink(toPrometheus(m_source()));
+        lock.lock();
+    }
+}
+
+
+/**
+ * @brief Replace the file at path with text.
+ *
+ * Steps:
+ *   1. Write text to path + ".tmp".
+ *   2. Rename it over path, so readers see the old file or the new one,
+ *      never a part of it.
+ */
+bool MetricsExporter::writeFile(const std::string& path, const std::string& text)
+{
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+        file << text;
+        if (!file.flush())
+            return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    return !error;
+}
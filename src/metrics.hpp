@@ -0,0 +1,206 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace dns
+{
+
+/* Tunnel metrics.
+ *
+ * Counters and histograms are sharded: each thread adds to one of
+ * SHARD_COUNT cache-line aligned shards with relaxed atomics, so the I/O
+ * threads do not share cache lines and never take a lock. snapshot() sums
+ * the shards. Gauges follow state kept under the Dns mutex and are plain
+ * atomics.
+ */
+
+enum class Counter
+{
+    ParseFailures = 0,   // datagrams that are not a well-formed query
+    BytesIn,             // query bytes received
+    BytesOut,            // response bytes sent
+    FragmentsIn,         // fragments added to a reassembly
+    FragmentsOut,        // fragments queued by splitPacket
+    FragmentsDiscarded,  // fragments with a bad header or inconsistent count
+    MessagesIn,          // messages reassembled
+    MessagesOut,         // messages split into fragments
+    NxDomain,            // responses with RCODE NameError
+    Truncated,           // responses with the TC bit
+    SendErrors,          // replies the socket did not take
+    SessionsDropped,     // incomplete sessions abandoned by their sender or evicted
+    Count
+};
+
+enum class Gauge
+{
+    QueuedFragments = 0, // fragments waiting in m_msgQueue, all clients
+    Sessions,            // sessions being reassembled, all clients
+    Count
+};
+
+// Latencies of the stages of a query, from the kernel receiving it to the
+// reply being handed back to the socket, and of whole messages.
+enum class Histogram
+{
+    ProcessLatency = 0,  // prepare and encode of one query
+    SendLatency,         // one sendto() or sendmmsg() of replies
+    ReceiveDelay,        // kernel receive timestamp (SO_TIMESTAMPNS) to read
+    Decode,              // parse of the datagram into a Query
+    Prepare,             // reassembly of the fragment and choice of the answer
+    Encode,              // write of the response
+    LockWait,            // wait for the Dns mutex, when another thread held it
+    MessageLatency,      // enqueue time carried by a message to its reassembly
+    Count
+};
+
+inline constexpr size_t COUNTER_COUNT = static_cast<size_t>(Counter::Count);
+inline constexpr size_t GAUGE_COUNT = static_cast<size_t>(Gauge::Count);
+inline constexpr size_t HISTOGRAM_COUNT = static_cast<size_t>(Histogram::Count);
+
+// Queries are counted by QTYPE: A, CNAME, NULL, MX, TXT, AAAA and the rest.
+inline constexpr size_t QTYPE_BUCKET_COUNT = 7;
+// Latency histograms are log-linear (HDR style): each power of two of
+// nanoseconds is split into 2^LATENCY_SUB_BUCKET_BITS buckets, so a value is
+// known within 1/16 of itself, up to 2^LATENCY_MAX_BITS ns (about 69 s);
+// longer durations go to the last bucket.
+inline constexpr size_t LATENCY_SUB_BUCKET_BITS = 4;
+inline constexpr size_t LATENCY_MAX_BITS = 36;
+inline constexpr size_t LATENCY_BUCKET_COUNT = (LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) << LATENCY_SUB_BUCKET_BITS;
+
+
+struct HistogramSnapshot
+{
+    std::array<uint64_t, LATENCY_BUCKET_COUNT> buckets{};
+    uint64_t count = 0;
+    uint64_t sumNanoseconds = 0;
+    uint64_t maxNanoseconds = 0;
+
+    // Smallest recorded duration not exceeded by the fraction q (0.99 for
+    // p99) of the values, to the precision of its bucket; 0 if empty.
+    uint64_t percentile(double q) const;
+};
+
+struct MetricsSnapshot
+{
+    std::array<uint64_t, COUNTER_COUNT> counters{};
+    std::array<uint64_t, QTYPE_BUCKET_COUNT> queries{};
+    std::array<int64_t, GAUGE_COUNT> gauges{};
+    std::array<HistogramSnapshot, HISTOGRAM_COUNT> histograms{};
+    // fragments queued for each client, when the owner could read them
+    std::vector<std::pair<std::string, size_t>> queueDepths;
+
+    uint64_t counter(Counter c) const { return counters[static_cast<size_t>(c)]; }
+    int64_t gauge(Gauge g) const { return gauges[static_cast<size_t>(g)]; }
+    const HistogramSnapshot& histogram(Histogram h) const { return histograms[static_cast<size_t>(h)]; }
+    uint64_t totalQueries() const;
+};
+
+
+class Metrics
+{
+public:
+    Metrics();
+
+    void add(Counter counter, uint64_t value = 1);
+    void countQuery(unsigned int qType);
+    void record(Histogram histogram, std::chrono::nanoseconds duration);
+
+    void adjust(Gauge gauge, int64_t delta);
+    void set(Gauge gauge, int64_t value);
+
+    MetricsSnapshot snapshot() const;
+
+    static constexpr size_t SHARD_COUNT = 16;
+
+    static size_t qTypeBucket(unsigned int qType);
+    static const char* qTypeBucketName(size_t bucket);
+    static const char* histogramName(Histogram histogram);
+    // Latency bucket of a duration, and the largest duration of a bucket, in
+    // nanoseconds.
+    static size_t latencyBucket(uint64_t nanoseconds);
+    static uint64_t latencyBucketBound(size_t bucket);
+
+private:
+    struct HistogramShard
+    {
+        std::array<std::atomic<uint64_t>, LATENCY_BUCKET_COUNT> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sumNanoseconds{0};
+        std::atomic<uint64_t> maxNanoseconds{0};
+    };
+
+    struct alignas(64) Shard
+    {
+        std::array<std::atomic<uint64_t>, COUNTER_COUNT> counters{};
+        std::array<std::atomic<uint64_t>, QTYPE_BUCKET_COUNT> queries{};
+        std::array<HistogramShard, HISTOGRAM_COUNT> histograms{};
+    };
+
+    Shard& shard();
+
+    std::unique_ptr<Shard[]> m_shards;
+    std::array<std::atomic<int64_t>, GAUGE_COUNT> m_gauges{};
+};
+
+
+// Prometheus text exposition format, metric names prefixed with prefix.
+// Histograms are exported with a bucket per power of two of nanoseconds,
+// followed by their p50, p99 and p999 as gauges.
+std::string toPrometheus(const MetricsSnapshot& snapshot, const std::string& prefix = "dns");
+
+// One line per histogram with values: count, p50, p99, p999 and max.
+std::string formatLatencies(const MetricsSnapshot& snapshot);
+
+
+/* Periodic exporter.
+ *
+ * Takes a snapshot every period on its own thread and writes it in the
+ * Prometheus text format, either to a file (replaced whole through a
+ * temporary file, for node_exporter's textfile collector) or to a
+ * callback. The I/O threads only ever add to their shards.
+ */
+class MetricsExporter
+{
+public:
+    using Source = std::function<MetricsSnapshot()>;
+    using Sink = std::function<void(const std::string& text)>;
+
+    MetricsExporter();
+    ~MetricsExporter();
+
+    bool startFile(Source source, const std::string& path, std::chrono::milliseconds period);
+    bool startCallback(Source source, Sink sink, std::chrono::milliseconds period);
+    // Export a last time and stop.
+    void stop();
+
+    // Write text to path atomically; false on error.
+    static bool writeFile(const std::string& path, const std::string& text);
+
+private:
+    bool start(Source source, Sink sink, std::chrono::milliseconds period);
+    void run();
+
+    Source m_source;
+    Sink m_sink;
+    std::chrono::milliseconds m_period;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    bool m_stopping;
+};
+
+}
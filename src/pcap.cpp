@@ -0,0 +1,324 @@
+#include "pcap.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+
+using namespace dns;
+
+
+namespace
+{
+constexpr size_t IPV4_HEADER_SIZE = 20;
+constexpr size_t UDP_HEADER_SIZE = 8;
+constexpr size_t RECORD_HEADER_SIZE = 16;
+constexpr size_t FILE_HEADER_SIZE = 24;
+constexpr uint16_t ETHERTYPE_IPV4 = 0x0800;
+constexpr uint16_t ETHERTYPE_VLAN = 0x8100;
+constexpr uint8_t IPPROTO_UDP_NUMBER = 17;
+
+void putLe16(std::string& out, uint16_t value)
+{
+    out.push_back(static_cast<char>(value));
+    out.push_back(static_cast<char>(value >> 8));
+}
+
+void putLe32(std::string& out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+void putBe16(std::string& out, uint16_t value)
+{
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+void putBe32(std::string& out, uint32_t value)
+{
+    for (int i = 3; i >= 0; --i)
+        out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+uint16_t getBe16(const unsigned char* p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t getBe32(const unsigned char* p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+uint32_t getLe32(const unsigned char* p)
+{
+    return (static_cast<uint32_t>(p[3]) << 24) | (static_cast<uint32_t>(p[2]) << 16) |
+           (static_cast<uint32_t>(p[1]) << 8) | p[0];
+}
+
+// Internet checksum of the IPv4 header.
+uint16_t ipv4Checksum(const unsigned char* header)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < IPV4_HEADER_SIZE; i += 2)
+        sum += getBe16(header + i);
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return static_cast<uint16_t>(~sum);
+}
+
+// Offset of the IPv4 header in a frame of the given link type, or -1 if the
+// frame does not carry IPv4.
+long ipv4Offset(uint32_t linkType, const unsigned char* frame, size_t size)
+{
+    switch (linkType)
+    {
+    case PCAP_LINKTYPE_RAW:
+    case PCAP_LINKTYPE_IPV4:
+        return 0;
+    case PCAP_LINKTYPE_ETHERNET:
+    {
+        size_t offset = 12;
+        if (size >= offset + 2 && getBe16(frame + offset) == ETHERTYPE_VLAN)
+            offset += 4;
+        if (size < offset + 2 || getBe16(frame + offset) != ETHERTYPE_IPV4)
+            return -1;
+        return static_cast<long>(offset + 2);
+    }
+    case PCAP_LINKTYPE_LINUX_SLL:
+        if (size < 16 || getBe16(frame + 14) != ETHERTYPE_IPV4)
+            return -1;
+        return 16;
+    default:
+        return -1;
+    }
+}
+
+// Extract the UDP datagram of an IPv4 packet; false for anything else,
+// including fragments of a datagram.
+bool parseUdp(const unsigned char* packet, size_t size, CapturedDatagram& datagram)
+{
+    if (size < IPV4_HEADER_SIZE || (packet[0] >> 4) != 4)
+        return false;
+    const size_t headerSize = static_cast<size_t>(packet[0] & 0x0F) * 4;
+    if (headerSize < IPV4_HEADER_SIZE || size < headerSize + UDP_HEADER_SIZE)
+        return false;
+    if (packet[9] != IPPROTO_UDP_NUMBER || (getBe16(packet + 6) & 0x3FFF) != 0)
+        return false;
+
+    const unsigned char* udp = packet + headerSize;
+    const size_t udpLength = getBe16(udp + 4);
+    if (udpLength < UDP_HEADER_SIZE)
+        return false;
+    // the capture may be cut at the snapshot length
+    const size_t payloadSize = std::min(udpLength, size - headerSize) - UDP_HEADER_SIZE;
+
+    datagram.source.address = getBe32(packet + 12);
+    datagram.destination.address = getBe32(packet + 16);
+    datagram.source.port = getBe16(udp);
+    datagram.destination.port = getBe16(udp + 2);
+    datagram.payload.assign(reinterpret_cast<const char*>(udp + UDP_HEADER_SIZE), payloadSize);
+    return true;
+}
+}
+
+
+PcapWriter::PcapWriter()
+    : m_file(nullptr)
+    , m_open(false)
+    , m_packets(0)
+{
+}
+
+
+PcapWriter::~PcapWriter()
+{
+    close();
+}
+
+
+bool PcapWriter::open(const std::string& path)
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_file)
+        return false;
+
+    m_file = std::fopen(path.c_str(), "wb");
+    if (!m_file)
+        return false;
+
+    std::string header;
+    putLe32(header, PCAP_MAGIC);
+    putLe16(header, 2);     // version 2.4
+    putLe16(header, 4);
+    putLe32(header, 0);     // time zone
+    putLe32(header, 0);     // timestamp accuracy
+    putLe32(header, PCAP_SNAPLEN);
+    putLe32(header, PCAP_LINKTYPE_RAW);
+    if (std::fwrite(header.data(), 1, header.size(), m_file) != header.size())
+    {
+        std::fclose(m_file);
+        m_file = nullptr;
+        return false;
+    }
+
+    m_packets.store(0, std::memory_order_relaxed);
+    m_open.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+
+void PcapWriter::close()
+{
+    const std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_open.store(false, std::memory_order_relaxed);
+    if (m_file)
+    {
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+
+/**
+ * @brief Append one UDP datagram to the capture.
+ *
+ * Steps:
+ *   1. Return at once if the capture is closed.
+ *   2. Build the record header (time, captured and original length), then an
+ *      IPv4 header with its checksum and a UDP header without checksum
+ *      (optional over IPv4), in a buffer of the calling thread.
+ *   3. Write the record and the payload under the mutex, so records of
+ *      several threads do not interleave.
+ *
+ * Datagrams larger than the snapshot length are cut, keeping their
+ * original length in the record header.
+ */
+void PcapWriter::write(const PcapEndpoint& source, const PcapEndpoint& destination, const char* data, size_t size,
+                       std::chrono::system_clock::time_point time)
+{
+    if (!isOpen())
+        return;
+
+    const size_t packetSize = IPV4_HEADER_SIZE + UDP_HEADER_SIZE + size;
+    const size_t capturedSize = std::min(packetSize, PCAP_SNAPLEN);
+    const auto sinceEpoch = std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+
+    thread_local std::string record;
+    record.clear();
+    putLe32(record, static_cast<uint32_t>(sinceEpoch / 1000000));
+    putLe32(record, static_cast<uint32_t>(sinceEpoch % 1000000));
+    putLe32(record, static_cast<uint32_t>(capturedSize));
+    putLe32(record, static_cast<uint32_t>(packetSize));
+
+    const size_t ipStart = record.size();
+    record.push_back(0x45);
+    record.push_back(0);
+    putBe16(record, static_cast<uint16_t>(std::min<size_t>(packetSize, 0xFFFF)));
+    putBe16(record, 0);         // identification
+    putBe16(record, 0x4000);    // don't fragment
+    record.push_back(64);       // TTL
+    record.push_back(static_cast<char>(IPPROTO_UDP_NUMBER));
+    putBe16(record, 0);         // checksum, patched below
+    putBe32(record, source.address);
+    putBe32(record, destination.address);
+    const uint16_t checksum = ipv4Checksum(reinterpret_cast<const unsigned char*>(record.data() + ipStart));
+    record[ipStart + 10] = static_cast<char>(checksum >> 8);
+    record[ipStart + 11] = static_cast<char>(checksum);
+
+    putBe16(record, source.port);
+    putBe16(record, destination.port);
+    putBe16(record, static_cast<uint16_t>(std::min<size_t>(UDP_HEADER_SIZE + size, 0xFFFF)));
+    putBe16(record, 0);
+
+    const size_t payloadSize = capturedSize - IPV4_HEADER_SIZE - UDP_HEADER_SIZE;
+
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_file)
+        return;
+    std::fwrite(record.data(), 1, record.size(), m_file);
+    std::fwrite(data, 1, payloadSize, m_file);
+    m_packets.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief Read the IPv4 UDP datagrams of a pcap file.
+ *
+ * Steps:
+ *   1. Read the whole file and check the magic number, which also gives
+ *      the byte order of the file and the resolution of its timestamps.
+ *   2. Check the link type: raw IPv4, Ethernet (with an optional 802.1Q
+ *      tag) or Linux cooked capture.
+ *   3. For each record, find the IPv4 header in the frame and keep the
+ *      packet if it is a whole UDP datagram.
+ *
+ * @return false if the file cannot be read, is not a supported capture, or
+ *         ends inside a record. datagrams holds the packets read so far.
+ */
+bool dns::readPcap(const std::string& path, std::vector<CapturedDatagram>& datagrams)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    const std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(content.data());
+    if (content.size() < FILE_HEADER_SIZE)
+        return false;
+
+    bool swapped = false;
+    bool nanoseconds = false;
+    const uint32_t magic = getLe32(data);
+    if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NANOSECONDS)
+        nanoseconds = magic == PCAP_MAGIC_NANOSECONDS;
+    else if (getBe32(data) == PCAP_MAGIC || getBe32(data) == PCAP_MAGIC_NANOSECONDS)
+    {
+        swapped = true;
+        nanoseconds = getBe32(data) == PCAP_MAGIC_NANOSECONDS;
+    }
+    else
+        return false;
+
+    auto get32 = [swapped](const unsigned char* p) { return swapped ? getBe32(p) : getLe32(p); };
+
+    const uint32_t linkType = get32(data + 20) & 0x0FFFFFFF;
+    if (linkType != PCAP_LINKTYPE_RAW && linkType != PCAP_LINKTYPE_IPV4 &&
+        linkType != PCAP_LINKTYPE_ETHERNET && linkType != PCAP_LINKTYPE_LINUX_SLL)
+        return false;
+
+    size_t offset = FILE_HEADER_SIZE;
+    while (offset < content.size())
+    {
+        if (content.size() - offset < RECORD_HEADER_SIZE)
+            return false;
+        const unsigned char* record = data + offset;
+        const uint32_t seconds = get32(record);
+        const uint32_t fraction = get32(record + 4);
+        const size_t capturedSize = get32(record + 8);
+        offset += RECORD_HEADER_SIZE;
+        if (content.size() - offset < capturedSize)
+            return false;
+
+        const unsigned char* frame = data + offset;
+        offset += capturedSize;
+
+        const long ipStart = ipv4Offset(linkType, frame, capturedSize);
+        if (ipStart < 0)
+            continue;
+
+        CapturedDatagram datagram;
+        if (!parseUdp(frame + ipStart, capturedSize - static_cast<size_t>(ipStart), datagram))
+            continue;
+
+        const std::chrono::nanoseconds sinceSecond(nanoseconds ? fraction : static_cast<uint64_t>(fraction) * 1000);
+        datagram.time = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::seconds(seconds) + sinceSecond));
+        datagrams.push_back(std::move(datagram));
+    }
+    return true;
+}
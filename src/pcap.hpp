@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace dns
+{
+
+/* Packet capture in the libpcap file format.
+ *
+ * The writer records UDP datagrams as raw IPv4 packets (LINKTYPE_RAW) with
+ * synthesized IPv4 and UDP headers, so the files open in Wireshark and
+ * tcpdump and decode as DNS. The reader takes those files back, as well as
+ * captures taken by tcpdump on an Ethernet or Linux "any" interface, and
+ * keeps the IPv4 UDP datagrams. Timestamps have microsecond resolution.
+ */
+
+inline constexpr uint32_t PCAP_MAGIC = 0xa1b2c3d4;
+inline constexpr uint32_t PCAP_MAGIC_NANOSECONDS = 0xa1b23c4d;
+inline constexpr uint32_t PCAP_LINKTYPE_ETHERNET = 1;
+inline constexpr uint32_t PCAP_LINKTYPE_RAW = 101;
+inline constexpr uint32_t PCAP_LINKTYPE_LINUX_SLL = 113;
+inline constexpr uint32_t PCAP_LINKTYPE_IPV4 = 228;
+inline constexpr size_t PCAP_SNAPLEN = 65535;
+
+// An IPv4 address and UDP port, both in host byte order.
+struct PcapEndpoint
+{
+    uint32_t address = 0;
+    uint16_t port = 0;
+};
+
+struct CapturedDatagram
+{
+    std::chrono::system_clock::time_point time;
+    PcapEndpoint source;
+    PcapEndpoint destination;
+    std::string payload;
+};
+
+
+/* Appends datagrams to a capture file.
+ *
+ * write() may be called from any thread: records are written whole under a
+ * mutex, through the stdio buffer. While the writer is closed, write()
+ * costs a relaxed atomic load, so the I/O paths can call it unconditionally.
+ */
+class PcapWriter
+{
+public:
+    PcapWriter();
+    ~PcapWriter();
+
+    PcapWriter(const PcapWriter&) = delete;
+    PcapWriter& operator=(const PcapWriter&) = delete;
+
+    // Create or truncate path and write the file header; false if it cannot
+    // be opened or a capture is already open.
+    bool open(const std::string& path);
+    // Flush and close the file.
+    void close();
+    bool isOpen() const { return m_open.load(std::memory_order_relaxed); }
+
+    void write(const PcapEndpoint& source, const PcapEndpoint& destination, const char* data, size_t size,
+               std::chrono::system_clock::time_point time = std::chrono::system_clock::now());
+
+    // Datagrams written since open().
+    uint64_t packets() const { return m_packets.load(std::memory_order_relaxed); }
+
+private:
+    std::mutex m_mutex;
+    std::FILE* m_file;
+    std::atomic<bool> m_open;
+    std::atomic<uint64_t> m_packets;
+};
+
+
+// Read the IPv4 UDP datagrams of a capture. Other packets, such as IPv6 or
+// TCP ones, are skipped. false if path is not a pcap file of a supported
+// link type, or is cut short.
+bool readPcap(const std::string& path, std::vector<CapturedDatagram>& datagrams);
+
+}
@@ -38,77 +38,66 @@ string Query::asString() const
 }
 
 
-int Query::code(char* buffer)  
+int Query::code(char* buffer, size_t capacity)
 {
-    char* bufferBegin = buffer;
+    WireWriter writer(buffer, capacity);
 
-    code_hdr(buffer);
-    buffer += HDR_OFFSET;
-
-    encode_qname(buffer, m_qName);
+    // the header goes in last, over the room left here
+    writer.skip(HDR_OFFSET);
+    encode_qname(writer, m_qName);
+    writer.put16(static_cast<uint16_t>(m_qType));
+    writer.put16(static_cast<uint16_t>(m_qClass));
+    code_edns(writer);
 
-    put16bits(buffer, m_qType);
-    put16bits(buffer, m_qClass);
+    if (writer.full())
+        return 0;
 
-    int size = buffer - bufferBegin;
-
-    return size;
+    code_hdr(buffer);
+    return static_cast<int>(writer.size());
 }
 
 
 void Query::decode(const char* buffer, int size)  
 {
     // log_buffer(buffer, size);
-
-    decode_hdr(buffer);
-    buffer += HDR_OFFSET;
-    
-    decode_qname(buffer);
-
-    m_qType = get16bits(buffer);
-    m_qClass = get16bits(buffer);
+    QueryView view;
+    view.parse(buffer, size < 0 ? 0 : static_cast<size_t>(size));
+    assign(view);
 }
 
 
-void Query::decode_qname(const char*& buffer)  
+void Query::assign(const QueryView& view)
 {
-    m_qName.clear();
-
-    int length = *buffer++;
-    while (length != 0) 
-    {
-        for (int i = 0; i < length; i++) 
-        {
-            char c = *buffer++;
-            m_qName.append(1, c);
-        }
-        
-        length = *buffer++;
-        if (length != 0) 
-            m_qName.append(1,'.');
-    }
+    if (view.size() >= HDR_OFFSET)
+        decode_hdr(view.data());
+    else
+        m_id = m_qdCount = m_anCount = m_nsCount = m_arCount = 0;
+
+    // the view found the OPT record, if any, and left it out of ARCOUNT
+    m_arCount = view.arCount();
+    m_ednsUdpSize = view.ednsUdpSize();
+
+    if (!view.qname().copyTo(m_qName))
+        m_qName.clear();
+    m_qType = view.qType();
+    m_qClass = view.qClass();
 }
 
 
-void Query::encode_qname(char*& buffer, const std::string& domain)  
+bool Query::encode_qname(WireWriter& writer, const std::string& domain)
 {
-    int start(0), end; // indexes
-
-    while ((end = domain.find('.', start)) != string::npos) {
+    size_t start = 0;
+    size_t end;
 
-        *buffer++ = end - start; // label length octet
-        for (int i=start; i<end; i++) {
-
-            *buffer++ = domain[i]; // label octets
-        }
+    while ((end = domain.find('.', start)) != string::npos)
+    {
+        writer.put8(static_cast<uint8_t>(end - start)); // label length octet
+        writer.putBytes(domain.data() + start, end - start); // label octets
         start = end + 1; // Skip '.'
     }
 
-    *buffer++ = domain.size() - start; // last label length octet
-    for (int i=start; i<domain.size(); i++) {
+    writer.put8(static_cast<uint8_t>(domain.size() - start)); // last label length octet
+    writer.putBytes(domain.data() + start, domain.size() - start); // last label octets
 
-        *buffer++ = domain[i]; // last label octets
-    }
-
-    *buffer++ = 0;
-}
\ No newline at end of file
+    return writer.put8(0);
+}
@@ -3,6 +3,7 @@
 #include <string>
 
 #include "message.hpp"
+#include "messageView.hpp"
 
 
 namespace dns 
@@ -15,9 +16,13 @@ public:
     Query();
     ~Query();
 
-    int code(char* buffer);
+    using Message::code;
+    int code(char* buffer, size_t capacity) override;
 
     void decode(const char* buffer, int size);
+    // Fill the query from a parsed view. The QNAME reuses the capacity of
+    // the previous one, so a Query kept across datagrams stops allocating.
+    void assign(const QueryView& view);
 
     std::string asString() const;
 
@@ -34,8 +39,7 @@ private:
     uint m_qType;
     uint m_qClass;
 
-    void decode_qname(const char*& buffer);
-    void encode_qname(char*& buffer, const std::string& domain);
+    bool encode_qname(WireWriter& writer, const std::string& domain);
 };
 
 }
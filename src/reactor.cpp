@@ -0,0 +1,402 @@
+#ifdef __linux__
+
+#include <cstring>
+
+#include <algorithm>
+#include <cctype>
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "reactor.hpp"
+#include "debugLog.hpp"
+
+
+using namespace std;
+using namespace dns;
+
+
+Reactor::Buffers::Buffers()
+    : datagrams(BATCH_SIZE * Server::BUFFER_SIZE)
+    , replies(BATCH_SIZE * Server::BUFFER_SIZE)
+    , addresses(BATCH_SIZE)
+    , datagramIovs(BATCH_SIZE)
+    , replyIovs(BATCH_SIZE)
+    , received(BATCH_SIZE)
+    , toSend(BATCH_SIZE)
+{
+    for(unsigned int i = 0; i < BATCH_SIZE; ++i)
+    {
+        datagramIovs[i].iov_base = &datagrams[i * Server::BUFFER_SIZE];
+        datagramIovs[i].iov_len = Server::BUFFER_SIZE;
+    }
+}
+
+
+Reactor::Reactor(unsigned int threadCount)
+    : m_threadCount(std::max(1U, threadCount))
+    , m_epollfd(-1)
+    , m_wakeupfd(-1)
+    , m_isStoped(true)
+{
+}
+
+
+Reactor::~Reactor()
+{
+    stop();
+    closeAll();
+}
+
+
+/**
+ * @brief Serve a server's domain on a UDP port.
+ *
+ * The first server added for a port creates its socket: non-blocking, bound
+ * to all interfaces. Later servers on the same port share the socket; they
+ * are kept sorted by decreasing domain length so findServer() returns the
+ * longest matching suffix first.
+ *
+ * @return false if the reactor is running, the domain is already served on
+ *         this port, or the socket cannot be created or bound.
+ */
+bool Reactor::addServer(Server& server, int port)
+{
+    if(!m_isStoped)
+    {
+        DNS_LOG(Error, "Reactor::addServer", "Cannot add a server while running");
+        return false;
+    }
+
+    auto it = std::find_if(m_endpoints.begin(), m_endpoints.end(),
+                           [port](const std::unique_ptr<Endpoint>& endpoint) { return endpoint->port == port; });
+
+    Endpoint* endpoint = nullptr;
+    if(it == m_endpoints.end())
+    {
+        int sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if(sockfd < 0)
+        {
+            DNS_LOG(Error, "Reactor::addServer",
+                           "socket() failed: " + std::string(strerror(errno)));
+            return false;
+        }
+
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = INADDR_ANY;
+        address.sin_port = htons(port);
+        if(bind(sockfd, (struct sockaddr *) &address, sizeof(address)) != 0)
+        {
+            DNS_LOG(Error, "Reactor::addServer",
+                           "Could not bind port " + std::to_string(port) + ": " + std::string(strerror(errno)));
+            close(sockfd);
+            return false;
+        }
+
+        m_endpoints.push_back(std::make_unique<Endpoint>());
+        endpoint = m_endpoints.back().get();
+        endpoint->port = port;
+        endpoint->sockfd = sockfd;
+    }
+    else
+    {
+        endpoint = it->get();
+    }
+
+    const std::string domain = str_tolower(server.getDomain());
+    for(Server* existing : endpoint->servers)
+    {
+        if(str_tolower(existing->getDomain()) == domain)
+        {
+            DNS_LOG(Warn, "Reactor::addServer",
+                          "Domain '" + domain + "' is already served on port " + std::to_string(port));
+            return false;
+        }
+    }
+
+    endpoint->servers.push_back(&server);
+    std::stable_sort(endpoint->servers.begin(), endpoint->servers.end(),
+                     [](const Server* a, const Server* b) { return a->getDomain().size() > b->getDomain().size(); });
+
+    DNS_LOG(Info, "Reactor::addServer",
+                  "Serving domain '" + domain + "' on port " + std::to_string(port) + " (" +
+                      std::to_string(endpoint->servers.size()) + " domain(s) on this port)");
+    return true;
+}
+
+
+/**
+ * @brief Register the sockets in epoll and start the thread pool.
+ *
+ * Steps:
+ *   1. Create the epoll instance and an eventfd used by stop() to wake up
+ *      every thread (registered level-triggered and never read, so it
+ *      stays readable once written).
+ *   2. Register every endpoint socket with EPOLLIN | EPOLLONESHOT: after an
+ *      event is reported, the socket is disabled until the thread that got
+ *      it has drained it and re-armed it, so no two threads read the same
+ *      socket at once.
+ *   3. Start m_threadCount threads running run().
+ *
+ * @return false, with everything closed, if a step fails.
+ */
+bool Reactor::start()
+{
+    if(!m_isStoped)
+        return true;
+
+    m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeupfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_epollfd < 0 || m_wakeupfd < 0)
+    {
+        DNS_LOG(Error, "Reactor::start",
+                       "epoll/eventfd creation failed: " + std::string(strerror(errno)));
+        closeAll();
+        return false;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if(epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_wakeupfd, &event) != 0)
+    {
+        DNS_LOG(Error, "Reactor::start",
+                       "epoll_ctl(wakeup) failed: " + std::string(strerror(errno)));
+        closeAll();
+        return false;
+    }
+
+    for(const std::unique_ptr<Endpoint>& endpoint : m_endpoints)
+    {
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = endpoint.get();
+        if(epoll_ctl(m_epollfd, EPOLL_CTL_ADD, endpoint->sockfd, &event) != 0)
+        {
+            DNS_LOG(Error, "Reactor::start",
+                           "epoll_ctl(port " + std::to_string(endpoint->port) + ") failed: " +
+                               std::string(strerror(errno)));
+            closeAll();
+            return false;
+        }
+    }
+
+    m_isStoped = false;
+    for(unsigned int i = 0; i < m_threadCount; ++i)
+        m_threads.emplace_back(&Reactor::run, this);
+
+    DNS_LOG(Info, "Reactor::start",
+                  "Serving " + std::to_string(m_endpoints.size()) + " socket(s) with " +
+                      std::to_string(m_threadCount) + " thread(s)");
+    return true;
+}
+
+
+/**
+ * @brief Stop the thread pool.
+ *
+ * Wakes every thread through the eventfd and joins them. The sockets stay
+ * open, so the reactor can be started again.
+ */
+void Reactor::stop()
+{
+    if(m_isStoped.exchange(true))
+        return;
+
+    uint64_t one = 1;
+    if(write(m_wakeupfd, &one, sizeof(one)) != sizeof(one))
+        DNS_LOG(Error, "Reactor::stop", "eventfd write failed: " + std::string(strerror(errno)));
+
+    for(std::thread& thread : m_threads)
+    {
+        if(thread.joinable())
+            thread.join();
+    }
+    m_threads.clear();
+
+    close(m_epollfd);
+    close(m_wakeupfd);
+    m_epollfd = -1;
+    m_wakeupfd = -1;
+
+    DNS_LOG(Info, "Reactor::stop", "Thread pool stopped");
+}
+
+
+void Reactor::closeAll()
+{
+    if(m_epollfd >= 0)
+        close(m_epollfd);
+    if(m_wakeupfd >= 0)
+        close(m_wakeupfd);
+    m_epollfd = -1;
+    m_wakeupfd = -1;
+
+    for(const std::unique_ptr<Endpoint>& endpoint : m_endpoints)
+        close(endpoint->sockfd);
+    m_endpoints.clear();
+}
+
+
+/**
+ * @brief Thread pool loop.
+ *
+ * Waits for one ready socket at a time, drains it with drain(), then
+ * re-arms it in epoll. Returns when the wakeup eventfd becomes readable.
+ */
+void Reactor::run()
+{
+    Buffers buffers;
+
+    while(!m_isStoped)
+    {
+        struct epoll_event event;
+        int ready = epoll_wait(m_epollfd, &event, 1, -1);
+        if(ready <= 0)
+        {
+            if(ready < 0 && errno != EINTR)
+                DNS_LOG(Error, "Reactor::run", "epoll_wait failed: " + std::string(strerror(errno)));
+            continue;
+        }
+
+        // the wakeup eventfd: stop() was called
+        if(event.data.ptr == nullptr)
+            break;
+
+        Endpoint& endpoint = *static_cast<Endpoint*>(event.data.ptr);
+        for(unsigned int i = 0; i < MAX_BATCHES_PER_WAKEUP; ++i)
+        {
+            if(!drain(endpoint, buffers))
+                break;
+        }
+
+        // give the socket back to the pool
+        event.events = EPOLLIN | EPOLLONESHOT;
+        if(epoll_ctl(m_epollfd, EPOLL_CTL_MOD, endpoint.sockfd, &event) != 0)
+            DNS_LOG(Error, "Reactor::run",
+                           "epoll_ctl(re-arm port " + std::to_string(endpoint.port) + ") failed: " +
+                               std::string(strerror(errno)));
+    }
+}
+
+
+/**
+ * @brief Answer one batch of queries waiting on an endpoint socket.
+ *
+ * Steps:
+ *   1. Read up to BATCH_SIZE datagrams with a non-blocking recvmmsg().
+ *   2. For each datagram that parses as a query (see QueryView), fill the
+ *      thread's scratch Query from it, pick its server with findServer()
+ *      and answer it with Server::processQuery() into the reply slot of the
+ *      batch. Other datagrams are counted as parse failures by the first
+ *      server of the endpoint (see Server::discardDatagram).
+ *   3. Send all the replies with sendmmsg(), finishing partial sends.
+ *
+ * @return true if the batch was full, so more datagrams may be waiting.
+ */
+bool Reactor::drain(Endpoint& endpoint, Buffers& buffers)
+{
+    for(unsigned int i = 0; i < BATCH_SIZE; ++i)
+    {
+        memset(&buffers.received[i], 0, sizeof(struct mmsghdr));
+        buffers.received[i].msg_hdr.msg_name = &buffers.addresses[i];
+        buffers.received[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        buffers.received[i].msg_hdr.msg_iov = &buffers.datagramIovs[i];
+        buffers.received[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int nbReceived = recvmmsg(endpoint.sockfd, buffers.received.data(), BATCH_SIZE, MSG_DONTWAIT, nullptr);
+    if(nbReceived <= 0)
+        return false;
+
+    unsigned int nbReplies = 0;
+    for(int i = 0; i < nbReceived; ++i)
+    {
+        const size_t size = buffers.received[i].msg_len;
+        QueryView view;
+        if(size < 12 || !view.parse(&buffers.datagrams[i * Server::BUFFER_SIZE], size))
+        {
+            // no QNAME to pick a server: counted by the first one
+            endpoint.servers.front()->discardDatagram(static_cast<int>(size));
+            continue;
+        }
+
+        Query& query = buffers.query;
+        query.assign(view);
+
+        Server* server = findServer(endpoint, query.getQName());
+
+        char* reply = &buffers.replies[nbReplies * Server::BUFFER_SIZE];
+        int nbytes = server->processQuery(query, reply, Server::BUFFER_SIZE);
+        if(nbytes <= 0)
+            continue;
+
+        buffers.replyIovs[nbReplies].iov_base = reply;
+        buffers.replyIovs[nbReplies].iov_len = nbytes;
+
+        memset(&buffers.toSend[nbReplies], 0, sizeof(struct mmsghdr));
+        buffers.toSend[nbReplies].msg_hdr.msg_name = &buffers.addresses[i];
+        buffers.toSend[nbReplies].msg_hdr.msg_namelen = buffers.received[i].msg_hdr.msg_namelen;
+        buffers.toSend[nbReplies].msg_hdr.msg_iov = &buffers.replyIovs[nbReplies];
+        buffers.toSend[nbReplies].msg_hdr.msg_iovlen = 1;
+        ++nbReplies;
+    }
+
+    unsigned int nbSent = 0;
+    while(nbSent < nbReplies)
+    {
+        int sent = sendmmsg(endpoint.sockfd, &buffers.toSend[nbSent], nbReplies - nbSent, 0);
+        if(sent <= 0)
+        {
+            DNS_LOG(Error, "Reactor::drain",
+                           "sendmmsg() failed on port " + std::to_string(endpoint.port) + " (" +
+                               std::string(strerror(errno)) + "); dropping " +
+                               std::to_string(nbReplies - nbSent) + " reply(ies)");
+            break;
+        }
+        nbSent += sent;
+    }
+
+    DNS_LOG(Debug, "Reactor::drain",
+                   "Port " + std::to_string(endpoint.port) + ": answered " + std::to_string(nbSent) +
+                       "/" + std::to_string(nbReceived) + " quer(ies)");
+
+    return nbReceived == static_cast<int>(BATCH_SIZE);
+}
+
+
+/**
+ * @brief Pick the server of an endpoint answering a QNAME.
+ *
+ * Returns the server whose domain is the longest suffix of the QNAME, on a
+ * label boundary and ignoring case. Queries matching no domain go to the
+ * first server, which answers them with NXDOMAIN like a standalone Server.
+ */
+Server* Reactor::findServer(const Endpoint& endpoint, const std::string& qname) const
+{
+    for(Server* server : endpoint.servers)
+    {
+        const std::string& domain = server->getDomain();
+        if(qname.size() < domain.size())
+            continue;
+
+        const size_t offset = qname.size() - domain.size();
+        if(offset > 0 && qname[offset - 1] != '.')
+            continue;
+
+        bool match = true;
+        for(size_t i = 0; i < domain.size() && match; ++i)
+            match = std::tolower(static_cast<unsigned char>(qname[offset + i])) ==
+                    std::tolower(static_cast<unsigned char>(domain[i]));
+        if(match)
+            return server;
+    }
+
+    return endpoint.servers.front();
+}
+
+#endif
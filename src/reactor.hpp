@@ -0,0 +1,95 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "server.hpp"
+
+
+namespace dns
+{
+
+/* Serves any number of Server instances, ports and domains from a fixed
+ * pool of threads.
+ *
+ * Every port gets one non-blocking socket registered in an epoll instance
+ * with EPOLLONESHOT, so a socket is drained by one thread at a time while
+ * the other threads serve the other sockets. Each query is dispatched to
+ * the Server whose domain is the longest suffix of its QNAME among the
+ * servers registered on that port, and answered with
+ * Server::processQuery(). The thread count never depends on the number of
+ * endpoints.
+ *
+ * Servers hosted by a reactor must not be launched themselves, and must
+ * outlive it. Their message API (waitForMessage, setMessageToSend, ...)
+ * works as usual.
+ */
+class Reactor
+{
+public:
+    explicit Reactor(unsigned int threadCount);
+    ~Reactor();
+
+    // Serve server's domain on the UDP port. Several servers can share a
+    // port if their domains differ. Only before start().
+    bool addServer(Server& server, int port);
+
+    bool start();
+    void stop();
+
+private:
+    struct Endpoint
+    {
+        int port = 0;
+        int sockfd = -1;
+        // servers answering on this socket, longest domain first
+        std::vector<Server*> servers;
+    };
+
+    // per-thread receive and reply buffers, allocated once
+    struct Buffers
+    {
+        Buffers();
+
+        std::vector<char> datagrams;
+        std::vector<char> replies;
+        std::vector<struct sockaddr_in> addresses;
+        std::vector<struct iovec> datagramIovs;
+        std::vector<struct iovec> replyIovs;
+        std::vector<struct mmsghdr> received;
+        std::vector<struct mmsghdr> toSend;
+        // decoded query, kept so its QNAME storage is reused
+        Query query;
+    };
+
+    void run();
+    bool drain(Endpoint& endpoint, Buffers& buffers);
+    Server* findServer(const Endpoint& endpoint, const std::string& qname) const;
+    void closeAll();
+
+    // datagrams read with one recvmmsg, and batches read before giving the
+    // socket back to the other threads
+    static constexpr unsigned int BATCH_SIZE = 32;
+    static constexpr unsigned int MAX_BATCHES_PER_WAKEUP = 8;
+
+    unsigned int m_threadCount;
+    int m_epollfd;
+    int m_wakeupfd;
+
+    std::atomic<bool> m_isStoped;
+
+    std::vector<std::unique_ptr<Endpoint>> m_endpoints;
+    std::vector<std::thread> m_threads;
+};
+
+}
+
+#endif
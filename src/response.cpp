@@ -1,6 +1,5 @@
 #include <algorithm>
 #include <cstring>
-#include <set>
 #include <sstream>
 
 #ifdef __linux__
@@ -17,6 +16,7 @@
 #endif
 
 #include "message.hpp"
+#include "messageView.hpp"
 #include "response.hpp"
 
 using namespace std;
@@ -40,22 +40,21 @@ static int hex_value(char c)
     return -1;
 }
 
-static std::vector<uint8_t> hex_to_bytes(const std::string& hex)
+// Decode exactly 2 * size hex digits into out.
+static bool hex_to_bytes(const std::string& hex, uint8_t* out, size_t size)
 {
-    if (hex.size() % 2 != 0)
-        return {};
+    if (hex.size() != 2 * size)
+        return false;
 
-    std::vector<uint8_t> bytes;
-    bytes.reserve(hex.size() / 2);
-    for (size_t i = 0; i < hex.size(); i += 2)
+    for (size_t i = 0; i < size; ++i)
     {
-        int high = hex_value(hex[i]);
-        int low = hex_value(hex[i + 1]);
+        int high = hex_value(hex[2 * i]);
+        int low = hex_value(hex[2 * i + 1]);
         if (high < 0 || low < 0)
-            return {};
-        bytes.push_back(static_cast<uint8_t>((high << 4) | low));
+            return false;
+        out[i] = static_cast<uint8_t>((high << 4) | low);
     }
-    return bytes;
+    return true;
 }
 
 static std::string bytes_to_hex(const char* data, size_t length)
@@ -78,65 +77,71 @@ Response::Response()
 : Message(Message::Response)
 , m_questionType(0)
 , m_questionClass(0)
-, m_answerType(0)
-, m_answerClass(0)
-, m_ttl(0)
-, m_rdLength(0)
-, m_mxPreference(0)
 {}
 
 Response::~Response() = default;
 
+Response::Answer& Response::primaryAnswer()
+{
+    if (m_answers.empty())
+        m_answers.emplace_back();
+    return m_answers.front();
+}
+
+const Response::Answer& Response::firstAnswer() const
+{
+    static const Answer none;
+    return m_answers.empty() ? none : m_answers.front();
+}
+
 void Response::setName(const std::string& value)
 {
     m_questionName = value;
-    m_answerName = value;
+    primaryAnswer().name = value;
 }
 
 void Response::setAnswerName(const std::string& value)
 {
-    m_answerName = value;
+    primaryAnswer().name = value;
 }
 
 void Response::setType(const uint value)
 {
     m_questionType = value;
-    m_answerType = value;
+    primaryAnswer().type = value;
 }
 
 void Response::setClass(const uint value)
 {
     m_questionClass = value;
-    m_answerClass = value;
+    primaryAnswer().klass = value;
 }
 
 void Response::setRdata(const std::string& value)
 {
-    m_rdata = value;
-    m_rdataBinary.clear();
-    m_txtStrings.clear();
+    Answer& answer = primaryAnswer();
+    answer.rdata = value;
+    answer.rdataBinary.clear();
+    answer.txtStrings.clear();
 }
 
 void Response::setRdataBytes(const std::vector<uint8_t>& data)
 {
-    m_rdataBinary = data;
-    m_rdata.assign(data.begin(), data.end());
-    m_txtStrings.clear();
-    m_rdLength = static_cast<uint>(data.size());
+    Answer& answer = primaryAnswer();
+    answer.rdataBinary = data;
+    answer.rdata.assign(data.begin(), data.end());
+    answer.txtStrings.clear();
 }
 
 void Response::clearAnswer()
 {
     m_anCount = 0;
-    m_answerName.clear();
-    m_answerType = 0;
-    m_answerClass = 0;
-    m_ttl = 0;
-    m_rdLength = 0;
-    m_rdata.clear();
-    m_rdataBinary.clear();
-    m_txtStrings.clear();
-    m_mxPreference = 0;
+    m_answers.clear();
+}
+
+void Response::addAnswer(const Answer& answer)
+{
+    m_answers.push_back(answer);
 }
 
 string Response::asString() const
@@ -149,13 +154,17 @@ string Response::asString() const
     text << "\tqtype: " << m_questionType << endl;
     text << "\tqclass: " << m_questionClass << endl;
 
-    text << "\tanswerName: " << m_answerName << endl;
-    text << "\tanswerType: " << m_answerType << endl;
-    text << "\tanswerClass: " << m_answerClass << endl;
-    text << "\tttl: " << m_ttl << endl;
-    text << "\trdLength: " << m_rdLength << endl;
-    text << "\tmxPreference: " << m_mxPreference << endl;
-    text << "\trdata (text): " << m_rdata << " }" << dec;
+    for (const Answer& answer : m_answers)
+    {
+        text << "\tanswerName: " << answer.name << endl;
+        text << "\tanswerType: " << answer.type << endl;
+        text << "\tanswerClass: " << answer.klass << endl;
+        text << "\tttl: " << answer.ttl << endl;
+        text << "\trdLength: " << answer.rdataBinary.size() << endl;
+        text << "\tmxPreference: " << answer.mxPreference << endl;
+        text << "\trdata (text): " << answer.rdata << endl;
+    }
+    text << " }" << dec;
 
     return text.str();
 }
@@ -166,17 +175,9 @@ void Response::decode(const char* buffer, int size)
     const char* end = buffer + size;
 
     m_questionName.clear();
-    m_answerName.clear();
-    m_rdata.clear();
-    m_rdataBinary.clear();
-    m_txtStrings.clear();
-    m_mxPreference = 0;
-    m_rdLength = 0;
     m_questionType = 0;
     m_questionClass = 0;
-    m_answerType = 0;
-    m_answerClass = 0;
-    m_ttl = 0;
+    m_answers.clear();
 
     if (size < static_cast<int>(HDR_OFFSET))
         return;
@@ -218,25 +219,19 @@ void Response::decode(const char* buffer, int size)
 
     for (uint i = 0; i < m_anCount && cursor < end; ++i)
     {
-        std::string name;
-        decode_domain(cursor, name, begin, end);
-        uint16_t type = safe_get16(cursor);
-        uint16_t klass = safe_get16(cursor);
-        uint32_t ttl = safe_get32(cursor);
+        Answer answer;
+        decode_domain(cursor, answer.name, begin, end);
+        answer.type = safe_get16(cursor);
+        answer.klass = safe_get16(cursor);
+        answer.ttl = safe_get32(cursor);
         uint16_t rdlength = safe_get16(cursor);
         if (cursor + rdlength > end)
         {
             rdlength = static_cast<uint16_t>(std::max<long>(0, end - cursor));
         }
 
-        if (i == 0)
-        {
-            m_answerName = name;
-            m_answerType = type;
-            m_answerClass = klass;
-            m_ttl = ttl;
-            parse_rdata(type, cursor, rdlength, begin, end);
-        }
+        parse_rdata(answer, cursor, rdlength, begin, end);
+        m_answers.push_back(std::move(answer));
 
         cursor += rdlength;
     }
@@ -246,47 +241,90 @@ void Response::decode(const char* buffer, int size)
         skip_record(cursor, begin, end);
     }
 
-    for (uint i = 0; i < m_arCount && cursor < end; ++i)
-    {
-        skip_record(cursor, begin, end);
-    }
+    // additional section, where an EDNS0 OPT record may be
+    decode_records(cursor, end, m_arCount);
 }
 
-int Response::code(char* buffer)
+/**
+ * @brief Encode the response into buffer, within capacity bytes.
+ *
+ * Steps:
+ *   1. Create a bare answer to the question if ANCOUNT is set but no
+ *      answer was filled in.
+ *   2. Keep room for the EDNS0 OPT record, if any, and leave the header
+ *      for last. Write the question; give up if it does not fit.
+ *   3. Write the answers, each straight into the buffer with
+ *      write_rdata(). Owner names, and the targets of CNAME, NS, PTR and MX
+ *      records given as text, are compressed (RFC 1035 4.1.4): a name
+ *      whose suffix is already in the message ends with a pointer to it, so
+ *      an answer to the question costs 2 bytes of name instead of repeating
+ *      the QNAME. The first answer that does not fit is taken back, with
+ *      the names it recorded, and the TC bit is set.
+ *   4. Append the OPT record, then write the header with ANCOUNT set to the
+ *      number of answers written.
+ *
+ * @return The size of the encoded message, 0 if the question does not fit.
+ */
+int Response::code(char* buffer, size_t capacity)
 {
-    char* bufferBegin = buffer;
+    NameOffsets names;
+    WireWriter writer(buffer, capacity);
 
-    code_hdr(buffer);
-    buffer += HDR_OFFSET;
+    // a bare answer to the question when none was filled in
+    if (m_anCount > 0 && m_answers.empty())
+        primaryAnswer();
+    const size_t answerCount = m_anCount > 0 ? m_answers.size() : 0;
 
+    const size_t optSize = m_ednsUdpSize != 0 ? EDNS_OPT_SIZE : 0;
+    if (capacity < HDR_OFFSET + optSize)
+        return 0;
+    writer.setCapacity(capacity - optSize);
+
+    writer.skip(HDR_OFFSET);
     if (m_qdCount > 0 && !m_questionName.empty())
     {
-        code_domain(buffer, m_questionName);
-        put16bits(buffer, m_questionType);
-        put16bits(buffer, m_questionClass);
+        code_domain(writer, m_questionName, names);
+        writer.put16(static_cast<uint16_t>(m_questionType));
+        writer.put16(static_cast<uint16_t>(m_questionClass));
     }
+    if (writer.full())
+        return 0;
 
-    if (m_anCount > 0)
+    size_t written = 0;
+    for (; written < answerCount; ++written)
     {
-        const std::string owner = m_answerName.empty() ? m_questionName : m_answerName;
-        code_domain(buffer, owner);
-        put16bits(buffer, m_answerType);
-        put16bits(buffer, m_answerClass);
-        put32bits(buffer, m_ttl);
-
-        std::vector<uint8_t> rdata = build_rdata();
-        m_rdLength = static_cast<uint>(rdata.size());
-        m_rdataBinary = rdata;
-        put16bits(buffer, m_rdLength);
-        if (!rdata.empty())
+        const Answer& answer = m_answers[written];
+        const size_t mark = writer.size();
+
+        const std::string& owner = answer.name.empty() ? m_questionName : answer.name;
+        code_domain(writer, owner, names);
+        writer.put16(static_cast<uint16_t>(answer.type));
+        writer.put16(static_cast<uint16_t>(answer.klass));
+        writer.put32(static_cast<uint32_t>(answer.ttl));
+
+        // RDLENGTH is known once the RDATA is written
+        const size_t rdLength = writer.size();
+        writer.skip(2);
+        write_rdata(writer, answer, names);
+        writer.patch16(rdLength, static_cast<uint16_t>(writer.size() - rdLength - 2));
+
+        if (writer.full())
         {
-            std::memcpy(buffer, rdata.data(), rdata.size());
-            buffer += rdata.size();
+            writer.rollback(mark);
+            std::erase_if(names, [mark](const auto& name) { return name.second >= mark; });
+            break;
         }
     }
 
-    int size = static_cast<int>(buffer - bufferBegin);
-    log_buffer(bufferBegin, size);
+    m_tc = written < answerCount ? 1U : 0U;
+    m_anCount = static_cast<uint>(written);
+
+    writer.setCapacity(capacity);
+    code_edns(writer);
+    code_hdr(buffer);
+
+    int size = static_cast<int>(writer.size());
+    log_buffer(buffer, size);
 
     return size;
 }
@@ -294,98 +332,69 @@ int Response::code(char* buffer)
 void Response::decode_domain(const char*& buffer, std::string& domain,
                              const char* begin, const char* end)
 {
+    // bounds and compression loops (a hop counter) are checked by the view
+    NameView name(begin, static_cast<size_t>(end - begin), static_cast<size_t>(buffer - begin));
+    size_t next = 0;
     domain.clear();
-
-    const char* cur = buffer;
-    bool jumped = false;
-    std::set<const char*> visited;
-
-    while (cur < end)
+    auto append = [&domain](std::string_view label) {
+        if (!domain.empty())
+            domain.push_back('.');
+        domain.append(label);
+    };
+    if (!name.forEachLabel(append, &next))
     {
-        uint8_t len = static_cast<uint8_t>(*cur);
-
-        if ((len & 0xC0) == 0xC0)
-        {
-            if (cur + 1 >= end) { buffer = end; return; }
-            uint16_t offset = ((len & 0x3F) << 8) | static_cast<uint8_t>(cur[1]);
-            const char* ptr = begin + offset;
-            if (ptr < begin || ptr >= end || visited.count(ptr))
-            {
-                buffer = end;
-                return;
-            }
-            visited.insert(ptr);
-            if (!jumped)
-            {
-                buffer = cur + 2;
-                jumped = true;
-            }
-            cur = ptr;
-            continue;
-        }
-
-        if (len == 0)
-        {
-            ++cur;
-            if (!jumped) buffer = cur;
-            return;
-        }
-
-        ++cur;
-        if (cur + len > end) { buffer = end; return; }
-        domain.append(cur, len);
-        cur += len;
-        if (*cur != 0) domain.push_back('.');
+        buffer = end;
+        return;
     }
-
-    buffer = end;
+    buffer = begin + next;
 }
 
-void Response::code_domain(char*& buffer, const std::string& domain)
+// Write domain, ending it with a pointer to the longest suffix already
+// written in the message, and record the offsets of the suffixes it writes
+// in full. Labels longer than 63 bytes are cut into several; only whole
+// labels are looked up and recorded.
+bool Response::code_domain(WireWriter& writer, const std::string& domain, NameOffsets& names)
 {
-    if (domain.empty())
+    size_t start = 0;
+    while (start < domain.size())
     {
-        *buffer++ = 0;
-        return;
-    }
+        std::string suffix = domain.substr(start);
+        auto known = names.find(suffix);
+        if (known != names.end())
+            return writer.put16(static_cast<uint16_t>(0xC000 | known->second));
 
-    int start = 0;
-    int end = 0;
+        // pointers have 14 bits of offset
+        const size_t offset = writer.size();
+        if (offset <= 0x3FFF)
+            names.emplace(std::move(suffix), static_cast<uint16_t>(offset));
 
-    while (start < static_cast<int>(domain.size()))
-    {
-        end = domain.find('.', start);
+        size_t end = domain.find('.', start);
         if (end == std::string::npos)
-            end = static_cast<int>(domain.size());
+            end = domain.size();
 
-        int labelLen = end - start;
-        int processed = 0;
-        while (processed < labelLen)
+        size_t processed = start;
+        while (processed < end)
         {
-            int chunkLen = std::min(63, labelLen - processed);
-            *buffer++ = static_cast<char>(chunkLen);
-            for (int i = 0; i < chunkLen; ++i)
-            {
-                *buffer++ = domain[start + processed + i];
-            }
+            size_t chunkLen = std::min<size_t>(63, end - processed);
+            writer.put8(static_cast<uint8_t>(chunkLen));
+            writer.putBytes(domain.data() + processed, chunkLen);
             processed += chunkLen;
         }
 
         start = end + 1;
     }
 
-    *buffer++ = 0;
+    return writer.put8(0);
 }
 
-void Response::parse_rdata(uint16_t type, const char* data, uint16_t length,
+void Response::parse_rdata(Answer& answer, const char* data, uint16_t length,
                            const char* begin, const char* end)
 {
-    m_rdLength = length;
-    m_rdataBinary.assign(data, data + length);
-    m_rdata.clear();
-    m_txtStrings.clear();
+    answer.rdataBinary.assign(data, data + length);
+    answer.rdata.clear();
+    answer.txtStrings.clear();
 
-    switch (type)
+    switch (answer.type)
     {
         case 16: // TXT
         {
@@ -401,16 +410,16 @@ void Response::parse_rdata(uint16_t type, const char* data, uint16_t length,
                     chunkLen = remaining;
 
                 std::string piece(ptr, ptr + chunkLen);
-                m_txtStrings.push_back(piece);
+                answer.txtStrings.push_back(piece);
                 combined.append(piece);
                 ptr += chunkLen;
                 remaining -= chunkLen;
             }
 
             if (length == 0)
-                m_txtStrings.emplace_back();
+                answer.txtStrings.emplace_back();
 
-            m_rdata = combined;
+            answer.rdata = combined;
             break;
         }
         case 5:  // CNAME
@@ -418,21 +427,21 @@ void Response::parse_rdata(uint16_t type, const char* data, uint16_t length,
         case 12: // PTR
         {
             const char* ptr = data;
-            decode_domain(ptr, m_rdata, begin, end);
+            decode_domain(ptr, answer.rdata, begin, end);
             break;
         }
         case 15: // MX
         {
             if (length >= 2)
             {
-                m_mxPreference = peek16(data);
+                answer.mxPreference = peek16(data);
                 const char* ptr = data + 2;
-                decode_domain(ptr, m_rdata, begin, end);
+                decode_domain(ptr, answer.rdata, begin, end);
             }
             else
             {
-                m_mxPreference = 0;
-                m_rdata.clear();
+                answer.mxPreference = 0;
+                answer.rdata.clear();
             }
             break;
         }
@@ -441,134 +450,101 @@ void Response::parse_rdata(uint16_t type, const char* data, uint16_t length,
             if (length == 4)
                 // Convert IPv4 bytes to hex so the tunneling logic can
                 // reassemble the payload without additional parsing.
-                m_rdata = bytes_to_hex(data, length);
+                answer.rdata = bytes_to_hex(data, length);
             break;
         }
         case 28: // AAAA
         {
             if (length == 16)
                 // Same strategy for IPv6: expose the raw bytes as hex.
-                m_rdata = bytes_to_hex(data, length);
+                answer.rdata = bytes_to_hex(data, length);
             break;
         }
         default:
         {
-            m_rdata.assign(data, data + length);
+            answer.rdata.assign(data, data + length);
             break;
         }
     }
 }
 
-std::vector<uint8_t> Response::build_rdata() const
+/**
+ * @brief Write the RDATA of answer in place.
+ *
+ * Bytes set with setRdataBytes() go out as they are. Otherwise the text
+ * RDATA is laid out for the record type: TXT as character-strings of up to
+ * 255 bytes (one or more per entry of txtStrings when set), CNAME/NS/PTR
+ * as a compressed name, MX as the preference and a compressed name, A and
+ * AAAA from hex or from the textual address, anything else as raw bytes.
+ *
+ * @return false if it does not fit in the writer.
+ */
+bool Response::write_rdata(WireWriter& writer, const Answer& answer, NameOffsets& names)
 {
-    if (!m_rdataBinary.empty())
-        return m_rdataBinary;
+    if (!answer.rdataBinary.empty())
+        return writer.putBytes(answer.rdataBinary.data(), answer.rdataBinary.size());
 
-    switch (m_answerType)
+    switch (answer.type)
     {
-        case 16:
-            return encode_txt_rdata(m_rdata);
-        case 5:
-        case 2:
-        case 12:
-            return encode_domain_rdata(m_rdata);
-        case 15:
-            return encode_mx_rdata(m_mxPreference, m_rdata);
-        case 1:
-            return encode_address_rdata(AF_INET, m_rdata);
-        case 28:
-            return encode_address_rdata(AF_INET6, m_rdata);
+        case 16: // TXT
+            if (answer.txtStrings.empty())
+                return write_txt(writer, answer.rdata);
+            for (const std::string& text : answer.txtStrings)
+                write_txt(writer, text);
+            return !writer.full();
+        case 5:  // CNAME
+        case 2:  // NS
+        case 12: // PTR
+            return code_domain(writer, answer.rdata, names);
+        case 15: // MX
+            writer.put16(answer.mxPreference);
+            return code_domain(writer, answer.rdata, names);
+        case 1:  // A
+            return write_address(writer, AF_INET, answer.rdata);
+        case 28: // AAAA
+            return write_address(writer, AF_INET6, answer.rdata);
         default:
-            return std::vector<uint8_t>(m_rdata.begin(), m_rdata.end());
-    }
-}
-
-std::vector<uint8_t> Response::encode_domain_rdata(const std::string& domain) const
-{
-    std::vector<uint8_t> out;
-    if (domain.empty())
-    {
-        out.push_back(0);
-        return out;
+            return writer.putBytes(answer.rdata.data(), answer.rdata.size());
     }
-
-    size_t start = 0;
-    while (start < domain.size())
-    {
-        size_t dot = domain.find('.', start);
-        if (dot == std::string::npos)
-            dot = domain.size();
-
-        std::string label = domain.substr(start, dot - start);
-        size_t consumed = 0;
-        while (consumed < label.size())
-        {
-            size_t chunk = std::min<size_t>(63, label.size() - consumed);
-            out.push_back(static_cast<uint8_t>(chunk));
-            out.insert(out.end(), label.begin() + consumed, label.begin() + consumed + chunk);
-            consumed += chunk;
-        }
-
-        start = dot + 1;
-    }
-
-    out.push_back(0);
-    return out;
 }
 
-std::vector<uint8_t> Response::encode_txt_rdata(const std::string& text) const
+// Write text as TXT character-strings of up to 255 bytes; an empty text is
+// one empty string.
+bool Response::write_txt(WireWriter& writer, const std::string& text)
 {
-    std::vector<uint8_t> out;
     if (text.empty())
-    {
-        out.push_back(0);
-        return out;
-    }
+        return writer.put8(0);
 
     size_t pos = 0;
     while (pos < text.size())
     {
         size_t chunk = std::min<size_t>(255, text.size() - pos);
-        out.push_back(static_cast<uint8_t>(chunk));
-        out.insert(out.end(), text.begin() + pos, text.begin() + pos + chunk);
+        writer.put8(static_cast<uint8_t>(chunk));
+        writer.putBytes(text.data() + pos, chunk);
         pos += chunk;
     }
 
-    return out;
+    return !writer.full();
 }
 
-std::vector<uint8_t> Response::encode_mx_rdata(uint16_t preference, const std::string& exchange) const
+// Write an IPv4 or IPv6 address given as hex digits or in textual form;
+// nothing if it is neither.
+bool Response::write_address(WireWriter& writer, int family, const std::string& address)
 {
-    std::vector<uint8_t> domain = encode_domain_rdata(exchange);
-    std::vector<uint8_t> out;
-    out.reserve(domain.size() + 2);
-    out.push_back(static_cast<uint8_t>((preference >> 8) & 0xFF));
-    out.push_back(static_cast<uint8_t>(preference & 0xFF));
-    out.insert(out.end(), domain.begin(), domain.end());
-    return out;
-}
-
-std::vector<uint8_t> Response::encode_address_rdata(int family, const std::string& address) const
-{
-    size_t expected = (family == AF_INET) ? 4 : (family == AF_INET6 ? 16 : 0);
-    if (expected == 0)
-        return {};
+    const size_t expected = (family == AF_INET) ? 4 : 16;
+    uint8_t bytes[16];
 
-    bool looksHex = !address.empty() &&
-                    address.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos &&
-                    address.size() == expected * 2;
-    if (looksHex)
-        return hex_to_bytes(address);
+    if (hex_to_bytes(address, bytes, expected))
+        return writer.putBytes(bytes, expected);
 
-    std::vector<uint8_t> out(expected);
 #ifdef _WIN32
-    if (InetPtonA(family, address.c_str(), out.data()) != 1)
-        return {};
+    if (InetPtonA(family, address.c_str(), bytes) != 1)
+        return true;
 #else
-    if (inet_pton(family, address.c_str(), out.data()) != 1)
-        return {};
+    if (inet_pton(family, address.c_str(), bytes) != 1)
+        return true;
 #endif
-    return out;
+    return writer.putBytes(bytes, expected);
 }
 
 void Response::skip_record(const char*& buffer, const char* begin, const char* end)
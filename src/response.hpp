@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "message.hpp"
@@ -16,65 +17,85 @@ public:
 
     enum Code { Ok=0, FormatError, ServerFailure, NameError, NotImplemented, Refused };
 
+    // One record of the answer section.
+    struct Answer
+    {
+        std::string name;
+        uint type = 0;
+        uint klass = 0;
+        ulong ttl = 0;
+        // decoded RDATA: TXT strings concatenated, names as text, A/AAAA
+        // as hex, raw bytes otherwise
+        std::string rdata;
+        std::vector<uint8_t> rdataBinary;
+        // TXT character-strings; when set, code() writes one per entry
+        // (split further if longer than 255 bytes) instead of cutting rdata
+        std::vector<std::string> txtStrings;
+        uint16_t mxPreference = 0;
+    };
+
     Response();
     ~Response();
 
-    int code(char* buffer);
+    using Message::code;
+    int code(char* buffer, size_t capacity) override;
     void decode(const char* buffer, int size);
 
     std::string asString() const;
 
     void setRCode(Code code) { m_rcode = code; }
 
+    // The setters and getters below act on the first answer, created on
+    // demand; addAnswer() appends more.
     void setName(const std::string& value);
     void setAnswerName(const std::string& value);
     void setType(const uint value);
     void setClass(const uint value);
-    void setTtl(const ulong value) { m_ttl = value; }
-    void setRdLength(const uint value) { m_rdLength = value; }
+    void setTtl(const ulong value) { primaryAnswer().ttl = value; }
+    // RDATA length is computed by code(); kept for compatibility.
+    void setRdLength(const uint value) { (void)value; }
     void setRdata(const std::string& value);
     void setRdataBytes(const std::vector<uint8_t>& data);
-    void setMxPreference(uint16_t preference) { m_mxPreference = preference; }
+    void setMxPreference(uint16_t preference) { primaryAnswer().mxPreference = preference; }
 
     void clearAnswer();
+    // Append an answer record. code() writes all the answers and sets
+    // ANCOUNT to their number, unless ANCOUNT is 0.
+    void addAnswer(const Answer& answer);
+    const std::vector<Answer>& getAnswers() const { return m_answers; }
 
     const std::string& getQuestionName() const { return m_questionName; }
     uint getQuestionType() const { return m_questionType; }
     uint getQuestionClass() const { return m_questionClass; }
 
-    const std::string& getRdata() const { return m_rdata; }
-    const std::vector<uint8_t>& getRdataBytes() const { return m_rdataBinary; }
-    const std::vector<std::string>& getTxtStrings() const { return m_txtStrings; }
-    uint16_t getMxPreference() const { return m_mxPreference; }
-    const std::string& getName() const { return m_answerName; }
-    uint getType() const { return m_answerType; }
-    uint getClass() const { return m_answerClass; }
+    const std::string& getRdata() const { return firstAnswer().rdata; }
+    const std::vector<uint8_t>& getRdataBytes() const { return firstAnswer().rdataBinary; }
+    const std::vector<std::string>& getTxtStrings() const { return firstAnswer().txtStrings; }
+    uint16_t getMxPreference() const { return firstAnswer().mxPreference; }
+    const std::string& getName() const { return firstAnswer().name; }
+    uint getType() const { return firstAnswer().type; }
+    uint getClass() const { return firstAnswer().klass; }
     
 private:
     std::string m_questionName;
     uint m_questionType;
     uint m_questionClass;
 
-    std::string m_answerName;
-    uint m_answerType;
-    uint m_answerClass;
-    ulong m_ttl;
-    uint m_rdLength;
-    std::string m_rdata;
-    std::vector<uint8_t> m_rdataBinary;
-    std::vector<std::string> m_txtStrings;
-    uint16_t m_mxPreference;
+    std::vector<Answer> m_answers;
+
+    Answer& primaryAnswer();
+    const Answer& firstAnswer() const;
 
     void decode_domain(const char*& buffer, std::string& domain, const char* begin, const char* end);
-    void code_domain(char*& buffer, const std::string& domain);
+    // offsets of the names written so far by code(), for compression
+    using NameOffsets = std::unordered_map<std::string, uint16_t>;
+    bool code_domain(WireWriter& writer, const std::string& domain, NameOffsets& names);
 
-    void parse_rdata(uint16_t type, const char* data, uint16_t length,
+    void parse_rdata(Answer& answer, const char* data, uint16_t length,
                      const char* begin, const char* end);
-    std::vector<uint8_t> build_rdata() const;
-    std::vector<uint8_t> encode_domain_rdata(const std::string& domain) const;
-    std::vector<uint8_t> encode_txt_rdata(const std::string& text) const;
-    std::vector<uint8_t> encode_mx_rdata(uint16_t preference, const std::string& exchange) const;
-    std::vector<uint8_t> encode_address_rdata(int family, const std::string& address) const;
+    bool write_rdata(WireWriter& writer, const Answer& answer, NameOffsets& names);
+    bool write_txt(WireWriter& writer, const std::string& text);
+    bool write_address(WireWriter& writer, int family, const std::string& address);
     void skip_record(const char*& buffer, const char* begin, const char* end);
 };
 
@@ -5,6 +5,7 @@
 #include <chrono>
 #include <cctype>
 #include <string_view>
+#include <vector>
 
 #include <errno.h>
 
@@ -19,6 +20,16 @@
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
+#ifdef DNS_HAVE_IO_URING
+#include <poll.h>
+
+#include "ioUring.hpp"
+#endif
+
 namespace
 {
 std::string endpointToString(const sockaddr_in& addr)
@@ -33,6 +44,155 @@ std::string endpointToString(const sockaddr_in& addr)
 #endif
     return std::string(buffer) + ":" + std::to_string(ntohs(addr.sin_port));
 }
+
+dns::PcapEndpoint toEndpoint(const sockaddr_in& addr)
+{
+    dns::PcapEndpoint endpoint;
+    endpoint.address = ntohl(addr.sin_addr.s_addr);
+    endpoint.port = ntohs(addr.sin_port);
+    return endpoint;
+}
+
+#ifdef __linux__
+// room for the SCM_TIMESTAMPNS control message of a received datagram
+constexpr size_t TIMESTAMP_CONTROL_SIZE = CMSG_SPACE(sizeof(struct timespec));
+
+struct timespec wallClockNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now;
+}
+
+/**
+ * @brief Time a datagram waited in the socket before being read.
+ *
+ * With SO_TIMESTAMPNS the kernel attaches the wall-clock time it received
+ * each datagram as an SCM_TIMESTAMPNS control message; the delay is `now`
+ * minus that time. It covers the socket receive queue and the time the
+ * worker spent on the datagrams before it.
+ *
+ * @return The delay, or a negative duration if msg carries no timestamp.
+ */
+std::chrono::nanoseconds receiveDelay(struct msghdr& msg, const struct timespec& now)
+{
+    for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPNS)
+            continue;
+
+        struct timespec stamp;
+        memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+        return std::chrono::seconds(now.tv_sec - stamp.tv_sec) + std::chrono::nanoseconds(now.tv_nsec - stamp.tv_nsec);
+    }
+    return std::chrono::nanoseconds(-1);
+}
+
+/**
+ * @brief Build the classic BPF program steering queries to reuseport workers.
+ *
+ * The program runs on the UDP payload of every query reaching the port and
+ * returns the index of the worker socket that receives it. It reads the
+ * client id, the label right before the domain in `data.id.domain`, and
+ * hashes its first four bytes so every query of a client lands on the same
+ * worker.
+ *
+ * Classic BPF has no backward jumps, so the QNAME is walked with one
+ * unrolled block per label. Scratch memory holds a shift register of the
+ * offsets of the last `domainLabels + 1` labels: when the terminating zero
+ * label is reached, its oldest slot is the offset of the client id label.
+ *
+ * Per label block (X holds the offset of the label length byte):
+ *   A = P[X]; if A == 0 goto done; if A & 0xC0 goto invalid;
+ *   M[tmp] = A; M[k] = M[k-1] for k = domainLabels..1; M[0] = X;
+ *   X = X + M[tmp] + 1
+ *
+ * Then:
+ *   done:    X = M[domainLabels]; if X == 0 goto invalid;
+ *            A = P[X+1 .. X+4] | 0x20202020   (ignore 0x20 case randomization)
+ *            return (A * golden ratio >> 16) % workers
+ *   invalid: return ~0
+ *
+ * An index past the number of sockets, as returned for names that are not
+ * in the expected form, makes the kernel fall back to its default hash.
+ * Reads past the end of the datagram end the program with 0 (first worker).
+ *
+ * @return The program, or an empty vector if the domain has too many labels
+ *         for the scratch memory.
+ */
+std::vector<struct sock_filter> buildSteeringProgram(unsigned int domainLabels, unsigned int workers)
+{
+    std::vector<struct sock_filter> program;
+
+    const unsigned int slots = domainLabels + 1;
+    const unsigned int tmp = slots;
+    if(tmp >= BPF_MEMWORDS)
+        return program;
+
+    const unsigned int blockSize = 11 + 2 * domainLabels;
+    const unsigned int epilogueSize = 12;
+    const unsigned int maxLabels = std::min(127U, (BPF_MAXINSNS - 2 * slots - 2 - epilogueSize) / blockSize);
+
+    auto emit = [&](uint16_t code, uint8_t jt, uint8_t jf, uint32_t k) {
+        program.push_back(BPF_JUMP(code, k, jt, jf));
+    };
+
+    // mark every slot as "no label yet", X = offset of the QNAME
+    emit(BPF_LD | BPF_IMM, 0, 0, 0);
+    for(unsigned int i = 0; i < slots; ++i)
+        emit(BPF_ST, 0, 0, i);
+    emit(BPF_LDX | BPF_IMM, 0, 0, 12);
+
+    // unrolled label walk, the ja targets are patched once the end is known
+    std::vector<size_t> jumpsToDone;
+    std::vector<size_t> jumpsToInvalid;
+    for(unsigned int label = 0; label < maxLabels; ++label)
+    {
+        emit(BPF_LD | BPF_B | BPF_IND, 0, 0, 0);
+        emit(BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0);
+        jumpsToDone.push_back(program.size());
+        emit(BPF_JMP | BPF_JA, 0, 0, 0);
+        emit(BPF_JMP | BPF_JSET | BPF_K, 0, 1, 0xC0);
+        jumpsToInvalid.push_back(program.size());
+        emit(BPF_JMP | BPF_JA, 0, 0, 0);
+
+        emit(BPF_ST, 0, 0, tmp);
+        for(unsigned int k = domainLabels; k > 0; --k)
+        {
+            emit(BPF_LD | BPF_MEM, 0, 0, k - 1);
+            emit(BPF_ST, 0, 0, k);
+        }
+        emit(BPF_STX, 0, 0, 0);
+        emit(BPF_LD | BPF_MEM, 0, 0, tmp);
+        emit(BPF_ALU | BPF_ADD | BPF_K, 0, 0, 1);
+        emit(BPF_ALU | BPF_ADD | BPF_X, 0, 0, 0);
+        emit(BPF_MISC | BPF_TAX, 0, 0, 0);
+    }
+    // too many labels
+    jumpsToInvalid.push_back(program.size());
+    emit(BPF_JMP | BPF_JA, 0, 0, 0);
+
+    const size_t done = program.size();
+    emit(BPF_LDX | BPF_MEM, 0, 0, slots - 1);
+    emit(BPF_MISC | BPF_TXA, 0, 0, 0);
+    emit(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 0);
+    emit(BPF_LD | BPF_W | BPF_IND, 0, 0, 1);
+    emit(BPF_ALU | BPF_OR | BPF_K, 0, 0, 0x20202020);
+    emit(BPF_ALU | BPF_MUL | BPF_K, 0, 0, 0x9E3779B1);
+    emit(BPF_ALU | BPF_RSH | BPF_K, 0, 0, 16);
+    emit(BPF_ALU | BPF_MOD | BPF_K, 0, 0, workers);
+    emit(BPF_RET | BPF_A, 0, 0, 0);
+    const size_t invalid = program.size();
+    emit(BPF_RET | BPF_K, 0, 0, 0xFFFFFFFF);
+
+    for(size_t at : jumpsToDone)
+        program[at].k = static_cast<uint32_t>(done - at - 1);
+    for(size_t at : jumpsToInvalid)
+        program[at].k = static_cast<uint32_t>(invalid - at - 1);
+
+    return program;
+}
+#endif
 }
 
 using namespace std;
@@ -42,10 +202,16 @@ using namespace dns;
 Server::Server(int port, const std::string& domainToResolve)
 : Dns(domainToResolve, "")
 , m_port(port)
+, m_batchSize(DEFAULT_BATCH_SIZE)
+, m_workerCount(1)
+, m_clientSteering(false)
+, m_clientSteeringActive(false)
+, m_ioUring(true)
+, m_isStoped(true)
 {
-    dns::debug::log("Server",
-                    "Constructed for domain '" + m_domainToResolve +
-                        "' on port " + std::to_string(m_port));
+    DNS_LOG(Info, "Server",
+                  "Constructed for domain '" + m_domainToResolve +
+                      "' on port " + std::to_string(m_port));
 }
 
 
@@ -55,38 +221,103 @@ Server::~Server()
 }
 
 
+/**
+ * @brief Stop the workers and close their sockets.
+ *
+ * On Linux each socket is shut down for reading, which makes the blocked
+ * recvfrom()/recvmmsg() of its worker return, and io_uring workers are
+ * woken up through the eventfd of their ring. Elsewhere the only worker is
+ * woken up with an empty datagram sent to the loopback address. The worker
+ * threads are then joined and the sockets closed.
+ */
 void Server::stop()
 {
-    if (m_isStoped)
+    if (m_isStoped.exchange(true))
     {
-        dns::debug::log("Server::stop",
-                        "Stop requested but server already stopped");
+        DNS_LOG(Debug, "Server::stop",
+                       "Stop requested but server already stopped");
         return;
     }
-    dns::debug::log("Server::stop",
-                    "Stopping server on port " + std::to_string(m_port));
-    m_isStoped=true;
-    // Send an empty datagram to unblock recvfrom
-    struct sockaddr_in addr = m_address;
-    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    char byte = 0;
-    sendto(m_sockfd, &byte, 1, 0, (struct sockaddr*)&addr, sizeof(addr));
-    dns::debug::log("Server::stop", "Sent loopback datagram to unblock recvfrom");
-    if(m_dnsServ && m_dnsServ->joinable())
+    DNS_LOG(Info, "Server::stop",
+                  "Stopping server on port " + std::to_string(m_port));
+
+    for(int sockfd : m_sockets)
     {
-        dns::debug::log("Server::stop", "Joining worker thread");
-        m_dnsServ->join();
-    }
 #ifdef __linux__
-    close(m_sockfd);
+        shutdown(sockfd, SHUT_RD);
+        DNS_LOG(Debug, "Server::stop", "Shut down socket " + std::to_string(sockfd) + " to unblock its worker");
 #elif _WIN32
-    closesocket(m_sockfd);
+        // Send an empty datagram to unblock recvfrom
+        struct sockaddr_in addr = m_address;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        char byte = 0;
+        sendto(sockfd, &byte, 1, 0, (struct sockaddr*)&addr, sizeof(addr));
+        DNS_LOG(Debug, "Server::stop", "Sent loopback datagram to unblock recvfrom");
+#endif
+    }
+#ifdef DNS_HAVE_IO_URING
+    for(std::unique_ptr<IoUring>& ring : m_rings)
+        ring->wakeup();
+#endif
+
+    for(std::thread& worker : m_workers)
+    {
+        if(worker.joinable())
+        {
+            DNS_LOG(Debug, "Server::stop", "Joining worker thread");
+            worker.join();
+        }
+    }
+    m_workers.clear();
+#ifdef DNS_HAVE_IO_URING
+    m_rings.clear();
+#endif
+
+    closeSockets();
+#ifdef _WIN32
     WSACleanup();
 #endif
-    dns::debug::log("Server::stop", "Socket closed");
+    DNS_LOG(Info, "Server::stop", "Socket closed");
 }
 
 
+void Server::closeSockets()
+{
+    for(int sockfd : m_sockets)
+    {
+#ifdef __linux__
+        close(sockfd);
+#elif _WIN32
+        closesocket(sockfd);
+#endif
+    }
+    m_sockets.clear();
+}
+
+
+/**
+ * @brief Open the worker sockets and start one worker thread per socket.
+ *
+ * Steps:
+ *   1. Create m_workerCount UDP sockets. With more than one worker, each
+ *      socket gets SO_REUSEPORT before being bound, so they all bind the
+ *      same port and the kernel spreads the incoming queries across them
+ *      (by hash of the source address and port). On Linux each socket
+ *      also gets SO_TIMESTAMPNS, so the workers can measure how long
+ *      queries waited before being read.
+ *   2. Bind every socket to m_port on all interfaces. If any step fails,
+ *      close the sockets already opened and leave the server stopped.
+ *   3. If client steering is enabled, attach the classic BPF program that
+ *      sends all the queries of a client to the same worker (see
+ *      attachSteeringProgram()).
+ *   4. If io_uring is enabled (DNS_ENABLE_IO_URING builds), create one ring
+ *      per socket (see setupRings()).
+ *   5. Start one thread per socket running runUring() if the rings were
+ *      created, else runBatched() (Linux, batch size above 1) or run().
+ *
+ * Workers only share the session state inherited from Dns, which is
+ * protected by m_mutex.
+ */
 void Server::launch()
 {
 #ifdef _WIN32
@@ -98,295 +329,1108 @@ void Server::launch()
     }
 #endif
 
-    dns::debug::log("Server::launch",
-                    "Launching server for domain '" + m_domainToResolve +
-                        "' on port " + std::to_string(m_port));
+    DNS_LOG(Info, "Server::launch",
+                  "Launching server for domain '" + m_domainToResolve +
+                      "' on port " + std::to_string(m_port) + " with " +
+                      std::to_string(m_workerCount) + " worker(s)");
 
-    m_isStoped=false;
-    m_sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    m_address.sin_family = AF_INET;
+    m_address.sin_addr.s_addr = INADDR_ANY;
+    m_address.sin_port = htons(m_port);
 
-    if(m_sockfd < 0)
+    for(unsigned int i = 0; i < m_workerCount; ++i)
     {
-        dns::debug::log("Server::launch",
-                        "socket() failed: " + std::string(strerror(errno)));
-        m_isStoped = true;
+        int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        if(sockfd < 0)
+        {
+            DNS_LOG(Error, "Server::launch",
+                           "socket() failed: " + std::string(strerror(errno)));
+            closeSockets();
 #ifdef _WIN32
-        WSACleanup();
+            WSACleanup();
 #endif
-        return;
-    }
+            return;
+        }
+        m_sockets.push_back(sockfd);
 
-    dns::debug::log("Server::launch", "Socket created (fd=" +
-                                         std::to_string(m_sockfd) + ")");
+        DNS_LOG(Debug, "Server::launch", "Socket created (fd=" +
+                                            std::to_string(sockfd) + ")");
 
-    m_address.sin_family = AF_INET;
-    m_address.sin_addr.s_addr = INADDR_ANY;
-    m_address.sin_port = htons(m_port);
+#ifdef __linux__
+        if(m_workerCount > 1)
+        {
+            int enable = 1;
+            if(setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0)
+            {
+                DNS_LOG(Error, "Server::launch",
+                               "setsockopt(SO_REUSEPORT) failed: " + std::string(strerror(errno)));
+                closeSockets();
+                return;
+            }
+        }
+#endif
 
-    int rbind = bind(m_sockfd, (struct sockaddr *) & m_address, sizeof(struct sockaddr_in));
-    if (rbind != 0)
-    {
-        string text("Could not bind: ");
-        text += strerror(errno);
+#ifdef __linux__
+        // kernel receive times, for Histogram::ReceiveDelay
+        int timestamps = 1;
+        if(setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &timestamps, sizeof(timestamps)) != 0)
+        {
+            DNS_LOG(Warn, "Server::launch",
+                          "setsockopt(SO_TIMESTAMPNS) failed: " + std::string(strerror(errno)) +
+                              "; receive delays will not be measured");
+        }
+#endif
+
+        int rbind = bind(sockfd, (struct sockaddr *) & m_address, sizeof(struct sockaddr_in));
+        if (rbind != 0)
+        {
+            string text("Could not bind: ");
+            text += strerror(errno);
 
-        dns::debug::log("Server::launch", text);
+            DNS_LOG(Debug, "Server::launch", text);
 
+            closeSockets();
 #ifdef _WIN32
-        WSACleanup();
+            WSACleanup();
+#endif
+
+            return;
+        }
+    }
+
+    DNS_LOG(Info, "Server::launch",
+                  "Socket(s) bound to port " + std::to_string(m_port));
+
+    m_clientSteeringActive = false;
+#ifdef __linux__
+    if(m_clientSteering && m_sockets.size() > 1)
+        attachSteeringProgram();
+#endif
+
+#ifdef DNS_HAVE_IO_URING
+    if(m_ioUring)
+        setupRings();
+#endif
+
+    m_isStoped = false;
+    for(size_t i = 0; i < m_sockets.size(); ++i)
+    {
+        const int sockfd = m_sockets[i];
+#ifdef DNS_HAVE_IO_URING
+        if(!m_rings.empty())
+            m_workers.emplace_back(&Server::runUring, this, m_rings[i].get(), sockfd);
+        else
 #endif
+#ifdef __linux__
+        if(m_batchSize > 1)
+            m_workers.emplace_back(&Server::runBatched, this, sockfd);
+        else
+#endif
+            m_workers.emplace_back(&Server::run, this, sockfd);
+    }
+    DNS_LOG(Info, "Server::launch", std::to_string(m_workers.size()) + " worker thread(s) started");
+}
+
 
+#ifdef __linux__
+/**
+ * @brief Steer the queries of each client to a single worker.
+ *
+ * Attaches the program built by buildSteeringProgram() to the reuseport
+ * group with SO_ATTACH_REUSEPORT_CBPF; the kernel runs it for every query
+ * and delivers it to the socket it returns. Without it the kernel hashes the
+ * source address and port, which changes with every resolver and query, so
+ * the fragments of one client are spread over all workers.
+ *
+ * Failures are logged and leave the kernel's default distribution in place:
+ * steering is an optimization, every worker can handle every client.
+ */
+void Server::attachSteeringProgram()
+{
+    std::string domain = m_domainToResolve;
+    if(!domain.empty() && domain.back() == '.')
+        domain.pop_back();
+    const unsigned int domainLabels = static_cast<unsigned int>(std::count(domain.begin(), domain.end(), '.')) + 1;
+
+    std::vector<struct sock_filter> program = buildSteeringProgram(domainLabels, static_cast<unsigned int>(m_sockets.size()));
+    if(program.empty())
+    {
+        DNS_LOG(Warn, "Server::attachSteeringProgram",
+                      "Domain '" + domain + "' has too many labels for client steering");
         return;
     }
 
-    dns::debug::log("Server::launch",
-                    "Socket bound to port " + std::to_string(m_port));
+    struct sock_fprog fprog;
+    fprog.len = static_cast<unsigned short>(program.size());
+    fprog.filter = program.data();
 
-    this->m_dnsServ = std::make_unique<std::thread>(&Server::run, this);
-    dns::debug::log("Server::launch", "Worker thread started");
+    if(setsockopt(m_sockets.front(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog)) != 0)
+    {
+        DNS_LOG(Error, "Server::attachSteeringProgram",
+                       "setsockopt(SO_ATTACH_REUSEPORT_CBPF) failed: " + std::string(strerror(errno)));
+        return;
+    }
+
+    m_clientSteeringActive = true;
+    DNS_LOG(Info, "Server::attachSteeringProgram",
+                  "Attached " + std::to_string(program.size()) +
+                      " instruction client steering program for " +
+                      std::to_string(m_sockets.size()) + " workers");
+}
+#endif
+
+
+void Server::setClientSteering(bool enable)
+{
+    m_clientSteering = enable;
+}
+
+
+bool Server::isClientSteeringActive() const
+{
+    return m_clientSteeringActive;
+}
+
+
+void Server::setIoUring(bool enable)
+{
+    m_ioUring = enable;
+}
+
+
+bool Server::isIoUringActive() const
+{
+#ifdef DNS_HAVE_IO_URING
+    return m_uringWorkers.load(std::memory_order_acquire) > 0;
+#else
+    return false;
+#endif
+}
+
+
+/**
+ * @brief Set the number of worker threads, each with its own socket.
+ *
+ * More than one worker requires SO_REUSEPORT (Linux); elsewhere the count
+ * stays at 1. Takes effect at the next launch().
+ */
+void Server::setWorkerCount(unsigned int workerCount)
+{
+#ifdef __linux__
+    m_workerCount = std::clamp(workerCount, 1U, MAX_WORKER_COUNT);
+#else
+    (void)workerCount;
+    m_workerCount = 1;
+#endif
 }
 
 
 /**
- * @brief Process queued QNAMEs and return the first complete reassembled message.
+ * @brief Return the next complete reassembled message, if any.
  *
- * This function is used on the server side to process DNS query names (QNAMEs)
- * that were previously received and stored in `m_qnameReceived` by the worker loop.
- * It extracts message fragments, associates them with client IDs, and then
- * reassembles complete messages.
+ * Fragments are reassembled by the worker loop as queries arrive (see
+ * handleQname), so this only pops the ready queue: it calls getMsg() to
+ * retrieve the next fully reassembled message, round-robin across clients.
  *
- * Steps:
- *   1. Acquire the mutex and move all queued QNAMEs into a local vector
- *      (`qnameTmp`), then clear the shared queue. Unlock the mutex early
- *      so other threads can continue appending new QNAMEs.
- *   2. Log the number of QNAMEs to process if any are present.
- *   3. For each QNAME:
- *        - Strip off the configured domain (`m_domainToResolve`),
- *          leaving only the "data.clientId" prefix.
- *        - Find the last dot:
- *            * everything before it is considered the `data` (the message fragment),
- *            * everything after it is considered the `clientId`.
- *        - Log domain, raw QNAME, extracted data, and clientId.
- *        - If both data and clientId are non-empty, call handleDataReceived()
- *          to parse and accumulate the fragment for that client.
- *   4. After processing all QNAMEs, call getMsg() to retrieve the first
- *      fully reassembled message (if any).
- *   5. Return the pair {clientId, msg}.
+ * @param report  If not null, receives the timing of the returned message:
+ *                first fragment received, reassembly and, when the client
+ *                timestamps its fragments, the time it queued the message.
  *
  * @return std::pair<std::string, std::string>
  *         - clientId: The identifier of the client whose message was completed.
  *         - msg:      The full reconstructed message payload, or empty if none complete.
  *
  * @note
- * - On the client side, this logic is not needed since handleResponse()
- *   is called directly for each response, so `m_qnameReceived` is unused.
- * - QNAMEs are expected in the form: `data.id.domain`.
- * - Only the first complete message (if any) is returned; additional
- *   complete messages remain in the reassembly buffer until requested.
+ * - Only one complete message (if any) is returned; additional complete
+ *   messages remain in the ready queue until requested. Use
+ *   getAvailableMessages() to drain several at once, or waitForMessage() to
+ *   block until one completes instead of polling.
  */
-std::pair<std::string, std::string> Server::getAvailableMessage()
+std::pair<std::string, std::string> Server::getAvailableMessage(TransferReport* report)
 {
-    std::unique_lock<std::mutex> lock(m_mutex);
+    auto [clientId, msg] = getMsg(report);
+
+    return {clientId, msg};
+}
 
-    std::vector<std::string> qnameTmp = m_qnameReceived;
-    m_qnameReceived.clear();
 
-    lock.unlock();
+/**
+ * @brief Retrieve up to maxCount fully reassembled messages at once.
+ *
+ * Same as getAvailableMessage(), but drains several complete messages under
+ * a single lock. Messages are returned in round-robin order across clients
+ * (see Dns::getMsgs), so one busy client cannot starve the others.
+ *
+ * @param maxCount  Maximum number of messages to return.
+ *
+ * @return The {clientId, msg} pairs, empty if no message is complete.
+ */
+std::vector<std::pair<std::string, std::string>> Server::getAvailableMessages(size_t maxCount)
+{
+    return getMsgs(maxCount);
+}
 
-    if(qnameTmp.size()>0)
-        dns::debug::log(
-            "Server::getAvailableMessage",
-            "Processing " +
-                std::to_string(static_cast<unsigned long long>(qnameTmp.size())) +
-                " queued QNAME(s)");
 
-    for(int i=0; i<qnameTmp.size(); i++)
+/**
+ * @brief Block until a message is complete or the timeout expires.
+ *
+ * The worker loop wakes the caller as soon as the last fragment of a message
+ * has been reassembled, so there is no polling delay.
+ *
+ * @param timeout  Maximum time to wait.
+ *
+ * @return The next {clientId, msg} pair, round-robin across clients, or
+ *         {"", ""} if no message completed in time.
+ */
+std::pair<std::string, std::string> Server::waitForMessage(std::chrono::milliseconds timeout)
+{
+    return waitForMsg(timeout);
+}
+
+
+/**
+ * @brief Register an observer of fragment progress and completed messages.
+ *
+ * The observer is called from the worker thread (see MessageObserver). It is
+ * not owned by the server; replacing or removing it with nullptr waits for
+ * the callbacks in progress on the previous one, which may be destroyed
+ * once this returns. Must not be called from a callback.
+ */
+void Server::setMessageObserver(MessageObserver* observer)
+{
+    setObserver(observer);
+}
+
+
+/**
+ * @brief Feed the data carried by a query name to the reassembly.
+ *
+ * Steps:
+ *   1. Ignore names outside of the configured domain (`m_domainToResolve`).
+ *   2. Strip off the domain, leaving only the "data.clientId" prefix.
+ *   3. Find the last dot:
+ *        * everything before it is considered the `data` (the message fragment),
+ *        * everything after it is considered the `clientId`.
+ *   4. If both data and clientId are non-empty, call handleDataReceived()
+ *      to parse and accumulate the fragment for that client. Control words
+ *      ("ask", "hello") are filtered out there.
+ *
+ * @param qname  The QNAME of a query, expected in the form `data.id.domain`.
+ */
+void Server::handleQname(const std::string& qname)
+{
+    if (qname.size() <= m_domainToResolve.size() || !endsWith(qname, m_domainToResolve))
+        return;
+
+    //data.id.domain
+    std::string prefix = qname.substr(0, qname.size() - m_domainToResolve.size() -1);
+    auto lastDot = prefix.rfind('.');
+
+    std::string data;
+    std::string clientId;
+
+    if (lastDot != std::string::npos) 
     {
+        data = prefix.substr(0, lastDot);          // "test1.test2.test3"
+        clientId = prefix.substr(lastDot + 1);      // "id"
+    } 
 
-        dns::debug::log(
-            "Server::getAvailableMessage",
-            "Processing " +
-            qnameTmp[i] +
-                " queued QNAME(s)");
+    DNS_LOG_EVENT(Debug, "Server::handleQname", "qName '{}' data '{}' clientId '{}'", qname, data, clientId);
 
-        //data.id.domain
-        std::string prefix = qnameTmp[i].substr(0, qnameTmp[i].size() - m_domainToResolve.size() -1);
-        auto lastDot = prefix.rfind('.');
+    if(!data.empty() && !clientId.empty()) 
+        handleDataReceived(data, clientId);
+}
 
-        std::string data;
-        std::string clientId;
 
-        if (lastDot != std::string::npos) 
-        {
-            data = prefix.substr(0, lastDot);          // "test1.test2.test3"
-            clientId = prefix.substr(lastDot + 1);      // "id"
-        } 
+/**
+ * @brief Queue a message for a client, behind the ones already pending.
+ *
+ * Messages are sent in order, one fragment per "ask" query from the client.
+ * Each client's queue is bounded by the byte watermarks (see
+ * setSendQueueWatermarks): once it holds the high watermark it refuses new
+ * messages until the client has drained it to the low watermark.
+ *
+ * @return true if the message was queued, false if the client's queue is
+ *         full. Use waitForSendSpace() to block until it is not.
+ */
+bool Server::setMessageToSend(const std::string& msg, const std::string& clientId)
+{
+    return setMsg(msg, clientId);
+}
+
+
+bool Server::waitForSendSpace(const std::string& clientId, std::chrono::milliseconds timeout)
+{
+    return Dns::waitForSendSpace(clientId, timeout);
+}
+
+
+void Server::setSendQueueWatermarks(size_t high, size_t low)
+{
+    setWatermarks(high, low);
+}
+
+
+void Server::setTransferTimestamps(bool enable)
+{
+    Dns::setTransferTimestamps(enable);
+}
+
+
+bool Server::startMetricsExport(const std::string& path, std::chrono::milliseconds period)
+{
+    return m_metricsExporter.startFile([this] { return metricsSnapshot(); }, path, period);
+}
+
+
+bool Server::startMetricsExport(MetricsExporter::Sink sink, std::chrono::milliseconds period)
+{
+    return m_metricsExporter.startCallback([this] { return metricsSnapshot(); }, std::move(sink), period);
+}
+
+
+void Server::stopMetricsExport()
+{
+    m_metricsExporter.stop();
+}
+
 
-        dns::debug::log("Server::getAvailableMessage", "m_domainToResolve '" + m_domainToResolve + "'");
-        dns::debug::log("Server::getAvailableMessage", "qName '" + qnameTmp[i] + "'");
-        dns::debug::log("Server::getAvailableMessage", "data '" + data + "'");
-        dns::debug::log("Server::getAvailableMessage", "clientId '" + clientId + "'");
+/**
+ * @brief Record the queries received and the replies sent in a pcap file.
+ *
+ * Every worker loop (recvfrom, recvmmsg and io_uring) writes the datagrams
+ * it reads and the replies the socket took, addressed from the client to
+ * the server's bound address and back, so the capture can be opened in
+ * Wireshark or replayed with replayBench. Datagrams answered through
+ * processDatagram() alone, such as those of a Reactor, are not captured.
+ *
+ * @return false if the file cannot be created or a capture is running.
+ */
+bool Server::startCapture(const std::string& path)
+{
+    return m_capture.open(path);
+}
 
-        if(!data.empty() && !clientId.empty()) 
-            handleDataReceived(data, clientId);
+
+void Server::stopCapture()
+{
+    m_capture.close();
+}
+
+/**
+ * @brief Answer one DNS query.
+ *
+ * Steps:
+ *   1. Parse the datagram in place with a QueryView and drop it if it is
+ *      not a well-formed query: too short to hold a DNS header (such as the
+ *      one stop() sends to unblock the worker), without a question, or with
+ *      a QNAME running out of the datagram.
+ *   2. Fill `query` from the view and log its metadata (ID, qname, qtype,
+ *      qclass), then answer it with processQuery():
+ *   3. Pass the qname to handleQname(), which adds the fragment it carries
+ *      to the reassembly and wakes waitForMessage() when a message completes.
+ *   4. Construct a Response object and call prepareResponse() to build the
+ *      DNS reply based on the incoming query.
+ *   5. Serialize the Response into `out` and log its size and RDATA length.
+ *
+ * @param in       The received datagram.
+ * @param size     Size of the datagram in bytes.
+ * @param out      Buffer receiving the encoded reply.
+ * @param outSize  Size of `out`, at least BUFFER_SIZE.
+ * @param query    Scratch query the worker loops keep across datagrams, so
+ *                 the QNAME reuses the storage of the previous one.
+ *
+ * @return The size of the reply written to `out`, 0 if the datagram gets
+ *         no reply.
+ */
+int Server::processDatagram(const char* in, int size, char* out, int outSize, Query& query)
+{
+    m_metrics.add(Counter::BytesIn, static_cast<uint64_t>(std::max(0, size)));
+    const auto decodeStart = std::chrono::steady_clock::now();
+
+    QueryView view;
+    if(size < 12 || !view.parse(in, static_cast<size_t>(size)))
+    {
+        discardDatagram(size);
+        return 0;
     }
 
-    auto [clientId, msg] = getMsg();
+    // all messages are part of the final payload that need to be put together
+    query.assign(view);
+    m_metrics.record(Histogram::Decode, std::chrono::steady_clock::now() - decodeStart);
 
-    return {clientId, msg};
+    DNS_LOG_EVENT(Debug, "Server::processDatagram", "Decoded query id={} qname='{}' qtype={} qclass={}",
+                  query.getID(), query.getQName(), query.getQType(), query.getQClass());
+
+    return processQuery(query, out, outSize);
 }
 
 
-void Server::setMessageToSend(const std::string& msg, const std::string& clientId)
+int Server::processDatagram(const char* in, int size, char* out, int outSize)
 {
-    setMsg(msg, clientId);
+    Query query;
+    return processDatagram(in, size, out, outSize, query);
 }
 
+
+// Count a datagram that gets no reply because it is not a well-formed query,
+// for processDatagram() and the Reactor, which parses datagrams itself.
+void Server::discardDatagram(int size)
+{
+    m_metrics.add(Counter::ParseFailures);
+    DNS_LOG_EVENT(Warn, "Server::processDatagram", "Ignoring malformed {} byte datagram", size);
+}
+
+
+/**
+ * @brief Answer a decoded query.
+ *
+ * Second half of processDatagram(), for callers that already decoded the
+ * query, such as the Reactor which needs the QNAME to pick the server.
+ *
+ * @return The size of the reply written to `out`, within responseSizeLimit().
+ */
+int Server::processQuery(const Query& query, char* out, int outSize)
+{
+    const auto processStart = std::chrono::steady_clock::now();
+    m_metrics.countQuery(query.getQType());
+
+    // add the fragment carried by the qname to the message it belongs to
+    handleQname(query.getQName());
+
+    Response response;
+    prepareResponse(query, response);
+
+    const auto afterPrepare = std::chrono::steady_clock::now();
+
+    DNS_LOG_EVENT(Debug, "Server::processQuery", "handleQname and prepareResponse completed in {} us",
+                  dns::debug::microseconds(afterPrepare - processStart));
+
+    // the writer stops at what the requester accepts; answers that would
+    // not fit are left out and the TC bit is set
+    const int limit = std::min(outSize, responseSizeLimit(query));
+    int nbytes = response.code(out, static_cast<size_t>(std::max(0, limit)));
+
+    const auto afterEncode = std::chrono::steady_clock::now();
+
+    DNS_LOG_EVENT(Debug, "Server::processQuery", "Encoded response of {} bytes with {} answer(s), TC={}",
+                  nbytes, response.getAnCount(), response.isTruncated());
+
+    m_metrics.add(Counter::BytesOut, static_cast<uint64_t>(std::max(0, nbytes)));
+    if(response.isTruncated())
+        m_metrics.add(Counter::Truncated);
+    m_metrics.record(Histogram::Prepare, afterPrepare - processStart);
+    m_metrics.record(Histogram::Encode, afterEncode - afterPrepare);
+    m_metrics.record(Histogram::ProcessLatency, afterEncode - processStart);
+
+    return nbytes;
+}
+
+
 /**
  * @brief Main worker loop of the DNS server.
  *
  * This function runs in a loop until `m_isStoped` is set, continuously
- * receiving DNS queries from clients, decoding them, preparing responses,
- * and sending replies back.
+ * receiving DNS queries from clients on `sockfd`, one of the worker sockets,
+ * answering them with processDatagram(),
+ * and sending replies back, one datagram at a time. It is used when the
+ * batch size is 1 and on platforms without recvmmsg (see runBatched()).
  *
  * Steps:
- *   1. Wait for an incoming UDP datagram using recvfrom().
- *      - If recvfrom() returns <= 0 and the server is stopping, exit the loop.
- *      - If recvfrom() returns <= 0 but the server is not stopping, continue
+ *   1. Wait for an incoming UDP datagram using recvfrom(), or recvmsg() on
+ *      Linux, which also returns the kernel receive time (SO_TIMESTAMPNS)
+ *      recorded in Histogram::ReceiveDelay.
+ *      - If it returns <= 0 and the server is stopping, exit the loop.
+ *      - If it returns <= 0 but the server is not stopping, continue
  *        waiting.
  *   2. Convert the client address into a string for logging.
- *   3. Decode the received buffer into a Query object and log its metadata
- *      (ID, qname, qtype, qclass).
- *   4. Store the qname in m_qnameReceived (used later to reassemble complete
- *      messages).
- *   5. Construct a Response object and call prepareResponse() to build the
- *      DNS reply based on the incoming query.
- *      - TODO: add validation to ensure data is only sent to the correct
- *        beacon / client identity.
- *   6. Serialize the Response into the buffer and log its size and RDATA length.
- *   7. Send the response back to the client using sendto(), and log the number
+ *   3. Call processDatagram() to decode the query, feed the reassembly and
+ *      encode the reply.
+ *   4. Send the response back to the client using sendto(), and log the number
  *      of bytes sent along with timing information.
- *   8. Loop repeats until m_isStoped is true.
+ *   5. Loop repeats until m_isStoped is true.
  *
  * @note
- * - This loop processes all incoming queries synchronously on the thread
- *   that calls run().
+ * - This loop processes the queries of its socket synchronously on the
+ *   thread that calls run(); each worker runs its own loop.
  * - Currently, the client address is only logged but not used for session
  *   handling; depending on the design, this might need to be tied to client
  *   sessions for correctness.
- * - m_qnameReceived accumulates all qnames seen, which are later processed
- *   to reconstruct higher-level messages.
+ * - Messages are reassembled on this thread; MessageObserver callbacks run
+ *   here too.
  *
  * Logging:
  * - Detailed debug logs are emitted for receive timings, query decoding,
  *   response preparation, and send timings.
  */
 
-void Server::run()
+void Server::run(int sockfd)
 {
     char buffer[BUFFER_SIZE];
+    char reply[BUFFER_SIZE];
     struct sockaddr_in clientAddress;
     socklen_t addrLen = sizeof (struct sockaddr_in);
+    Query query;
+#ifdef __linux__
+    // recvmsg, to get the kernel receive time along with the datagram
+    alignas(struct cmsghdr) char control[TIMESTAMP_CONTROL_SIZE];
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = BUFFER_SIZE;
+    struct msghdr msg;
+#endif
 
-    dns::debug::log("Server::run", "Worker loop started");
+    DNS_LOG(Info, "Server::run", "Worker loop started");
 
     while(!m_isStoped)
     {
         // wait to reveive a message
-        auto waitStart = std::chrono::steady_clock::now();
-        int nbytes = recvfrom(m_sockfd, buffer, BUFFER_SIZE, 0, (struct sockaddr *) &clientAddress, &addrLen);
-        auto afterRecv = std::chrono::steady_clock::now();
+        auto waitStart = dns::debug::now();
+#ifdef __linux__
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &clientAddress;
+        msg.msg_namelen = sizeof(clientAddress);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        int nbytes = recvmsg(sockfd, &msg, 0);
+        addrLen = msg.msg_namelen;
+#else
+        int nbytes = recvfrom(sockfd, buffer, BUFFER_SIZE, 0, (struct sockaddr *) &clientAddress, &addrLen);
+#endif
+        auto afterRecv = dns::debug::now();
 
         if(nbytes <= 0)
         {
             if(m_isStoped)
             {
-                dns::debug::log("Server::run",
-                                "recvfrom() returned " + std::to_string(nbytes) +
-                                    " while stopping");
+                DNS_LOG(Debug, "Server::run",
+                               "recvfrom() returned " + std::to_string(nbytes) +
+                                   " while stopping");
                 break;
             }
 
-            dns::debug::log("Server::run",
-                            "recvfrom() returned " + std::to_string(nbytes) +
-                                ", continuing");
+            DNS_LOG(Warn, "Server::run",
+                          "recvfrom() returned " + std::to_string(nbytes) +
+                              ", continuing");
             continue;
         }
 
+#ifdef __linux__
+        const std::chrono::nanoseconds delay = receiveDelay(msg, wallClockNow());
+        if(delay.count() >= 0)
+            m_metrics.record(Histogram::ReceiveDelay, delay);
+#endif
+
         // client address only used for logging for the moment, do I need to use to handle sessions ??
-        std::string clientEndpoint = endpointToString(clientAddress);
-        dns::debug::log(
-            "Server::run",
-            "Received " + std::to_string(nbytes) + " bytes from " +
-                clientEndpoint + " after " +
-                dns::debug::formatDuration(afterRecv - waitStart));
+        DNS_LOG_EVENT(Debug, "Server::run", "Received {} bytes from {} after {} us",
+                      nbytes, endpointToString(clientAddress), dns::debug::microseconds(afterRecv - waitStart));
+
+        if(m_capture.isOpen())
+            m_capture.write(toEndpoint(clientAddress), toEndpoint(m_address), buffer, nbytes);
+
+        nbytes = processDatagram(buffer, nbytes, reply, BUFFER_SIZE, query);
+        if(nbytes <= 0)
+            continue;
+
+        // send the reponse to the query
+        auto beforeSend = std::chrono::steady_clock::now();
+        int sent = sendto(sockfd, reply, nbytes, 0, (struct sockaddr *) &clientAddress, addrLen);
+        auto afterSend = std::chrono::steady_clock::now();
 
-        // all messages are part of the final payload that need to be put together
-        // decode extract the data using decode_qname
-        Query query;
-        query.decode(buffer, nbytes);
+        m_metrics.record(Histogram::SendLatency, afterSend - beforeSend);
+        if(sent < 0)
+            m_metrics.add(Counter::SendErrors);
+        else if(m_capture.isOpen())
+            m_capture.write(toEndpoint(m_address), toEndpoint(clientAddress), reply, sent);
 
-        std::string qname = query.getQName();
+        DNS_LOG_EVENT(Debug, "Server::run", "Sent {} bytes to {} in {} us",
+                      sent, endpointToString(clientAddress), dns::debug::microseconds(afterSend - beforeSend));
+    }
 
-        dns::debug::log(
-            "Server::run",
-            "Decoded query id=" + std::to_string(query.getID()) + " qname='" +
-                qname + "' qtype=" + std::to_string(query.getQType()) +
-                " qclass=" + std::to_string(query.getQClass()));
+    DNS_LOG(Info, "Server::run", "Worker loop terminated");
+}
 
 
-        // add the qname received to a list that will be put togheter after to form a message
+#ifdef __linux__
+/**
+ * @brief Batched worker loop of the DNS server (Linux).
+ *
+ * Same as run(), but amortizes the syscalls over bursts of queries: each
+ * iteration costs one recvmmsg() and one sendmmsg() for up to m_batchSize
+ * datagrams instead of one recvfrom() and one sendto() per datagram.
+ *
+ * Steps:
+ *   1. Block in recvmmsg() with MSG_WAITFORONE: wait for the first datagram,
+ *      then take whatever else is already queued on the socket, up to
+ *      m_batchSize datagrams, without waiting for more.
+ *      - If recvmmsg() fails and the server is stopping, exit the loop.
+ *      - Otherwise retry.
+ *   2. Record how long each datagram waited in the socket, from its
+ *      kernel timestamp, then answer it with processDatagram(), in the
+ *      order received, writing the replies to their own slot of the reply
+ *      buffer and pointing each reply header at the address of its query.
+ *   3. Send all the replies with sendmmsg(). If the kernel takes only part
+ *      of the batch, send the rest; if it fails, drop the remaining replies
+ *      (the clients retry, as with a lost UDP datagram).
+ *   4. Loop repeats until m_isStoped is true.
+ *
+ * All buffers are allocated once, before the loop.
+ */
+void Server::runBatched(int sockfd)
+{
+    const size_t batchSize = m_batchSize;
+
+    std::vector<char> buffers(batchSize * BUFFER_SIZE);
+    std::vector<char> replies(batchSize * BUFFER_SIZE);
+    std::vector<struct sockaddr_in> addresses(batchSize);
+    std::vector<struct iovec> bufferIovs(batchSize);
+    std::vector<struct iovec> replyIovs(batchSize);
+    std::vector<struct mmsghdr> received(batchSize);
+    std::vector<struct mmsghdr> toSend(batchSize);
+    std::vector<char> controls(batchSize * TIMESTAMP_CONTROL_SIZE);
+    Query query;
+
+    for(size_t i = 0; i < batchSize; ++i)
+    {
+        bufferIovs[i].iov_base = &buffers[i * BUFFER_SIZE];
+        bufferIovs[i].iov_len = BUFFER_SIZE;
+        replyIovs[i].iov_base = &replies[i * BUFFER_SIZE];
+    }
+
+    DNS_LOG(Info, "Server::runBatched",
+                  "Worker loop started with batches of " + std::to_string(batchSize) + " datagram(s)");
+
+    while(!m_isStoped)
+    {
+        for(size_t i = 0; i < batchSize; ++i)
         {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            m_qnameReceived.push_back(qname);
+            memset(&received[i], 0, sizeof(struct mmsghdr));
+            received[i].msg_hdr.msg_name = &addresses[i];
+            received[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            received[i].msg_hdr.msg_iov = &bufferIovs[i];
+            received[i].msg_hdr.msg_iovlen = 1;
+            received[i].msg_hdr.msg_control = &controls[i * TIMESTAMP_CONTROL_SIZE];
+            received[i].msg_hdr.msg_controllen = TIMESTAMP_CONTROL_SIZE;
         }
 
-        Response response;
-        auto handleStart = std::chrono::steady_clock::now();
+        int nbReceived = recvmmsg(sockfd, received.data(), batchSize, MSG_WAITFORONE, nullptr);
+        if(nbReceived <= 0)
+        {
+            if(m_isStoped)
+            {
+                DNS_LOG(Debug, "Server::runBatched",
+                               "recvmmsg() returned " + std::to_string(nbReceived) +
+                                   " while stopping");
+                break;
+            }
 
-        // TODO put a mechnisme in place to validate that we send the data to the right beacon
-        // check if message if for our domain and prepare a response independty from the identity of the querier ! 
-        prepareResponse(query, response);
-        
-        auto afterHandle = std::chrono::steady_clock::now();
+            DNS_LOG(Warn, "Server::runBatched",
+                          "recvmmsg() returned " + std::to_string(nbReceived) +
+                              " (" + std::string(strerror(errno)) + "), continuing");
+            continue;
+        }
+
+        DNS_LOG_EVENT(Debug, "Server::runBatched", "Received batch of {} datagram(s)", nbReceived);
 
-        size_t pendingQueues = 0;
+        const struct timespec now = wallClockNow();
+        unsigned int nbReplies = 0;
+        for(int i = 0; i < nbReceived; ++i)
         {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            pendingQueues = m_msgQueue.size();
+            const std::chrono::nanoseconds delay = receiveDelay(received[i].msg_hdr, now);
+            if(delay.count() >= 0)
+                m_metrics.record(Histogram::ReceiveDelay, delay);
+
+            if(m_capture.isOpen())
+                m_capture.write(toEndpoint(addresses[i]), toEndpoint(m_address), &buffers[i * BUFFER_SIZE], received[i].msg_len);
+
+            char* reply = &replies[nbReplies * BUFFER_SIZE];
+            int nbytes = processDatagram(&buffers[i * BUFFER_SIZE], static_cast<int>(received[i].msg_len), reply, BUFFER_SIZE, query);
+            if(nbytes <= 0)
+                continue;
+
+            replyIovs[nbReplies].iov_base = reply;
+            replyIovs[nbReplies].iov_len = nbytes;
+
+            memset(&toSend[nbReplies], 0, sizeof(struct mmsghdr));
+            toSend[nbReplies].msg_hdr.msg_name = &addresses[i];
+            toSend[nbReplies].msg_hdr.msg_namelen = received[i].msg_hdr.msg_namelen;
+            toSend[nbReplies].msg_hdr.msg_iov = &replyIovs[nbReplies];
+            toSend[nbReplies].msg_hdr.msg_iovlen = 1;
+            ++nbReplies;
+        }
+
+        // send the reponses, the kernel may take only part of the batch
+        unsigned int nbSent = 0;
+        while(nbSent < nbReplies)
+        {
+            auto beforeSend = std::chrono::steady_clock::now();
+            int sent = sendmmsg(sockfd, &toSend[nbSent], nbReplies - nbSent, 0);
+            m_metrics.record(Histogram::SendLatency, std::chrono::steady_clock::now() - beforeSend);
+            if(sent <= 0)
+            {
+                m_metrics.add(Counter::SendErrors, nbReplies - nbSent);
+                DNS_LOG(Error, "Server::runBatched",
+                               "sendmmsg() failed (" + std::string(strerror(errno)) +
+                                   "); dropping " + std::to_string(nbReplies - nbSent) +
+                                   " reply(ies)");
+                break;
+            }
+            if(m_capture.isOpen())
+            {
+                for(int i = 0; i < sent; ++i)
+                {
+                    const struct msghdr& header = toSend[nbSent + i].msg_hdr;
+                    m_capture.write(toEndpoint(m_address), toEndpoint(*static_cast<const sockaddr_in*>(header.msg_name)),
+                                    static_cast<const char*>(header.msg_iov->iov_base), header.msg_iov->iov_len);
+                }
+            }
+            nbSent += sent;
         }
 
-        dns::debug::log(
-            "Server::run",
-            "prepareResponse completed in " +
-                dns::debug::formatDuration(afterHandle - handleStart) +
-                "; outbound fragment queue size=" +
-                std::to_string(static_cast<unsigned long long>(pendingQueues)));
+        DNS_LOG_EVENT(Debug, "Server::runBatched", "Sent {}/{} reply(ies)", nbSent, nbReplies);
+    }
 
-        memset(buffer, 0, BUFFER_SIZE);
-        nbytes = response.code(buffer);
+    DNS_LOG(Info, "Server::runBatched", "Worker loop terminated");
+}
+#endif
 
-        dns::debug::log(
-            "Server::run",
-            "Encoded response of " + std::to_string(nbytes) +
-                " bytes with RDATA length=" +
-                std::to_string(
-                    static_cast<unsigned long long>(response.getRdata().size())));
 
-        // send the reponse to the query
-        auto beforeSend = std::chrono::steady_clock::now();
-        int sent = sendto(m_sockfd, buffer, nbytes, 0, (struct sockaddr *) &clientAddress, addrLen);
-        auto afterSend = std::chrono::steady_clock::now();
+#ifdef DNS_HAVE_IO_URING
+/**
+ * @brief Create the io_uring ring of every worker socket.
+ *
+ * Each ring gets URING_BUFFER_COUNT provided buffers, registered with the
+ * kernel, large enough for the header the kernel writes in front of each
+ * received datagram, the source address and the datagram itself.
+ *
+ * @return false, with no ring kept, if io_uring or buffer rings are not
+ *         available; the workers then use the recvmmsg/recvfrom loops.
+ */
+bool Server::setupRings()
+{
+    const size_t bufferSize = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + TIMESTAMP_CONTROL_SIZE + BUFFER_SIZE;
 
-        dns::debug::log(
-            "Server::run",
-            "Sent " + std::to_string(sent) + " bytes to " + clientEndpoint +
-                " in " +
-                dns::debug::formatDuration(afterSend - beforeSend));
+    for(size_t i = 0; i < m_sockets.size(); ++i)
+    {
+        std::unique_ptr<IoUring> ring = std::make_unique<IoUring>();
+        // one receive, plus one send per reply slot
+        if(!ring->init(URING_BUFFER_COUNT * 2) || !ring->registerBuffers(0, URING_BUFFER_COUNT, bufferSize))
+        {
+            DNS_LOG(Warn, "Server::setupRings", "io_uring unavailable, falling back to the socket loops");
+            m_rings.clear();
+            return false;
+        }
+        m_rings.push_back(std::move(ring));
     }
 
-    dns::debug::log("Server::run", "Worker loop terminated");
+    DNS_LOG(Info, "Server::setupRings", std::to_string(m_rings.size()) + " io_uring ring(s) ready");
+    return true;
 }
 
+
+/**
+ * @brief io_uring worker loop of the DNS server (DNS_ENABLE_IO_URING).
+ *
+ * A single multishot recvmsg keeps receiving datagrams into the ring's
+ * provided buffers, so no syscall is spent per datagram; the replies are
+ * queued as sendmsg submissions and each iteration submits all of them and
+ * waits for new completions with one io_uring_enter().
+ *
+ * Steps:
+ *   1. Arm a multishot IORING_OP_RECVMSG on the socket, taking its buffers
+ *      from buffer group 0, and a poll on the ring's wakeup eventfd, which
+ *      stop() makes readable.
+ *   2. Submit the queued entries and wait for at least one completion.
+ *   3. Handle every available completion:
+ *      - A receive: the kernel wrote an io_uring_recvmsg_out header, the
+ *        source address, the receive timestamp and the datagram in the
+ *        buffer. Answer it with
+ *        processDatagram() into a free reply slot, queue a sendmsg for the
+ *        reply and give the buffer back to the kernel. If no slot is free
+ *        the reply is dropped (the client retries, as with a lost datagram).
+ *        Without IORING_CQE_F_MORE the receive has ended (error, or no
+ *        buffer left): re-arm it unless the server is stopping.
+ *      - A send: free its reply slot.
+ *   4. Loop until m_isStoped is true, then wait for the sends in flight,
+ *      which point into the reply slots.
+ *
+ * The worker counts in isIoUringActive() while it runs this loop. If the
+ * kernel rejects the multishot receive before any datagram arrives (Linux
+ * before 6.0), it stops counting and continues with runBatched() or run().
+ */
+void Server::runUring(IoUring* ring, int sockfd)
+{
+    static constexpr uint64_t RECV_TAG = ~0ULL;
+    static constexpr uint64_t WAKEUP_TAG = ~0ULL - 1;
+
+    struct ReplySlot
+    {
+        struct sockaddr_in address;
+        struct iovec iov;
+        struct msghdr msg;
+        char data[BUFFER_SIZE];
+    };
+    std::vector<ReplySlot> slots(URING_BUFFER_COUNT);
+    Query query;
+    std::vector<unsigned int> freeSlots;
+    for(unsigned int i = URING_BUFFER_COUNT; i > 0; --i)
+        freeSlots.push_back(i - 1);
+
+    // only the name and control sizes are used by multishot receives
+    struct msghdr recvTemplate;
+    memset(&recvTemplate, 0, sizeof(recvTemplate));
+    recvTemplate.msg_namelen = sizeof(struct sockaddr_in);
+    recvTemplate.msg_controllen = TIMESTAMP_CONTROL_SIZE;
+
+    auto getSqe = [ring]()
+    {
+        struct io_uring_sqe* sqe = ring->getSqe();
+        if(!sqe)
+        {
+            ring->submit(0);
+            sqe = ring->getSqe();
+        }
+        return sqe;
+    };
+
+    auto armReceive = [&]()
+    {
+        struct io_uring_sqe* sqe = getSqe();
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = sockfd;
+        sqe->addr = reinterpret_cast<uint64_t>(&recvTemplate);
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        sqe->user_data = RECV_TAG;
+    };
+
+    m_uringWorkers.fetch_add(1, std::memory_order_release);
+    DNS_LOG(Info, "Server::runUring", "Worker loop started on io_uring");
+
+    armReceive();
+    struct io_uring_sqe* wakeupSqe = getSqe();
+    wakeupSqe->opcode = IORING_OP_POLL_ADD;
+    wakeupSqe->fd = ring->wakeupFd();
+    wakeupSqe->poll32_events = POLLIN;
+    wakeupSqe->user_data = WAKEUP_TAG;
+
+    bool received = false;
+    bool unsupported = false;
+    while(!m_isStoped && !unsupported)
+    {
+        int ret = ring->submit(1);
+        if(ret < 0 && ret != -EINTR)
+        {
+            DNS_LOG(Error, "Server::runUring", "io_uring_enter() failed: " + std::string(strerror(-ret)));
+            continue;
+        }
+
+        const struct timespec now = wallClockNow();
+        unsigned int nbReplies = 0;
+        while(struct io_uring_cqe* cqe = ring->peekCqe())
+        {
+            const uint64_t tag = cqe->user_data;
+            const int res = cqe->res;
+            const unsigned int flags = cqe->flags;
+            ring->cqeSeen();
+
+            if(tag == WAKEUP_TAG)
+                continue;
+
+            if(tag != RECV_TAG)
+            {
+                if(res < 0)
+                {
+                    m_metrics.add(Counter::SendErrors);
+                    DNS_LOG(Error, "Server::runUring", "sendmsg failed: " + std::string(strerror(-res)));
+                }
+                else if(m_capture.isOpen())
+                {
+                    const ReplySlot& slot = slots[tag];
+                    m_capture.write(toEndpoint(m_address), toEndpoint(slot.address), slot.data, static_cast<size_t>(res));
+                }
+                freeSlots.push_back(static_cast<unsigned int>(tag));
+                continue;
+            }
+
+            if(flags & IORING_CQE_F_BUFFER)
+            {
+                const uint16_t bufferId = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+                char* buffer = ring->buffer(bufferId);
+                const struct io_uring_recvmsg_out* out = reinterpret_cast<const struct io_uring_recvmsg_out*>(buffer);
+                const char* name = buffer + sizeof(struct io_uring_recvmsg_out);
+                const char* payload = name + recvTemplate.msg_namelen + recvTemplate.msg_controllen;
+                const int size = static_cast<int>(std::min<size_t>(out->payloadlen, BUFFER_SIZE));
+                received = true;
+
+                // the control messages follow the name in the buffer
+                struct msghdr control;
+                memset(&control, 0, sizeof(control));
+                control.msg_control = const_cast<char*>(name) + recvTemplate.msg_namelen;
+                control.msg_controllen = std::min<size_t>(out->controllen, recvTemplate.msg_controllen);
+                const std::chrono::nanoseconds delay = receiveDelay(control, now);
+                if(res >= 0 && delay.count() >= 0)
+                    m_metrics.record(Histogram::ReceiveDelay, delay);
+
+                if(res >= 0 && m_capture.isOpen())
+                {
+                    sockaddr_in from;
+                    memcpy(&from, name, sizeof(from));
+                    m_capture.write(toEndpoint(from), toEndpoint(m_address), payload, size);
+                }
+
+                if(res >= 0 && !freeSlots.empty())
+                {
+                    ReplySlot& slot = slots[freeSlots.back()];
+                    int nbytes = processDatagram(payload, size, slot.data, BUFFER_SIZE, query);
+                    if(nbytes > 0)
+                    {
+                        memcpy(&slot.address, name, sizeof(slot.address));
+                        slot.iov.iov_base = slot.data;
+                        slot.iov.iov_len = nbytes;
+                        memset(&slot.msg, 0, sizeof(slot.msg));
+                        slot.msg.msg_name = &slot.address;
+                        slot.msg.msg_namelen = std::min<socklen_t>(out->namelen, sizeof(slot.address));
+                        slot.msg.msg_iov = &slot.iov;
+                        slot.msg.msg_iovlen = 1;
+
+                        struct io_uring_sqe* sqe = getSqe();
+                        sqe->opcode = IORING_OP_SENDMSG;
+                        sqe->fd = sockfd;
+                        sqe->addr = reinterpret_cast<uint64_t>(&slot.msg);
+                        sqe->len = 1;
+                        sqe->user_data = freeSlots.back();
+                        freeSlots.pop_back();
+                        ++nbReplies;
+                    }
+                }
+                else if(res >= 0)
+                {
+                    DNS_LOG(Warn, "Server::runUring", "No reply slot free, dropping reply");
+                }
+
+                ring->recycleBuffer(bufferId);
+            }
+
+            if(flags & IORING_CQE_F_MORE)
+                continue;
+
+            // the multishot receive has ended
+            if(m_isStoped)
+                break;
+            if(res == -EINVAL && !received)
+            {
+                unsupported = true;
+                break;
+            }
+            if(res < 0 && res != -ENOBUFS)
+                DNS_LOG(Debug, "Server::runUring", "recvmsg ended: " + std::string(strerror(-res)) + ", re-arming");
+            armReceive();
+        }
+
+        if(nbReplies > 0)
+            DNS_LOG_EVENT(Debug, "Server::runUring", "Queued {} reply(ies)", nbReplies);
+    }
+
+    // the kernel still reads the reply slots of the sends in flight
+    while(freeSlots.size() < URING_BUFFER_COUNT && ring->submit(1) >= 0)
+    {
+        while(struct io_uring_cqe* cqe = ring->peekCqe())
+        {
+            if(cqe->user_data == RECV_TAG && (cqe->flags & IORING_CQE_F_BUFFER))
+                ring->recycleBuffer(static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+            else if(cqe->user_data != RECV_TAG && cqe->user_data != WAKEUP_TAG)
+                freeSlots.push_back(static_cast<unsigned int>(cqe->user_data));
+            ring->cqeSeen();
+        }
+    }
+
+    m_uringWorkers.fetch_sub(1, std::memory_order_release);
+
+    if(unsupported)
+    {
+        DNS_LOG(Warn, "Server::runUring", "Multishot recvmsg not supported, falling back to the socket loop");
+        if(m_batchSize > 1)
+            runBatched(sockfd);
+        else
+            run(sockfd);
+        return;
+    }
+
+    DNS_LOG(Info, "Server::runUring", "Worker loop terminated");
+}
+#endif
+
+
+void Server::setBatchSize(unsigned int batchSize)
+{
+    m_batchSize = std::clamp(batchSize, 1U, MAX_BATCH_SIZE);
+}
+
+
+// Largest response the requester accepts: the UDP payload size of its EDNS0
+// OPT record (at most BUFFER_SIZE here), or 512 bytes without one.
+int Server::responseSizeLimit(const Query& query)
+{
+    if (query.getEdnsUdpSize() == 0)
+        return LEGACY_UDP_SIZE;
+    return std::min<int>(query.getEdnsUdpSize(), BUFFER_SIZE);
+}
+
+
+/**
+ * @brief Bytes the answer records of a response to query can take.
+ *
+ * The response spends responseSizeLimit() on the header, the question and
+ * our own OPT record; the rest is left for the answer section.
+ */
+int Server::responseAnswerSpace(const Query& query) const
+{
+    const bool edns = query.getEdnsUdpSize() != 0;
+    const int responseSize = responseSizeLimit(query);
+    const int question = qnameWireSize(query) + 4;
+    const int opt = edns ? static_cast<int>(Message::EDNS_OPT_SIZE) : 0;
+    return std::max(0, responseSize - 12 - question - opt);
+}
+
+
+/**
+ * @brief Bytes of record data the first answer to query can carry.
+ *
+ * What responseAnswerSpace() leaves once the owner name and fixed fields of
+ * the answer are written. The owner name is compressed, so the bytes a long
+ * QNAME used to take twice go to the fragment, with or without EDNS0.
+ */
+int Server::responseRdataBudget(const Query& query) const
+{
+    return std::max(0, responseAnswerSpace(query) - answerWireSize(0, 0));
+}
+
+
+// Wire size of the query name: a length byte per label and the root label.
+int Server::qnameWireSize(const Query& query)
+{
+    return static_cast<int>(query.getQName().size()) + 2;
+}
+
+
+// Wire size of an answer to the question carrying `payload` bytes of
+// fragment data. Response::code() compresses the owner name to a pointer
+// to the question, and TXT data is cut into character-strings of up to
+// 255 bytes, each behind a length byte.
+int Server::answerWireSize(int qType, size_t payload)
+{
+    int rdata = static_cast<int>(payload);
+    if(qType == 16)
+        rdata += std::max<int>(1, (rdata + 254) / 255);
+    return COMPRESSED_NAME_SIZE + 10 + rdata;
+}
+
+
 /**
  * @brief Build a DNS response based on the incoming query (qName, qType, etc.).
  *
@@ -399,27 +1443,43 @@ void Server::run()
  *        - Split the prefix into `data` (everything before the last dot)
  *          and `id` (the last label, representing the client ID).
  *        - Log extracted values for debugging.
- *        - Depending on the QNAME contents:
- *            * If it contains `m_secretKeyClientAskData`:
- *                - Call splitPacket() to prepare fragments for this client.
+ *        - Depending on the first label of `data`, compared case-insensitively:
+ *            * If it is `m_secretKeyClientAskData`, optionally followed by a
+ *              codec tag (see codecTag()):
+ *                - Record the downstream codec requested by this client in
+ *                  `m_clientCodec` (hex when no tag is given).
+ *                - Call splitPacket() to prepare fragments for this client,
+ *                  sized with responseRdataBudget() to fill the response.
  *                - If fragments are queued in `m_msgQueue[id]`, dequeue one
- *                  fragment as the payload.
+ *                  fragment as the payload. A fragment whose answer does not
+ *                  fit responseAnswerSpace(), cut for an earlier query that
+ *                  advertised a larger EDNS0 buffer, is never dequeued: its
+ *                  message is put back with restartTransfer() and split
+ *                  again for this query.
+ *                - For TXT and NULL queries, keep dequeuing fragments into
+ *                  `extraFragments` while their answers fit in
+ *                  responseAnswerSpace(), calling splitPacket() again
+ *                  when the queue runs dry so several small messages can
+ *                  share a response.
  *                - Otherwise, respond with `m_secretKeyServerNoData`.
- *            * If it contains `m_secretKeyClientKeepAlive`:
+ *            * If it is `m_secretKeyClientKeepAlive`:
  *                - Respond with `m_secretKeyServerKeepAlive`.
  *            * Otherwise (client sent data or garbage):
  *                - Respond with `m_secretKeyAck`.
  *   3. If the QNAME is not in scope (doesn’t end with this domain),
  *      log the anomaly and leave `dataToSend` empty.
  *   4. Populate the `Response` object with:
- *        - Standard header fields (ID, flags, counts, TTL, etc.).
+ *        - Standard header fields (ID, flags, counts, TTL, etc.), and an
+ *          EDNS0 OPT record advertising EDNS_UDP_SIZE if the query had one.
  *        - If `dataToSend` is empty, set RCODE = NameError (NXDOMAIN).
  *        - Otherwise, set RCODE = Ok, ANCOUNT = 1, and put the payload
  *          into RDATA formatted for the query’s QTYPE:
  *            * A     → enforce 4-byte hex (8 chars).
  *            * AAAA  → enforce 16-byte hex (32 chars).
  *            * MX    → raw string.
- *            * CNAME/NS/PTR/TXT/default → raw string.
+ *            * CNAME/NS/PTR/TXT/NULL/default → raw string.
+ *          Each of `extraFragments` is added as one more answer record
+ *          of the query's type, and code() sets ANCOUNT to match.
  *
  * @param query     The incoming DNS query object (decoded from client packet).
  * @param response  The response object to populate and send back.
@@ -436,6 +1496,8 @@ void Server::prepareResponse(const Query& query, Response& response)
     string qName = query.getQName();
 
     string dataToSend = "";
+    // fragments sent in further answer records after dataToSend
+    std::vector<std::string> extraFragments;
     if (endsWith(qName, m_domainToResolve))
     {
         //data1.data2.data3.id.domain
@@ -452,64 +1514,140 @@ void Server::prepareResponse(const Query& query, Response& response)
             id   = prefix.substr(lastDot + 1);         // "id"
         } 
 
-        dns::debug::log("Server::prepareResponse", "m_domainToResolve '" + m_domainToResolve + "'");
-        dns::debug::log("Server::prepareResponse", "qName '" + qName + "'");
-        dns::debug::log("Server::prepareResponse", "data '" + data + "'");
-        dns::debug::log("Server::prepareResponse", "id '" + id + "'");
+        DNS_LOG_EVENT(Debug, "Server::prepareResponse", "m_domainToResolve '{}' qName '{}' data '{}' id '{}'",
+                      m_domainToResolve, qName, data, id);
        
+        // control queries start with a keyword label: "ask[codec tag].random" or "hello.random"
+        // the labels are matched case-insensitively to survive 0x20 randomization
+        const std::string keyword = str_tolower(data.substr(0, data.find('.')));
+
         // ask data
-        if(qName.contains(m_secretKeyClientAskData))
+        if(startsWith(keyword, m_secretKeyClientAskData) && keyword.size() <= m_secretKeyClientAskData.size() + 1)
         {
-            splitPacket(query.getQType(), id);
+            // an optional trailing character selects the downstream codec
+            Codec codec = Codec::Hex;
+            if(keyword.size() > m_secretKeyClientAskData.size())
+                codecFromTag(keyword.back(), codec);
+            {
+                // only the clients the server has messages for are tracked,
+                // any sender can make up new identifiers
+                std::unique_lock<std::mutex> lock = lockState();
+                if(m_msgToSend.count(id))
+                    m_clientCodec[id] = codec;
+            }
 
-            // data available
-            size_t remainingFragments = 0;
+            const int qType = query.getQType();
+            const int answerSpace = responseAnswerSpace(query);
+            const int rdataBudget = responseRdataBudget(query);
+
+            // Pop the next fragment for the client if its answer takes at
+            // most `space` bytes, splitting the next message once all the
+            // fragments of the previous one are gone. Fragments cut for a
+            // larger response than this requester accepts would be left out
+            // by Response::code(): their message is cut again to this size.
+            // A fragment put in a response counts as acknowledged: the
+            // reports of the messages it completes are emitted once the
+            // response is ready.
+            std::vector<TransferReport> finished;
+            MessageObserver* observer = nullptr;
+            auto popFragment = [&](int space, std::string& fragment) -> bool
+            {
+                for(int attempt = 0; attempt < 2; ++attempt)
+                {
+                    {
+                        std::unique_lock<std::mutex> lock = lockState();
+                        auto queueIt = m_msgQueue.find(id);
+                        if(queueIt != m_msgQueue.end() && !queueIt->second.empty() &&
+                           answerWireSize(qType, queueIt->second.front().size()) > answerSpace)
+                        {
+                            DNS_LOG_EVENT(Debug, "Server::prepareResponse",
+                                          "Fragment of {} bytes does not fit {} bytes of answers; cutting the message again",
+                                          queueIt->second.front().size(), answerSpace);
+                            restartTransfer(id);
+                        }
+                        if(queueIt != m_msgQueue.end() && !queueIt->second.empty())
+                        {
+                            auto& queue = queueIt->second;
+                            if(answerWireSize(qType, queue.front().size()) > space)
+                                return false;
+                            fragment = std::move(queue.front());
+                            queue.pop();
+                            noteFragmentSent(id);
+                            TransferReport report;
+                            if(noteFragmentDone(id, report))
+                                finished.push_back(report);
+                            return true;
+                        }
+                    }
+                    splitPacket(qType, id, rdataBudget);
+                }
+                return false;
+            };
+
+            popFragment(answerSpace, dataToSend);
+
+            // TXT and NULL answers can be repeated: fill the rest of the
+            // response with more fragments, of this message or the next ones
+            if(!dataToSend.empty() && (qType == 16 || qType == 10))
             {
-                std::lock_guard<std::mutex> lock(m_mutex);
-                auto& queue = m_msgQueue[id];
-                if(!queue.empty())
+                int space = answerSpace - answerWireSize(qType, dataToSend.size());
+                std::string fragment;
+                while(popFragment(space, fragment))
                 {
-                    dataToSend = queue.front();
-                    queue.pop();
-                    remainingFragments = queue.size();
+                    space -= answerWireSize(qType, fragment.size());
+                    extraFragments.push_back(std::move(fragment));
                 }
             }
 
+            size_t remainingFragments = 0;
+            {
+                std::unique_lock<std::mutex> lock = lockState();
+                auto queueIt = m_msgQueue.find(id);
+                if(queueIt != m_msgQueue.end())
+                    remainingFragments = queueIt->second.size();
+                if(!finished.empty())
+                    observer = acquireObserver();
+            }
+
+            if(observer)
+            {
+                for(const TransferReport& report : finished)
+                    observer->onTransferComplete(id, report);
+                releaseObserver();
+            }
+
             if(!dataToSend.empty())
             {
-                dns::debug::log(
-                    "Server::prepareResponse",
-                    "Using queued fragment for response; remaining fragments=" +
-                        std::to_string(static_cast<unsigned long long>(
-                            remainingFragments)) +
-                        " payload='" + dataToSend + "'");
+                DNS_LOG_EVENT(Debug, "Server::prepareResponse",
+                              "Using {} queued fragment(s) for response; remaining fragments={} payload='{}'",
+                              1 + extraFragments.size(), remainingFragments, dataToSend);
             }
             // no data
             else
             {
                 dataToSend = m_secretKeyServerNoData;
 
-                dns::debug::log("Server::prepareResponse", "No payload available; sending control domain '" + dataToSend + "'");
+                DNS_LOG(Debug, "Server::prepareResponse", "No payload available; sending control domain '" + dataToSend + "'");
             }
         }
         // just say hello -> could be used to ID 
-        else if(qName.contains(m_secretKeyClientKeepAlive))
+        else if(keyword == m_secretKeyClientKeepAlive)
         {
             dataToSend = m_secretKeyServerKeepAlive;
 
-            dns::debug::log("Server::prepareResponse", "Client send KeepAlive '" + dataToSend + "'");
+            DNS_LOG(Debug, "Server::prepareResponse", "Client send KeepAlive '" + dataToSend + "'");
         }
         // shit or acutal data sent from actual beacon
         else
         {
             dataToSend = m_secretKeyAck;
 
-            dns::debug::log("Server::prepareResponse", "Client sent data or parazit packet '" + dataToSend + "'");
+            DNS_LOG(Debug, "Server::prepareResponse", "Client sent data or parazit packet '" + dataToSend + "'");
         }
     }
     else
     {
-        dns::debug::log("Server::prepareResponse", "Received unexptected qname '" + qName + "'");
+        DNS_LOG(Warn, "Server::prepareResponse", "Received unexptected qname '" + qName + "'");
     }
 
     response.setID(query.getID());
@@ -521,18 +1659,21 @@ void Server::prepareResponse(const Query& query, Response& response)
     response.setQdCount(1);
     response.setNsCount(0);
     response.setArCount(0);
+    // RFC 6891: answer EDNS0 requesters with an OPT record
+    response.setEdnsUdpSize(query.getEdnsUdpSize() != 0 ? EDNS_UDP_SIZE : 0);
 
     if (dataToSend.empty())
     {
-        dns::debug::log("Server::prepareResponse", "Domain '" + qName + "' not in scope; sending NameError");
+        DNS_LOG(Debug, "Server::prepareResponse", "Domain '" + qName + "' not in scope; sending NameError");
 
         response.clearAnswer();
         response.setAnCount(0);
         response.setRCode(Response::NameError);
+        m_metrics.add(Counter::NxDomain);
     }
     else
     {
-        dns::debug::log("Server::prepareResponse", "Responding with payload '" + dataToSend + "' (" + std::to_string(static_cast<unsigned long long>(dataToSend.size())) + " bytes)");
+        DNS_LOG_EVENT(Debug, "Server::prepareResponse", "Responding with payload '{}' ({} bytes)", dataToSend, dataToSend.size());
 
         response.setAnCount(1);
         response.setRCode(Response::Ok);
@@ -573,6 +1714,17 @@ void Server::prepareResponse(const Query& query, Response& response)
                 response.setRdata(dataToSend);
                 break;
         }
+
+        for (std::string& fragment : extraFragments)
+        {
+            Response::Answer answer;
+            answer.name = query.getQName();
+            answer.type = query.getQType();
+            answer.klass = query.getQClass();
+            answer.ttl = 0;
+            answer.rdata = std::move(fragment);
+            response.addAnswer(answer);
+        }
     }
 }
 
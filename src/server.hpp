@@ -14,18 +14,27 @@
 
 #endif
 
+#include <atomic>
+#include <memory>
+
 #include "dns.hpp"
 #include "query.hpp"
 #include "response.hpp"
 #include "dnsPacker.hpp"
+#include "pcap.hpp"
 
 
 namespace dns 
 {
 
+#ifdef DNS_HAVE_IO_URING
+class IoUring;
+#endif
+
 class Server : public Dns
 {
 public:
+    static constexpr int BUFFER_SIZE = 4096;
 
     Server(int port, const std::string& domainToResolve);
     ~Server();
@@ -33,23 +42,123 @@ public:
     void launch();
     void stop();
 
-    std::pair<std::string, std::string>  getAvailableMessage();
-    void setMessageToSend(const std::string& msg, const std::string& clientId);
+    // Number of datagrams read and answered per recvmmsg/sendmmsg call on
+    // Linux; 1 selects the one recvfrom/sendto per query loop. Takes effect
+    // at the next launch().
+    void setBatchSize(unsigned int batchSize);
+    // Number of worker threads, each with its own SO_REUSEPORT socket bound
+    // to the port (Linux only). Takes effect at the next launch().
+    void setWorkerCount(unsigned int workerCount);
+    // With several workers, deliver all the queries of a client to the same
+    // worker, chosen from the client id label (Linux classic BPF program).
+    // Takes effect at the next launch().
+    void setClientSteering(bool enable);
+    // Whether the steering program is attached to the running workers.
+    bool isClientSteeringActive() const;
+    // Receive and answer queries through io_uring when the library is built
+    // with DNS_ENABLE_IO_URING (the default then) and the kernel allows it;
+    // otherwise the batch size selects the loop. Takes effect at the next
+    // launch().
+    void setIoUring(bool enable);
+    // Whether worker loops run on io_uring: true once a worker has entered
+    // its io_uring loop, false again when all of them fell back to the
+    // socket loops (kernel without multishot receive) or stopped.
+    bool isIoUringActive() const;
+
+    // Answer one query: returns the size of the reply written to out, which
+    // must hold BUFFER_SIZE bytes, or 0 if the datagram gets no reply.
+    int processDatagram(const char* in, int size, char* out, int outSize);
+    int processQuery(const Query& query, char* out, int outSize);
+    // Account for a datagram that is not a well-formed query, as
+    // processDatagram() does, when the caller parsed it itself.
+    void discardDatagram(int size);
+    const std::string& getDomain() const { return m_domainToResolve; }
+
+    // report, if not null, receives the timing of the returned message.
+    std::pair<std::string, std::string>  getAvailableMessage(TransferReport* report = nullptr);
+    std::vector<std::pair<std::string, std::string>> getAvailableMessages(size_t maxCount);
+    // Block until a message is complete, {"", ""} on timeout.
+    std::pair<std::string, std::string> waitForMessage(std::chrono::milliseconds timeout);
+    // Non-owning; nullptr removes the observer. Returns once no callback runs
+    // on the previous one.
+    void setMessageObserver(MessageObserver* observer);
+    // Returns false, without queuing msg, while the client's queue is full.
+    bool setMessageToSend(const std::string& msg, const std::string& clientId);
+    // Block until setMessageToSend accepts messages for clientId again.
+    bool waitForSendSpace(const std::string& clientId, std::chrono::milliseconds timeout);
+    void setSendQueueWatermarks(size_t high, size_t low);
+    // Timestamp the first fragment of each message sent to clients, so they
+    // can report its end-to-end latency (see TransferReport).
+    void setTransferTimestamps(bool enable);
+
+    // Write metricsSnapshot() in the Prometheus text format every period,
+    // to a file or to a callback, from a thread of its own. false if an
+    // export is already running.
+    bool startMetricsExport(const std::string& path, std::chrono::milliseconds period);
+    bool startMetricsExport(MetricsExporter::Sink sink, std::chrono::milliseconds period);
+    // Export a last time and stop; also done by the destructor.
+    void stopMetricsExport();
+
+    // Write the datagrams received and sent by the worker loops to a pcap
+    // file, from any thread. false if a capture is already running.
+    bool startCapture(const std::string& path);
+    void stopCapture();
 
 private:
-    void run();
+    void run(int sockfd);
+#ifdef __linux__
+    void runBatched(int sockfd);
+#endif
+#ifdef DNS_HAVE_IO_URING
+    void runUring(IoUring* ring, int sockfd);
+    bool setupRings();
+#endif
+    void closeSockets();
+#ifdef __linux__
+    void attachSteeringProgram();
+#endif
+    void handleQname(const std::string& qname);
 
+    int processDatagram(const char* in, int size, char* out, int outSize, Query& query);
     void prepareResponse(const Query& query, Response& response);
-
-    static const int BUFFER_SIZE = 4096;
+    static int responseSizeLimit(const Query& query);
+    int responseAnswerSpace(const Query& query) const;
+    int responseRdataBudget(const Query& query) const;
+    static int qnameWireSize(const Query& query);
+    static int answerWireSize(int qType, size_t payload);
+
+    // largest response a requester without EDNS0 accepts (RFC 1035)
+    static constexpr int LEGACY_UDP_SIZE = 512;
+    // a name written as a pointer to one already in the message
+    static constexpr int COMPRESSED_NAME_SIZE = 2;
+    static constexpr unsigned int DEFAULT_BATCH_SIZE = 32;
+    static constexpr unsigned int MAX_BATCH_SIZE = 1024;
+    static constexpr unsigned int MAX_WORKER_COUNT = 256;
+    // provided receive buffers and reply slots of each io_uring worker
+    static constexpr unsigned int URING_BUFFER_COUNT = 256;
 
     int m_port;
     struct sockaddr_in m_address;
-    int m_sockfd;    
+    unsigned int m_batchSize;
+    unsigned int m_workerCount;
+    bool m_clientSteering;
+    bool m_clientSteeringActive;
+    bool m_ioUring;
 
-    bool m_isStoped;
+    std::atomic<bool> m_isStoped;
     
-    std::unique_ptr<std::thread> m_dnsServ;
+    // one socket and one thread per worker
+    std::vector<int> m_sockets;
+    std::vector<std::thread> m_workers;
+#ifdef DNS_HAVE_IO_URING
+    // one ring per socket when io_uring is active
+    std::vector<std::unique_ptr<IoUring>> m_rings;
+    // workers currently in runUring()
+    std::atomic<unsigned int> m_uringWorkers{0};
+#endif
+
+    MetricsExporter m_metricsExporter;
+    PcapWriter m_capture;
 };
 
 }
@@ -0,0 +1,101 @@
+#include "wireWriter.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+
+using namespace dns;
+
+
+WireWriter::WireWriter(char* buffer, size_t capacity)
+    : m_buffer(buffer)
+    , m_bufferSize(capacity)
+    , m_capacity(capacity)
+    , m_size(0)
+    , m_full(false)
+{
+}
+
+
+bool WireWriter::reserve(size_t size)
+{
+    if (m_full || size > m_capacity - m_size)
+    {
+        m_full = true;
+        return false;
+    }
+    return true;
+}
+
+
+bool WireWriter::put8(uint8_t value)
+{
+    if (!reserve(1))
+        return false;
+    m_buffer[m_size++] = static_cast<char>(value);
+    return true;
+}
+
+
+bool WireWriter::put16(uint16_t value)
+{
+    if (!reserve(2))
+        return false;
+    m_buffer[m_size++] = static_cast<char>(value >> 8);
+    m_buffer[m_size++] = static_cast<char>(value & 0xFF);
+    return true;
+}
+
+
+bool WireWriter::put32(uint32_t value)
+{
+    if (!reserve(4))
+        return false;
+    m_buffer[m_size++] = static_cast<char>(value >> 24);
+    m_buffer[m_size++] = static_cast<char>((value >> 16) & 0xFF);
+    m_buffer[m_size++] = static_cast<char>((value >> 8) & 0xFF);
+    m_buffer[m_size++] = static_cast<char>(value & 0xFF);
+    return true;
+}
+
+
+bool WireWriter::putBytes(const void* data, size_t size)
+{
+    if (!reserve(size))
+        return false;
+    if (size > 0)
+        std::memcpy(m_buffer + m_size, data, size);
+    m_size += size;
+    return true;
+}
+
+
+bool WireWriter::skip(size_t size)
+{
+    if (!reserve(size))
+        return false;
+    m_size += size;
+    return true;
+}
+
+
+void WireWriter::patch16(size_t offset, uint16_t value)
+{
+    if (offset + 2 > m_size)
+        return;
+    m_buffer[offset] = static_cast<char>(value >> 8);
+    m_buffer[offset + 1] = static_cast<char>(value & 0xFF);
+}
+
+
+void WireWriter::rollback(size_t mark)
+{
+    m_size = std::min(mark, m_size);
+    m_full = false;
+}
+
+
+void WireWriter::setCapacity(size_t capacity)
+{
+    m_capacity = std::clamp(capacity, m_size, m_bufferSize);
+}
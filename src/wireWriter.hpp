@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace dns
+{
+
+/* Bounded writer for DNS wire data.
+ *
+ * Appends big-endian fields and bytes to a caller-owned buffer and never
+ * writes past its capacity: a write that does not fit leaves the buffer as
+ * it was and marks the writer full, and every later write fails as well, so
+ * a caller can write a whole record and check full() once. rollback() then
+ * takes the writer back to the end of the last record that fit.
+ */
+class WireWriter
+{
+public:
+    WireWriter(char* buffer, size_t capacity);
+
+    bool put8(uint8_t value);
+    bool put16(uint16_t value);
+    bool put32(uint32_t value);
+    bool putBytes(const void* data, size_t size);
+    // Leave size bytes to be written later with patch16() or directly.
+    bool skip(size_t size);
+    // Overwrite two bytes already written, such as an RDLENGTH placeholder.
+    void patch16(size_t offset, uint16_t value);
+
+    char* data() { return m_buffer; }
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_capacity; }
+    size_t remaining() const { return m_capacity - m_size; }
+    // Whether a write did not fit since the last rollback().
+    bool full() const { return m_full; }
+
+    // Drop what was written after the first `mark` bytes and clear full().
+    void rollback(size_t mark);
+    // Change the capacity, at most the one given to the constructor and at
+    // least size(), e.g. to keep room for a trailing record.
+    void setCapacity(size_t capacity);
+
+private:
+    // Whether size more bytes fit; marks the writer full if not.
+    bool reserve(size_t size);
+
+    char* m_buffer;
+    size_t m_bufferSize;
+    size_t m_capacity;
+    size_t m_size;
+    bool m_full;
+};
+
+}
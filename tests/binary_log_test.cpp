@@ -0,0 +1,150 @@
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "binaryLog.hpp"
+#include "debugLog.hpp"
+
+using namespace dns;
+using namespace dns::debug;
+
+namespace {
+
+LogSite packetSite{"Server::run", "Received {} bytes from {} in {} us", static_cast<int>(Level::Debug)};
+LogSite countSite{"Worker", "event {} of thread {}", static_cast<int>(Level::Info)};
+
+size_t countLines(const std::string& text, const std::string& needle)
+{
+    size_t count = 0;
+    for (size_t pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + 1))
+        ++count;
+    return count;
+}
+
+} // namespace
+
+int main()
+{
+    // format strings
+    assert(formatEvent("a {} b {}", {"1", "x"}) == "a 1 b x");
+    assert(formatEvent("no args", {}) == "no args");
+    assert(formatEvent("{} {}", {"only"}) == "only {}");
+
+    // the ring keeps records whole across its end and counts what does not fit
+    {
+        LogRing ring(4096, 0);
+        size_t written = 0;
+        size_t read = 0;
+        for (int round = 0; round < 100; ++round)
+        {
+            const size_t size = 8 * (2 + round % 37);
+            char* record = ring.reserve(size);
+            assert(record);
+            const uint32_t recordSize = static_cast<uint32_t>(size);
+            const uint16_t id = static_cast<uint16_t>(round + 1);
+            std::memcpy(record, &recordSize, 4);
+            std::memcpy(record + 4, &id, 2);
+            ring.commit(size);
+            ++written;
+
+            ring.drain([&](const char* data, size_t recordBytes) {
+                uint16_t seen = 0;
+                std::memcpy(&seen, data + 4, 2);
+                assert(seen == static_cast<uint16_t>(read + 1));
+                assert(recordBytes == 8 * (2 + read % 37));
+                ++read;
+            });
+        }
+        assert(read == written);
+
+        size_t accepted = 0;
+        while (char* record = ring.reserve(64))
+        {
+            const uint32_t recordSize = 64;
+            const uint16_t id = 1;
+            std::memcpy(record, &recordSize, 4);
+            std::memcpy(record + 4, &id, 2);
+            ring.commit(64);
+            ++accepted;
+        }
+        assert(accepted <= 4096 / 64);
+        assert(ring.dropped() == 1);
+    }
+
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "dns_binary_log_test.bin";
+
+    // events of several threads and text lines come back as text
+    {
+        bool started = startBinaryLog(path.string(), 1 << 20);
+        assert(started);
+        assert(binaryLogRunning());
+        started = startBinaryLog(path.string());
+        assert(!started);
+
+        logEvent(packetSite, 57, std::string("127.0.0.1:5353"), int64_t{12});
+        write(Level::Warn, "Dns::splitPacket", "a formatted line");
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 3; ++t)
+        {
+            threads.emplace_back([t] {
+                for (int i = 0; i < 100; ++i)
+                    logEvent(countSite, i, t);
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+
+        stopBinaryLog();
+        assert(!binaryLogRunning());
+
+        std::ifstream in(path, std::ios::binary);
+        std::ostringstream out;
+        const bool decoded = decodeBinaryLog(in, out);
+        assert(decoded);
+        const std::string text = out.str();
+
+        assert(text.find("[debug] [t0] [Server::run] Received 57 bytes from 127.0.0.1:5353 in 12 us") != std::string::npos);
+        assert(text.find("[warn] [t0] [Dns::splitPacket] a formatted line") != std::string::npos);
+        assert(countLines(text, "[Worker] event ") == 300);
+        assert(text.find("event 99 of thread 2") != std::string::npos);
+        assert(countLines(text, "dropped") == 0);
+    }
+
+    // a full ring drops events instead of blocking, and says so
+    {
+        const bool started = startBinaryLog(path.string(), 4096);
+        assert(started);
+        const int produced = 20000;
+        for (int i = 0; i < produced; ++i)
+            logEvent(countSite, i, 0);
+        const uint64_t dropped = binaryLogDropped();
+        stopBinaryLog();
+
+        std::ifstream in(path, std::ios::binary);
+        std::ostringstream out;
+        const bool decoded = decodeBinaryLog(in, out);
+        assert(decoded);
+        const std::string text = out.str();
+        const size_t logged = countLines(text, "[Worker] event ");
+        assert(logged > 0);
+        assert(logged + dropped >= static_cast<size_t>(produced) || text.find("dropped") != std::string::npos);
+        assert(logged <= static_cast<size_t>(produced));
+    }
+
+    // not a log
+    {
+        std::istringstream in("plain text");
+        std::ostringstream out;
+        const bool decoded = decodeBinaryLog(in, out);
+        assert(!decoded);
+    }
+
+    std::filesystem::remove(path);
+    return 0;
+}
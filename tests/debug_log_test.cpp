@@ -0,0 +1,74 @@
+#include <cassert>
+#include <string>
+#include <thread>
+
+#include "debugLog.hpp"
+
+using namespace dns;
+
+namespace {
+
+int evaluations = 0;
+
+std::string counted(const std::string& text)
+{
+    ++evaluations;
+    return text;
+}
+
+} // namespace
+
+int main()
+{
+    using debug::Level;
+
+    // levels: lines above the runtime level are dropped
+    debug::setLevel(Level::Info);
+    assert(debug::level() == Level::Info);
+    assert(debug::shouldLog(Level::Error, "Server::run"));
+    assert(debug::shouldLog(Level::Info, "Server::run"));
+    assert(!debug::shouldLog(Level::Debug, "Server::run"));
+    assert(!debug::shouldLog(Level::Trace, "Server::run"));
+
+    // component filters match prefixes
+    debug::setComponents({"Server", "Dns::handleResponse"});
+    assert(debug::shouldLog(Level::Info, "Server::run"));
+    assert(debug::shouldLog(Level::Info, "Server"));
+    assert(debug::shouldLog(Level::Info, "Dns::handleResponse"));
+    assert(!debug::shouldLog(Level::Info, "Dns::splitPacket"));
+    assert(!debug::shouldLog(Level::Info, "Client::sendMessage"));
+    debug::setComponents({});
+    assert(debug::shouldLog(Level::Info, "Client::sendMessage"));
+
+    // every thread sees a new filter, after it used the previous one
+    debug::setComponents({"Server"});
+    assert(debug::shouldLog(Level::Info, "Server::run"));
+    debug::setComponents({"Dns"});
+    assert(!debug::shouldLog(Level::Info, "Server::run"));
+    assert(debug::shouldLog(Level::Info, "Dns::splitPacket"));
+    bool otherThread = false;
+    std::thread([&otherThread] {
+        otherThread = debug::shouldLog(Level::Info, "Dns::splitPacket") &&
+                      !debug::shouldLog(Level::Info, "Server::run");
+    }).join();
+    assert(otherThread);
+    debug::setComponents({});
+
+    // a dropped line does not build its message
+    evaluations = 0;
+    for (int i = 0; i < 10; ++i)
+        DNS_LOG(Debug, "Server::run", counted("dropped " + std::to_string(i)));
+    assert(evaluations == 0);
+
+    debug::setComponents({"Reactor"});
+    DNS_LOG(Error, "Server::run", counted("filtered out"));
+    assert(evaluations == 0);
+
+    // a line that passes is built once, when logging is compiled in
+    DNS_LOG(Info, "Reactor::run", counted("printed"));
+    assert(evaluations == (debug::kEnabled ? 1 : 0));
+
+    debug::setComponents({});
+    debug::setLevel(Level::Debug);
+    return 0;
+}
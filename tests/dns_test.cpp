@@ -1,7 +1,11 @@
 #include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <chrono>
 #include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "dns.hpp"
 #include "dnsPacker.hpp"
@@ -22,6 +26,52 @@ public:
         splitPacket(qType, clientId);
     }
 
+    bool enqueue(const std::string& msg, const std::string& clientId)
+    {
+        return setMsg(msg, clientId);
+    }
+
+    void split(const std::string& clientId, int qType)
+    {
+        splitPacket(qType, clientId);
+    }
+
+    void setQueueWatermarks(size_t high, size_t low)
+    {
+        setWatermarks(high, low);
+    }
+
+    size_t pending(const std::string& clientId)
+    {
+        return pendingBytes(clientId);
+    }
+
+    bool waitForSpace(const std::string& clientId, std::chrono::milliseconds timeout)
+    {
+        return waitForSendSpace(clientId, timeout);
+    }
+
+    void setCodec(Codec codec)
+    {
+        m_codec = codec;
+        m_maxMessageSize = getMaxMsgLen(m_domainToResolve, codec);
+    }
+
+    void setClientCodec(const std::string& clientId, Codec codec)
+    {
+        m_clientCodec[clientId] = codec;
+    }
+
+    void ingest(const std::string& payload, const std::string& clientId, Codec codec)
+    {
+        handleDataReceived(payload, clientId, codec);
+    }
+
+    int maxMessageSize() const
+    {
+        return m_maxMessageSize;
+    }
+
     bool hasQueuedFragments(const std::string& clientId) const
     {
         auto it = m_msgQueue.find(clientId);
@@ -45,6 +95,52 @@ public:
     {
         return getMsg();
     }
+
+    std::vector<std::pair<std::string, std::string>> takeAllComplete(size_t maxCount)
+    {
+        return getMsgs(maxCount);
+    }
+
+    std::pair<std::string, std::string> waitComplete(std::chrono::milliseconds timeout)
+    {
+        return waitForMsg(timeout);
+    }
+
+    void observe(MessageObserver* observer)
+    {
+        setObserver(observer);
+    }
+
+    bool morePending() const
+    {
+        return m_moreMsgToGet;
+    }
+
+    size_t trackedClients() const
+    {
+        return m_msgReceived.size();
+    }
+
+    using Dns::MAX_INBOUND_CLIENTS;
+};
+
+class RecordingObserver : public MessageObserver {
+public:
+    void onFragmentReceived(const std::string& clientId, const FragmentProgress& progress) override
+    {
+        fragments.push_back(progress);
+        lastClient = clientId;
+    }
+
+    void onMessageComplete(const std::string& clientId, uint32_t session, size_t size) override
+    {
+        completed.emplace_back(session, size);
+        lastClient = clientId;
+    }
+
+    std::vector<FragmentProgress> fragments;
+    std::vector<std::pair<uint32_t, size_t>> completed;
+    std::string lastClient;
 };
 
 } // namespace
@@ -87,6 +183,354 @@ int main()
     assert(clientServerId == serverIdentity);
     assert(clientReceived == serverMsg);
 
+    // Client data encoded in base32 is recognised and decoded by the server,
+    // even when a resolver changed the case of the QNAME.
+    DnsHarness base32Harness(domain, "bb.");
+    const int hexCapacity = base32Harness.maxMessageSize();
+    base32Harness.setCodec(Codec::Base32);
+    assert(base32Harness.maxMessageSize() > hexCapacity);
+
+    const std::string longMsg(300, 'x');
+    base32Harness.queueMessage(longMsg, serverIdentity, 5);
+    bool flipCase = false;
+    while (base32Harness.hasQueuedFragments(serverIdentity))
+    {
+        std::string fragment = base32Harness.popFragment(serverIdentity);
+        assert(fragment[0] == BASE32_TAG);
+        std::string qnameData = addDotEvery62Chars(fragment);
+        assert(qnameData.size() + 1 + domain.size() + 3 <= MAX_DNS_LENGTH);
+        if (flipCase)
+            std::transform(qnameData.begin(), qnameData.end(), qnameData.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+        flipCase = !flipCase;
+        serverHarness.ingest(qnameData, clientIdentity);
+    }
+
+    auto [base32ClientId, base32Received] = serverHarness.takeComplete();
+    assert(base32ClientId == clientIdentity);
+    assert(base32Received == longMsg);
+
+    // Downstream TXT fragments in raw and base64 need fewer round trips than
+    // hex for the same message; the client decodes with the negotiated codec.
+    const std::string bigServerMsg(2000, 'y');
+    size_t fragmentsPerCodec[3] = {};
+    const Codec downstreamCodecs[3] = {Codec::Hex, Codec::Base64, Codec::Raw};
+    for (int c = 0; c < 3; ++c)
+    {
+        DnsHarness server(domain, "");
+        DnsHarness client(domain, "cc.");
+        server.setClientCodec(clientIdentity, downstreamCodecs[c]);
+        server.queueMessage(bigServerMsg, clientIdentity, 16);
+        while (server.hasQueuedFragments(clientIdentity))
+        {
+            client.ingest(server.popFragment(clientIdentity), serverIdentity, downstreamCodecs[c]);
+            ++fragmentsPerCodec[c];
+        }
+        auto [fromId, received] = client.takeComplete();
+        assert(fromId == serverIdentity);
+        assert(received == bigServerMsg);
+    }
+    assert(fragmentsPerCodec[1] < fragmentsPerCodec[0]);
+    assert(fragmentsPerCodec[2] < fragmentsPerCodec[1]);
+    assert(fragmentsPerCodec[2] * 2 <= fragmentsPerCodec[0] + 2);
+
+    // Binary codecs are not allowed in names: CNAME answers fall back to hex.
+    {
+        DnsHarness server(domain, "");
+        DnsHarness client(domain, "cc.");
+        server.setClientCodec(clientIdentity, Codec::Raw);
+        server.queueMessage(serverMsg, clientIdentity, 5);
+        const std::string fragment = server.popFragment(clientIdentity);
+        assert(fragment == stringToHex(hexToString(fragment)));
+        client.ingest(fragment, serverIdentity);
+        auto [fromId, received] = client.takeComplete();
+        assert(received == serverMsg);
+    }
+
+    // Binary messages (invalid UTF-8, NUL bytes, braces) survive framing in
+    // both directions and with every codec.
+    std::string binaryMsg;
+    for (int i = 0; i < 1024; ++i)
+        binaryMsg.push_back(static_cast<char>((i * 7) & 0xFF));
+    for (Codec codec : {Codec::Hex, Codec::Base32, Codec::Base64, Codec::Raw})
+    {
+        DnsHarness server(domain, "");
+        DnsHarness client(domain, "dd.");
+        server.setClientCodec(clientIdentity, codec);
+        server.queueMessage(binaryMsg, clientIdentity, 16);
+        while (server.hasQueuedFragments(clientIdentity))
+            client.ingest(server.popFragment(clientIdentity), serverIdentity, codec);
+        auto [fromId, received] = client.takeComplete();
+        assert(received == binaryMsg);
+    }
+    {
+        DnsHarness client(domain, "dd.");
+        DnsHarness server(domain, "");
+        client.setCodec(Codec::Base32);
+        client.queueMessage(binaryMsg, serverIdentity, 5);
+        while (client.hasQueuedFragments(serverIdentity))
+            server.ingest(addDotEvery62Chars(client.popFragment(serverIdentity)), clientIdentity);
+        auto [fromId, received] = server.takeComplete();
+        assert(received == binaryMsg);
+    }
+
+    // Messages queued back to back are all delivered, in order, one at a
+    // time: the next message is only split once the previous one is out.
+    {
+        DnsHarness server(domain, "");
+        DnsHarness client(domain, "ee.");
+        const std::string messages[3] = {std::string(700, 'a'), "second", std::string(300, 'c')};
+        for (const std::string& message : messages)
+        {
+            const bool queued = server.enqueue(message, clientIdentity);
+            assert(queued);
+        }
+        assert(server.pending(clientIdentity) == 1006);
+
+        // an A query cannot carry data and leaves the message queued
+        server.split(clientIdentity, 1);
+        assert(!server.hasQueuedFragments(clientIdentity));
+        assert(server.pending(clientIdentity) == 1006);
+
+        for (const std::string& message : messages)
+        {
+            server.split(clientIdentity, 16);
+            assert(server.hasQueuedFragments(clientIdentity));
+            // splitting again while fragments are pending is a no-op
+            const size_t pendingBefore = server.pending(clientIdentity);
+            server.split(clientIdentity, 16);
+            assert(server.pending(clientIdentity) == pendingBefore);
+
+            while (server.hasQueuedFragments(clientIdentity))
+                client.ingest(server.popFragment(clientIdentity), serverIdentity, Codec::Hex);
+            auto [fromId, received] = client.takeComplete();
+            assert(fromId == serverIdentity);
+            assert(received == message);
+        }
+        assert(server.pending(clientIdentity) == 0);
+    }
+
+    // Backpressure: the queue refuses messages from the high watermark until
+    // it has drained to the low watermark, and other clients are unaffected.
+    {
+        DnsHarness server(domain, "");
+        server.setQueueWatermarks(100, 40);
+        const std::string chunk(30, 'q');
+        for (int i = 0; i < 4; ++i)
+        {
+            const bool queued = server.enqueue(chunk, clientIdentity);
+            assert(queued);
+        }
+        assert(server.pending(clientIdentity) == 120);
+        bool queued = server.enqueue(chunk, clientIdentity);
+        assert(!queued);
+        assert(server.pending(clientIdentity) == 120);
+        queued = server.enqueue(chunk, "other");
+        assert(queued);
+        const bool space = server.waitForSpace(clientIdentity, std::chrono::milliseconds(1));
+        assert(!space);
+
+        // 90 bytes left: still above the low watermark
+        server.split(clientIdentity, 16);
+        while (server.hasQueuedFragments(clientIdentity))
+            server.popFragment(clientIdentity);
+        queued = server.enqueue(chunk, clientIdentity);
+        assert(!queued);
+
+        // a blocked producer is woken up when the queue drains to 30 bytes
+        std::thread producer([&] {
+            const bool woken = server.waitForSpace(clientIdentity, std::chrono::seconds(10));
+            assert(woken);
+            const bool requeued = server.enqueue(chunk, clientIdentity);
+            assert(requeued);
+        });
+        for (int i = 0; i < 2; ++i)
+        {
+            server.split(clientIdentity, 16);
+            while (server.hasQueuedFragments(clientIdentity))
+                server.popFragment(clientIdentity);
+        }
+        producer.join();
+        assert(server.pending(clientIdentity) == 60);
+
+        // a single message above the high watermark is accepted by an empty queue
+        DnsHarness other(domain, "");
+        other.setQueueWatermarks(100, 40);
+        queued = other.enqueue(std::string(500, 'z'), clientIdentity);
+        assert(queued);
+        queued = other.enqueue("x", clientIdentity);
+        assert(!queued);
+    }
+
+    // Completed messages are delivered round-robin across clients, whatever
+    // the order they completed in, and can be drained in bulk.
+    {
+        DnsHarness server(domain, "");
+        DnsHarness sender(domain, "ff.");
+        auto deliver = [&](const std::string& message, const std::string& fromId) {
+            sender.queueMessage(message, fromId, 5);
+            while (sender.hasQueuedFragments(fromId))
+                server.ingest(addDotEvery62Chars(sender.popFragment(fromId)), fromId);
+        };
+        deliver("a1", "alice");
+        deliver("a2", "alice");
+        deliver("a3", "alice");
+        deliver("b1", "bob");
+        deliver("c1", "carol");
+        deliver("b2", "bob");
+
+        const std::pair<std::string, std::string> expected[6] = {
+            {"alice", "a1"}, {"bob", "b1"}, {"carol", "c1"},
+            {"alice", "a2"}, {"bob", "b2"}, {"alice", "a3"}};
+
+        auto first = server.takeComplete();
+        assert(first == expected[0]);
+        auto batch = server.takeAllComplete(3);
+        assert(batch.size() == 3);
+        for (size_t i = 0; i < batch.size(); ++i)
+            assert(batch[i] == expected[i + 1]);
+        batch = server.takeAllComplete(10);
+        assert(batch.size() == 2);
+        assert(batch[0] == expected[4] && batch[1] == expected[5]);
+        batch = server.takeAllComplete(10);
+        assert(batch.empty());
+        auto none = server.takeComplete();
+        assert(none == std::make_pair(std::string(), std::string()));
+    }
+
+    // A retransmitted fragment of a completed message neither duplicates the
+    // message nor leaves a pending session behind.
+    {
+        DnsHarness server(domain, "");
+        DnsHarness sender(domain, "gg.");
+        sender.queueMessage(std::string(300, 'r'), "dave", 5);
+        std::vector<std::string> fragments;
+        while (sender.hasQueuedFragments("dave"))
+            fragments.push_back(addDotEvery62Chars(sender.popFragment("dave")));
+        assert(fragments.size() > 1);
+
+        for (size_t i = 0; i + 1 < fragments.size(); ++i)
+            server.ingest(fragments[i], "dave");
+        assert(server.morePending());
+        server.ingest(fragments.back(), "dave");
+        assert(!server.morePending());
+        server.ingest(fragments.back(), "dave");
+        server.ingest(fragments.front(), "dave");
+        assert(!server.morePending());
+
+        auto [fromId, received] = server.takeComplete();
+        assert(received == std::string(300, 'r'));
+        auto [noId, duplicate] = server.takeComplete();
+        assert(duplicate.empty());
+    }
+
+    // waitForMsg times out when nothing completes and wakes up as soon as
+    // the last fragment of a message is received on another thread.
+    {
+        DnsHarness server(domain, "");
+        DnsHarness sender(domain, "hh.");
+        auto [noId, nothing] = server.waitComplete(std::chrono::milliseconds(1));
+        assert(nothing.empty());
+
+        const std::string message(500, 'w');
+        sender.queueMessage(message, "erin", 5);
+        std::vector<std::string> fragments;
+        while (sender.hasQueuedFragments("erin"))
+            fragments.push_back(addDotEvery62Chars(sender.popFragment("erin")));
+
+        std::thread receiver([&] {
+            for (const std::string& fragment : fragments)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                server.ingest(fragment, "erin");
+            }
+        });
+        auto [fromId, received] = server.waitComplete(std::chrono::seconds(10));
+        receiver.join();
+        assert(fromId == "erin");
+        assert(received == message);
+    }
+
+    // The observer sees every new fragment and every completed message, but
+    // not duplicates.
+    {
+        DnsHarness server(domain, "");
+        DnsHarness sender(domain, "ii.");
+        RecordingObserver observer;
+        server.observe(&observer);
+
+        const std::string message(400, 'o');
+        sender.queueMessage(message, "frank", 5);
+        std::vector<std::string> fragments;
+        while (sender.hasQueuedFragments("frank"))
+            fragments.push_back(addDotEvery62Chars(sender.popFragment("frank")));
+        assert(fragments.size() > 2);
+
+        server.ingest(fragments[0], "frank");
+        server.ingest(fragments[0], "frank");
+        for (size_t i = 1; i < fragments.size(); ++i)
+            server.ingest(fragments[i], "frank");
+
+        assert(observer.fragments.size() == fragments.size());
+        for (size_t i = 0; i < observer.fragments.size(); ++i)
+        {
+            assert(observer.fragments[i].receivedFragments == i + 1);
+            assert(observer.fragments[i].expectedFragments == fragments.size());
+            assert(observer.fragments[i].session == observer.fragments[0].session);
+        }
+        assert(observer.fragments.back().receivedBytes == message.size());
+        assert(observer.completed.size() == 1);
+        assert(observer.completed[0].first == observer.fragments[0].session);
+        assert(observer.completed[0].second == message.size());
+        assert(observer.lastClient == "frank");
+
+        // the message is still delivered through the ready queue
+        auto [fromId, received] = server.takeComplete();
+        assert(received == message);
+
+        server.observe(nullptr);
+        sender.queueMessage("after", "frank", 5);
+        while (sender.hasQueuedFragments("frank"))
+            server.ingest(addDotEvery62Chars(sender.popFragment("frank")), "frank");
+        assert(observer.completed.size() == 1);
+    }
+
+    // Client identifiers come from the query names: a sender cycling them does
+    // not grow the reassembly state past the limit, and a client still active
+    // keeps its session.
+    {
+        DnsHarness sender(domain, "");
+        DnsHarness server(domain, "");
+        const std::string message(300, 'k');
+        sender.queueMessage(message, "keep", 5);
+        std::vector<std::string> fragments;
+        while (sender.hasQueuedFragments("keep"))
+            fragments.push_back(addDotEvery62Chars(sender.popFragment("keep")));
+        assert(fragments.size() > 1);
+
+        const size_t madeUp = DnsHarness::MAX_INBOUND_CLIENTS + 100;
+        server.ingest(fragments[0], "keep");
+        for (size_t i = 0; i < madeUp; ++i)
+        {
+            server.ingest(fragments[0], "c" + std::to_string(i));
+            if (i % 100 == 0)
+                server.ingest(fragments[0], "keep");
+            assert(server.trackedClients() <= DnsHarness::MAX_INBOUND_CLIENTS);
+        }
+
+        const MetricsSnapshot snapshot = server.metricsSnapshot();
+        const int64_t sessions = snapshot.gauge(Gauge::Sessions);
+        assert(static_cast<size_t>(sessions) == server.trackedClients());
+        assert(snapshot.counter(Counter::SessionsDropped) > 0);
+        assert(snapshot.counter(Counter::SessionsDropped) + static_cast<uint64_t>(sessions) == madeUp + 1);
+
+        for (size_t i = 1; i < fragments.size(); ++i)
+            server.ingest(fragments[i], "keep");
+        auto [fromId, received] = server.takeComplete();
+        assert(fromId == "keep");
+        assert(received == message);
+    }
+
     // Regression test: ensure QNAME encoding handles 62-byte labels without
     // introducing an empty label between the fragment and the domain.
     const std::string sixtyTwoHex(62, 'A');
@@ -0,0 +1,124 @@
+#include <cassert>
+#include <string>
+
+#include "query.hpp"
+#include "response.hpp"
+#include "server.hpp"
+#include "test_support.hpp"
+
+using namespace dns;
+
+namespace {
+
+const std::string domain = "edns.local";
+
+} // namespace
+
+int main()
+{
+    // OPT record layout: root name, type 41, class = UDP size, TTL 0, no options
+    {
+        Query query = test::makeQuery("a.example.com", 16, 1232);
+        char buffer[512];
+        int size = query.code(buffer);
+        const unsigned char opt[] = {0x00, 0x00, 0x29, 0x04, 0xD0, 0, 0, 0, 0, 0x00, 0x00};
+        assert(size == 12 + 15 + 4 + 11);
+        for (int i = 0; i < 11; ++i)
+            assert(static_cast<unsigned char>(buffer[size - 11 + i]) == opt[i]);
+        // counted in ARCOUNT on the wire
+        assert(buffer[11] == 1);
+
+        Query decoded;
+        decoded.decode(buffer, size);
+        assert(decoded.getQName() == "a.example.com");
+        assert(decoded.getEdnsUdpSize() == 1232);
+        assert(decoded.getArCount() == 0);
+    }
+
+    // no OPT record unless a size is set
+    {
+        Query query = test::makeQuery("a.example.com", 16, 0);
+        char buffer[512];
+        int size = query.code(buffer);
+        assert(size == 12 + 15 + 4);
+
+        Query decoded;
+        decoded.decode(buffer, size);
+        assert(decoded.getEdnsUdpSize() == 0);
+    }
+
+    // sizes below 512 mean 512 (RFC 6891)
+    {
+        Query query = test::makeQuery("a.example.com", 16, 100);
+        char buffer[512];
+        int size = query.code(buffer);
+
+        Query decoded;
+        decoded.decode(buffer, size);
+        assert(decoded.getEdnsUdpSize() == 512);
+    }
+
+    // responses carry it after the answer
+    {
+        Response response;
+        response.setID(7);
+        response.setName("a.example.com");
+        response.setType(16);
+        response.setClass(1);
+        response.setQdCount(1);
+        response.setAnCount(1);
+        response.setRdata("hello");
+        response.setEdnsUdpSize(4096);
+
+        char buffer[512];
+        int size = response.code(buffer);
+
+        Response decoded;
+        decoded.decode(buffer, size);
+        assert(decoded.getRdata() == "hello");
+        assert(decoded.getEdnsUdpSize() == 4096);
+        assert(decoded.getArCount() == 0);
+    }
+
+    // the server sizes downstream fragments to the advertised buffer
+    {
+        const std::string message(8000, 'x');
+
+        Server legacy(0, domain);
+        legacy.setMessageToSend(message, "abc");
+        // a fragment of the message queued for client "abc"
+        const std::string askName = "askr.rnd12345.abc." + domain;
+        Response legacyResponse;
+        const int legacySize = test::exchange(legacy, askName, 16, 0, legacyResponse);
+        assert(legacyResponse.getEdnsUdpSize() == 0);
+        assert(legacySize <= 512);
+        // the compressed owner name leaves the rest of the 512 bytes to data
+        assert(legacySize > 480);
+
+        Server srv(0, domain);
+        srv.setMessageToSend(message, "abc");
+        Response response;
+        int size = test::exchange(srv, askName, 16, 1232, response);
+        assert(response.getEdnsUdpSize() == Server::EDNS_UDP_SIZE);
+        assert(size <= 1232);
+        // raw codec: nearly the whole datagram is payload
+        assert(size > 1200);
+        assert(response.getRdata().size() >= 2 * legacyResponse.getRdata().size());
+
+        Server large(0, domain);
+        large.setMessageToSend(message, "abc");
+        size = test::exchange(large, askName, 16, 4096, response);
+        assert(size <= Server::BUFFER_SIZE);
+        assert(size > 4000);
+        assert(response.getRdata().size() >= 8 * legacyResponse.getRdata().size());
+
+        // what the resolver advertises, not what we would like
+        Server small(0, domain);
+        small.setMessageToSend(message, "abc");
+        size = test::exchange(small, askName, 16, 600, response);
+        assert(size <= 600);
+        assert(size > 560);
+    }
+
+    return 0;
+}
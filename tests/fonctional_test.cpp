@@ -20,20 +20,30 @@ R"(fonctionalTest test harness
 USAGE
   Server mode:
     fonctionalTest server --domain ns.example.com [--port 53] [--test-msg "text"] [--run-seconds 5]
+                     [--workers 1]
 
   Client mode:
     fonctionalTest client --dns 8.8.8.8 --host ns.example.com --send "text"
-                     [--timeout 5] [--expect "expected-reply"]
+                     [--timeout 5] [--expect "expected-reply"] [--upstream-codec hex|base32]
+                     [--downstream-codec hex|base64|raw]
 
 OPTIONS
   --domain <fqdn>        (server) Authoritative domain to handle.
   --port <1-65535>       (server) UDP/TCP port for the DNS server. Default: 53
   --test-msg <text>      (server) Message the server will expose via setMsg().
+  --workers <n>          (server) Worker threads, each with its own SO_REUSEPORT
+                         socket (Linux). Default: 1
 
   --dns <ip>             (client) DNS resolver IP to query (e.g., 8.8.8.8).
   --host <fqdn>          (client) Target host / domain to use.
   --send <text>          (client) Payload to send via Client::sendMessage().
 
+  --upstream-codec <c>   (client) Encoding of data sent in query names: hex or
+                         base32. Default: hex
+
+  --downstream-codec <c> (client) Encoding requested for data returned in TXT
+                         answers: hex, base64 or raw. Default: hex
+
   --timeout <seconds>    (client) How long to poll getMsg() before giving up.
                          Default: 5 seconds.
   --expect <text>        (client) If set, the test passes only if any received
@@ -89,7 +99,10 @@ int main(int argc, char** argv) {
     std::string host;
     std::optional<std::string> client_send;
     int client_timeout_sec = 5;
+    int server_workers = 1;
     std::optional<std::string> expect_eq;
+    Codec upstream_codec = Codec::Hex;
+    Codec downstream_codec = Codec::Hex;
 
     // Parse flags starting from argv[2]
     for (int i = 2; i < argc; ++i) {
@@ -122,6 +135,13 @@ int main(int argc, char** argv) {
             }
             server_run_seconds = s;
         }
+        else if (a == "--workers") {
+            std::string v = need_value("--workers");
+            if (!parse_int(v, server_workers) || server_workers <= 0) {
+                std::cerr << "Invalid --workers: " << v << "\n";
+                return 2;
+            }
+        }
         else if (a == "--dns")      { dns_ip = need_value("--dns"); }
         else if (a == "--host")     { host = need_value("--host"); }
         else if (a == "--send")     { client_send = need_value("--send"); }
@@ -133,6 +153,25 @@ int main(int argc, char** argv) {
             }
         }
         else if (a == "--expect")   { expect_eq = need_value("--expect"); }
+        else if (a == "--downstream-codec") {
+            std::string v = need_value("--downstream-codec");
+            if (v == "hex") downstream_codec = Codec::Hex;
+            else if (v == "base64") downstream_codec = Codec::Base64;
+            else if (v == "raw") downstream_codec = Codec::Raw;
+            else {
+                std::cerr << "Invalid --downstream-codec: " << v << "\n";
+                return 2;
+            }
+        }
+        else if (a == "--upstream-codec") {
+            std::string v = need_value("--upstream-codec");
+            if (v == "hex") upstream_codec = Codec::Hex;
+            else if (v == "base32") upstream_codec = Codec::Base32;
+            else {
+                std::cerr << "Invalid --upstream-codec: " << v << "\n";
+                return 2;
+            }
+        }
         else if (a == "-h" || a == "--help") {
             print_usage(std::cout);
             return 0;
@@ -160,6 +199,7 @@ int main(int argc, char** argv) {
                 "twilight harmony radiant tranquility paradise reflection serendipity "
                 "breeze blossom moonlight tranquility radiant whisper serendipity horizon";
 
+            server.setWorkerCount(static_cast<unsigned int>(server_workers));
             server.launch();
             const std::string beaconId = "default";
             server.setMessageToSend(server_test_msg.value_or(default_msg), beaconId);
@@ -168,12 +208,12 @@ int main(int argc, char** argv) {
             const int run_secs = server_run_seconds.value_or(5);
             auto end = std::chrono::steady_clock::now() + std::chrono::seconds(run_secs);
 
-            while (std::chrono::steady_clock::now() < end) {
-                auto [clientId, result] = server.getAvailableMessage();
+            for (auto now = std::chrono::steady_clock::now(); now < end; now = std::chrono::steady_clock::now()) {
+                auto [clientId, result] = server.waitForMessage(
+                    std::chrono::duration_cast<std::chrono::milliseconds>(end - now));
                 if (!result.empty()) {
                     std::cout << "[server] client=" << clientId << " msg: " << result << std::endl;
                 }
-                std::this_thread::sleep_for(std::chrono::milliseconds(200));
             }
 
             server.stop();
@@ -186,6 +226,8 @@ int main(int argc, char** argv) {
             }
 
             Client client(dns_ip, host, port);
+            client.setUpstreamCodec(upstream_codec);
+            client.setDownstreamCodec(downstream_codec);
             client.sendMessage(*client_send);
 
             const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(client_timeout_sec);
@@ -0,0 +1,275 @@
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fragment.hpp"
+
+using namespace dns;
+
+namespace {
+
+FragmentHeader makeHeader(uint32_t index, uint32_t count)
+{
+    FragmentHeader header;
+    header.session = 42;
+    header.index = index;
+    header.count = count;
+    return header;
+}
+
+// Cut message the way splitPacket does: equal chunks, shorter last one.
+std::vector<std::string> cut(const std::string& message, size_t chunk)
+{
+    std::vector<std::string> parts;
+    for (size_t offset = 0; offset < message.size(); offset += chunk)
+        parts.push_back(message.substr(offset, chunk));
+    return parts;
+}
+
+std::string makeMessage(size_t size)
+{
+    std::string message(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+        message[i] = static_cast<char>((i * 131 + 7) & 0xFF);
+    return message;
+}
+
+} // namespace
+
+int main()
+{
+    // Varint boundaries
+    assert(varintSize(0) == 1);
+    assert(varintSize(127) == 1);
+    assert(varintSize(128) == 2);
+    assert(varintSize(16383) == 2);
+    assert(varintSize(16384) == 3);
+    assert(varintSize(UINT32_MAX) == 5);
+
+    const uint32_t values[] = {0, 1, 127, 128, 300, 16383, 16384, 2097151, 2097152, UINT32_MAX - 1};
+    for (uint32_t session : values)
+    {
+        for (uint32_t count : {1u, 2u, 200u, 70000u, UINT32_MAX})
+        {
+            FragmentHeader header;
+            header.flags = 0x5;
+            header.session = session;
+            header.index = count - 1;
+            header.count = count;
+
+            std::string encoded;
+            encodeFragmentHeader(header, encoded);
+            assert(encoded.size() == fragmentHeaderSize(header));
+            assert(encoded.size() <= FRAGMENT_MAX_HEADER_SIZE);
+            encoded += std::string("\0\xFF payload}", 10);
+
+            FragmentHeader decoded;
+            std::string_view payload;
+            const bool ok = decodeFragment(encoded, decoded, payload);
+            assert(ok);
+            assert(decoded.flags == header.flags);
+            assert(decoded.session == header.session);
+            assert(decoded.index == header.index);
+            assert(decoded.count == header.count);
+            assert(payload == std::string_view("\0\xFF payload}", 10));
+            // the payload is a view into the fragment, not a copy
+            assert(payload.data() == encoded.data() + fragmentHeaderSize(header));
+        }
+    }
+
+    // A small header costs a handful of bytes.
+    FragmentHeader small;
+    small.session = 1000;
+    small.index = 3;
+    small.count = 10;
+    assert(fragmentHeaderSize(small) == 5);
+
+    FragmentHeader decoded;
+    std::string_view payload;
+
+    // The timestamp of a flagged header round-trips and costs 8 bytes
+    {
+        FragmentHeader stamped = small;
+        stamped.flags = FRAGMENT_FLAG_TIMESTAMP;
+        stamped.enqueueTime = 0x0102030405060708ULL;
+        assert(fragmentHeaderSize(stamped) == 5 + FRAGMENT_TIMESTAMP_SIZE);
+
+        std::string encoded;
+        encodeFragmentHeader(stamped, encoded);
+        assert(encoded.size() == fragmentHeaderSize(stamped));
+        encoded += "data";
+        bool ok = decodeFragment(encoded, decoded, payload);
+        assert(ok);
+        assert(decoded.flags == FRAGMENT_FLAG_TIMESTAMP);
+        assert(decoded.enqueueTime == stamped.enqueueTime);
+        assert(payload == "data");
+
+        // cut inside the timestamp
+        ok = decodeFragment(std::string_view(encoded).substr(0, 5 + 7), decoded, payload);
+        assert(!ok);
+
+        // unflagged headers leave the time at zero
+        std::string plain;
+        encodeFragmentHeader(small, plain);
+        ok = decodeFragment(plain, decoded, payload);
+        assert(ok);
+        assert(decoded.enqueueTime == 0);
+    }
+
+    // Empty, wrong version, truncated varints
+    assert(!decodeFragment(std::string_view(), decoded, payload));
+    assert(!decodeFragment(std::string_view("\x20\x01\x00\x01", 4), decoded, payload));
+    assert(!decodeFragment(std::string_view("\x10\x81", 2), decoded, payload));
+    assert(!decodeFragment(std::string_view("\x10\x01\x00", 3), decoded, payload));
+
+    // Zero count and index past the count
+    assert(!decodeFragment(std::string_view("\x10\x01\x00\x00", 4), decoded, payload));
+    assert(!decodeFragment(std::string_view("\x10\x01\x02\x02", 4), decoded, payload));
+
+    // Varints longer than 5 bytes or overflowing 32 bits
+    assert(!decodeFragment(std::string_view("\x10\xFF\xFF\xFF\xFF\x1F\x00\x01", 8), decoded, payload));
+    assert(!decodeFragment(std::string_view("\x10\xFF\xFF\xFF\xFF\x8F\x01\x00\x01", 9), decoded, payload));
+
+    // Legacy JSON fragments and control words are rejected
+    assert(!decodeFragment("{\"k\":0,\"m\":\"x\",\"n\":1,\"s\":\"ab\"}", decoded, payload));
+    assert(!decodeFragment("noData", decoded, payload));
+
+    // Minimal valid fragment with an empty payload
+    const bool ok = decodeFragment(std::string_view("\x10\x07\x00\x01", 4), decoded, payload);
+    assert(ok);
+    assert(decoded.session == 7 && decoded.index == 0 && decoded.count == 1);
+    assert(payload.empty());
+
+    const std::string message = makeMessage(1000);
+    const std::vector<std::string> parts = cut(message, 64);
+    const uint32_t count = static_cast<uint32_t>(parts.size());
+    Packet::AddResult result;
+    std::string data;
+
+    // In order
+    {
+        Packet packet;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            assert(!packet.isFull());
+            result = packet.addFragment(makeHeader(i, count), parts[i]);
+            assert(result == Packet::AddResult::Added);
+            assert(packet.receivedCount() == i + 1);
+        }
+        assert(packet.isFull());
+        assert(packet.accumulatedSize() == message.size());
+        data = packet.takeData();
+        assert(data == message);
+    }
+
+    // Reverse order, so the short last fragment arrives before the chunk size is known
+    {
+        Packet packet;
+        for (uint32_t i = count; i-- > 0;)
+        {
+            result = packet.addFragment(makeHeader(i, count), parts[i]);
+            assert(result == Packet::AddResult::Added);
+        }
+        assert(packet.isFull());
+        data = packet.takeData();
+        assert(data == message);
+    }
+
+    // Shuffled order with duplicates
+    {
+        Packet packet;
+        for (uint32_t step = 0; step < count; ++step)
+        {
+            const uint32_t i = (step * 7) % count;
+            result = packet.addFragment(makeHeader(i, count), parts[i]);
+            assert(result == Packet::AddResult::Added);
+            result = packet.addFragment(makeHeader(i, count), parts[i]);
+            assert(result == Packet::AddResult::Duplicate);
+        }
+        assert(packet.receivedCount() == count);
+        assert(packet.accumulatedSize() == message.size());
+        data = packet.takeData();
+        assert(data == message);
+    }
+
+    // Single fragment message, including an empty one
+    {
+        Packet packet;
+        result = packet.addFragment(makeHeader(0, 1), "hello");
+        assert(result == Packet::AddResult::Added);
+        assert(packet.isFull());
+        data = packet.takeData();
+        assert(data == "hello");
+
+        Packet empty;
+        result = empty.addFragment(makeHeader(0, 1), "");
+        assert(result == Packet::AddResult::Added);
+        assert(empty.isFull());
+        data = empty.takeData();
+        assert(data.empty());
+    }
+
+    // Inconsistent fragments are rejected without touching the state
+    {
+        Packet packet;
+        result = packet.addFragment(makeHeader(0, 0), "x");
+        assert(result == Packet::AddResult::Invalid);
+        result = packet.addFragment(makeHeader(0, MAX_FRAGMENT_COUNT + 1), "x");
+        assert(result == Packet::AddResult::Invalid);
+        assert(packet.expectedCount() == 0);
+
+        result = packet.addFragment(makeHeader(0, count), parts[0]);
+        assert(result == Packet::AddResult::Added);
+        // different count, index past the count, wrong chunk size, oversized last fragment
+        result = packet.addFragment(makeHeader(1, count + 1), parts[1]);
+        assert(result == Packet::AddResult::Invalid);
+        result = packet.addFragment(makeHeader(count, count), parts[1]);
+        assert(result == Packet::AddResult::Invalid);
+        result = packet.addFragment(makeHeader(1, count), parts[1] + "x");
+        assert(result == Packet::AddResult::Invalid);
+        result = packet.addFragment(makeHeader(count - 1, count), parts[0] + "x");
+        assert(result == Packet::AddResult::Invalid);
+        assert(packet.receivedCount() == 1);
+        assert(packet.accumulatedSize() == parts[0].size());
+
+        for (uint32_t i = 1; i < count; ++i)
+        {
+            result = packet.addFragment(makeHeader(i, count), parts[i]);
+            assert(result == Packet::AddResult::Added);
+        }
+        data = packet.takeData();
+        assert(data == message);
+    }
+
+    // A claimed size past the reassembly limit is refused before allocating
+    {
+        Packet packet;
+        const std::string chunk(1024, 'a');
+        result = packet.addFragment(makeHeader(0, MAX_FRAGMENT_COUNT), chunk);
+        assert(result == Packet::AddResult::Invalid);
+        assert(packet.receivedCount() == 0);
+    }
+
+    // Large message: 10k fragments, linear work
+    {
+        const std::string big = makeMessage(10000 * 50 - 13);
+        const std::vector<std::string> bigParts = cut(big, 50);
+        const uint32_t bigCount = static_cast<uint32_t>(bigParts.size());
+        assert(bigCount == 10000);
+
+        Packet packet;
+        for (uint32_t i = 0; i < bigCount; ++i)
+        {
+            const uint32_t index = (i % 2) ? bigCount - 1 - i / 2 : i / 2;
+            result = packet.addFragment(makeHeader(index, bigCount), bigParts[index]);
+            assert(result == Packet::AddResult::Added);
+        }
+        assert(packet.isFull());
+        data = packet.takeData();
+        assert(data == big);
+    }
+
+    return 0;
+}
@@ -6,7 +6,7 @@ using namespace dns;
 struct MessageHdrTest : public Message {
     MessageHdrTest() : Message(Message::Response) {}
 
-    int code(char*) override { return 0; }
+    int code(char*, size_t) override { return 0; }
     void decode(const char*, int) override {}
 
     using Message::code_hdr;
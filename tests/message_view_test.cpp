@@ -0,0 +1,232 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "messageView.hpp"
+#include "query.hpp"
+#include "response.hpp"
+
+using namespace dns;
+
+// count heap allocations to check the steady state of the parsers
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+int codeQuery(char* buffer, const std::string& qname, uint ednsUdpSize)
+{
+    Query query;
+    query.setID(0xBEEF);
+    query.setQdCount(1);
+    query.setAnCount(0);
+    query.setNsCount(0);
+    query.setArCount(0);
+    query.setQName(qname);
+    query.setQType(16);
+    query.setQClass(1);
+    query.setEdnsUdpSize(ednsUdpSize);
+    return query.code(buffer);
+}
+
+} // namespace
+
+int main()
+{
+    const std::string qname = "askr.rnd12345.abc.some.long.tunnel.domain.example.com";
+
+    // queries: header, question and EDNS0 size, read in place
+    {
+        char buffer[512];
+        int size = codeQuery(buffer, qname, 1232);
+
+        QueryView view;
+        bool ok = view.parse(buffer, size);
+        assert(ok);
+        assert(view.id() == 0xBEEF);
+        assert(!view.isResponse());
+        assert(view.isRecursionDesired());
+        assert(view.qType() == 16);
+        assert(view.qClass() == 1);
+        assert(view.ednsUdpSize() == 1232);
+        assert(view.arCount() == 0);
+
+        std::string name;
+        ok = view.qname().copyTo(name);
+        assert(ok);
+        assert(name == qname);
+
+        size_t labels = 0;
+        ok = view.qname().forEachLabel([&](std::string_view label) {
+            if (labels++ == 0)
+                assert(label == "askr");
+        });
+        assert(ok);
+        assert(labels == 9);
+
+        // Query::decode goes through the view
+        Query query;
+        query.decode(buffer, size);
+        assert(query.getQName() == qname);
+        assert(query.getEdnsUdpSize() == 1232);
+        assert(query.getArCount() == 0);
+
+        // truncated anywhere in the question
+        for (int cut = 0; cut < 12 + static_cast<int>(qname.size()) + 2 + 4; ++cut)
+            assert(!view.parse(buffer, cut));
+
+        // no question
+        buffer[5] = 0;
+        assert(!view.parse(buffer, size));
+    }
+
+    // compression loops end with the hop counter
+    {
+        const unsigned char selfLoop[] = {
+            0x00,0x01, 0x01,0x00, 0x00,0x01, 0x00,0x00, 0x00,0x00, 0x00,0x00,
+            0x01,'a', 0xC0,0x0C,
+            0x00,0x10, 0x00,0x01
+        };
+        QueryView view;
+        assert(!view.parse(reinterpret_cast<const char*>(selfLoop), sizeof(selfLoop)));
+
+        // a long chain of pointers, each to the one before
+        char chain[12 + 2 + 2 * 100 + 4] = {};
+        chain[5] = 1;
+        chain[12] = 0; // the root
+        size_t offset = 13;
+        for (int i = 0; i < 100; ++i)
+        {
+            const size_t target = i == 0 ? 12 : offset - 2;
+            chain[offset] = static_cast<char>(0xC0 | (target >> 8));
+            chain[offset + 1] = static_cast<char>(target & 0xFF);
+            offset += 2;
+        }
+        NameView shortChain(chain, sizeof(chain), 13 + 2 * 10);
+        std::string name = "x";
+        const bool copied = shortChain.copyTo(name);
+        assert(copied);
+        assert(name.empty());
+        NameView longChain(chain, sizeof(chain), 13 + 2 * 99);
+        assert(!longChain.copyTo(name));
+
+        // Response::decode survives the loop as well
+        const unsigned char loopAnswer[] = {
+            0x00,0x01, 0x81,0x80, 0x00,0x00, 0x00,0x01, 0x00,0x00, 0x00,0x00,
+            0xC0,0x0C,
+            0x00,0x10, 0x00,0x01, 0x00,0x00,0x00,0x00, 0x00,0x00
+        };
+        Response response;
+        response.decode(reinterpret_cast<const char*>(loopAnswer), sizeof(loopAnswer));
+        ResponseView responseView;
+        assert(!responseView.parse(reinterpret_cast<const char*>(loopAnswer), sizeof(loopAnswer)));
+    }
+
+    // responses: answers as spans of the buffer, names through pointers
+    {
+        Response response;
+        response.setID(7);
+        response.setName(qname);
+        response.setType(16);
+        response.setClass(1);
+        response.setQdCount(1);
+        response.setAnCount(1);
+        response.setRdata(std::string(300, 't'));
+
+        Response::Answer cname;
+        cname.type = 5;
+        cname.klass = 1;
+        cname.rdata = "target.example.com";
+        response.addAnswer(cname);
+
+        Response::Answer mx;
+        mx.type = 15;
+        mx.klass = 1;
+        mx.ttl = 60;
+        mx.mxPreference = 5;
+        mx.rdata = "mail.example.com";
+        response.addAnswer(mx);
+        response.setEdnsUdpSize(1232);
+
+        char buffer[1024];
+        int size = response.code(buffer);
+
+        ResponseView view;
+        bool ok = view.parse(buffer, size);
+        assert(ok);
+        assert(view.isResponse());
+        assert(view.ednsUdpSize() == 1232);
+        assert(view.answerCount() == 3);
+
+        std::string text;
+        ok = view.questionName().copyTo(text);
+        assert(ok && text == qname);
+
+        RecordView first = view.answer(0);
+        assert(first.type == 16);
+        ok = first.name.copyTo(text);
+        assert(ok && text == qname);
+        assert(first.rdata.size() == 302);
+        ok = first.copyRdata(text);
+        assert(ok && text == std::string(300, 't'));
+
+        RecordView second = view.answer(1);
+        assert(second.type == 5);
+        ok = second.copyRdata(text);
+        assert(ok && text == "target.example.com");
+
+        RecordView third = view.answer(2);
+        assert(third.type == 15);
+        assert(third.ttl == 60);
+        ok = third.copyRdata(text);
+        assert(ok && text == "mail.example.com");
+
+        // MX RDATA: preference, "mail" and a pointer to example.com
+        assert(third.rdata.size() == 9);
+
+        // an RDATA length past the end keeps the answers before it
+        buffer[size - 11 - 9 - 2] = 0x7F;
+        ok = view.parse(buffer, size - 11);
+        assert(!ok);
+        assert(view.answerCount() == 2);
+    }
+
+    // steady state: parsing into kept storage does not allocate
+    {
+        char buffer[512];
+        int size = codeQuery(buffer, qname, 1232);
+
+        Query query;
+        std::string name;
+        QueryView view;
+        view.parse(buffer, size);
+        query.assign(view);
+        view.qname().copyTo(name);
+
+        const size_t before = allocations;
+        for (int i = 0; i < 100; ++i)
+        {
+            bool ok = view.parse(buffer, size);
+            assert(ok);
+            query.assign(view);
+            ok = view.qname().copyTo(name);
+            assert(ok);
+        }
+        assert(allocations == before);
+        assert(query.getQName() == qname);
+    }
+
+    return 0;
+}
@@ -0,0 +1,265 @@
+#include <cassert>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.hpp"
+#include "response.hpp"
+#include "server.hpp"
+#include "test_support.hpp"
+
+using namespace dns;
+
+namespace {
+
+const std::string domain = "metrics.local";
+
+// The shared receiver, also fed single fragments.
+class Receiver : public test::Receiver {
+public:
+    Receiver() : test::Receiver(domain) {}
+
+    void feed(const std::string& rdata) { handleDataReceived(rdata, "serv", Codec::Raw); }
+    std::unique_lock<std::mutex> lock() { return lockState(); }
+};
+
+bool contains(const std::string& text, const std::string& needle)
+{
+    return text.find(needle) != std::string::npos;
+}
+
+} // namespace
+
+int main()
+{
+    // counters of several threads add up, histograms bucket by power of two
+    {
+        Metrics metrics;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; ++t)
+        {
+            threads.emplace_back([&metrics] {
+                for (int i = 0; i < 1000; ++i)
+                {
+                    metrics.add(Counter::BytesIn, 3);
+                    metrics.countQuery(16);
+                }
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+
+        metrics.countQuery(1);
+        metrics.countQuery(99);
+        metrics.adjust(Gauge::Sessions, 5);
+        metrics.adjust(Gauge::Sessions, -2);
+
+        metrics.record(Histogram::ProcessLatency, std::chrono::nanoseconds(500));
+        metrics.record(Histogram::ProcessLatency, std::chrono::microseconds(1));
+        metrics.record(Histogram::ProcessLatency, std::chrono::microseconds(3));
+        metrics.record(Histogram::ProcessLatency, std::chrono::seconds(100));
+
+        const MetricsSnapshot snapshot = metrics.snapshot();
+        assert(snapshot.counter(Counter::BytesIn) == 24000);
+        assert(snapshot.queries[Metrics::qTypeBucket(16)] == 8000);
+        assert(snapshot.queries[Metrics::qTypeBucket(1)] == 1);
+        assert(std::string(Metrics::qTypeBucketName(Metrics::qTypeBucket(99))) == "other");
+        assert(snapshot.totalQueries() == 8002);
+        assert(snapshot.gauge(Gauge::Sessions) == 3);
+
+        const HistogramSnapshot& latency = snapshot.histogram(Histogram::ProcessLatency);
+        assert(latency.count == 4);
+        assert(latency.buckets[Metrics::latencyBucket(500)] == 1);
+        assert(latency.buckets[Metrics::latencyBucket(3000)] == 1);
+        assert(latency.buckets[LATENCY_BUCKET_COUNT - 1] == 1);
+        assert(latency.sumNanoseconds == 500 + 1000 + 3000 + 100000000000ULL);
+        assert(latency.maxNanoseconds == 100000000000ULL);
+
+        const std::string text = toPrometheus(snapshot);
+        assert(contains(text, "# TYPE dns_queries_total counter\n"));
+        assert(contains(text, "dns_queries_total{qtype=\"TXT\"} 8000\n"));
+        assert(contains(text, "dns_bytes_in_total 24000\n"));
+        assert(contains(text, "dns_sessions 3\n"));
+        assert(contains(text, "# TYPE dns_process_seconds histogram\n"));
+        assert(contains(text, "dns_process_seconds_bucket{le=\"1.024e-06\"} 2\n"));
+        assert(contains(text, "dns_process_seconds_bucket{le=\"4.096e-06\"} 3\n"));
+        assert(contains(text, "dns_process_seconds_bucket{le=\"+Inf\"} 4\n"));
+        assert(contains(text, "dns_process_seconds_count 4\n"));
+        assert(contains(text, "dns_process_seconds_quantile{quantile=\"0.999\"} 100\n"));
+        assert(!contains(text, "client_queued_fragments"));
+
+        const std::string summary = formatLatencies(snapshot);
+        assert(contains(summary, "process"));
+        assert(contains(summary, "p999=100000000.0us"));
+        assert(!contains(summary, "lock_wait"));
+    }
+
+    // log-linear buckets: contiguous, ordered, within 1/16 of their values
+    {
+        assert(Metrics::latencyBucket(0) == 0);
+        assert(Metrics::latencyBucket(15) == 15);
+        assert(Metrics::latencyBucket(16) == 16);
+        assert(Metrics::latencyBucket(uint64_t{1} << 40) == LATENCY_BUCKET_COUNT - 1);
+        for (size_t i = 1; i < LATENCY_BUCKET_COUNT; ++i)
+        {
+            const uint64_t lowest = Metrics::latencyBucketBound(i - 1) + 1;
+            const uint64_t highest = Metrics::latencyBucketBound(i);
+            assert(Metrics::latencyBucket(lowest) == i);
+            assert(Metrics::latencyBucket(highest) == i);
+            assert((highest - lowest) * 16 <= lowest);
+        }
+        for (uint64_t value = 1; value < (uint64_t{1} << 36); value = value * 3 + 1)
+            assert(Metrics::latencyBucketBound(Metrics::latencyBucket(value)) >= value);
+
+        // 1000 values of 1..1000 us
+        Metrics metrics;
+        for (int i = 1; i <= 1000; ++i)
+            metrics.record(Histogram::SendLatency, std::chrono::microseconds(i));
+        const HistogramSnapshot latency = metrics.snapshot().histogram(Histogram::SendLatency);
+        auto near = [](uint64_t value, uint64_t expected) {
+            return value >= expected && value <= expected + expected / 16;
+        };
+        assert(near(latency.percentile(0.5), 500000));
+        assert(near(latency.percentile(0.99), 990000));
+        assert(near(latency.percentile(0.999), 999000));
+        assert(latency.percentile(1.0) == 1000000);
+        assert(near(latency.percentile(0.0), 1000));
+        assert(HistogramSnapshot().percentile(0.5) == 0);
+    }
+
+    // the server counts queries, fragments, bytes and NXDOMAIN answers
+    {
+        Server srv(0, domain);
+        Receiver receiver;
+        const std::string message(3000, 'm');
+        const bool queued = srv.setMessageToSend(message, "abc");
+        assert(queued);
+
+        Response response;
+        std::string received;
+        int responses = 0;
+        uint64_t bytesOut = 0;
+        while (received.empty() && responses < 100)
+        {
+            bytesOut += static_cast<uint64_t>(test::exchange(srv, "askr.rnd" + std::to_string(responses) + ".abc." + domain, 16, 1232, response));
+            receiver.ingest(response, Codec::Raw);
+            received = receiver.takeComplete();
+            ++responses;
+        }
+        assert(received == message);
+
+        test::exchange(srv, "hello.rnd.abc." + domain, 1, 1232, response);
+        test::exchange(srv, "www.elsewhere.org", 28, 1232, response);
+        char garbage[5] = {1, 2, 3, 4, 5};
+        char out[Server::BUFFER_SIZE];
+        const int garbageSize = srv.processDatagram(garbage, sizeof(garbage), out, Server::BUFFER_SIZE);
+        assert(garbageSize == 0);
+
+        const MetricsSnapshot snapshot = srv.metricsSnapshot();
+        assert(snapshot.queries[Metrics::qTypeBucket(16)] == static_cast<uint64_t>(responses));
+        assert(snapshot.queries[Metrics::qTypeBucket(1)] == 1);
+        assert(snapshot.queries[Metrics::qTypeBucket(28)] == 1);
+        assert(snapshot.counter(Counter::ParseFailures) == 1);
+        assert(snapshot.counter(Counter::NxDomain) == 1);
+        assert(snapshot.counter(Counter::MessagesOut) == 1);
+        assert(snapshot.counter(Counter::FragmentsOut) > 1);
+        assert(snapshot.counter(Counter::BytesIn) > 0);
+        assert(snapshot.counter(Counter::BytesOut) >= bytesOut);
+        assert(snapshot.gauge(Gauge::QueuedFragments) == 0);
+        assert(snapshot.histogram(Histogram::ProcessLatency).count == static_cast<uint64_t>(responses) + 2);
+        assert(snapshot.histogram(Histogram::Decode).count == static_cast<uint64_t>(responses) + 2);
+        assert(snapshot.histogram(Histogram::Prepare).count == static_cast<uint64_t>(responses) + 2);
+        assert(snapshot.histogram(Histogram::Encode).count == static_cast<uint64_t>(responses) + 2);
+        // processDatagram alone does not read the socket
+        assert(snapshot.histogram(Histogram::ReceiveDelay).count == 0);
+
+        // the receiving side counts what it reassembled
+        const MetricsSnapshot inbound = receiver.metricsSnapshot();
+        assert(inbound.counter(Counter::FragmentsIn) == snapshot.counter(Counter::FragmentsOut));
+        assert(inbound.counter(Counter::MessagesIn) == 1);
+        assert(inbound.gauge(Gauge::Sessions) == 0);
+
+        bool found = false;
+        for (const auto& [client, depth] : snapshot.queueDepths)
+            found = found || (client == "abc" && depth == 0);
+        assert(found);
+        assert(contains(toPrometheus(snapshot), "dns_client_queued_fragments{client=\"abc\"} 0\n"));
+    }
+
+    // incomplete sessions and bad fragments
+    {
+        Receiver receiver;
+        receiver.feed("\x7f garbage");
+        MetricsSnapshot snapshot = receiver.metricsSnapshot();
+        assert(snapshot.counter(Counter::FragmentsDiscarded) == 1);
+        assert(snapshot.gauge(Gauge::Sessions) == 0);
+    }
+
+    // only contended acquisitions of the session mutex are timed
+    {
+        Receiver receiver;
+        receiver.lock();
+        receiver.feed("\x7f garbage");
+        assert(receiver.metricsSnapshot().histogram(Histogram::LockWait).count == 0);
+
+        std::unique_lock<std::mutex> held = receiver.lock();
+        std::thread waiter([&receiver] { receiver.lock(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        held.unlock();
+        waiter.join();
+
+        const HistogramSnapshot wait = receiver.metricsSnapshot().histogram(Histogram::LockWait);
+        assert(wait.count == 1);
+        assert(wait.maxNanoseconds >= 10000000);
+    }
+
+    // exporters write files whole and call callbacks off the caller's thread
+    {
+        const std::filesystem::path path = std::filesystem::temp_directory_path() / "dns_metrics_test.prom";
+        std::filesystem::remove(path);
+
+        Server srv(0, domain);
+        Response response;
+        test::exchange(srv, "hello.rnd.abc." + domain, 16, 1232, response);
+
+        bool started = srv.startMetricsExport(path.string(), std::chrono::milliseconds(10));
+        assert(started);
+        started = srv.startMetricsExport(path.string(), std::chrono::milliseconds(10));
+        assert(!started);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        srv.stopMetricsExport();
+
+        std::ifstream in(path);
+        std::stringstream text;
+        text << in.rdbuf();
+        assert(contains(text.str(), "dns_queries_total{qtype=\"TXT\"} 1\n"));
+        assert(!std::filesystem::exists(path.string() + ".tmp"));
+        std::filesystem::remove(path);
+
+        std::mutex mutex;
+        std::vector<std::string> exports;
+        const std::thread::id caller = std::this_thread::get_id();
+        bool offThread = true;
+        started = srv.startMetricsExport([&](const std::string& exported) {
+            std::lock_guard<std::mutex> lock(mutex);
+            offThread = offThread && std::this_thread::get_id() != caller;
+            exports.push_back(exported);
+        }, std::chrono::milliseconds(10));
+        assert(started);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        srv.stopMetricsExport();
+
+        // the last export comes from stop()
+        std::lock_guard<std::mutex> lock(mutex);
+        assert(!exports.empty());
+        assert(offThread);
+        assert(contains(exports.back(), "dns_process_seconds_count 1\n"));
+    }
+
+    return 0;
+}
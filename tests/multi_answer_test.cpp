@@ -0,0 +1,147 @@
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "response.hpp"
+#include "server.hpp"
+#include "test_support.hpp"
+
+using namespace dns;
+
+namespace {
+
+const std::string domain = "multi.local";
+
+} // namespace
+
+int main()
+{
+    // several answers, each with several character-strings, round trip
+    {
+        Response response;
+        response.setID(9);
+        response.setName("a.example.com");
+        response.setType(16);
+        response.setClass(1);
+        response.setQdCount(1);
+        response.setAnCount(1);
+        response.setRdata("first");
+
+        Response::Answer second;
+        second.type = 16;
+        second.klass = 1;
+        second.ttl = 30;
+        second.txtStrings = {"two", "strings"};
+        response.addAnswer(second);
+
+        Response::Answer third;
+        third.name = "b.example.com";
+        third.type = 16;
+        third.klass = 1;
+        third.rdata = std::string(300, 'z');
+        response.addAnswer(third);
+
+        char buffer[1024];
+        int size = response.code(buffer);
+        // ANCOUNT follows the answers
+        assert(buffer[7] == 3);
+
+        Response decoded;
+        decoded.decode(buffer, size);
+        assert(decoded.getAnCount() == 3);
+        const std::vector<Response::Answer>& answers = decoded.getAnswers();
+        assert(answers.size() == 3);
+        assert(answers[0].name == "a.example.com");
+        assert(answers[0].rdata == "first");
+        assert(answers[1].name == "a.example.com");
+        assert(answers[1].ttl == 30);
+        assert((answers[1].txtStrings == std::vector<std::string>{"two", "strings"}));
+        assert(answers[1].rdata == "twostrings");
+        assert(answers[2].name == "b.example.com");
+        assert(answers[2].txtStrings.size() == 2);
+        assert(answers[2].rdata == std::string(300, 'z'));
+        // the single-answer accessors see the first one
+        assert(decoded.getRdata() == "first");
+
+        // no answers at all
+        response.clearAnswer();
+        size = response.code(buffer);
+        decoded.decode(buffer, size);
+        assert(decoded.getAnswers().empty());
+    }
+
+    // small messages share one response, over TXT and NULL
+    for (uint qType : {16u, 10u})
+    {
+        Server srv(0, domain);
+        std::vector<std::string> messages;
+        for (int i = 0; i < 6; ++i)
+        {
+            messages.push_back("message " + std::to_string(i));
+            const bool queued = srv.setMessageToSend(messages.back(), "abc");
+            assert(queued);
+        }
+
+        const std::string askName = "askr.rnd12345.abc." + domain;
+        Response response;
+        int size = test::exchange(srv, askName, qType, 1232, response);
+        assert(size <= 1232);
+        assert(response.getAnswers().size() == messages.size());
+        for (const Response::Answer& answer : response.getAnswers())
+            assert(answer.type == qType);
+
+        test::Receiver receiver(domain);
+        receiver.ingest(response, Codec::Raw);
+        for (const std::string& msg : messages)
+        {
+            const std::string received = receiver.takeComplete();
+            assert(received == msg);
+        }
+
+        // nothing left behind
+        size = test::exchange(srv, askName, qType, 1232, response);
+        assert(response.getAnswers().size() == 1);
+        assert(response.getRdata() == "noData");
+    }
+
+    // a large message fills the response, and the rest follows
+    {
+        const std::string message(5000, 'm');
+        Server srv(0, domain);
+        const bool queued = srv.setMessageToSend(message, "abc");
+        assert(queued);
+
+        test::Receiver receiver(domain);
+        size_t responses = 0;
+        std::string complete;
+        while (complete.empty())
+        {
+            Response response;
+            const int size = test::exchange(srv, "askr.rnd12345.abc." + domain, 16, 4096, response);
+            assert(size <= 4096);
+            receiver.ingest(response, Codec::Raw);
+            complete = receiver.takeComplete();
+            ++responses;
+        }
+        assert(complete == message);
+        assert(responses <= 2);
+    }
+
+    // without EDNS0 responses stay within 512 bytes, packed or not
+    {
+        Server srv(0, domain);
+        for (int i = 0; i < 20; ++i)
+        {
+            const bool queued = srv.setMessageToSend("short " + std::to_string(i), "abc");
+            assert(queued);
+        }
+
+        Response response;
+        const int size = test::exchange(srv, "askr.rnd12345.abc." + domain, 16, 0, response);
+        assert(size <= 512);
+        assert(response.getAnswers().size() > 1);
+        assert(response.getAnswers().size() < 20);
+    }
+
+    return 0;
+}
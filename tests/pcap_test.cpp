@@ -0,0 +1,178 @@
+#include <cassert>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pcap.hpp"
+
+using namespace dns;
+
+namespace {
+
+void putLe32(std::string& out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+void putBe32(std::string& out, uint32_t value)
+{
+    for (int i = 3; i >= 0; --i)
+        out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+// IPv4 UDP packet from 10.0.0.1:1234 to 10.0.0.2:53 carrying payload.
+std::string udpPacket(const std::string& payload, uint8_t protocol = 17)
+{
+    std::string packet = {0x45, 0};
+    const size_t total = 28 + payload.size();
+    packet.push_back(static_cast<char>(total >> 8));
+    packet.push_back(static_cast<char>(total));
+    packet += std::string("\0\0\x40\0\x40", 5);
+    packet.push_back(static_cast<char>(protocol));
+    packet += std::string("\0\0\x0a\0\0\x01\x0a\0\0\x02", 10);
+    packet += std::string("\x04\xd2\0\x35", 4);
+    packet.push_back(static_cast<char>((8 + payload.size()) >> 8));
+    packet.push_back(static_cast<char>(8 + payload.size()));
+    packet += std::string("\0\0", 2);
+    return packet + payload;
+}
+
+// A capture file of the given link type, written big-endian if asked.
+std::string capture(uint32_t linkType, const std::vector<std::string>& frames, bool bigEndian = false)
+{
+    auto put32 = bigEndian ? putBe32 : putLe32;
+    std::string file;
+    put32(file, PCAP_MAGIC);
+    file += bigEndian ? std::string("\0\x02\0\x04", 4) : std::string("\x02\0\x04\0", 4);
+    put32(file, 0);
+    put32(file, 0);
+    put32(file, PCAP_SNAPLEN);
+    put32(file, linkType);
+    for (const std::string& frame : frames)
+    {
+        put32(file, 1700000000);
+        put32(file, 250000);
+        put32(file, static_cast<uint32_t>(frame.size()));
+        put32(file, static_cast<uint32_t>(frame.size()));
+        file += frame;
+    }
+    return file;
+}
+
+void save(const std::filesystem::path& path, const std::string& content)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << content;
+}
+
+} // namespace
+
+int main()
+{
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / "dns_pcap_test.pcap";
+
+    // the writer's datagrams come back with their addresses, ports and time
+    {
+        PcapWriter writer;
+        assert(!writer.isOpen());
+        bool opened = writer.open(path.string());
+        assert(opened);
+        opened = writer.open(path.string());
+        assert(!opened);
+
+        const PcapEndpoint client{0x7F000001, 40000};
+        const PcapEndpoint server{0x0A000002, 53};
+        const auto time = std::chrono::system_clock::time_point(std::chrono::microseconds(1700000000123456LL));
+        writer.write(client, server, "query", 5, time);
+        writer.write(server, client, std::string(70000, 'r').data(), 70000, time);
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t)
+        {
+            threads.emplace_back([&writer, &client, &server, t] {
+                const std::string payload(100 + t, static_cast<char>('a' + t));
+                for (int i = 0; i < 50; ++i)
+                    writer.write(client, server, payload.data(), payload.size());
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+        assert(writer.packets() == 202);
+        writer.close();
+        assert(!writer.isOpen());
+        writer.write(client, server, "late", 4);
+
+        std::vector<CapturedDatagram> datagrams;
+        const bool read = readPcap(path.string(), datagrams);
+        assert(read);
+        assert(datagrams.size() == 202);
+        assert(datagrams[0].payload == "query");
+        assert(datagrams[0].source.address == client.address && datagrams[0].source.port == client.port);
+        assert(datagrams[0].destination.address == server.address && datagrams[0].destination.port == 53);
+        assert(datagrams[0].time == time);
+        // cut at the snapshot length
+        assert(datagrams[1].payload.size() == PCAP_SNAPLEN - 28);
+        // records of several threads stay whole
+        for (size_t i = 2; i < datagrams.size(); ++i)
+        {
+            const std::string& payload = datagrams[i].payload;
+            assert(payload.size() >= 100 && payload.size() <= 103);
+            assert(payload == std::string(payload.size(), static_cast<char>('a' + payload.size() - 100)));
+        }
+    }
+
+    // Ethernet (with a VLAN tag), Linux cooked and big-endian captures
+    {
+        const std::string ethernet = std::string(12, '\x11') + std::string("\x08\x00", 2) + udpPacket("eth");
+        const std::string vlan = std::string(12, '\x11') + std::string("\x81\x00\x00\x05\x08\x00", 6) + udpPacket("vlan");
+        const std::string arp = std::string(12, '\x11') + std::string("\x08\x06", 2) + std::string(28, '\0');
+        save(path, capture(PCAP_LINKTYPE_ETHERNET, {ethernet, arp, vlan}));
+        std::vector<CapturedDatagram> datagrams;
+        bool read = readPcap(path.string(), datagrams);
+        assert(read);
+        assert(datagrams.size() == 2);
+        assert(datagrams[0].payload == "eth" && datagrams[1].payload == "vlan");
+        assert(datagrams[0].source.address == 0x0A000001 && datagrams[0].source.port == 1234);
+        assert(datagrams[0].destination.port == 53);
+        assert(datagrams[0].time == std::chrono::system_clock::time_point(std::chrono::microseconds(1700000000250000LL)));
+
+        const std::string cooked = std::string(14, '\0') + std::string("\x08\x00", 2) + udpPacket("sll");
+        save(path, capture(PCAP_LINKTYPE_LINUX_SLL, {cooked}));
+        datagrams.clear();
+        read = readPcap(path.string(), datagrams);
+        assert(read);
+        assert(datagrams.size() == 1 && datagrams[0].payload == "sll");
+
+        // TCP is skipped
+        save(path, capture(PCAP_LINKTYPE_RAW, {udpPacket("tcp", 6), udpPacket("udp")}, true));
+        datagrams.clear();
+        read = readPcap(path.string(), datagrams);
+        assert(read);
+        assert(datagrams.size() == 1 && datagrams[0].payload == "udp");
+    }
+
+    // not a capture, unsupported link type, cut short
+    {
+        std::vector<CapturedDatagram> datagrams;
+        save(path, "plain text, not a capture file");
+        bool read = readPcap(path.string(), datagrams);
+        assert(!read);
+        save(path, capture(105, {udpPacket("wifi")}));
+        read = readPcap(path.string(), datagrams);
+        assert(!read);
+        const std::string whole = capture(PCAP_LINKTYPE_RAW, {udpPacket("one"), udpPacket("two")});
+        save(path, whole.substr(0, whole.size() - 1));
+        read = readPcap(path.string(), datagrams);
+        assert(!read);
+        assert(datagrams.size() == 1);
+        read = readPcap(path.string() + ".missing", datagrams);
+        assert(!read);
+    }
+
+    std::filesystem::remove(path);
+    return 0;
+}
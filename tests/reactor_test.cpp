@@ -0,0 +1,114 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "client.hpp"
+#include "reactor.hpp"
+#include "server.hpp"
+
+using namespace dns;
+
+namespace {
+
+// Send msg upstream with client and check it reaches expected, and only
+// it. Returns the client id seen by the server.
+std::string checkRouted(Client& client, const std::string& msg, Server& expected, Server& other1, Server& other2)
+{
+    client.sendMessage(msg);
+
+    std::pair<std::string, std::string> received = expected.waitForMessage(std::chrono::milliseconds(2000));
+    assert(received.second == msg);
+    const std::string misrouted1 = other1.getAvailableMessage().second;
+    const std::string misrouted2 = other2.getAvailableMessage().second;
+    assert(misrouted1.empty());
+    assert(misrouted2.empty());
+    return received.first;
+}
+
+// Send a datagram that is not a DNS query to the local port.
+void sendGarbage(int port, const std::string& bytes)
+{
+    const int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    assert(sockfd >= 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_aton("127.0.0.1", &address.sin_addr);
+    const ssize_t sent = sendto(sockfd, bytes.data(), bytes.size(), 0,
+                                reinterpret_cast<struct sockaddr*>(&address), sizeof(address));
+    assert(sent == static_cast<ssize_t>(bytes.size()));
+    close(sockfd);
+}
+
+} // namespace
+
+int main()
+{
+    const int port = 20000 + getpid() % 20000;
+    const int otherPort = port + 1;
+
+    // two domains, one a suffix of the other, share a port
+    Server parent(port, "reactor.local");
+    Server child(port, "sub.reactor.local");
+    Server elsewhere(otherPort, "other.local");
+
+    Reactor reactor(2);
+    bool ok = reactor.addServer(parent, port);
+    assert(ok);
+    ok = reactor.addServer(child, port);
+    assert(ok);
+    ok = reactor.addServer(elsewhere, otherPort);
+    assert(ok);
+
+    // a domain is served once per port
+    Server duplicate(port, "SUB.reactor.local");
+    ok = reactor.addServer(duplicate, port);
+    assert(!ok);
+
+    ok = reactor.start();
+    assert(ok);
+
+    // servers cannot be added while running
+    Server late(otherPort, "late.local");
+    ok = reactor.addServer(late, otherPort);
+    assert(!ok);
+
+    Client toParent("127.0.0.1", "reactor.local", port);
+    Client toChild("127.0.0.1", "sub.reactor.local", port);
+    Client toElsewhere("127.0.0.1", "other.local", otherPort);
+
+    checkRouted(toParent, "to the parent", parent, child, elsewhere);
+    std::string childId = checkRouted(toChild, "to the child", child, parent, elsewhere);
+    checkRouted(toElsewhere, "on the other port", elsewhere, parent, child);
+
+    // the downstream direction goes through the reactor too
+    ok = child.setMessageToSend("downstream", childId);
+    assert(ok);
+    const std::string downstream = toChild.requestMessage();
+    assert(downstream == "downstream");
+
+    // datagrams that are not queries are counted, by the server with the
+    // longest domain as they match none
+    sendGarbage(port, "short");
+    sendGarbage(port, std::string(40, '\xff'));
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (child.metricsSnapshot().counter(Counter::ParseFailures) < 2 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    assert(child.metricsSnapshot().counter(Counter::ParseFailures) == 2);
+    assert(parent.metricsSnapshot().counter(Counter::ParseFailures) == 0);
+
+    // restartable
+    reactor.stop();
+    ok = reactor.start();
+    assert(ok);
+    checkRouted(toElsewhere, "after restart", elsewhere, parent, child);
+    reactor.stop();
+
+    return 0;
+}
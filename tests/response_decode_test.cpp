@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cstring>
 
 #include "response.hpp"
 
@@ -136,5 +137,66 @@ int main() {
     respAaaa.decode(reinterpret_cast<const char*>(aaaaPacket), sizeof(aaaaPacket));
     assert(respAaaa.getRdata() == "20010DB8000000000000000000000001");
 
+    // encoding compresses the owner name and the MX exchange against the question
+    Response mxOut;
+    mxOut.setID(0x2020);
+    mxOut.setName("example.com");
+    mxOut.setType(15);
+    mxOut.setClass(1);
+    mxOut.setTtl(10);
+    mxOut.setQdCount(1);
+    mxOut.setAnCount(1);
+    mxOut.setMxPreference(10);
+    mxOut.setRdata("payload.example.com");
+
+    char buffer[512];
+    int size = mxOut.code(buffer);
+    const unsigned char mxCompressed[] = {
+        0xC0,0x0C,
+        0x00,0x0F,
+        0x00,0x01,
+        0x00,0x00,0x00,0x0A,
+        0x00,0x0C,
+        0x00,0x0A,
+        0x07,'p','a','y','l','o','a','d',
+        0xC0,0x0C
+    };
+    assert(size == 12 + 17 + static_cast<int>(sizeof(mxCompressed)));
+    assert(std::memcmp(buffer + 29, mxCompressed, sizeof(mxCompressed)) == 0);
+
+    Response mxBack;
+    mxBack.decode(buffer, size);
+    assert(mxBack.getName() == "example.com");
+    assert(mxBack.getMxPreference() == 10);
+    assert(mxBack.getRdata() == "payload.example.com");
+
+    // a CNAME target sharing a suffix with an earlier name, and an answer
+    // whose owner differs from the question
+    Response cnameOut;
+    cnameOut.setName("alias.example.com");
+    cnameOut.setType(5);
+    cnameOut.setClass(1);
+    cnameOut.setQdCount(1);
+    cnameOut.setAnCount(1);
+    cnameOut.setRdata("target.example.com");
+    Response::Answer second;
+    second.name = "other.example.com";
+    second.type = 5;
+    second.klass = 1;
+    second.rdata = "target.example.com";
+    cnameOut.addAnswer(second);
+
+    size = cnameOut.code(buffer);
+    // question 19, answers 2+10+(7+2) and (6+2)+10+2
+    assert(size == 12 + 19 + 4 + 21 + 20);
+
+    Response cnameBack;
+    cnameBack.decode(buffer, size);
+    assert(cnameBack.getAnswers().size() == 2);
+    assert(cnameBack.getAnswers()[0].name == "alias.example.com");
+    assert(cnameBack.getAnswers()[0].rdata == "target.example.com");
+    assert(cnameBack.getAnswers()[1].name == "other.example.com");
+    assert(cnameBack.getAnswers()[1].rdata == "target.example.com");
+
     return 0;
 }
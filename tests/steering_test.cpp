@@ -0,0 +1,140 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "dnsPacker.hpp"
+#include "fragment.hpp"
+#include "query.hpp"
+#include "server.hpp"
+
+using namespace dns;
+
+namespace {
+
+const std::string domain = "steer.test.local";
+
+// Records the worker thread that completed each client's messages.
+class ThreadRecorder : public MessageObserver {
+public:
+    void onMessageComplete(const std::string& clientId, uint32_t, size_t) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads[clientId].insert(std::this_thread::get_id());
+        ++completed;
+    }
+
+    std::mutex mutex;
+    std::map<std::string, std::set<std::thread::id>> threads;
+    int completed = 0;
+};
+
+// Send a one-fragment message for clientId from a fresh socket, so every
+// query comes from a different source port.
+void sendFragment(int port, const std::string& clientId, uint32_t session)
+{
+    FragmentHeader header;
+    header.session = session;
+    header.index = 0;
+    header.count = 1;
+    std::string fragment;
+    encodeFragmentHeader(header, fragment);
+    fragment += "payload";
+
+    Query query;
+    query.setID(static_cast<uint>(session));
+    query.setQdCount(1);
+    query.setAnCount(0);
+    query.setNsCount(0);
+    query.setArCount(0);
+    query.setQName(addDotEvery62Chars(stringToHex(fragment)) + "." + clientId + "." + domain);
+    query.setQType(16);
+    query.setQClass(1);
+
+    char buffer[512];
+    int size = query.code(buffer);
+
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sendto(sockfd, buffer, size, 0, reinterpret_cast<struct sockaddr*>(&address), sizeof(address));
+
+    struct timeval timeout {1, 0};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    recv(sockfd, buffer, sizeof(buffer), 0);
+    close(sockfd);
+}
+
+} // namespace
+
+int main()
+{
+    const int port = 20000 + getpid() % 20000;
+    const char* clients[] = {"abc", "xyz", "default", "beacon42", "q9"};
+    const int queriesPerClient = 24;
+
+    ThreadRecorder recorder;
+    Server server(port, domain);
+    server.setWorkerCount(4);
+    server.setBatchSize(1);
+    server.setClientSteering(true);
+    server.setMessageObserver(&recorder);
+    server.launch();
+
+    if (!server.isClientSteeringActive())
+    {
+        std::cout << "SO_ATTACH_REUSEPORT_CBPF not available, skipping" << std::endl;
+        server.stop();
+        return 0;
+    }
+
+    uint32_t session = 0;
+    for (int i = 0; i < queriesPerClient; ++i)
+    {
+        for (const char* clientId : clients)
+        {
+            // resolvers may randomize the case of the name (0x20 encoding)
+            std::string id = clientId;
+            if (i % 2)
+            {
+                for (char& c : id)
+                    c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            }
+            sendFragment(port, id, session++);
+        }
+    }
+
+    server.stop();
+
+    std::lock_guard<std::mutex> lock(recorder.mutex);
+    assert(recorder.completed == queriesPerClient * 5);
+    std::set<std::thread::id> workersUsed;
+    for (const char* clientId : clients)
+    {
+        std::string lower = clientId;
+        std::string upper = lower;
+        for (char& c : upper)
+            c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+
+        std::set<std::thread::id> threads = recorder.threads[lower];
+        threads.insert(recorder.threads[upper].begin(), recorder.threads[upper].end());
+        // every query of the client was handled by the same worker
+        assert(threads.size() == 1);
+        workersUsed.insert(*threads.begin());
+    }
+    // and clients are spread over several workers
+    assert(workersUsed.size() > 1);
+
+    return 0;
+}
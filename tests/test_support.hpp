@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+
+#include "dns.hpp"
+#include "query.hpp"
+#include "response.hpp"
+#include "server.hpp"
+
+
+// Helpers shared by the tests that drive a Server without sockets.
+namespace dns::test
+{
+
+// A query for qname with one question, and an OPT record advertising
+// ednsUdpSize unless it is 0.
+inline Query makeQuery(const std::string& qname, uint qType, uint ednsUdpSize = 0)
+{
+    Query query;
+    query.setID(0x4242);
+    query.setQdCount(1);
+    query.setAnCount(0);
+    query.setNsCount(0);
+    query.setArCount(0);
+    query.setQName(qname);
+    query.setQType(qType);
+    query.setQClass(1);
+    query.setEdnsUdpSize(ednsUdpSize);
+    return query;
+}
+
+// Answer a query for qname with srv, as its worker loop does, and decode the
+// reply into response. Returns the size of the encoded reply, 0 if the query
+// gets none.
+inline int exchange(Server& srv, const std::string& qname, uint qType, uint ednsUdpSize, Response& response)
+{
+    Query query = makeQuery(qname, qType, ednsUdpSize);
+    char in[Server::BUFFER_SIZE];
+    const int inSize = query.code(in, sizeof(in));
+
+    char out[Server::BUFFER_SIZE];
+    const int size = srv.processDatagram(in, inSize, out, Server::BUFFER_SIZE);
+    if (size > 0)
+        response.decode(out, size);
+    return size;
+}
+
+
+// Reassembles the fragments carried by the answers of a response, as the
+// client does with the server's replies.
+class Receiver : public Dns
+{
+public:
+    explicit Receiver(const std::string& domain) : Dns(domain, "serv") {}
+
+    void ingest(const Response& response, Codec codec)
+    {
+        for (const Response::Answer& answer : response.getAnswers())
+            handleDataReceived(answer.rdata, "serv", codec);
+    }
+
+    std::string takeComplete() { return getMsg().second; }
+};
+
+}
@@ -0,0 +1,282 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "messageObserver.hpp"
+#include "metrics.hpp"
+#include "response.hpp"
+#include "server.hpp"
+#include "test_support.hpp"
+
+using namespace dns;
+
+namespace {
+
+const std::string domain = "transfer.local";
+
+class Recorder : public MessageObserver {
+public:
+    void onTransferComplete(const std::string& clientId, const TransferReport& report) override
+    {
+        clients.push_back(clientId);
+        reports.push_back(report);
+    }
+
+    std::vector<std::string> clients;
+    std::vector<TransferReport> reports;
+};
+
+// Counts the callbacks in progress, each one long enough to be caught.
+class SlowObserver : public MessageObserver {
+public:
+    SlowObserver(std::atomic<int>& inside, std::atomic<int>& calls) : m_inside(inside), m_calls(calls) {}
+
+    void onTransferComplete(const std::string&, const TransferReport&) override
+    {
+        ++m_inside;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ++m_calls;
+        --m_inside;
+    }
+
+private:
+    std::atomic<int>& m_inside;
+    std::atomic<int>& m_calls;
+};
+
+// The shared receiver, which also sends messages the way the client does, one
+// acknowledgement per fragment.
+class Peer : public test::Receiver {
+public:
+    Peer() : test::Receiver(domain) {}
+
+    // fragments of another Peer, hex encoded
+    void feed(const std::string& rdata) { handleDataReceived(rdata, "serv", Codec::Hex); }
+    void observe(MessageObserver* observer) { setObserver(observer); }
+    void timestamps(bool enable) { setTransferTimestamps(enable); }
+    std::string take(TransferReport* report) { return getMsg(report).second; }
+
+    bool queue(const std::string& msg)
+    {
+        const bool queued = setMsg(msg, "serv");
+        splitPacket(16, "serv");
+        return queued;
+    }
+
+    // Fragments of the message being sent, in order.
+    std::vector<std::string> fragments()
+    {
+        std::vector<std::string> result;
+        std::queue<std::string> copy = m_msgQueue["serv"];
+        for (; !copy.empty(); copy.pop())
+            result.push_back(copy.front());
+        return result;
+    }
+
+    void send()
+    {
+        std::unique_lock<std::mutex> lock = lockState();
+        noteFragmentSent("serv");
+    }
+
+    bool ack(TransferReport& report)
+    {
+        std::unique_lock<std::mutex> lock = lockState();
+        m_msgQueue["serv"].pop();
+        return noteFragmentDone("serv", report);
+    }
+};
+
+bool unset(TransferReport::Clock::time_point time)
+{
+    return time == TransferReport::Clock::time_point();
+}
+
+} // namespace
+
+int main()
+{
+    // server to client with timestamps: both ends report the message
+    {
+        Server srv(0, domain);
+        srv.setTransferTimestamps(true);
+        Recorder serverSide;
+        srv.setMessageObserver(&serverSide);
+
+        Peer peer;
+        Recorder clientSide;
+        peer.observe(&clientSide);
+
+        const std::string message(2000, 'x');
+        const auto before = TransferReport::Clock::now();
+        const bool queued = srv.setMessageToSend(message, "abc");
+        assert(queued);
+
+        Response response;
+        int queries = 0;
+        while (clientSide.reports.empty() && queries < 100)
+        {
+            test::exchange(srv, "askr.rnd" + std::to_string(queries) + ".abc." + domain, 16, 0, response);
+            peer.ingest(response, Codec::Raw);
+            ++queries;
+        }
+
+        assert(serverSide.reports.size() == 1);
+        assert(serverSide.clients[0] == "abc");
+        const TransferReport& sent = serverSide.reports[0];
+        assert(sent.outbound);
+        assert(sent.bytes == message.size());
+        assert(sent.fragments > 1);
+        assert(sent.retransmits == 0);
+        assert(sent.enqueued >= before);
+        assert(sent.firstSent >= sent.enqueued);
+        assert(sent.lastAcked >= sent.firstSent);
+
+        assert(clientSide.reports.size() == 1);
+        const TransferReport& received = clientSide.reports[0];
+        assert(!received.outbound);
+        assert(received.session == sent.session);
+        assert(received.bytes == message.size());
+        assert(received.fragments == sent.fragments);
+        // carried in microseconds
+        assert(received.enqueued <= sent.enqueued);
+        assert(sent.enqueued - received.enqueued < std::chrono::microseconds(1));
+        assert(received.completed >= received.firstReceived);
+        assert(received.latency() >= std::chrono::duration_cast<std::chrono::microseconds>(received.completed - received.firstReceived));
+        assert(received.goodput() >= 0);
+
+        TransferReport taken;
+        const std::string complete = peer.take(&taken);
+        assert(complete == message);
+        assert(taken.session == received.session);
+        assert(taken.completed == received.completed);
+        assert(peer.metricsSnapshot().histogram(Histogram::MessageLatency).count == 1);
+    }
+
+    // an observer removed while workers call it can be destroyed right away
+    {
+        Server srv(0, domain);
+        std::atomic<int> inside{0};
+        std::atomic<int> calls{0};
+        auto observer = std::make_unique<SlowObserver>(inside, calls);
+        srv.setMessageObserver(observer.get());
+
+        std::atomic<bool> running{true};
+        std::vector<std::thread> workers;
+        for (int w = 0; w < 4; ++w)
+        {
+            workers.emplace_back([&srv, &running, w]
+            {
+                const std::string clientId = "c" + std::to_string(w);
+                Response response;
+                for (int i = 0; running; ++i)
+                {
+                    srv.setMessageToSend(std::string(50, 'o'), clientId);
+                    test::exchange(srv, "askr.rnd" + std::to_string(i) + "." + clientId + "." + domain, 16, 0, response);
+                }
+            });
+        }
+
+        while (calls < 20)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        srv.setMessageObserver(nullptr);
+        assert(inside == 0);
+        observer.reset();
+        const int callsAtRemoval = calls;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        running = false;
+        for (std::thread& worker : workers)
+            worker.join();
+        assert(calls == callsAtRemoval);
+    }
+
+    // timestamps take room from every fragment
+    {
+        Peer plain;
+        Peer stamped;
+        stamped.timestamps(true);
+        const std::string message(3000, 'y');
+        bool queued = plain.queue(message);
+        assert(queued);
+        queued = stamped.queue(message);
+        assert(queued);
+        assert(stamped.fragments().size() >= plain.fragments().size());
+
+        for (const std::string& fragment : stamped.fragments())
+            assert(fragment.size() <= plain.fragments()[0].size());
+    }
+
+    // sender side: fragments sent again before their ack count as retransmits
+    {
+        Peer sender;
+        sender.timestamps(true);
+        Peer receiver;
+        const std::string message(1500, 'z');
+        const bool queued = sender.queue(message);
+        assert(queued);
+        const std::vector<std::string> fragments = sender.fragments();
+        assert(fragments.size() > 1);
+
+        TransferReport report;
+        for (size_t i = 0; i < fragments.size(); ++i)
+        {
+            sender.send();
+            receiver.feed(fragments[i]);
+            if (i == 0)
+            {
+                // lost reply: the fragment goes out a second time
+                sender.send();
+                receiver.feed(fragments[i]);
+            }
+            const bool done = sender.ack(report);
+            assert(done == (i + 1 == fragments.size()));
+        }
+        assert(report.outbound);
+        assert(report.retransmits == 1);
+        assert(report.fragments == fragments.size());
+        assert(!unset(report.firstSent) && !unset(report.lastAcked));
+        assert(report.firstSent >= report.enqueued && report.lastAcked >= report.firstSent);
+        assert(sender.metricsSnapshot().gauge(Gauge::QueuedFragments) == 0);
+
+        // the receiver saw the duplicate
+        TransferReport received;
+        const std::string complete = receiver.take(&received);
+        assert(complete == message);
+        assert(received.retransmits == 1);
+        assert(!unset(received.enqueued));
+    }
+
+    // without timestamps the receiver only knows its own times
+    {
+        Peer sender;
+        Peer receiver;
+        const std::string message(600, 'w');
+        const bool queued = sender.queue(message);
+        assert(queued);
+        for (const std::string& fragment : sender.fragments())
+            receiver.feed(fragment);
+
+        TransferReport received;
+        const std::string complete = receiver.take(&received);
+        assert(complete == message);
+        assert(unset(received.enqueued));
+        assert(!unset(received.firstReceived) && !unset(received.completed));
+        assert(receiver.metricsSnapshot().histogram(Histogram::MessageLatency).count == 0);
+
+        // nothing complete
+        TransferReport none;
+        none.bytes = 42;
+        const std::string nothing = receiver.take(&none);
+        assert(nothing.empty());
+        assert(none.bytes == 42);
+        assert(TransferReport().latency() == std::chrono::microseconds(0));
+        assert(TransferReport().goodput() == 0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,231 @@
+#include <unistd.h>
+
+#ifdef DNS_HAVE_IO_URING
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "client.hpp"
+#include "server.hpp"
+#include "test_support.hpp"
+
+using namespace dns;
+
+namespace {
+
+const std::string domain = "transport.local";
+
+#ifdef DNS_HAVE_IO_URING
+// Make io_uring_setup() fail with ENOSYS in this process from now on, as on
+// a kernel without io_uring. Returns false if seccomp filters are refused.
+bool denyIoUringSetup()
+{
+    struct sock_filter filter[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_io_uring_setup, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | ENOSYS),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    };
+    struct sock_fprog program = {static_cast<unsigned short>(sizeof(filter) / sizeof(filter[0])), filter};
+    return prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0 &&
+           prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program) == 0;
+}
+#endif
+
+// A client that can fill its outbound queue before calling sendMessage().
+class FullQueueClient : public Client {
+public:
+    explicit FullQueueClient(int port) : Client("127.0.0.1", domain, port) { setWatermarks(100, 50); }
+
+    bool queue(const std::string& msg) { return setMsg(msg, "serv"); }
+};
+
+// A message sent while the client's queue is full waits for it to drain,
+// and goes out after the queued ones.
+void checkFullQueue(int port)
+{
+    Server server(port, domain);
+    server.launch();
+
+    FullQueueClient client(port);
+    const std::vector<std::string> messages = {std::string(60, '1'), std::string(60, '2'), std::string(60, '3')};
+    bool queued = client.queue(messages[0]);
+    assert(queued);
+    queued = client.queue(messages[1]);
+    assert(queued);
+    queued = client.queue("refused");
+    assert(!queued);
+
+    const std::vector<TransferReport> sent = client.sendMessage(messages[2]);
+    assert(sent.size() == messages.size());
+    for (const std::string& message : messages)
+    {
+        const std::pair<std::string, std::string> received = server.waitForMessage(std::chrono::milliseconds(2000));
+        assert(received.second == message);
+    }
+
+    server.stop();
+}
+
+// A client that can be handed replies it did not request itself.
+class ResumingClient : public Client {
+public:
+    explicit ResumingClient(int port) : Client("127.0.0.1", domain, port) {}
+
+    std::string id() const { return m_domainToResolve.substr(0, m_domainToResolve.find('.')); }
+
+    void ingest(const Response& response)
+    {
+        for (const Response::Answer& answer : response.getAnswers())
+            handleDataReceived(answer.rdata, "serv", Codec::Raw);
+    }
+
+    bool reassembling() const
+    {
+        for (const auto& [clientId, inbound] : m_msgReceived)
+            if (!inbound.sessions.empty())
+                return true;
+        return false;
+    }
+};
+
+// The client shrinks its EDNS size mid-transfer: the server cuts the message
+// again in a new session, and the one the client started is dropped when the
+// new one completes.
+void checkShrinkingEdns(int port)
+{
+    Server server(port, domain);
+    server.launch();
+
+    ResumingClient client(port);
+    client.setDownstreamCodec(Codec::Raw, 16);
+    const std::string message(6000, 'e');
+    const bool queued = server.setMessageToSend(message, client.id());
+    assert(queued);
+
+    Response response;
+    const int size = test::exchange(server, "askr.rnd0." + client.id() + "." + domain, 16, 4096, response);
+    assert(size > 4000);
+    client.ingest(response);
+    assert(client.reassembling());
+
+    client.setEdnsUdpSize(0);
+    const std::string answered = client.requestMessage();
+    assert(answered == message);
+    assert(!client.reassembling());
+
+    server.stop();
+}
+
+// Exchange a message each way with a server using the given loop. Without
+// uringAllowed the kernel refuses io_uring and the workers must fall back.
+void checkLoop(int port, unsigned int batchSize, bool ioUring, bool uringAllowed = true)
+{
+    Server server(port, domain);
+    server.setBatchSize(batchSize);
+    server.setIoUring(ioUring);
+    server.launch();
+
+    const std::filesystem::path capture = std::filesystem::temp_directory_path() /
+                                          ("dns_transport_test_" + std::to_string(port) + ".pcap");
+    const bool capturing = server.startCapture(capture.string());
+    assert(capturing);
+
+    if (!ioUring)
+        assert(!server.isIoUringActive());
+#ifndef DNS_HAVE_IO_URING
+    assert(!server.isIoUringActive());
+#endif
+
+    Client client("127.0.0.1", domain, port);
+    client.setTransferTimestamps(true);
+    std::string upstream(700, 'u');
+    const std::vector<TransferReport> sent = client.sendMessage(upstream);
+    assert(sent.size() == 1);
+    assert(sent[0].bytes == upstream.size());
+    assert(sent[0].latency() >= std::chrono::milliseconds(100) * (sent[0].fragments - 1));
+
+    std::pair<std::string, std::string> received = server.waitForMessage(std::chrono::milliseconds(2000));
+    assert(received.second == upstream);
+    assert(server.metricsSnapshot().histogram(Histogram::MessageLatency).count == 1);
+
+    std::string downstream(900, 'd');
+    const bool queued = server.setMessageToSend(downstream, received.first);
+    assert(queued);
+    TransferReport report;
+    const std::string answered = client.requestMessage(&report);
+    assert(answered == downstream);
+    assert(report.bytes == downstream.size());
+    assert(report.fragments > 0);
+
+    // the worker that answered runs the io_uring loop only when it was
+    // asked for and the kernel let it
+    if (!ioUring || !uringAllowed)
+        assert(!server.isIoUringActive());
+
+    // every loop reads the kernel receive time of the queries
+    const MetricsSnapshot snapshot = server.metricsSnapshot();
+    assert(snapshot.histogram(Histogram::ReceiveDelay).count > 0);
+    assert(snapshot.histogram(Histogram::ReceiveDelay).count <= snapshot.counter(Counter::BytesIn));
+    assert(snapshot.histogram(Histogram::Decode).count == snapshot.totalQueries());
+
+    // the capture holds every query and its reply
+    server.stopCapture();
+    std::vector<CapturedDatagram> datagrams;
+    const bool read = readPcap(capture.string(), datagrams);
+    assert(read);
+    size_t queries = 0;
+    size_t replies = 0;
+    for (const CapturedDatagram& datagram : datagrams)
+    {
+        if (datagram.destination.port == port)
+            ++queries;
+        else if (datagram.source.port == port)
+            ++replies;
+    }
+    assert(queries == snapshot.totalQueries());
+    // the last reply may reach the client before the worker records it
+    assert(replies <= queries && replies + 1 >= queries);
+    std::filesystem::remove(capture);
+
+    server.stop();
+    assert(!server.isIoUringActive());
+}
+
+} // namespace
+
+int main()
+{
+    int port = 20000 + getpid() % 20000;
+
+    // io_uring, or its fallback when the kernel does not allow it
+    checkLoop(port++, 32, true);
+    checkLoop(port++, 1, true);
+    // recvmmsg/sendmmsg and recvfrom/sendto loops
+    checkLoop(port++, 32, false);
+    checkLoop(port++, 1, false);
+
+    checkFullQueue(port++);
+    checkShrinkingEdns(port++);
+
+#ifdef DNS_HAVE_IO_URING
+    // a kernel without io_uring: the workers use the socket loops instead
+    if (denyIoUringSetup())
+    {
+        checkLoop(port++, 32, true, false);
+        checkLoop(port++, 1, true, false);
+    }
+#endif
+
+    return 0;
+}
@@ -1,13 +1,14 @@
 #include "message.hpp"
 #include "dnsPacker.hpp"
 #include <cassert>
+#include <cctype>
 #include <string>
 
 using namespace dns;
 
 struct MessageTest : public Message {
     MessageTest() : Message(Message::Query) {}
-    int code(char*) override { return 0; }
+    int code(char*, size_t) override { return 0; }
     void decode(const char*, int) override {}
     void put32(char*& buffer, ulong value) { put32bits(buffer, value); }
 };
@@ -33,5 +34,107 @@ int main() {
     assert(hex.size() == binaryData.size() * 2);
     std::string roundTrip = hexToString(hex);
     assert(roundTrip == binaryData);
+
+    // Every kernel must agree with the scalar one, including the tail handling
+    // for lengths that are not a multiple of the vector width.
+    std::string allBytes;
+    for (int i = 0; i < 256; ++i)
+        allBytes.push_back(static_cast<char>(i));
+    const HexKernel kernels[] = {HexKernel::Scalar, HexKernel::Sse41, HexKernel::Avx2};
+    for (size_t len : {0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 256})
+    {
+        const std::string input = allBytes.substr(0, len);
+        const std::string expected = stringToHex(input, HexKernel::Scalar);
+        assert(expected.size() == len * 2);
+        for (HexKernel kernel : kernels)
+        {
+            assert(stringToHex(input, kernel) == expected);
+            assert(hexToString(expected, kernel) == input);
+
+            std::string lower = expected;
+            for (char& c : lower)
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            assert(hexToString(lower, kernel) == input);
+
+            if (len > 0)
+            {
+                // Corrupt the last digit so the scalar tail and the vector
+                // blocks both get exercised.
+                for (char bad : {'g', 'G', '/', ':', '@', '`', ' ', '\xFF'})
+                {
+                    std::string corrupted = expected;
+                    corrupted.back() = bad;
+                    assert(hexToString(corrupted, kernel).empty());
+                    corrupted = expected;
+                    corrupted.front() = bad;
+                    assert(hexToString(corrupted, kernel).empty());
+                }
+            }
+        }
+    }
+    assert(hexToString("ABC").empty());
+    assert(std::string(hexKernelName(activeHexKernel())).size() > 0);
+
+    // RFC 4648 test vectors, lower-case alphabet without padding.
+    assert(stringToBase32("") == "");
+    assert(stringToBase32("f") == "my");
+    assert(stringToBase32("fo") == "mzxq");
+    assert(stringToBase32("foo") == "mzxw6");
+    assert(stringToBase32("foob") == "mzxw6yq");
+    assert(stringToBase32("fooba") == "mzxw6ytb");
+    assert(stringToBase32("foobar") == "mzxw6ytboi");
+    assert(base32ToString("mzxw6ytboi") == "foobar");
+    assert(base32ToString("MZXW6YTBOI") == "foobar");
+    assert(base32ToString("MzXw6YtBoI") == "foobar");
+    assert(base32ToString("mzxw6ytbo1").empty());
+    assert(base32ToString("mzx").empty());
+
+    for (size_t len = 0; len < 40; ++len)
+    {
+        const std::string input = allBytes.substr(200, len);
+        assert(base32ToString(stringToBase32(input)) == input);
+
+        const std::string tagged = encodeFragmentData(input, Codec::Base32);
+        assert(tagged[0] == BASE32_TAG);
+        assert(decodeFragmentData(tagged) == input);
+        assert(decodeFragmentData(encodeFragmentData(input, Codec::Hex)) == input);
+    }
+
+    // RFC 4648 base64 vectors, without padding on output.
+    assert(stringToBase64("") == "");
+    assert(stringToBase64("f") == "Zg");
+    assert(stringToBase64("fo") == "Zm8");
+    assert(stringToBase64("foo") == "Zm9v");
+    assert(stringToBase64("foobar") == "Zm9vYmFy");
+    assert(base64ToString("Zm9vYg==") == "foob");
+    assert(base64ToString("Zm9vYg") == "foob");
+    assert(base64ToString("Zm9v!mFy").empty());
+    assert(base64ToString("Z").empty());
+    for (size_t len = 0; len < 40; ++len)
+    {
+        const std::string input = allBytes.substr(100, len);
+        assert(base64ToString(stringToBase64(input)) == input);
+        assert(decodeFragmentData(encodeFragmentData(input, Codec::Base64), Codec::Base64) == input);
+        assert(decodeFragmentData(encodeFragmentData(input, Codec::Raw), Codec::Raw) == input);
+    }
+
+    for (Codec codec : {Codec::Hex, Codec::Base32, Codec::Base64, Codec::Raw})
+    {
+        Codec parsed = Codec::Hex;
+        assert(codecFromTag(codecTag(codec), parsed) && parsed == codec);
+        assert(codecFromTag(static_cast<char>(std::toupper(codecTag(codec))), parsed) && parsed == codec);
+        // an encoded payload never exceeds the budget it was sized for
+        const int capacity = getPayloadCapacity(200, codec);
+        assert(static_cast<int>(encodeFragmentData(std::string(capacity, 'q'), codec).size()) <= 200);
+    }
+    Codec unused;
+    assert(!codecFromTag('?', unused));
+
+    // Base32 carries 25% more bytes than hex in the same QNAME.
+    const std::string domain = "abc.example.com";
+    assert(getMaxMsgLen(domain, Codec::Base32) > getMaxMsgLen(domain, Codec::Hex));
+    const int b32Chars = 1 + (getMaxMsgLen(domain, Codec::Base32) * 8 + 4) / 5;
+    const std::string b32Qname = addDotEvery62Chars(std::string(b32Chars, 'a')) + "." + domain;
+    assert(b32Qname.size() <= MAX_DNS_LENGTH);
     return 0;
 }
@@ -0,0 +1,189 @@
+#include <cassert>
+#include <cstring>
+#include <string>
+
+#include "messageView.hpp"
+#include "metrics.hpp"
+#include "query.hpp"
+#include "response.hpp"
+#include "server.hpp"
+#include "test_support.hpp"
+#include "wireWriter.hpp"
+
+using namespace dns;
+
+namespace {
+
+const std::string domain = "wire.local";
+
+Response makeResponse(size_t answers, size_t rdataSize, uint ednsUdpSize)
+{
+    Response response;
+    response.setID(3);
+    response.setName("a.example.com");
+    response.setType(16);
+    response.setClass(1);
+    response.setQdCount(1);
+    response.setAnCount(1);
+    response.setRdata(std::string(rdataSize, 'a'));
+    for (size_t i = 1; i < answers; ++i)
+    {
+        Response::Answer answer;
+        answer.type = 16;
+        answer.klass = 1;
+        answer.rdata = std::string(rdataSize, static_cast<char>('a' + i));
+        response.addAnswer(answer);
+    }
+    response.setEdnsUdpSize(ednsUdpSize);
+    return response;
+}
+
+} // namespace
+
+int main()
+{
+    // the writer never goes past its capacity and stays full until rollback
+    {
+        char buffer[8];
+        std::memset(buffer, 0x55, sizeof(buffer));
+        WireWriter writer(buffer, 6);
+        bool written = writer.put16(0x0102);
+        assert(written);
+        written = writer.put8(3);
+        assert(written);
+        const size_t mark = writer.size();
+        written = writer.put32(0x04050607);
+        assert(!written);
+        assert(writer.full());
+        written = writer.put8(4);
+        assert(!written);
+        assert(writer.size() == 3);
+        assert(buffer[3] == 0x55);
+
+        writer.rollback(mark);
+        assert(!writer.full());
+        written = writer.skip(2);
+        assert(written);
+        writer.patch16(3, 0xABCD);
+        assert(static_cast<uint8_t>(buffer[3]) == 0xAB);
+        assert(writer.remaining() == 1);
+
+        // room kept at the end for a trailing record
+        writer.setCapacity(5);
+        written = writer.put8(9);
+        assert(!written);
+        writer.rollback(writer.size());
+        writer.setCapacity(100);
+        assert(writer.capacity() == 6);
+        written = writer.put8(9);
+        assert(written);
+        assert(writer.remaining() == 0);
+    }
+
+    // a query that does not fit is not written
+    {
+        Query query = test::makeQuery("askr.rnd12345.abc." + domain, 16, 1232);
+        char buffer[512];
+        const int size = query.code(buffer, sizeof(buffer));
+        assert(size > 0);
+        const int exact = query.code(buffer, static_cast<size_t>(size));
+        assert(exact == size);
+        const int tooSmall = query.code(buffer, static_cast<size_t>(size - 1));
+        assert(tooSmall == 0);
+    }
+
+    // answers that do not fit are left out and TC is set
+    {
+        Response response = makeResponse(4, 200, 1232);
+        char full[2048];
+        const int fullSize = response.code(full, sizeof(full));
+        assert(!response.isTruncated());
+        assert(response.getAnCount() == 4);
+
+        char buffer[2048];
+        response = makeResponse(4, 200, 1232);
+        const int size = response.code(buffer, 600);
+        assert(size > 0 && size <= 600);
+        assert(size < fullSize);
+        assert(response.isTruncated());
+
+        ResponseView view;
+        bool parsed = view.parse(buffer, static_cast<size_t>(size));
+        assert(parsed);
+        assert(view.isTruncated());
+        // ANCOUNT matches what was written, and the OPT record is still there
+        assert(view.anCount() == 2);
+        assert(view.answerCount() == 2);
+        assert(view.ednsUdpSize() == 1232);
+        std::string text;
+        const bool copied = view.answer(1).copyRdata(text);
+        assert(copied && text == std::string(200, 'b'));
+
+        // nothing beyond the question fits
+        response = makeResponse(1, 200, 0);
+        const int bare = response.code(buffer, 12 + 15 + 4 + 10);
+        assert(bare == 12 + 15 + 4);
+        assert(response.isTruncated());
+        parsed = view.parse(buffer, static_cast<size_t>(bare));
+        assert(parsed && view.anCount() == 0);
+
+        // not even the question
+        response = makeResponse(1, 10, 0);
+        const int none = response.code(buffer, 20);
+        assert(none == 0);
+    }
+
+    // packed responses use the whole datagram the requester allows
+    for (uint ednsUdpSize : {0u, 1232u, 4096u})
+    {
+        for (uint qType : {16u, 10u})
+        {
+            Server srv(0, domain);
+            const bool queued = srv.setMessageToSend(std::string(20000, 'p'), "abc");
+            assert(queued);
+
+            Response response;
+            const int size = test::exchange(srv, "askr.rnd12345.abc." + domain, qType, ednsUdpSize, response);
+            const int limit = ednsUdpSize == 0 ? 512 : static_cast<int>(ednsUdpSize);
+            assert(size <= limit);
+            assert(size >= limit - 8);
+            assert(!response.isTruncated());
+        }
+    }
+
+    // the requester shrinks its buffer mid-transfer: the fragments cut for the
+    // larger one are not lost, the message is cut again and still arrives
+    {
+        Server srv(0, domain);
+        const std::string message(12000, 's');
+        const bool queued = srv.setMessageToSend(message, "abc");
+        assert(queued);
+
+        test::Receiver receiver(domain);
+        Response response;
+        int size = test::exchange(srv, "askr.rnd0.abc." + domain, 16, 4096, response);
+        assert(size > 4000);
+        receiver.ingest(response, Codec::Raw);
+
+        std::string complete;
+        int queries = 1;
+        while (complete.empty() && queries < 100)
+        {
+            size = test::exchange(srv, "askr.rnd" + std::to_string(queries) + ".abc." + domain, 16, 0, response);
+            assert(size <= 512);
+            assert(!response.isTruncated());
+            assert(!response.getAnswers().empty());
+            assert(response.getRdata() != "noData");
+            receiver.ingest(response, Codec::Raw);
+            complete = receiver.takeComplete();
+            ++queries;
+        }
+        assert(complete == message);
+
+        size = test::exchange(srv, "askr.rnd.abc." + domain, 16, 0, response);
+        assert(response.getRdata() == "noData");
+        assert(srv.metricsSnapshot().gauge(Gauge::QueuedFragments) == 0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "binaryLog.hpp"
+
+// Turn a binary log written after dns::debug::startBinaryLog() into text.
+//
+//   dnsLogDecode <log file> [output file]
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        std::cerr << "usage: " << argv[0] << " <log file> [output file]" << std::endl;
+        return 2;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "cannot open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::ofstream file;
+    if (argc == 3)
+    {
+        file.open(argv[2]);
+        if (!file)
+        {
+            std::cerr << "cannot open " << argv[2] << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = argc == 3 ? file : std::cout;
+
+    if (!dns::debug::decodeBinaryLog(in, out))
+    {
+        std::cerr << argv[1] << ": not a binary log, or cut short" << std::endl;
+        return 1;
+    }
+    return 0;
+}